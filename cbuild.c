@@ -1,24 +1,98 @@
 // This is free and unencumbered software released into the public domain.
 
-#define CBUILD_IMPLEMENTATION
+#ifdef CBUILD_CONFIGURED
+// Before cbuild.h, cb_rebuild_yourself links with the probed linker
+#  include "build/toolchain.h"
+#endif
+
+// The recipe module links against the cbuild.h of the driver, see cb_recipes_load
+#ifndef CBUILD_RECIPES
+#  define CBUILD_IMPLEMENTATION
+#endif
 #include "cbuild.h"
 
-#ifdef CBUILD_CONFIGURED
+#ifdef CBUILD_RECIPES
 #  include "build/config.h"
+#  include <stdlib.h>
+#  include <string.h>
+#  include <errno.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#  include <time.h>
+#  include <sys/stat.h>
+#  include <sys/resource.h>
+#  include <pthread.h>
+#endif
+
+#if !defined(CB_TC_CC)
+#  define CB_TC_CC "cc"
 #endif
 
 #if !defined(SOKOL_LIB_ENTRY)
 #  define SOKOL_LIB_ENTRY "vendor/sokol.c"
 #endif
 
-#if defined(CBUILD_CONFIGURED)
-CB_b32 build_freetype_library(CB_Write_Buffer *stderr);
-CB_b32 build_sokol_library(CB_Write_Buffer *stderr);
-CB_b32 build_sokol_example(CB_Str program, CB_Write_Buffer *stderr);
-CB_b32 build_editor(CB_Write_Buffer *stderr);
+#if defined(CBUILD_RECIPES)
+// Where the recipes put their outputs and how they compile. The default build
+// goes to `build/` with debug flags, the release pipeline fills in the rest.
+typedef struct Build_Profile {
+  CB_Str dir;          // output directory
+  CB_Str_List cflags;  // extra flags for every compile and link
+  CB_b32 optimize;     // release flags instead of debug flags
+  CB_b32 lto;          // link against the library objects instead of the archives
+  CB_b32 force;        // rebuild even when outputs look up to date
+  CB_Pool *pool;       // the recipes push their jobs here
+} Build_Profile;
+
+CB_Pool new_pool(CB_Arena *arena, CB_Write_Buffer *stderr);
+CB_b32 build_freetype_library(Build_Profile *p, CB_Write_Buffer *stderr);
+CB_b32 build_sokol_library(Build_Profile *p, CB_Write_Buffer *stderr);
+CB_b32 build_sokol_example(Build_Profile *p, CB_Str program, CB_Write_Buffer *stderr);
+CB_b32 build_editor(Build_Profile *p, CB_Write_Buffer *stderr);
+CB_b32 build_release(CB_Write_Buffer *stderr);
+CB_b32 build_variants(CB_Str_List names, CB_Write_Buffer *stderr);
+CB_b32 check_includes(CB_Write_Buffer *stderr);
+CB_b32 run_tests(CB_Str_List args, CB_Write_Buffer *stderr);
+CB_b32 profile_compile(CB_Write_Buffer *stderr);
+CB_b32 bench_build(CB_Arena *perm, CB_Str_List args, CB_Write_Buffer *stderr);
+CB_b32 bench_da(CB_Str_List args, CB_Write_Buffer *stderr);
+CB_b32 bench_arena(CB_Str_List args, CB_Write_Buffer *stderr);
+
+// Why each target was rebuilt, a JSON object per line, see cb_explain.
+#define EXPLAIN_PATH "build/explain.jsonl"
 
-void run(CB_Arena *perm, CB_Write_Buffer *stderr)
+void run(CB_Arena *perm, CB_Str command, CB_Str_List args, CB_Write_Buffer *stderr)
 {
+#if defined(LOG_LEVEL)
+  cb_log_level = LOG_LEVEL;
+#endif
+#if defined(LOG_JSON)
+  cb_log_format = CB_LOG_FORMAT_JSON;
+#endif
+#if defined(LOG_ASYNC)
+  if (!cb_log_start_async(2, stderr)) { cb_exit(1); }
+#endif
+
+  if (cb_str_equals(command, S("--explain"))) {
+    // Runs the command after it, the default build if none
+    cb_explain = 1;
+    CB_i32 fd = cb_open(S(EXPLAIN_PATH), stderr);
+    if (fd < 0) { cb_exit(1); }
+    cb_explain_out = cb_fd_buffer(fd, perm, 16 * 1024);
+    command = args.len ? args.items[0] : (CB_Str){0};
+    args.items += args.len ? 1 : 0;
+    args.len -= args.len ? 1 : 0;
+  }
+
+  if (cb_str_equals(command, S("--worker"))) {
+    if (args.len != 1) {
+      cb_log_emit(stderr, CB_LOG_ERROR, S("Usage: ./cbuild --worker unix:<path> | tcp:<host>:<port>"));
+      cb_exit(1);
+    }
+    cb_dist_worker(args.items[0], S(CB_TC_CC), stderr);
+    cb_exit(1);
+  }
+
   { // Print current config
     cb_log_emit(stderr, CB_LOG_INFO, S("Config:"));
     CB_Read_Result conf = cb_read_entire_file(perm, S("build/config.h"), stderr);
@@ -26,317 +100,2207 @@ void run(CB_Arena *perm, CB_Write_Buffer *stderr)
       cb_log_emit(stderr, CB_LOG_WARNING, S("Could read from \"build/config.h\", are you running from project root?"));
       cb_exit(1);
     }
-    cb_append(stderr, conf.file_contents);
+    cb_append(stderr, conf.file_contents);
+  }
+
+  if (cb_str_equals(command, S("release"))) {
+    if (!build_release(stderr)) { cb_exit(1); }
+    cb_log_emit(stderr, CB_LOG_INFO, S("Done."));
+    return;
+  }
+
+  if (cb_str_equals(command, S("variants"))) {
+    if (!build_variants(args, stderr)) { cb_exit(1); }
+    cb_log_emit(stderr, CB_LOG_INFO, S("Done."));
+    return;
+  }
+
+  if (cb_str_equals(command, S("check-includes"))) {
+    if (!check_includes(stderr)) { cb_exit(1); }
+    return;
+  }
+
+  if (cb_str_equals(command, S("test"))) {
+    if (!run_tests(args, stderr)) { cb_exit(1); }
+    return;
+  }
+
+  if (cb_str_equals(command, S("--profile-compile"))) {
+    if (!profile_compile(stderr)) { cb_exit(1); }
+    return;
+  }
+
+  if (cb_str_equals(command, S("bench-build"))) {
+    if (!bench_build(perm, args, stderr)) { cb_exit(1); }
+    return;
+  }
+
+  if (cb_str_equals(command, S("bench-da"))) {
+    if (!bench_da(args, stderr)) { cb_exit(1); }
+    return;
+  }
+
+  if (cb_str_equals(command, S("bench-arena"))) {
+    if (!bench_arena(args, stderr)) { cb_exit(1); }
+    return;
+  }
+
+  if (command.len) {
+    cb_log_emit(stderr, CB_LOG_ERROR, S("Unknown command \""), command,
+                S("\", expected one of [ config, release, variants [<name>...], check-includes, test [--shard=<i>/<n>], bench-build, bench-da, bench-arena, watch [command], --profile-compile, --explain [command], --worker <address> ]"));
+    cb_exit(1);
+  }
+
+  { // Builder program
+    cb_log_emit(stderr, CB_LOG_INFO, S("Starting Build ..."));
+
+    CB_Pool pool = new_pool(perm, stderr);
+    Build_Profile debug = { .dir = S("build"), .pool = &pool, };
+    if (!build_freetype_library(&debug, stderr)) { cb_exit(1); }
+    if (!build_sokol_library(&debug, stderr)) { cb_exit(1); }
+#if defined(BUILD_SOKOL_EXAMPLE)
+    if (!build_sokol_example(&debug, S("triangle-sapp"), stderr)) { cb_exit(1); }
+#endif
+#if defined(BUILD_EDITOR)
+    if (!build_editor(&debug, stderr)) { cb_exit(1); }
+#endif
+    if (!cb_pool_run(&pool, stderr)) { cb_exit(1); }
+    cb_log_emit(stderr, CB_LOG_INFO, S("Done."));
+  }
+}
+
+void cmd_profile_flags(CB_Arena *arena, CB_Command *cmd, Build_Profile *p)
+{
+  cb_cmd_append_strs(arena, cmd, p->cflags.items, p->cflags.len);
+}
+
+// Debug info for development builds.
+void cmd_debug_flags(CB_Arena *arena, CB_Command *cmd)
+{
+  cb_cmd_append_lit(arena, cmd, "-g");
+}
+
+// For development compiles with -c only. Split DWARF leaves the debug info in
+// a .dwo next to each object, so the linker neither copies nor relocates it.
+void cmd_split_dwarf_flags(CB_Arena *arena, CB_Command *cmd, Build_Profile *p)
+{
+#if defined(CB_TC_HAVE_SPLIT_DWARF)
+  if (!p->optimize) { cb_cmd_append_lit(arena, cmd, "-gsplit-dwarf"); }
+#else
+  (void)arena; (void)cmd; (void)p;
+#endif
+}
+
+// For compiles with -c writing obj. The pool can have them write <obj>.tmp,
+// see CB_Job.atomic, if the compiler names the .dwo, .i and .gcda after obj
+// all the same. 1 if it does.
+CB_b32 cmd_atomic_flags(CB_Arena *arena, CB_Command *cmd, CB_Str obj)
+{
+#if defined(CB_TC_HAVE_DUMPBASE)
+  CB_Write_Buffer *b = cb_mem_buffer(arena, obj.len + 2);
+  cb_append(b, cb_path_dirname(obj), S("/"));
+  cb_cmd_append(arena, cmd, S("-dumpdir"), (CB_Str){ .buf = b->buf, .len = b->len, });
+  cb_cmd_append(arena, cmd, S("-dumpbase"), cb_path_basename(obj));
+  CB_Str ext = cb_path_extension(obj);
+  if (ext.len) { cb_cmd_append(arena, cmd, S("-dumpbase-ext"), ext); }
+  return 1;
+#else
+  (void)arena; (void)cmd; (void)obj;
+  return 0;
+#endif
+}
+
+// The fastest linker build/toolchain.h found, with a prebuilt gdb index for
+// development links.
+void cmd_link_flags(CB_Arena *arena, CB_Command *cmd, Build_Profile *p)
+{
+#if defined(CB_TC_FUSE_LD)
+  cb_cmd_append_lit(arena, cmd, CB_TC_FUSE_LD);
+#endif
+#if defined(CB_TC_HAVE_GDB_INDEX)
+  if (!p->optimize) { cb_cmd_append_lit(arena, cmd, "-Wl,--gdb-index"); }
+#else
+  (void)p;
+#endif
+}
+
+// Duration and peak RSS of every command, for scheduling the job pool.
+#define JOB_LOG_PATH "build/.cbuild_log"
+
+CB_Pool new_pool(CB_Arena *arena, CB_Write_Buffer *stderr)
+{
+  CB_Pool pool = cb_pool_init(arena, S(JOB_LOG_PATH), stderr);
+  *(cb_da_push(arena, &pool.glob_ignore)) = S("build");
+#if defined(POOL_JOBS)
+  pool.max_jobs = POOL_JOBS;
+#endif
+#if defined(POOL_CGROUP_LIMIT)
+  pool.cgroup_limit = POOL_CGROUP_LIMIT;
+#endif
+  return pool;
+}
+
+// <dir>/<name> of the profile.
+CB_Str profile_path(CB_Arena *arena, Build_Profile *p, CB_Str name)
+{
+  CB_Write_Buffer *b = cb_mem_buffer(arena, p->dir.len + name.len + 1);
+  cb_append(b, p->dir, S("/"), name);
+  return (CB_Str){ .buf = b->buf, .len = b->len, };
+}
+
+typedef struct Archive_Job {
+  CB_Str path;
+  CB_Str_List members;
+  CB_b32 thin;
+} Archive_Job;
+
+CB_b32 archive_job(void *data, CB_Write_Buffer *stderr)
+{
+  Archive_Job *a = data;
+  return cb_ar_write(a->path, a->members.items, a->members.len, a->thin, stderr);
+}
+
+// The ftmodule.h and ftoption.h of the selected modules, in place of FreeType's own.
+#define FREETYPE_CONFIG_DIR "build/freetype-config"
+#define FREETYPE_CONFIG_MACROS "-DFT_CONFIG_MODULES_H=<ftmodule.h>", "-DFT_CONFIG_OPTIONS_H=<ftoption.h>"
+
+// A FreeType module, the sources it compiles and the classes it registers.
+typedef struct Freetype_Module {
+  char *name;            // as in FREETYPE_MODULES
+  char *sources[2];      // under FREETYPE_LOC "src/"
+  char *classes[2];      // FT_USE_MODULE arguments, none for helper code
+  char *requires[4];     // modules it needs, selected along with it
+  char *option;          // undefined in ftoption.h if the module is not built
+} Freetype_Module;
+
+// In the order of the stock ftmodule.h, FT_Open_Face tries the drivers in it.
+Freetype_Module freetype_modules[] = {
+  { .name = "autofit", .sources = { "autofit/autofit.c" }, .classes = { "FT_Module_Class, autofit_module_class" }, },
+  { .name = "truetype", .sources = { "truetype/truetype.c" }, .classes = { "FT_Driver_ClassRec, tt_driver_class" }, .requires = { "sfnt" }, },
+  { .name = "type1", .sources = { "type1/type1.c", "base/fttype1.c" }, .classes = { "FT_Driver_ClassRec, t1_driver_class" }, .requires = { "psaux", "pshinter", "psnames" }, },
+  { .name = "cff", .sources = { "cff/cff.c" }, .classes = { "FT_Driver_ClassRec, cff_driver_class" }, .requires = { "sfnt", "psaux", "pshinter", "psnames" }, },
+  { .name = "cid", .sources = { "cid/type1cid.c", "base/ftcid.c" }, .classes = { "FT_Driver_ClassRec, t1cid_driver_class" }, .requires = { "psaux", "pshinter", "psnames" }, },
+  { .name = "pfr", .sources = { "pfr/pfr.c", "base/ftpfr.c" }, .classes = { "FT_Driver_ClassRec, pfr_driver_class" }, },
+  { .name = "type42", .sources = { "type42/type42.c" }, .classes = { "FT_Driver_ClassRec, t42_driver_class" }, .requires = { "truetype", "psaux", "psnames" }, },
+  { .name = "winfonts", .sources = { "winfonts/winfnt.c", "base/ftwinfnt.c" }, .classes = { "FT_Driver_ClassRec, winfnt_driver_class" }, },
+  { .name = "pcf", .sources = { "pcf/pcf.c" }, .classes = { "FT_Driver_ClassRec, pcf_driver_class" }, },
+  { .name = "bdf", .sources = { "bdf/bdf.c", "base/ftbdf.c" }, .classes = { "FT_Driver_ClassRec, bdf_driver_class" }, },
+  { .name = "psaux", .sources = { "psaux/psaux.c" }, .classes = { "FT_Module_Class, psaux_module_class" }, .requires = { "psnames" }, },
+  { .name = "psnames", .sources = { "psnames/psnames.c" }, .classes = { "FT_Module_Class, psnames_module_class" }, },
+  { .name = "pshinter", .sources = { "pshinter/pshinter.c" }, .classes = { "FT_Module_Class, pshinter_module_class" }, },
+  { .name = "sfnt", .sources = { "sfnt/sfnt.c" }, .classes = { "FT_Module_Class, sfnt_module_class" }, },
+  { .name = "smooth", .sources = { "smooth/smooth.c" }, .classes = { "FT_Renderer_Class, ft_smooth_renderer_class" }, },
+  { .name = "raster", .sources = { "raster/raster.c" }, .classes = { "FT_Renderer_Class, ft_raster1_renderer_class" }, },
+  { .name = "sdf", .sources = { "sdf/sdf.c" }, .classes = { "FT_Renderer_Class, ft_sdf_renderer_class", "FT_Renderer_Class, ft_bitmap_sdf_renderer_class" }, },
+  { .name = "svg", .sources = { "svg/svg.c" }, .classes = { "FT_Renderer_Class, ft_svg_renderer_class" }, .option = "FT_CONFIG_OPTION_SVG", },
+  { .name = "gzip", .sources = { "gzip/ftgzip.c" }, .option = "FT_CONFIG_OPTION_USE_ZLIB", }, // gzip'ed PCF, WOFF, SVGZ
+  { .name = "lzw", .sources = { "lzw/ftlzw.c" }, .option = "FT_CONFIG_OPTION_USE_LZW", }, // compressed PCF
+  { .name = "bzip2", .sources = { "bzip2/ftbzip2.c" }, },
+  { .name = "cache", .sources = { "cache/ftcache.c" }, },
+  { .name = "gxvalid", .sources = { "base/ftgxval.c" }, },
+  { .name = "otvalid", .sources = { "base/ftotval.c" }, },
+};
+
+// Marks the modules of FREETYPE_MODULES and the ones they require, all of
+// them if it is not defined. Returns the first unknown name, 0 if none.
+char *select_freetype_modules(CB_b32 selected[CB_countof(freetype_modules)])
+{
+#if defined(FREETYPE_MODULES)
+  char *names[] = { FREETYPE_MODULES };
+  for (CB_size i = 0; i < CB_countof(freetype_modules); i++) { selected[i] = 0; }
+  for (CB_size i = 0; i < CB_countof(names); i++) {
+    CB_size k = 0;
+    while (k < CB_countof(freetype_modules) && strcmp(freetype_modules[k].name, names[i]) != 0) { k++; }
+    if (k == CB_countof(freetype_modules)) { return names[i]; }
+    selected[k] = 1;
+  }
+  for (CB_b32 changed = 1; changed;) {
+    changed = 0;
+    for (CB_size i = 0; i < CB_countof(freetype_modules); i++) {
+      for (CB_size r = 0; selected[i] && r < CB_countof(freetype_modules[i].requires) && freetype_modules[i].requires[r]; r++) {
+        for (CB_size k = 0; k < CB_countof(freetype_modules); k++) {
+          if (selected[k] || strcmp(freetype_modules[k].name, freetype_modules[i].requires[r]) != 0) { continue; }
+          selected[k] = changed = 1;
+        }
+      }
+    }
+  }
+#else
+  for (CB_size i = 0; i < CB_countof(freetype_modules); i++) { selected[i] = 1; }
+#endif
+  return 0;
+}
+
+// The base library and the sources of the selected modules.
+CB_Str_List list_freetype_sources(CB_Arena *arena)
+{
+  CB_Str_List sources = cb_str_dup_list(arena,
+    FREETYPE_LOC "src/base/ftbase.c",
+    FREETYPE_LOC "src/base/ftsystem.c",
+    FREETYPE_LOC "src/base/ftdebug.c",
+    FREETYPE_LOC "src/base/ftbbox.c",
+    FREETYPE_LOC "src/base/ftbitmap.c",
+    FREETYPE_LOC "src/base/ftfstype.c",
+    FREETYPE_LOC "src/base/ftgasp.c",
+    FREETYPE_LOC "src/base/ftglyph.c",
+    FREETYPE_LOC "src/base/ftinit.c",
+    FREETYPE_LOC "src/base/ftmm.c",
+    FREETYPE_LOC "src/base/ftpatent.c",
+    FREETYPE_LOC "src/base/ftstroke.c",
+    FREETYPE_LOC "src/base/ftsynth.c");
+
+  CB_b32 selected[CB_countof(freetype_modules)];
+  select_freetype_modules(selected); // unknown names fail in write_freetype_config
+  for (CB_size i = 0; i < CB_countof(freetype_modules); i++) {
+    for (CB_size k = 0; selected[i] && k < CB_countof(freetype_modules[i].sources) && freetype_modules[i].sources[k]; k++) {
+      CB_Write_Buffer *b = cb_mem_buffer(arena, 256);
+      cb_append(b, S(FREETYPE_LOC "src/"), cb_str_from_cstr(freetype_modules[i].sources[k]));
+      *(cb_da_push(arena, &sources)) = (CB_Str){ .buf = b->buf, .len = b->len, };
+    }
+  }
+  return sources;
+}
+
+// Writes the ftmodule.h and ftoption.h of the selected modules to
+// FREETYPE_CONFIG_DIR, left untouched if they did not change.
+CB_b32 write_freetype_config(CB_Write_Buffer *stderr)
+{
+  CB_Arena_Mark scratch = cb_arena_get_scratch(0, 0);
+  CB_b32 result = 1;
+
+  CB_b32 selected[CB_countof(freetype_modules)];
+  char *unknown = select_freetype_modules(selected);
+  if (unknown) {
+    cb_log_emit(stderr, CB_LOG_ERROR, S("Unknown FreeType module \""), cb_str_from_cstr(unknown), S("\" in FREETYPE_MODULES"));
+    cb_return_defer(0);
+  }
+  if (!cb_mkdir_if_not_exists(S(FREETYPE_CONFIG_DIR), stderr)) { cb_return_defer(0); }
+
+  CB_Write_Buffer *modules = cb_mem_buffer(scratch.arena, 4 * 1024);
+  CB_Write_Buffer *options = cb_mem_buffer(scratch.arena, 4 * 1024);
+  cb_append(modules, S("/* Generated by cbuild from FREETYPE_MODULES. */\n"));
+  cb_append(options, S("/* Generated by cbuild from FREETYPE_MODULES. */\n"));
+  cb_append(options, S("#include <freetype/config/ftoption.h>\n"));
+  for (CB_size i = 0; i < CB_countof(freetype_modules); i++) {
+    Freetype_Module *m = freetype_modules + i;
+    for (CB_size k = 0; selected[i] && k < CB_countof(m->classes) && m->classes[k]; k++) {
+      cb_append(modules, S("FT_USE_MODULE( "), cb_str_from_cstr(m->classes[k]), S(" )\n"));
+    }
+    if (!selected[i] && m->option) {
+      cb_append(options, S("#undef "), cb_str_from_cstr(m->option), S("\n"));
+    }
+  }
+
+  CB_Str module_h = { .buf = modules->buf, .len = modules->len, };
+  CB_Str option_h = { .buf = options->buf, .len = options->len, };
+  if (cb_write_file_if_changed(S(FREETYPE_CONFIG_DIR "/ftmodule.h"), module_h, stderr) < 0) { cb_return_defer(0); }
+  if (cb_write_file_if_changed(S(FREETYPE_CONFIG_DIR "/ftoption.h"), option_h, stderr) < 0) { cb_return_defer(0); }
+
+ defer:
+  cb_arena_pop_mark(scratch);
+  return result;
+}
+
+CB_Str_List list_freetype_objects(CB_Arena *arena, Build_Profile *p, CB_Str_List sources)
+{
+  CB_Write_Buffer *b = cb_mem_buffer(arena, 4 * 1024);
+  CB_Str_List obj_files = cb_da_init(arena, CB_Str_List, 128);
+  { // freetype/**/*/<base>.c -> <dir>/freetype/<base>.o
+    for (CB_size i = 0; i < sources.len; i++) {
+      CB_Str_Mark mark = cb_write_buffer_mark(b);
+      cb_append(b, p->dir, S("/freetype/"), cb_path_stem(sources.items[i]), S(".o"));
+      CB_Str obj = cb_str_from_mark(&mark);
+      *(cb_da_push(arena, &obj_files)) = obj;
+    }
+  }
+  return obj_files;
+}
+
+
+// Flags every FreeType object is compiled with.
+void cmd_freetype_compile_flags(CB_Arena *arena, CB_Command *cmd)
+{
+  cb_cmd_append_lit(arena, cmd, "-I" FREETYPE_CONFIG_DIR, FREETYPE_CONFIG_MACROS);
+  cb_cmd_append_lit(arena, cmd, "-I" FREETYPE_LOC "include");
+  cb_cmd_append_lit(arena, cmd, "-DFT2_BUILD_LIBRARY");
+  cb_cmd_append_lit(arena, cmd, "-DHAVE_UNISTD_H");
+}
+
+CB_b32 build_freetype_library(Build_Profile *p, CB_Write_Buffer *stderr)
+{
+  CB_Arena_Mark scratch = cb_arena_get_scratch(&p->pool->arena, 1);
+  CB_Arena *arena = p->pool->arena; // the archive job reads its members while the pool runs
+  CB_b32 result = 0;
+
+  CB_Str freetype_out = profile_path(arena, p, S("libfreetype.a"));
+  CB_Str freetype_dir = profile_path(scratch.arena, p, S("freetype"));
+  CB_Str_List freetype_sources = list_freetype_sources(scratch.arena);
+  CB_Str_List obj_files = list_freetype_objects(arena, p, freetype_sources);
+
+  if (!cb_mkdir_if_not_exists(freetype_dir, stderr)) cb_return_defer(0);
+  if (!write_freetype_config(stderr)) cb_return_defer(0);
+
+  CB_Command cmd = cb_da_init(scratch.arena, CB_Command, 128);
+  cmd_freetype_compile_flags(scratch.arena, &cmd);
+  // Headers come from the scanner instead of the compiler, one scanner for all
+  // sources so every header is read once
+  CB_Include_Scanner scanner = cb_include_scanner_init(scratch.arena, cmd);
+  for (CB_size i = 0; i < freetype_sources.len; i++) {
+    cmd.len = 0;
+
+    cb_cmd_append_lit(scratch.arena, &cmd, CB_TC_CC);
+    cb_cmd_append    (scratch.arena, &cmd, S("-o"), obj_files.items[i]);
+    cb_cmd_append    (scratch.arena, &cmd, S("-c"), freetype_sources.items[i]);
+    cmd_freetype_compile_flags(scratch.arena, &cmd);
+    if (p->optimize) { cb_cmd_append_lit(scratch.arena, &cmd, "-O2"); }
+    cmd_profile_flags(scratch.arena, &cmd, p);
+    CB_b32 atomic = cmd_atomic_flags(scratch.arena, &cmd, obj_files.items[i]);
+
+    CB_Str_List inputs = cb_da_init(scratch.arena, CB_Str_List, 64);
+    *(cb_da_push(scratch.arena, &inputs)) = freetype_sources.items[i];
+    if (!cb_scan_includes(&scanner, freetype_sources.items[i], &inputs, stderr)) { cb_return_defer(0); }
+
+    CB_Job *job = cb_pool_push(p->pool, cmd, obj_files.items[i], inputs.items, inputs.len);
+    job->always = p->force;
+    job->atomic = atomic;
+#if defined(DIST_WORKERS)
+    // Profile flags (PGO instrumentation) have to run on this host
+    if (p->cflags.len == 0) {
+      char *workers[] = { DIST_WORKERS };
+      job->worker = cb_str_from_cstr(workers[i % CB_countof(workers)]);
+    }
+#endif
+  }
+
+  Archive_Job *archive = new(arena, Archive_Job, 1);
+  archive->path = freetype_out;
+  archive->members = obj_files;
+#if defined(FREETYPE_THIN_ARCHIVE)
+  archive->thin = 1;
+#endif
+  CB_Job *job = cb_pool_push_fn(p->pool, archive_job, archive, freetype_out, obj_files.items, obj_files.len);
+  job->always = p->force;
+  cb_return_defer(1);
+
+ defer:
+  cb_arena_pop_mark(scratch);
+  return result;
+}
+
+// One source of check_includes.
+typedef struct Include_Check {
+  CB_Arena *arena;       // the pool's
+  CB_Str source;
+  CB_Str_List scanned;
+  CB_Str depfile;        // written by `cc -MM`
+  CB_Command cmd;
+  CB_size compiler_deps;
+} Include_Check;
+
+CB_b32 include_check_compare(Include_Check *c, CB_Write_Buffer *stderr)
+{
+  CB_Read_Result depfile = cb_read_entire_file(c->arena, c->depfile, stderr);
+  if (!depfile.status) { return 0; }
+  CB_Str_List deps = cb_parse_depfile(c->arena, depfile.file_contents);
+  c->compiler_deps = deps.len;
+
+  // Compared by inode, the compiler spells paths differently
+  CB_b32 result = 1;
+  struct stat *scanned_stats = new(c->arena, struct stat, c->scanned.len);
+  for (CB_size k = 0; k < c->scanned.len; k++) {
+    stat(cb_str_to_cstr(c->arena, c->scanned.items[k]), scanned_stats + k);
+  }
+  for (CB_size j = 0; j < deps.len; j++) {
+    struct stat dep = {0};
+    CB_b32 found = 0;
+    if (stat(cb_str_to_cstr(c->arena, deps.items[j]), &dep) == 0) {
+      for (CB_size k = 0; k < c->scanned.len && !found; k++) {
+        found = (scanned_stats[k].st_dev == dep.st_dev && scanned_stats[k].st_ino == dep.st_ino);
+      }
+    }
+    if (!found) {
+      cb_log_emit(stderr, CB_LOG_ERROR, S("Include scanner missed "), deps.items[j], S(" of "), c->source);
+      result = 0;
+    }
+  }
+  return result;
+}
+
+CB_Task_Status include_check_task(CB_Task *t, void *data, CB_Write_Buffer *stderr)
+{
+  Include_Check *c = data;
+  CB_TASK_BEGIN(t);
+  CB_AWAIT_CMD(t, c->cmd);
+  if (t->status != 0) {
+    cb_log_emit(stderr, CB_LOG_ERROR, S("Compiler could not list the dependencies of "), c->source);
+    CB_TASK_FAIL(t);
+  }
+  if (!include_check_compare(c, stderr)) { CB_TASK_FAIL(t); }
+  CB_TASK_END(t);
+}
+
+// Test mode of the include scanner: every header `cc -MM` reports for a
+// FreeType source has to be among the scanned inputs. The scanner ignores
+// conditionals, so it may find more. The compiler runs as one task per
+// source, in parallel.
+CB_b32 check_includes(CB_Write_Buffer *stderr)
+{
+  CB_Arena_Mark scratch = cb_arena_get_scratch(0, 0);
+  CB_b32 result = 1;
+
+  if (!cb_mkdir_if_not_exists(S("build/check-includes"), stderr)) { cb_return_defer(0); }
+  if (!write_freetype_config(stderr)) { cb_return_defer(0); }
+
+  CB_Pool pool = new_pool(scratch.arena, stderr);
+  CB_Command flags = cb_da_init(scratch.arena, CB_Command, 16);
+  cmd_freetype_compile_flags(scratch.arena, &flags);
+  CB_Include_Scanner scanner = cb_include_scanner_init(scratch.arena, flags);
+  CB_Str_List sources = list_freetype_sources(scratch.arena);
+  Include_Check *checks = new(scratch.arena, Include_Check, sources.len);
+
+  for (CB_size i = 0; i < sources.len; i++) {
+    Include_Check *c = checks + i;
+    c->arena = scratch.arena;
+    c->source = sources.items[i];
+    c->scanned = cb_da_init(scratch.arena, CB_Str_List, 64);
+    *(cb_da_push(scratch.arena, &c->scanned)) = c->source;
+    if (!cb_scan_includes(&scanner, c->source, &c->scanned, stderr)) { cb_return_defer(0); }
+
+    CB_Write_Buffer *b = cb_mem_buffer(scratch.arena, 64);
+    cb_append(b, S("build/check-includes/"));
+    cb_append_long(b, (long)i);
+    cb_append(b, S(".d"));
+    c->depfile = (CB_Str){ .buf = b->buf, .len = b->len, };
+
+    c->cmd = cb_da_init(scratch.arena, CB_Command, 16);
+    cb_cmd_append_lit(scratch.arena, &c->cmd, CB_TC_CC, "-MM");
+    cb_cmd_append(scratch.arena, &c->cmd, c->source, S("-MF"), c->depfile);
+    cb_cmd_append_strs(scratch.arena, &c->cmd, flags.items, flags.len);
+
+    CB_Job *job = cb_pool_push_task(&pool, include_check_task, c, c->depfile, &c->source, 1);
+    job->always = 1;
+  }
+  result = cb_pool_run(&pool, stderr);
+
+  CB_size compiler_deps = 0, scanned_deps = 0;
+  for (CB_size i = 0; i < sources.len; i++) {
+    compiler_deps += checks[i].compiler_deps;
+    scanned_deps += checks[i].scanned.len;
+  }
+  CB_Write_Buffer *b = cb_mem_buffer(scratch.arena, 256);
+  cb_append(b, S("Include scanner: "));
+  cb_append_long(b, (long)sources.len);
+  cb_append(b, S(" sources, "));
+  cb_append_long(b, (long)compiler_deps);
+  cb_append(b, S(" compiler dependencies, "));
+  cb_append_long(b, (long)scanned_deps);
+  cb_append(b, S(" scanned"));
+  cb_log_emit(stderr, result ? CB_LOG_INFO : CB_LOG_ERROR, ((CB_Str){ .buf = b->buf, .len = b->len, }));
+
+ defer:
+  cb_arena_pop_mark(scratch);
+  return result;
+}
+
+// Logs of `./cbuild test` and its own job log: the tests run the driver
+// again, which writes the build's log.
+#define TESTS_DIR "build/tests"
+
+// Test programs, tests/<name>.c built against cbuild.h into build/tests/<name>.
+typedef struct Test_Program {
+  char *name;
+  CB_b32 threads; // built with -fsanitize=thread if the toolchain has it
+} Test_Program;
+
+Test_Program test_programs_table[] = {
+  { .name = "ar_same_second", },
+  { .name = "log_stress", .threads = 1, },
+};
+
+// The self-checks, run as tests by `./cbuild test [--shard=<i>/<n>] [--timeout=<ms>]`.
+CB_b32 run_tests(CB_Str_List args, CB_Write_Buffer *stderr)
+{
+  CB_Arena_Mark scratch = cb_arena_get_scratch(0, 0);
+  CB_b32 result = 1;
+
+  CB_Test_Options options = { .dir = S(TESTS_DIR), .timeout_ms = 10 * 60 * 1000, };
+  if (!cb_test_parse_args(args, &options, stderr)) { cb_return_defer(0); }
+  if (!cb_mkdir_if_not_exists(S(TESTS_DIR), stderr)) { cb_return_defer(0); }
+
+  CB_Pool pool = cb_pool_init(scratch.arena, S(TESTS_DIR "/.cbuild_log"), stderr);
+#if defined(POOL_JOBS)
+  pool.max_jobs = POOL_JOBS;
+#endif
+
+  CB_Tests tests = cb_da_init(scratch.arena, CB_Tests, 8);
+  for (CB_size i = 0; i < CB_countof(test_programs_table); i++) {
+    Test_Program *t = test_programs_table + i;
+    CB_Str name = cb_str_from_cstr(t->name);
+    CB_Write_Buffer *b = cb_mem_buffer(scratch.arena, 2 * name.len + 32);
+    CB_Str_Mark mark = cb_write_buffer_mark(b);
+    cb_append(b, S("tests/"), name, S(".c"));
+    CB_Str source = cb_str_from_mark(&mark);
+    cb_append(b, S(TESTS_DIR "/"), name);
+    CB_Str exe = cb_str_from_mark(&mark);
+
+    CB_Command cmd = cb_da_init(scratch.arena, CB_Command, 16);
+    cb_cmd_append_lit(scratch.arena, &cmd, CB_TC_CC);
+    cb_cmd_append    (scratch.arena, &cmd, S("-o"), exe, source);
+    cb_cmd_append_lit(scratch.arena, &cmd, "-g", "-O1", "-pthread", "-Wall", "-Wextra");
+#if defined(CB_TC_HAVE_TSAN)
+    if (t->threads) { cb_cmd_append_lit(scratch.arena, &cmd, "-fsanitize=thread"); }
+#endif
+    CB_Str inputs[] = { source, S("cbuild.h"), };
+    cb_pool_push(&pool, cmd, exe, inputs, CB_countof(inputs))->atomic = 1;
+
+    CB_Test *test = cb_da_push(scratch.arena, &tests);
+    *test = (CB_Test){ .name = name, .cmd = cb_da_init(scratch.arena, CB_Command, 1), .timeout_ms = 60 * 1000, };
+    cb_cmd_append(scratch.arena, &test->cmd, exe);
+  }
+
+  CB_Test *test = cb_da_push(scratch.arena, &tests);
+  *test = (CB_Test){ .name = S("check-includes"), .cmd = cb_da_init(scratch.arena, CB_Command, 4), };
+  cb_cmd_append_lit(scratch.arena, &test->cmd, "./cbuild", "check-includes");
+  test = cb_da_push(scratch.arena, &tests);
+  *test = (CB_Test){ .name = S("concurrent-arena"), .cmd = cb_da_init(scratch.arena, CB_Command, 4), .timeout_ms = 60 * 1000, };
+  cb_cmd_append_lit(scratch.arena, &test->cmd, "./cbuild", "bench-arena", "--items=20000", "--runs=1");
+  // Finds each compile's report and .i where it expects them, next to the output
+  test = cb_da_push(scratch.arena, &tests);
+  *test = (CB_Test){ .name = S("profile-compile"), .cmd = cb_da_init(scratch.arena, CB_Command, 4), };
+  cb_cmd_append_lit(scratch.arena, &test->cmd, "./cbuild", "--profile-compile");
+
+  result = cb_run_tests(&pool, &tests, options, stderr);
+
+ defer:
+  cb_arena_pop_mark(scratch);
+  return result;
+}
+
+void cmd_freetype_flags(CB_Arena *arena, CB_Command *cmd)
+{
+  // The public headers depend on the options the library was built with
+  cb_cmd_append_lit(arena, cmd, "-I" FREETYPE_CONFIG_DIR, FREETYPE_CONFIG_MACROS);
+  cb_cmd_append_lit(arena, cmd, "-I./vendor/freetype/include/");
+}
+
+void cmd_freetype_link_flags(CB_Arena *arena, CB_Command *cmd, Build_Profile *p)
+{
+  if (p->lto) {
+    CB_Str_List obj_files = list_freetype_objects(arena, p, list_freetype_sources(arena));
+    cb_cmd_append_strs(arena, cmd, obj_files.items, obj_files.len);
+  }
+  else {
+    CB_Write_Buffer *b = cb_mem_buffer(arena, p->dir.len + 2);
+    cb_append(b, S("-L"), p->dir);
+    cb_cmd_append(arena, cmd, ((CB_Str){ .buf = b->buf, .len = b->len, }), S("-lfreetype"));
+  }
+}
+
+CB_b32 build_sokol_library(Build_Profile *p, CB_Write_Buffer *stderr)
+{
+  CB_Arena_Mark scratch = cb_arena_get_scratch(&p->pool->arena, 1);
+  CB_b32 result = 0;
+
+  CB_Str sokol_out = profile_path(scratch.arena, p, S("libsokol.a"));
+
+  CB_Command cmd = cb_da_init(scratch.arena, CB_Command, 64);
+  cb_cmd_append_lit(scratch.arena, &cmd, CB_TC_CC);
+  cb_cmd_append    (scratch.arena, &cmd, S("-o"), sokol_out);
+  cb_cmd_append    (scratch.arena, &cmd, S("-c"), S(SOKOL_LIB_ENTRY));
+  cb_cmd_append_lit(scratch.arena, &cmd, "-I" SOKOL_LOC);
+  cb_cmd_append_lit(scratch.arena, &cmd, "-DSOKOL_GLCORE33");
+#if defined(SOKOL_DEBUG)
+  if (!p->optimize) {
+    cmd_debug_flags(scratch.arena, &cmd);
+    cmd_split_dwarf_flags(scratch.arena, &cmd, p);
+  }
+  else
+#endif
+  cb_cmd_append_lit(scratch.arena, &cmd, "-O2");
+  cmd_profile_flags(scratch.arena, &cmd, p);
+  CB_b32 atomic = cmd_atomic_flags(scratch.arena, &cmd, sokol_out);
+
+  // Only the headers the entry compiles, not every sokol header
+  CB_Str_List sokol_sources = cb_da_init(scratch.arena, CB_Str_List, 16);
+  *(cb_da_push(scratch.arena, &sokol_sources)) = S(SOKOL_LIB_ENTRY);
+  CB_Include_Scanner scanner = cb_include_scanner_init(scratch.arena, cmd);
+  if (!cb_scan_includes(&scanner, S(SOKOL_LIB_ENTRY), &sokol_sources, stderr)) { cb_return_defer(0); }
+
+  CB_Job *job = cb_pool_push(p->pool, cmd, sokol_out, sokol_sources.items, sokol_sources.len);
+  job->always = p->force;
+  job->atomic = atomic;
+  cb_return_defer(1);
+
+ defer:
+  cb_arena_pop_mark(scratch);
+  return result;
+}
+
+void cmd_sokol_flags(CB_Arena *arena, CB_Command *cmd)
+{
+  cb_cmd_append_lit(arena, cmd, "-I./vendor/sokol/");
+  cb_cmd_append_lit(arena, cmd, "-DSOKOL_GLCORE33");
+  cb_cmd_append_lit(arena, cmd, "-pthread");
+}
+
+void cmd_sokol_link_flags(CB_Arena *arena, CB_Command *cmd, Build_Profile *p)
+{
+  CB_Write_Buffer *b = cb_mem_buffer(arena, p->dir.len + 2);
+  cb_append(b, S("-L"), p->dir);
+  cb_cmd_append(arena, cmd, ((CB_Str){ .buf = b->buf, .len = b->len, }), S("-lsokol"));
+  cb_cmd_append_lit(arena, cmd, "-pthread");
+  cb_cmd_append_lit(arena, cmd, "-lGL");
+  cb_cmd_append_lit(arena, cmd, "-lX11", "-lXi", "-lXcursor");
+}
+
+// <shader>.h, the output of shdc_compile_shader.
+CB_Str shader_header(CB_Arena *arena, CB_Str shader)
+{
+  CB_Write_Buffer *b = cb_mem_buffer(arena, shader.len + 2);
+  cb_append(b, shader, S(".h"));
+  return (CB_Str){ .buf = b->buf, .len = b->len, };
+}
+
+#if defined(SOKOL_SHDC_PATH)
+#  define SHDC_PROGRAM SOKOL_SHDC_PATH
+#else
+#  define SHDC_PROGRAM "sokol-shdc" // Is "sokol-shdc" in PATH? Configure in ./build/config.h
+#endif
+#if !defined(SHDC_LANGS)
+#  define SHDC_LANGS "glsl330"
+#endif
+#define SHADER_DIR "build/shaders"
+
+// sokol-shdc output language and the sokol backend define that selects it
+struct { char *lang; char *backend; } shader_backends[] = {
+  { "glsl330",     "SOKOL_GLCORE33", },
+  { "glsl300es",   "SOKOL_GLES3", },
+  { "hlsl5",       "SOKOL_D3D11", },
+  { "metal_macos", "SOKOL_METAL", },
+  { "wgsl",        "SOKOL_WGPU", },
+};
+
+typedef struct Shader_Key_Job {
+  CB_Str shader;
+  CB_Str key_path;
+  CB_Str cmd_line;
+} Shader_Key_Job;
+
+// The key of a shader compile is the shader's content, the sokol-shdc binary
+// and the command line. It is only written when it changed (restat), so the
+// compile does not run for a touched but unchanged shader.
+CB_b32 shader_key_job(void *data, CB_Write_Buffer *stderr)
+{
+  Shader_Key_Job *k = data;
+  CB_Arena_Mark scratch = cb_arena_get_scratch(0, 0);
+  CB_b32 result = 0;
+
+  CB_Read_Result shader = cb_read_entire_file(scratch.arena, k->shader, stderr);
+  if (!shader.status) { cb_return_defer(0); }
+  CB_u64 h = cb_hash_str(CB_HASH_INIT, shader.file_contents);
+  h = cb_hash_program(h, S(SHDC_PROGRAM));
+  h = cb_hash_str(h, k->cmd_line);
+
+  CB_Write_Buffer *b = cb_mem_buffer(scratch.arena, 32);
+  cb_append_hex(b, h);
+  cb_append(b, S("\n"));
+  cb_return_defer(cb_write_file_if_changed(k->key_path, (CB_Str){ .buf = b->buf, .len = b->len, }, stderr) >= 0);
+
+ defer:
+  cb_arena_pop_mark(scratch);
+  return result;
+}
+
+typedef struct Shader_Header_Job {
+  CB_Str shader;
+  CB_Str header;
+  CB_Str_List backends;
+  CB_Str_List parts;     // header of every backend
+} Shader_Header_Job;
+
+// Joins the per-backend headers into <shader>.h, each behind its backend
+// define. Written only when it changed, so the programs including it are not
+// rebuilt for nothing.
+CB_b32 shader_header_job(void *data, CB_Write_Buffer *stderr)
+{
+  Shader_Header_Job *h = data;
+  CB_Arena_Mark scratch = cb_arena_get_scratch(0, 0);
+  CB_b32 result = 0;
+
+  CB_File_Info *parts = new(scratch.arena, CB_File_Info, h->parts.len);
+  for (CB_size i = 0; i < h->parts.len; i++) { parts[i].path = h->parts.items[i]; }
+  cb_read_files(scratch.arena, parts, h->parts.len);
+
+  CB_size size = 1024;
+  for (CB_size i = 0; i < h->parts.len; i++) {
+    if (parts[i].error) {
+      cb_log_emit(stderr, CB_LOG_ERROR,
+                  S("Could not read file "),
+                  parts[i].path,
+                  S(": "),
+                  cb_str_from_cstr(strerror(parts[i].error)));
+      cb_return_defer(0);
+    }
+    size += parts[i].contents.len + h->backends.items[i].len + 32;
+  }
+
+  CB_Write_Buffer *b = cb_mem_buffer(scratch.arena, size);
+  cb_append(b, S("// Generated by cbuild from "), h->shader, S(", do not edit.\n"));
+  for (CB_size i = 0; i < h->parts.len; i++) {
+    cb_append(b, i == 0 ? S("#if defined(") : S("#elif defined("), h->backends.items[i], S(")\n"));
+    cb_append(b, parts[i].contents, S("\n"));
+  }
+  cb_append(b, S("#endif\n"));
+  cb_return_defer(cb_write_file_if_changed(h->header, (CB_Str){ .buf = b->buf, .len = b->len, }, stderr) >= 0);
+
+ defer:
+  cb_arena_pop_mark(scratch);
+  return result;
+}
+
+// Compiles shader with sokol-shdc for every language in SHDC_LANGS, one job
+// per language, into <shader>.h.
+CB_b32 shdc_compile_shader(CB_Pool *pool, CB_Str shader, CB_Write_Buffer *stderr)
+{
+  CB_Arena_Mark scratch = cb_arena_get_scratch(&pool->arena, 1);
+  CB_Arena *arena = pool->arena; // job data is read while the pool runs
+  CB_b32 result = 0;
+
+  if (!cb_mkdir_if_not_exists(S(SHADER_DIR), stderr)) { cb_return_defer(0); }
+
+  // ./examples/editor/editor.glsl -> build/shaders/examples_editor_editor.glsl
+  CB_Write_Buffer *b = cb_mem_buffer(scratch.arena, shader.len + 64);
+  CB_Str name = shader;
+  if (cb_str_starts_with(name, S("./"))) { name.buf += 2; name.len -= 2; }
+  cb_append(b, S(SHADER_DIR "/"), name);
+  CB_Str base = { .buf = b->buf, .len = b->len, };
+  for (CB_size i = CB_sizeof(SHADER_DIR); i < base.len; i++) {
+    if (base.buf[i] == '/') { base.buf[i] = '_'; }
+  }
+
+  Shader_Header_Job *header = new(arena, Shader_Header_Job, 1);
+  header->shader = shader;
+  header->header = shader_header(arena, shader);
+  header->backends = cb_da_init(arena, CB_Str_List, 8);
+  header->parts = cb_da_init(arena, CB_Str_List, 8);
+
+  char *langs[] = { SHDC_LANGS };
+  for (CB_size i = 0; i < CB_countof(langs); i++) {
+    CB_Str lang = cb_str_from_cstr(langs[i]);
+    CB_Str backend = {0};
+    for (CB_size j = 0; j < CB_countof(shader_backends); j++) {
+      if (cb_str_equals(lang, cb_str_from_cstr(shader_backends[j].lang))) {
+        backend = cb_str_from_cstr(shader_backends[j].backend);
+      }
+    }
+    if (backend.len == 0) {
+      cb_log_emit(stderr, CB_LOG_ERROR, S("Unknown shader language in SHDC_LANGS: "), lang);
+      cb_return_defer(0);
+    }
+
+    CB_Write_Buffer *paths = cb_mem_buffer(arena, 2 * base.len + 2 * lang.len + 16);
+    CB_Str_Mark mark = cb_write_buffer_mark(paths);
+    cb_append(paths, base, S("."), lang, S(".h"));
+    CB_Str part = cb_str_from_mark(&mark);
+    cb_append(paths, base, S("."), lang, S(".key"));
+    CB_Str key = cb_str_from_mark(&mark);
+
+    CB_Command cmd = cb_da_init(scratch.arena, CB_Command, 16);
+    cb_cmd_append(scratch.arena, &cmd, S(SHDC_PROGRAM));
+    cb_cmd_append(scratch.arena, &cmd, S("-l"), lang);
+    cb_cmd_append(scratch.arena, &cmd, S("-i"), shader);
+    cb_cmd_append(scratch.arena, &cmd, S("-o"), part);
+
+    Shader_Key_Job *key_job = new(arena, Shader_Key_Job, 1);
+    key_job->shader = shader;
+    key_job->key_path = key;
+    CB_Write_Buffer *cmd_line = cb_mem_buffer(arena, 1024);
+    cb_cmd_render(cmd, cmd_line);
+    key_job->cmd_line = (CB_Str){ .buf = cmd_line->buf, .len = cmd_line->len, };
+
+    CB_Job *job = cb_pool_push_fn(pool, shader_key_job, key_job, key, &shader, 1);
+    job->always = 1;
+    job->restat = 1;
+    cb_pool_push(pool, cmd, part, &key, 1)->atomic = 1;
+
+    *(cb_da_push(arena, &header->backends)) = backend;
+    *(cb_da_push(arena, &header->parts)) = part;
+  }
+
+  CB_Job *job = cb_pool_push_fn(pool, shader_header_job, header, header->header, header->parts.items, header->parts.len);
+  job->restat = 1;
+  cb_return_defer(1);
+
+ defer:
+  cb_arena_pop_mark(scratch);
+  return result;
+}
+
+CB_b32 build_sokol_example(Build_Profile *p, CB_Str program, CB_Write_Buffer *stderr)
+{
+  CB_Arena_Mark scratch = cb_arena_get_scratch(&p->pool->arena, 1);
+  CB_b32 result = 0;
+
+  CB_Write_Buffer *b = cb_mem_buffer(scratch.arena, 1024);
+
+  CB_Str_Mark mark = cb_write_buffer_mark(b);
+  cb_append(b, S("./examples/sokol-examples/"), program, S(".c"));
+  CB_Str source = cb_str_from_mark(&mark);
+
+  cb_append(b, S("./examples/sokol-examples/"), program, S(".glsl"));
+  CB_Str shader = cb_str_from_mark(&mark);
+
+  cb_append(b, p->dir, S("/"), program);
+  CB_Str exe = cb_str_from_mark(&mark);
+
+  cb_append(b, p->dir, S("/"), program, S(".o"));
+  CB_Str obj = cb_str_from_mark(&mark);
+
+  if (!shdc_compile_shader(p->pool, shader, stderr)) { cb_return_defer(0); }
+
+  // For the compile and the link
+  CB_Command flags = cb_da_init(scratch.arena, CB_Command, 16);
+  if (p->optimize) { cb_cmd_append_lit(scratch.arena, &flags, "-O2"); }
+  else             { cmd_debug_flags(scratch.arena, &flags); }
+  cmd_profile_flags(scratch.arena, &flags, p);
+
+  CB_Command cmd = cb_da_init(scratch.arena, CB_Command, 64);
+  cb_cmd_append_lit(scratch.arena, &cmd, CB_TC_CC);
+  cb_cmd_append    (scratch.arena, &cmd, S("-o"), obj, S("-c"), source);
+  cb_cmd_append_strs(scratch.arena, &cmd, flags.items, flags.len);
+  cmd_split_dwarf_flags(scratch.arena, &cmd, p);
+  cmd_sokol_flags(scratch.arena, &cmd);
+  CB_b32 atomic = cmd_atomic_flags(scratch.arena, &cmd, obj);
+
+  CB_Str compile_inputs[] = { source, shader_header(scratch.arena, shader), };
+  CB_Job *job = cb_pool_push(p->pool, cmd, obj, compile_inputs, CB_countof(compile_inputs));
+  job->always = p->force;
+  job->atomic = atomic;
+
+  cmd.len = 0;
+  cb_cmd_append_lit(scratch.arena, &cmd, CB_TC_CC);
+  cb_cmd_append    (scratch.arena, &cmd, S("-o"), exe, obj);
+  cb_cmd_append_strs(scratch.arena, &cmd, flags.items, flags.len);
+  cmd_link_flags(scratch.arena, &cmd, p);
+  cmd_sokol_link_flags(scratch.arena, &cmd, p);
+
+  CB_Str link_inputs[] = { obj, profile_path(scratch.arena, p, S("libsokol.a")), };
+  job = cb_pool_push(p->pool, cmd, exe, link_inputs, CB_countof(link_inputs));
+  job->always = p->force;
+  job->atomic = 1; // a link names nothing else after its output
+  cb_return_defer(1);
+
+ defer:
+  cb_arena_pop_mark(scratch);
+  return result;
+}
+
+CB_b32 build_editor(Build_Profile *p, CB_Write_Buffer *stderr)
+{
+  CB_Arena_Mark scratch = cb_arena_get_scratch(&p->pool->arena, 1);
+  CB_b32 result = 0;
+
+  CB_Str source = S("./examples/editor/editor.c");
+  CB_Str shader = S("./examples/editor/editor.glsl");
+  CB_Str exe = profile_path(scratch.arena, p, S("editor"));
+  CB_Str obj = profile_path(scratch.arena, p, S("editor.o"));
+
+  if (!shdc_compile_shader(p->pool, shader, stderr)) { cb_return_defer(0); }
+
+  // For the compile and the link
+  CB_Command flags = cb_da_init(scratch.arena, CB_Command, 16);
+  if (p->optimize) {
+    cb_cmd_append_lit(scratch.arena, &flags, "-O2");
+  }
+  else {
+#if defined(CB_TC_HAVE_UBSAN)
+    cb_cmd_append_lit(scratch.arena, &flags, "-fsanitize=undefined");
+#endif
+    cmd_debug_flags(scratch.arena, &flags);
+#if defined(EDITOR_OPTIMIZE)
+    cb_cmd_append_lit(scratch.arena, &flags, "-O2");
+#  if defined(CB_TC_HAVE_MARCH_NATIVE)
+    cb_cmd_append_lit(scratch.arena, &flags, "-march=native");
+#  endif
+#endif
+  }
+  cmd_profile_flags(scratch.arena, &flags, p);
+
+  // Compiled apart from the link, so a change to a library only relinks
+  CB_Command cmd = cb_da_init(scratch.arena, CB_Command, 64);
+  cb_cmd_append_lit(scratch.arena, &cmd, CB_TC_CC);
+  cb_cmd_append    (scratch.arena, &cmd, S("-o"), obj, S("-c"), source);
+  cb_cmd_append_lit(scratch.arena, &cmd, "-I./vendor/");
+  cb_cmd_append_lit(scratch.arena, &cmd, "-Wall", "-Wextra");
+  cb_cmd_append_strs(scratch.arena, &cmd, flags.items, flags.len);
+  cmd_split_dwarf_flags(scratch.arena, &cmd, p);
+#if defined(EDITOR_ARENA_TELEMETRY)
+  cb_cmd_append_lit(scratch.arena, &cmd, "-DCB_ARENA_TELEMETRY");
+#endif
+  cmd_sokol_flags(scratch.arena, &cmd);
+  cmd_freetype_flags(scratch.arena, &cmd);
+  CB_b32 atomic = cmd_atomic_flags(scratch.arena, &cmd, obj);
+
+  CB_Str compile_inputs[] = { source, shader_header(scratch.arena, shader), };
+  CB_Job *job = cb_pool_push(p->pool, cmd, obj, compile_inputs, CB_countof(compile_inputs));
+  job->always = p->force;
+  job->atomic = atomic;
+
+  cmd.len = 0;
+  cb_cmd_append_lit(scratch.arena, &cmd, CB_TC_CC);
+  cb_cmd_append    (scratch.arena, &cmd, S("-o"), exe, obj);
+  cb_cmd_append_strs(scratch.arena, &cmd, flags.items, flags.len);
+  cmd_link_flags(scratch.arena, &cmd, p);
+  cmd_sokol_link_flags(scratch.arena, &cmd, p);
+  cmd_freetype_link_flags(scratch.arena, &cmd, p);
+  cb_cmd_append_lit(scratch.arena, &cmd, "-lm");
+
+  CB_Str link_inputs[] = {
+    obj,
+    profile_path(scratch.arena, p, S("libsokol.a")),
+    profile_path(scratch.arena, p, S("libfreetype.a")),
+  };
+  job = cb_pool_push(p->pool, cmd, exe, link_inputs, CB_countof(link_inputs));
+  job->always = p->force;
+  job->atomic = 1; // a link names nothing else after its output
+  cb_return_defer(1);
+
+ defer:
+  cb_arena_pop_mark(scratch);
+  return result;
+}
+
+#define RELEASE_DIR "build/release"
+#define RELEASE_PROFILE_DIR RELEASE_DIR "/profile"
+
+CB_b32 release_stamp(CB_Str stamp, CB_Write_Buffer *stderr)
+{
+  return cb_write_entire_file(stamp, S(""), stderr);
+}
+
+// Release pipeline, whole-stack LTO with profile-guided optimization:
+//   1. build FreeType, sokol and the editor instrumented (-fprofile-generate)
+//   2. run the editor's scripted workload to collect profiles
+//   3. merge the profiles (clang; gcc merges into the .gcda files as it writes them)
+//   4. rebuild everything with -flto -fprofile-use
+// Every stage leaves a stamp in build/release and is skipped while the stamp is
+// newer than the inputs of the stage.
+CB_b32 build_release(CB_Write_Buffer *stderr)
+{
+#if !defined(CB_TC_HAVE_LTO) || !defined(CB_TC_HAVE_PGO)
+  cb_log_emit(stderr, CB_LOG_ERROR, S("Toolchain does not support LTO and PGO, see build/toolchain.h"));
+  return 0;
+#else
+  CB_Arena_Mark scratch = cb_arena_get_scratch(0, 0);
+  CB_b32 result = 0;
+
+  if (!cb_mkdir_if_not_exists(S(RELEASE_DIR), stderr)) { cb_return_defer(0); }
+
+  CB_Str instrument_stamp = S(RELEASE_DIR "/1-instrument.stamp");
+  CB_Str train_stamp      = S(RELEASE_DIR "/2-train.stamp");
+  CB_Str merge_stamp      = S(RELEASE_DIR "/3-merge.stamp");
+  CB_Str optimize_stamp   = S(RELEASE_DIR "/4-optimize.stamp");
+
+  CB_Str_List inputs = list_freetype_sources(scratch.arena);
+  CB_Str other_inputs[] = {
+    S(SOKOL_LIB_ENTRY),
+    S("./examples/editor/editor.c"),
+    S("./examples/editor/editor.glsl"),
+    S("cbuild.c"), // the recipes, the driver binary does not change with them
+    S("cbuild.h"),
+    S("build/config.h"),
+  };
+  for (CB_size i = 0; i < CB_countof(other_inputs); i++) {
+    *(cb_da_push(scratch.arena, &inputs)) = other_inputs[i];
+  }
+
+  { // 1. Instrumented build
+    int status = cb_needs_rebuild(instrument_stamp, inputs.items, inputs.len, stderr);
+    if (status < 0) { cb_return_defer(0); }
+    if (status > 0) {
+      cb_log_emit(stderr, CB_LOG_INFO, S("Release 1/4: instrumented build"));
+      CB_Pool pool = new_pool(scratch.arena, stderr);
+      Build_Profile instrumented = { .dir = S(RELEASE_DIR), .optimize = 1, .force = 1, .pool = &pool, };
+      instrumented.cflags = cb_str_dup_list(scratch.arena, "-fprofile-generate=" RELEASE_PROFILE_DIR);
+      if (!build_freetype_library(&instrumented, stderr)) { cb_return_defer(0); }
+      if (!build_sokol_library(&instrumented, stderr)) { cb_return_defer(0); }
+      if (!build_editor(&instrumented, stderr)) { cb_return_defer(0); }
+      if (!cb_pool_run(&pool, stderr)) { cb_return_defer(0); }
+      if (!release_stamp(instrument_stamp, stderr)) { cb_return_defer(0); }
+    }
+  }
+
+  { // 2. Training run
+    int status = cb_needs_rebuild(train_stamp, &instrument_stamp, 1, stderr);
+    if (status < 0) { cb_return_defer(0); }
+    if (status > 0) {
+      cb_log_emit(stderr, CB_LOG_INFO, S("Release 2/4: training workload"));
+      // Profiles of an older instrumented build do not match, start over
+      CB_Command cmd = cb_da_init(scratch.arena, CB_Command, 16);
+      cb_cmd_append_lit(scratch.arena, &cmd, "rm", "-rf", RELEASE_PROFILE_DIR);
+      if (!cb_cmd_run_sync(cmd, stderr)) { cb_return_defer(0); }
+      if (!cb_mkdir_if_not_exists(S(RELEASE_PROFILE_DIR), stderr)) { cb_return_defer(0); }
+
+      cmd.len = 0;
+#if defined(RELEASE_WORKLOAD_RUNNER)
+      cb_cmd_append_lit(scratch.arena, &cmd, RELEASE_WORKLOAD_RUNNER);
+#endif
+      cb_cmd_append_lit(scratch.arena, &cmd, RELEASE_DIR "/editor", "--workload");
+      if (!cb_cmd_run_sync(cmd, stderr)) { cb_return_defer(0); }
+      if (!release_stamp(train_stamp, stderr)) { cb_return_defer(0); }
+    }
+  }
+
+  { // 3. Merge profiles
+    int status = cb_needs_rebuild(merge_stamp, &train_stamp, 1, stderr);
+    if (status < 0) { cb_return_defer(0); }
+    if (status > 0) {
+      cb_log_emit(stderr, CB_LOG_INFO, S("Release 3/4: merging profiles"));
+#if defined(CB_TC_CLANG) && defined(CB_TC_PROFDATA)
+      CB_Command cmd = cb_da_init(scratch.arena, CB_Command, 16);
+      cb_cmd_append_lit(scratch.arena, &cmd, CB_TC_PROFDATA, "merge");
+      cb_cmd_append_lit(scratch.arena, &cmd, "-o", RELEASE_PROFILE_DIR "/default.profdata");
+      cb_cmd_append_lit(scratch.arena, &cmd, RELEASE_PROFILE_DIR);
+      if (!cb_cmd_run_sync(cmd, stderr)) { cb_return_defer(0); }
+#elif defined(CB_TC_CLANG)
+      cb_log_emit(stderr, CB_LOG_ERROR, S("llvm-profdata not found, can not merge clang profiles"));
+      cb_return_defer(0);
+#endif
+      if (!release_stamp(merge_stamp, stderr)) { cb_return_defer(0); }
+    }
+  }
+
+  { // 4. Optimized build
+    int status = cb_needs_rebuild(optimize_stamp, &merge_stamp, 1, stderr);
+    if (status < 0) { cb_return_defer(0); }
+    if (status > 0) {
+      cb_log_emit(stderr, CB_LOG_INFO, S("Release 4/4: LTO + PGO build"));
+      CB_Pool pool = new_pool(scratch.arena, stderr);
+      Build_Profile optimized = { .dir = S(RELEASE_DIR), .optimize = 1, .lto = 1, .force = 1, .pool = &pool, };
+#if defined(CB_TC_CLANG)
+      optimized.cflags = cb_str_dup_list(scratch.arena, "-flto",
+        "-fprofile-use=" RELEASE_PROFILE_DIR "/default.profdata", "-Wno-profile-instr-unprofiled");
+#else
+      optimized.cflags = cb_str_dup_list(scratch.arena, "-flto=auto",
+        "-fprofile-use=" RELEASE_PROFILE_DIR, "-Wno-missing-profile");
+#endif
+      if (!build_freetype_library(&optimized, stderr)) { cb_return_defer(0); }
+      if (!build_sokol_library(&optimized, stderr)) { cb_return_defer(0); }
+      if (!build_editor(&optimized, stderr)) { cb_return_defer(0); }
+      if (!cb_pool_run(&pool, stderr)) { cb_return_defer(0); }
+      if (!release_stamp(optimize_stamp, stderr)) { cb_return_defer(0); }
+    }
+    else {
+      cb_log_emit(stderr, CB_LOG_INFO, S("Release build is up to date: " RELEASE_DIR "/editor"));
+    }
+  }
+  cb_return_defer(1);
+
+ defer:
+  cb_arena_pop_mark(scratch);
+  return result;
+#endif
+}
+
+// Builds that go to build/<name> next to the default one. Not "release", that
+// directory belongs to the PGO pipeline above.
+typedef struct Build_Variant {
+  char *name;
+  CB_b32 optimize;
+  const char *cflags[2];
+} Build_Variant;
+
+Build_Variant build_variants_table[] = {
+  { .name = "debug", },
+  { .name = "opt",   .optimize = 1, },
+  { .name = "asan",  .cflags = { "-fsanitize=address", "-fno-omit-frame-pointer", }, },
+};
+
+// Builds the named variants, all of them if none, in one pool so their jobs
+// run side by side. Outputs that do not depend on the variant (the shader
+// headers, the FreeType config) are pushed by every variant and made once.
+CB_b32 build_variants(CB_Str_List names, CB_Write_Buffer *stderr)
+{
+  CB_Arena_Mark scratch = cb_arena_get_scratch(0, 0);
+  CB_b32 result = 0;
+
+  for (CB_size i = 0; i < names.len; i++) {
+    CB_b32 known = 0;
+    for (CB_size j = 0; j < CB_countof(build_variants_table); j++) {
+      known |= cb_str_equals(names.items[i], cb_str_from_cstr(build_variants_table[j].name));
+    }
+    if (!known) {
+      cb_log_emit(stderr, CB_LOG_ERROR, S("Unknown variant \""), names.items[i], S("\", expected one of [ debug, opt, asan ]"));
+      cb_return_defer(0);
+    }
   }
 
-  { // Builder program
-    cb_log_emit(stderr, CB_LOG_INFO, S("Starting Build ..."));
+  CB_Pool pool = new_pool(scratch.arena, stderr);
+  for (CB_size i = 0; i < CB_countof(build_variants_table); i++) {
+    Build_Variant *v = &build_variants_table[i];
+    CB_Str name = cb_str_from_cstr(v->name);
+    CB_b32 selected = names.len == 0;
+    for (CB_size j = 0; j < names.len; j++) { selected |= cb_str_equals(names.items[j], name); }
+    if (!selected) { continue; }
+
+    CB_Write_Buffer *dir = cb_mem_buffer(scratch.arena, name.len + 8);
+    cb_append(dir, S("build/"), name);
+    Build_Profile profile = { .dir = { .buf = dir->buf, .len = dir->len, }, .optimize = v->optimize, .pool = &pool, };
+    CB_size cflags_len = 0;
+    while (cflags_len < CB_countof(v->cflags) && v->cflags[cflags_len]) { cflags_len++; }
+    profile.cflags = cb_str_dup_list_(scratch.arena, v->cflags, cflags_len);
 
-    if (!build_freetype_library(stderr)) { cb_exit(1); }
-    if (!build_sokol_library(stderr)) { cb_exit(1); }
+    cb_log_emit(stderr, CB_LOG_INFO, S("Variant "), name, S(" -> "), profile.dir);
+    if (!cb_mkdir_if_not_exists(profile.dir, stderr)) { cb_return_defer(0); }
+    if (!build_freetype_library(&profile, stderr)) { cb_return_defer(0); }
+    if (!build_sokol_library(&profile, stderr)) { cb_return_defer(0); }
 #if defined(BUILD_SOKOL_EXAMPLE)
-    if (!build_sokol_example(S("triangle-sapp"), stderr)) { cb_exit(1); }
+    if (!build_sokol_example(&profile, S("triangle-sapp"), stderr)) { cb_return_defer(0); }
 #endif
 #if defined(BUILD_EDITOR)
-    if (!build_editor(stderr)) { cb_exit(1); }
+    if (!build_editor(&profile, stderr)) { cb_return_defer(0); }
 #endif
-    cb_log_emit(stderr, CB_LOG_INFO, S("Done."));
   }
+  cb_return_defer(cb_pool_run(&pool, stderr));
+
+ defer:
+  cb_arena_pop_mark(scratch);
+  return result;
 }
 
+#define COMPILE_PROFILE_DIR "build/profile-compile"
+#define COMPILE_PROFILE_REPORT "build/compile-profile.txt"
+#define COMPILE_PROFILE_TOP 25
+
+// Time spent in one thing, summed over the translation units.
+typedef struct Compile_Cost {
+  CB_Str name;
+  CB_i64 us;
+  CB_size count;         // times it showed up
+} Compile_Cost;
 
-CB_b32 build_freetype_library(CB_Write_Buffer *stderr)
+typedef struct Compile_Costs {
+  Compile_Cost *items;
+  CB_size capacity;
+  CB_size len;
+} Compile_Costs;
+
+typedef struct Compile_Profile {
+  Compile_Costs units;
+  Compile_Costs headers;
+  Compile_Costs phases;     // gcc time variables, clang "Total" events
+  Compile_Costs expansions; // clang: instantiations, parsed and optimized functions
+} Compile_Profile;
+
+// The entry of name, a copy of name in arena if it is new.
+Compile_Cost *compile_cost(CB_Arena *arena, Compile_Costs *costs, CB_Str name)
 {
-  CB_Arena_Mark scratch = cb_arena_get_scratch(0, 0);
-  CB_b32 result = 0;
+  for (CB_size i = 0; i < costs->len; i++) {
+    if (cb_str_equals(costs->items[i].name, name)) { return costs->items + i; }
+  }
+  Compile_Cost *c = cb_da_push(arena, costs);
+  *c = (Compile_Cost){ .name = { .buf = new(arena, CB_u8, name.len), .len = name.len, }, };
+  memcpy(c->name.buf, name.buf, (size_t)name.len);
+  return c;
+}
 
-  CB_Write_Buffer *b = cb_mem_buffer(scratch.arena, 4 * 1024);
+void compile_cost_add(CB_Arena *arena, Compile_Costs *costs, CB_Str name, CB_i64 us)
+{
+  Compile_Cost *c = compile_cost(arena, costs, name);
+  c->us += us;
+  c->count++;
+}
 
-  CB_Str freetype_out = S("build/libfreetype.a");
-  CB_Str_List freetype_sources = cb_str_dup_list(scratch.arena,
-    FREETYPE_LOC "src/autofit/autofit.c",
-    FREETYPE_LOC "src/base/ftbase.c",
-    FREETYPE_LOC "src/base/ftsystem.c",
-    FREETYPE_LOC "src/base/ftdebug.c",
-    FREETYPE_LOC "src/base/ftbbox.c",
-    FREETYPE_LOC "src/base/ftbdf.c",
-    FREETYPE_LOC "src/base/ftbitmap.c",
-    FREETYPE_LOC "src/base/ftcid.c",
-    FREETYPE_LOC "src/base/ftfstype.c",
-    FREETYPE_LOC "src/base/ftgasp.c",
-    FREETYPE_LOC "src/base/ftglyph.c",
-    FREETYPE_LOC "src/base/ftgxval.c",
-    FREETYPE_LOC "src/base/ftinit.c",
-    FREETYPE_LOC "src/base/ftmm.c",
-    FREETYPE_LOC "src/base/ftotval.c",
-    FREETYPE_LOC "src/base/ftpatent.c",
-    FREETYPE_LOC "src/base/ftpfr.c",
-    FREETYPE_LOC "src/base/ftstroke.c",
-    FREETYPE_LOC "src/base/ftsynth.c",
-    FREETYPE_LOC "src/base/fttype1.c",
-    FREETYPE_LOC "src/base/ftwinfnt.c",
-    FREETYPE_LOC "src/bdf/bdf.c",
-    FREETYPE_LOC "src/bzip2/ftbzip2.c",
-    FREETYPE_LOC "src/cache/ftcache.c",
-    FREETYPE_LOC "src/cff/cff.c",
-    FREETYPE_LOC "src/cid/type1cid.c",
-    FREETYPE_LOC "src/gzip/ftgzip.c",
-    FREETYPE_LOC "src/lzw/ftlzw.c",
-    FREETYPE_LOC "src/pcf/pcf.c",
-    FREETYPE_LOC "src/pfr/pfr.c",
-    FREETYPE_LOC "src/psaux/psaux.c",
-    FREETYPE_LOC "src/pshinter/pshinter.c",
-    FREETYPE_LOC "src/psnames/psnames.c",
-    FREETYPE_LOC "src/raster/raster.c",
-    FREETYPE_LOC "src/sdf/sdf.c",
-    FREETYPE_LOC "src/sfnt/sfnt.c",
-    FREETYPE_LOC "src/smooth/smooth.c",
-    FREETYPE_LOC "src/svg/svg.c",
-    FREETYPE_LOC "src/truetype/truetype.c",
-    FREETYPE_LOC "src/type1/type1.c",
-    FREETYPE_LOC "src/type42/type42.c",
-    FREETYPE_LOC "src/winfonts/winfnt.c");
-
-  CB_Str_List obj_files = cb_da_init(scratch.arena, CB_Str_List, 128);
-  { // freetype/**/*/<base>.c -> build/freetype/<base>.o
-    for (CB_size i = 0; i < freetype_sources.len; i++) {
-      CB_Str base = cb_str_chop_right(freetype_sources.items[i], '.');
-      // TODO: Implement common Str manipulation operations
-      CB_Str left = cb_str_chop_right(base, '/');
-      base.len = base.len - left.len - 1;
-      base.buf = base.buf + left.len + 1;
-      CB_Str_Mark mark = cb_write_buffer_mark(b);
-      cb_append(b, S("build/freetype/"), base, S(".o"));
-      CB_Str obj = cb_str_from_mark(&mark);
-      *(cb_da_push(scratch.arena, &obj_files)) = obj;
+int compile_cost_compare(const void *a, const void *b)
+{
+  CB_i64 x = ((const Compile_Cost *)a)->us, y = ((const Compile_Cost *)b)->us;
+  return (x < y) - (x > y);
+}
+
+// Next line of *rest without the newline, rest moves past it.
+CB_Str next_line(CB_Str *rest)
+{
+  CB_Str line = { .buf = rest->buf, .len = 0, };
+  while (line.len < rest->len && rest->buf[line.len] != '\n') { line.len++; }
+  CB_size skip = line.len < rest->len ? line.len + 1 : line.len;
+  rest->buf += skip;
+  rest->len -= skip;
+  return line;
+}
+
+CB_Str trim_spaces(CB_Str str)
+{
+  while (str.len && str.buf[0] == ' ') { str.buf++; str.len--; }
+  while (str.len && (str.buf[str.len - 1] == ' ' || str.buf[str.len - 1] == '\r')) { str.len--; }
+  return str;
+}
+
+// Microseconds of seconds written like "0.25".
+CB_i64 parse_seconds_us(CB_Str str)
+{
+  CB_size len = 0;
+  CB_i64 us = cb_str_parse_int(str, &len) * 1000000;
+  if (len < str.len && str.buf[len] == '.') {
+    CB_i64 scale = 100000;
+    for (CB_size i = len + 1; i < str.len && str.buf[i] >= '0' && str.buf[i] <= '9' && scale; i++) {
+      us += (str.buf[i] - '0') * scale;
+      scale /= 10;
     }
   }
+  return us;
+}
 
-  int status = cb_needs_rebuild(freetype_out, freetype_sources.items, freetype_sources.len, stderr);
-  if (status <  0) { cb_return_defer(0); }
-  if (status == 0) { cb_return_defer(1); }
-  if (status >  0) {
-    cb_log_emit(stderr, CB_LOG_INFO, S("Building Freetype2 lib ... "));
-    if (!cb_mkdir_if_not_exists(S("build/freetype"), stderr)) cb_return_defer(0);
+// Where the compiler leaves the intermediate file with the extension ext of a
+// compile writing output: `-c -o x.o` makes x<ext>, a compile and link
+// `-o prog a.c` makes prog-a<ext>.
+CB_Str compile_side_file(CB_Arena *arena, CB_Job *job, CB_Str source, CB_Str ext)
+{
+  CB_b32 compile_only = 0;
+  for (CB_size i = 0; i < job->cmd.len; i++) {
+    compile_only |= cb_str_equals(job->cmd.items[i], S("-c"));
+  }
+  CB_Write_Buffer *b = cb_mem_buffer(arena, job->output.len + source.len + ext.len + 1);
+  if (compile_only) {
+    CB_Str base = job->output;
+    base.len -= cb_path_extension(base).len;
+    cb_append(b, base, ext);
+  }
+  else {
+    cb_append(b, job->output, S("-"), cb_path_stem(source), ext);
+  }
+  return (CB_Str){ .buf = b->buf, .len = b->len, };
+}
 
-    CB_Command cmd = cb_da_init(scratch.arena, CB_Command, 128);
-    CB_Procs procs = cb_da_init(scratch.arena, CB_Procs, 128);
+// Adds a gcc -ftime-report. gcc does not time headers, their share of the
+// parsing time is estimated from their share of the preprocessed lines.
+CB_b32 profile_gcc_report(CB_Arena *arena, Compile_Profile *prof, CB_Str source,
+                          CB_Str report, CB_Str preprocessed, CB_Write_Buffer *stderr)
+{
+  CB_Arena_Mark scratch = cb_arena_get_scratch(&arena, 1);
+  CB_b32 result = 0;
 
-    for (CB_size i = 0; i < freetype_sources.len; i++) {
-      cmd.len = 0;
+  CB_Read_Result read = cb_read_entire_file(scratch.arena, report, stderr);
+  if (!read.status) { cb_return_defer(0); }
 
-      cb_cmd_append_lit(scratch.arena, &cmd, "cc");
-      cb_cmd_append    (scratch.arena, &cmd, S("-o"), obj_files.items[i]);
-      cb_cmd_append    (scratch.arena, &cmd, S("-c"), freetype_sources.items[i]);
-      cb_cmd_append_lit(scratch.arena, &cmd, "-I" FREETYPE_LOC "include");
-      cb_cmd_append_lit(scratch.arena, &cmd, "-DFT2_BUILD_LIBRARY");
-      cb_cmd_append_lit(scratch.arena, &cmd, "-DHAVE_UNISTD_H");
+  // " phase parsing   :   0.02 ( 40%)   0.00 (  0%)   0.03 ( 43%)  1234k ( 10%)",
+  // usr, sys, wall and GGC. With -save-temps the preprocessor prints its own
+  // table, every table ends in TOTAL.
+  CB_i64 total = 0, parsing = 0;
+  CB_Str rest = read.file_contents;
+  while (rest.len) {
+    CB_Str line = next_line(&rest);
+    CB_size colon = cb_str_find(line, S(" : "));
+    if (colon < 0 || line.buf[0] != ' ') { continue; }
+    CB_Str name = trim_spaces((CB_Str){ .buf = line.buf, .len = colon, });
+    CB_Str fields = { .buf = line.buf + colon + 3, .len = line.len - colon - 3, };
 
-      *(cb_da_push(scratch.arena, &procs)) = cb_cmd_run_async(cmd, stderr);
+    CB_i64 wall = -1;
+    for (CB_size n = 0; fields.len && wall < 0;) {
+      fields = trim_spaces(fields);
+      CB_Str field = { .buf = fields.buf, .len = 0, };
+      while (field.len < fields.len && fields.buf[field.len] != ' ') { field.len++; }
+      fields.buf += field.len;
+      fields.len -= field.len;
+      if (!field.len || field.buf[0] == '(' || field.buf[field.len - 1] == ')') { continue; }
+      if (++n == 3) { wall = parse_seconds_us(field); }
     }
+    if (wall < 0) { continue; }
 
-    for (CB_size i = 0; i < procs.len; i++) {
-      if (!cb_proc_wait(procs.items[i], stderr)) { continue; }
+    if (cb_str_equals(name, S("TOTAL"))) { total += wall; }
+    else {
+      compile_cost_add(arena, &prof->phases, name, wall);
+      if (cb_str_equals(name, S("phase parsing"))) { parsing += wall; }
     }
+  }
+  compile_cost_add(arena, &prof->units, source, total);
 
-    cmd.len = 0;
-    cb_cmd_append(scratch.arena, &cmd, S("ar"), S("-r"), freetype_out);
-    for (CB_size i = 0; i < obj_files.len; i++) {
-      cb_cmd_append(scratch.arena, &cmd, obj_files.items[i]);
+  read = cb_read_entire_file(scratch.arena, preprocessed, stderr);
+  if (!read.status) { cb_return_defer(0); }
+
+  // Lines per file, following the linemarkers `# <line> "<file>" <flags>`
+  Compile_Costs lines = cb_da_init(scratch.arena, Compile_Costs, 64);
+  Compile_Cost *file = 0;
+  CB_i64 total_lines = 0;
+  rest = read.file_contents;
+  while (rest.len) {
+    CB_Str line = next_line(&rest);
+    if (line.len > 2 && line.buf[0] == '#' && line.buf[1] == ' ' && line.buf[2] >= '0' && line.buf[2] <= '9') {
+      CB_size open = cb_str_find(line, S("\""));
+      CB_Str name = { .buf = line.buf + open + 1, .len = 0, };
+      while (open >= 0 && open + 1 + name.len < line.len && name.buf[name.len] != '"') { name.len++; }
+      file = (open >= 0 && name.len && name.buf[0] != '<') ? compile_cost(scratch.arena, &lines, name) : 0;
+      continue;
     }
-    if (!cb_cmd_run_sync(cmd, stderr)) { cb_return_defer(0); }
-    cb_return_defer(1);
+    if (file && trim_spaces(line).len) {
+      file->us++; // counts lines here
+      total_lines++;
+    }
+  }
+  for (CB_size i = 0; i < lines.len && total_lines; i++) {
+    if (cb_str_equals(lines.items[i].name, source)) { continue; }
+    compile_cost_add(arena, &prof->headers, lines.items[i].name, parsing * lines.items[i].us / total_lines);
   }
+  cb_return_defer(1);
 
-  CB_assert(0 && "unreachable");
  defer:
   cb_arena_pop_mark(scratch);
   return result;
 }
 
-void cmd_freetype_flags(CB_Arena *arena, CB_Command *cmd)
+// The string value after key in a JSON object, escapes left as they are.
+CB_Str json_string_field(CB_Str object, CB_Str key)
 {
-  cb_cmd_append_lit(arena, cmd, "-I./vendor/freetype/include/", "-Lbuild/", "-lfreetype");
+  CB_size at = cb_str_find(object, key);
+  if (at < 0) { return (CB_Str){0}; }
+  CB_Str value = { .buf = object.buf + at + key.len, .len = 0, };
+  CB_size end = object.len - at - key.len;
+  while (value.len < end && value.buf[value.len] != '"') {
+    value.len += (value.buf[value.len] == '\\') ? 2 : 1;
+  }
+  if (value.len > end) { value.len = end; }
+  return value;
 }
 
-CB_b32 build_sokol_library(CB_Write_Buffer *stderr)
+// Adds a clang -ftime-trace, a Chrome trace of events like
+//   {"pid":1,"tid":2,"ph":"X","ts":0,"dur":150,"name":"Source","args":{"detail":"a.h"}}
+// with durations in microseconds. Source events nest, so header costs include
+// the headers they include.
+CB_b32 profile_clang_trace(CB_Arena *arena, Compile_Profile *prof, CB_Str source,
+                           CB_Str trace, CB_Write_Buffer *stderr)
 {
-  CB_Arena_Mark scratch = cb_arena_get_scratch(0, 0);
+  CB_Arena_Mark scratch = cb_arena_get_scratch(&arena, 1);
   CB_b32 result = 0;
 
-  CB_Str sokol_out = S("build/libsokol.a");
-  CB_Str sokol_sources[] = {
-    S(SOKOL_LIB_ENTRY),
-    S(SOKOL_LOC "sokol_app.h"),
-    S(SOKOL_LOC "sokol_gfx.h"),
-    S(SOKOL_LOC "sokol_time.h"),
-    S(SOKOL_LOC "sokol_fetch.h"),
-    S(SOKOL_LOC "sokol_log.h"),
-    S(SOKOL_LOC "sokol_glue.h"),
-  };
-  int status = cb_needs_rebuild(sokol_out, sokol_sources, CB_countof(sokol_sources), stderr);
-  if (status <  0) { cb_return_defer(0); }
-  if (status == 0) { cb_return_defer(1); }
-  if (status >  0) {
-    cb_log_emit(stderr, CB_LOG_INFO, S("Building Sokol Library ..."));
-    CB_Command cmd = cb_da_init(scratch.arena, CB_Command, 64);
-    cb_cmd_append_lit(scratch.arena, &cmd, "cc");
-    cb_cmd_append    (scratch.arena, &cmd, S("-o"), sokol_out);
-    cb_cmd_append    (scratch.arena, &cmd, S("-c"), S(SOKOL_LIB_ENTRY));
-    cb_cmd_append_lit(scratch.arena, &cmd, "-I" SOKOL_LOC);
-    cb_cmd_append_lit(scratch.arena, &cmd, "-DSOKOL_GLCORE33");
-#if defined(SOKOL_DEBUG)
-    cb_cmd_append_lit(scratch.arena, &cmd, "-g");
-#else
-    cb_cmd_append_lit(scratch.arena, &cmd, "-O2");
-#endif
+  CB_Read_Result read = cb_read_entire_file(scratch.arena, trace, stderr);
+  if (!read.status) { cb_return_defer(0); }
+
+  CB_Str event_start = S("{\"pid\":");
+  CB_Str rest = read.file_contents;
+  for (CB_size at; (at = cb_str_find(rest, event_start)) >= 0;) {
+    rest.buf += at + event_start.len;
+    rest.len -= at + event_start.len;
+    CB_size end = cb_str_find(rest, event_start);
+    CB_Str event = { .buf = rest.buf, .len = end >= 0 ? end : rest.len, };
+
+    CB_Str name = json_string_field(event, S("\"name\":\""));
+    CB_Str detail = json_string_field(event, S("\"detail\":\""));
+    CB_size dur_at = cb_str_find(event, S("\"dur\":"));
+    if (!name.len || dur_at < 0) { continue; }
+    CB_Str dur_str = { .buf = event.buf + dur_at + 6, .len = event.len - dur_at - 6, };
+    CB_i64 dur = cb_str_parse_int(dur_str, 0);
 
-    if (!cb_cmd_run_sync(cmd, stderr)) { cb_return_defer(0); }
-    cb_return_defer(1);
+    if (cb_str_equals(name, S("ExecuteCompiler"))) {
+      compile_cost_add(arena, &prof->units, source, dur);
+    }
+    else if (cb_str_equals(name, S("Source"))) {
+      compile_cost_add(arena, &prof->headers, detail, dur);
+    }
+    else if (cb_str_starts_with(name, S("Total "))) {
+      compile_cost_add(arena, &prof->phases, (CB_Str){ .buf = name.buf + 6, .len = name.len - 6, }, dur);
+    }
+    else if (detail.len) {
+      CB_Write_Buffer *b = cb_mem_buffer(scratch.arena, name.len + detail.len + 1);
+      cb_append(b, name, S(" "), detail);
+      compile_cost_add(arena, &prof->expansions, (CB_Str){ .buf = b->buf, .len = b->len, }, dur);
+    }
   }
+  cb_return_defer(1);
 
-  CB_assert(0 && "unreachable");
  defer:
   cb_arena_pop_mark(scratch);
   return result;
 }
 
-void cmd_sokol_flags(CB_Arena *arena, CB_Command *cmd)
+void append_ms(CB_Write_Buffer *b, CB_i64 us)
 {
-  cb_cmd_append_lit(arena, cmd, "-I./vendor/sokol/", "-Lbuild/", "-lsokol");
-  cb_cmd_append_lit(arena, cmd, "-DSOKOL_GLCORE33");
-  cb_cmd_append_lit(arena, cmd, "-pthread");
-  cb_cmd_append_lit(arena, cmd, "-lGL");
-  cb_cmd_append_lit(arena, cmd, "-lX11", "-lXi", "-lXcursor");
+  CB_i64 ms = us / 1000;
+  for (CB_i64 width = 1, x = ms; width < 7; width++, x /= 10) {
+    if (x < 10) { cb_append(b, S(" ")); }
+  }
+  cb_append_long(b, (long)ms);
+  cb_append(b, S("."));
+  cb_append_long(b, (long)(us / 100 % 10));
+  cb_append(b, S(" ms"));
+}
+
+void append_compile_costs(CB_Write_Buffer *b, CB_Str title, Compile_Costs costs)
+{
+  qsort(costs.items, (size_t)costs.len, sizeof(costs.items[0]), compile_cost_compare);
+  cb_append(b, S("\n"), title, S(", "));
+  cb_append_long(b, (long)costs.len);
+  cb_append(b, S(" total:\n"));
+  for (CB_size i = 0; i < costs.len && i < COMPILE_PROFILE_TOP; i++) {
+    append_ms(b, costs.items[i].us);
+    cb_append(b, S("  "));
+    cb_append_long(b, (long)costs.items[i].count);
+    cb_append(b, S("x  "), costs.items[i].name, S("\n"));
+  }
 }
 
-CB_b32 shdc_compile_shader(CB_Str shader, CB_Write_Buffer *stderr)
+// Rebuilds everything with the compiler's timing report on and writes the most
+// expensive translation units, headers and compiler phases to
+// build/compile-profile.txt. Outputs go to build/profile-compile so the
+// regular build stays untouched. With gcc the compilers' stderr goes to a
+// <output>.time-report next to each output, warnings included.
+CB_b32 profile_compile(CB_Write_Buffer *stderr)
 {
   CB_Arena_Mark scratch = cb_arena_get_scratch(0, 0);
-  CB_b32 result = 0;
+  CB_b32 result = 1;
 
-  CB_Write_Buffer *b = cb_mem_buffer(scratch.arena, 1024);
-  CB_Str_Mark mark = cb_write_buffer_mark(b);
-  cb_append(b, shader, S(".h"));
-  CB_Str shader_h = cb_str_from_mark(&mark);
+  if (!cb_mkdir_if_not_exists(S(COMPILE_PROFILE_DIR), stderr)) { cb_return_defer(0); }
 
-  int status = cb_needs_rebuild(shader_h, &shader, 1, stderr);
-  if (status <  0) { cb_return_defer(0); }
-  if (status == 0) { cb_return_defer(1); }
-  if (status >  0) {
-    CB_Command cmd = cb_da_init(scratch.arena, CB_Command, 64);
-#if defined(SOKOL_SHDC_PATH)
-    CB_Str shdc_program = S(SOKOL_SHDC_PATH);
+  CB_Pool pool = new_pool(scratch.arena, stderr);
+  Build_Profile profile = { .dir = S(COMPILE_PROFILE_DIR), .force = 1, .pool = &pool, };
+#if defined(CB_TC_HAVE_TIME_TRACE)
+  CB_b32 trace = 1;
+  profile.cflags = cb_str_dup_list(scratch.arena, "-ftime-trace");
 #else
-    CB_Str shdc_program = S("sokol-shdc");
+  CB_b32 trace = 0;
+  profile.cflags = cb_str_dup_list(scratch.arena, "-ftime-report", "-save-temps=obj");
 #endif
-    cb_cmd_append(scratch.arena, &cmd, shdc_program);
-    cb_cmd_append(scratch.arena, &cmd, S("-l"), S("glsl330"));
-    cb_cmd_append(scratch.arena, &cmd, S("-i"), shader);
-    cb_cmd_append(scratch.arena, &cmd, S("-o"), shader_h);
-    if (!cb_cmd_run_sync(cmd, stderr)) {
-#if !defined(SOKOL_SHDC_PATH)
-      cb_log_emit(stderr, CB_LOG_WARNING,
-                  S("Is \"sokol-shdc\" in PATH? Configure in ./build/config.h"));
+  if (!build_freetype_library(&profile, stderr)) { cb_return_defer(0); }
+  if (!build_sokol_library(&profile, stderr)) { cb_return_defer(0); }
+#if defined(BUILD_EDITOR)
+  if (!build_editor(&profile, stderr)) { cb_return_defer(0); }
 #endif
-      cb_return_defer(0);
+
+  // Every compiler job and where its timings end up, the pool clears its jobs
+  CB_Str_List sources = cb_da_init(scratch.arena, CB_Str_List, 64);
+  CB_Str_List reports = cb_da_init(scratch.arena, CB_Str_List, 64);
+  CB_Str_List preprocessed = cb_da_init(scratch.arena, CB_Str_List, 64);
+  for (CB_size i = 0; i < pool.jobs.len; i++) {
+    CB_Job *job = cb_seg_at(&pool.jobs, i);
+    if (!job->cmd.len || !cb_str_equals(job->cmd.items[0], S(CB_TC_CC))) { continue; }
+    CB_Str source = {0};
+    for (CB_size j = 1; j < job->cmd.len && !source.len; j++) {
+      CB_Str arg = job->cmd.items[j];
+      if (arg.len > 2 && arg.buf[arg.len - 2] == '.' && arg.buf[arg.len - 1] == 'c') { source = arg; }
+    }
+    if (!source.len) { continue; }
+
+    *(cb_da_push(scratch.arena, &sources)) = source;
+    if (trace) {
+      *(cb_da_push(scratch.arena, &reports)) = compile_side_file(scratch.arena, job, source, S(".json"));
+    }
+    else {
+      CB_Write_Buffer *b = cb_mem_buffer(scratch.arena, job->output.len + 16);
+      cb_append(b, job->output, S(".time-report"));
+      job->stderr_path = (CB_Str){ .buf = b->buf, .len = b->len, };
+      *(cb_da_push(scratch.arena, &reports)) = job->stderr_path;
+      *(cb_da_push(scratch.arena, &preprocessed)) = compile_side_file(scratch.arena, job, source, S(".i"));
     }
-    cb_return_defer(1);
   }
+  // Stops at the first failure, the units that did compile are still reported
+  result = cb_pool_run(&pool, stderr);
+
+  Compile_Profile prof = {
+    .units      = cb_da_init(scratch.arena, Compile_Costs, 64),
+    .headers    = cb_da_init(scratch.arena, Compile_Costs, 256),
+    .phases     = cb_da_init(scratch.arena, Compile_Costs, 64),
+    .expansions = cb_da_init(scratch.arena, Compile_Costs, 256),
+  };
+  CB_size profiled = 0;
+  for (CB_size i = 0; i < sources.len; i++) {
+    struct stat st = {0};
+    if (stat(cb_str_to_cstr(scratch.arena, reports.items[i]), &st) != 0 || st.st_size == 0) { continue; }
+    CB_b32 ok = trace
+      ? profile_clang_trace(scratch.arena, &prof, sources.items[i], reports.items[i], stderr)
+      : profile_gcc_report(scratch.arena, &prof, sources.items[i], reports.items[i], preprocessed.items[i], stderr);
+    if (!ok) { cb_return_defer(0); }
+    profiled++;
+  }
+
+  // Streamed to the file, the tables grow with the build
+  CB_Str tmp_path = S(COMPILE_PROFILE_REPORT ".tmp");
+  CB_i32 fd = cb_open(tmp_path, stderr);
+  if (fd < 0) { cb_return_defer(0); }
+  CB_Write_Buffer *b = cb_fd_buffer(fd, scratch.arena, 16 * 1024);
+  cb_append(b, S("Compile profile of "));
+  cb_append_long(b, (long)profiled);
+  cb_append(b, trace ? S(" translation units, " CB_TC_CC " -ftime-trace\n")
+                     : S(" translation units, " CB_TC_CC " -ftime-report\n"
+                         "Header costs are estimated: parsing time split by share of preprocessed lines\n"));
+  append_compile_costs(b, S("Translation units"), prof.units);
+  append_compile_costs(b, trace ? S("Headers, including their includes") : S("Headers"), prof.headers);
+  append_compile_costs(b, S("Compiler phases"), prof.phases);
+  if (trace) { append_compile_costs(b, S("Instantiations, parsed and optimized functions"), prof.expansions); }
+  cb_flush(b);
+  if (b->error) {
+    cb_log_emit(stderr, CB_LOG_ERROR, S("Could not write file "), tmp_path, S(": "), cb_str_from_cstr(strerror(errno)));
+  }
+  if (!cb_close(fd, stderr) || b->error) { cb_return_defer(0); }
+  if (!cb_rename(tmp_path, S(COMPILE_PROFILE_REPORT), stderr)) { cb_return_defer(0); }
+  cb_log_emit(stderr, CB_LOG_INFO, S("Wrote " COMPILE_PROFILE_REPORT));
 
-  CB_assert(0 && "unreachable");
  defer:
   cb_arena_pop_mark(scratch);
   return result;
 }
 
-CB_b32 build_sokol_example(CB_Str program, CB_Write_Buffer *stderr)
+#define BENCH_DIR "build/bench"
+#define BENCH_CSV "build/bench-build.csv"
+#define BENCH_LINE_MAX 256 // bytes of a generated source line, or a CSV line but its label and compiler
+#define BENCH_ARENA_CAPACITY (1024ll * 1024 * 1024) // malloc'ed, only touched as used
+
+// Shape of the synthetic projects of bench-build.
+typedef struct Bench_Options {
+  CB_Str_List tus;          // project sizes to measure, in translation units
+  CB_size tus_per_lib;
+  CB_size headers_per_lib;
+  CB_size fan_in;           // headers every TU includes, half of them from the lib it depends on
+  CB_b32 deep;              // lib i depends on lib i-1 instead of every lib on lib 0
+  CB_b32 stub;              // `cp` instead of the compiler and no link, times cbuild alone
+  CB_Str label;             // first column of the CSV, to compare runs
+} Bench_Options;
+
+// A generated project of one size.
+typedef struct Bench_Project {
+  CB_Str dir;
+  CB_size tus;
+  CB_size libs;
+} Bench_Project;
+
+CB_Str bench_path(CB_Arena *arena, Bench_Project *proj, char *kind, CB_size lib, char *name, CB_size index, char *ext)
+{
+  CB_Write_Buffer *b = cb_mem_buffer(arena, proj->dir.len + 64);
+  cb_append(b, proj->dir, S("/"), cb_str_from_cstr(kind), S("/lib"));
+  cb_append_long(b, (long)lib);
+  if (name) {
+    cb_append(b, S("/"), cb_str_from_cstr(name));
+    cb_append_long(b, (long)index);
+  }
+  cb_append(b, cb_str_from_cstr(ext));
+  return (CB_Str){ .buf = b->buf, .len = b->len, };
+}
+
+CB_size bench_dep(Bench_Options *o, CB_size lib)
+{
+  return o->deep ? lib - 1 : 0;
+}
+
+// Writes the sources of proj, only the files that changed so the mtimes of a
+// project generated before stay.
+CB_b32 bench_generate(Bench_Options *o, Bench_Project *proj, CB_Write_Buffer *stderr)
 {
   CB_Arena_Mark scratch = cb_arena_get_scratch(0, 0);
   CB_b32 result = 0;
+  // Fits the largest file: a TU has two lines per include and main two per
+  // lib, no line is longer than BENCH_LINE_MAX.
+  CB_Write_Buffer *b = cb_mem_buffer(scratch.arena, (4 + 2 * CB_max(o->fan_in, proj->libs)) * BENCH_LINE_MAX);
 
-  CB_Write_Buffer *b = cb_mem_buffer(scratch.arena, 1024);
+  if (!cb_mkdir_if_not_exists(proj->dir, stderr)) { cb_return_defer(0); }
+  char *subdirs[] = { "src", "obj", "lib", };
+  for (CB_size i = 0; i < CB_countof(subdirs); i++) {
+    CB_Write_Buffer *dir = cb_mem_buffer(scratch.arena, proj->dir.len + 8);
+    cb_append(dir, proj->dir, S("/"), cb_str_from_cstr(subdirs[i]));
+    if (!cb_mkdir_if_not_exists((CB_Str){ .buf = dir->buf, .len = dir->len, }, stderr)) { cb_return_defer(0); }
+  }
 
-  CB_Str_Mark mark = cb_write_buffer_mark(b);
-  cb_append(b, S("./examples/sokol-examples/"), program, S(".c"));
-  CB_Str source = cb_str_from_mark(&mark);
+  for (CB_size lib = 0; lib < proj->libs; lib++) {
+    CB_Arena_Mark lib_scratch = cb_arena_get_scratch(&scratch.arena, 1);
+    if (!cb_mkdir_if_not_exists(bench_path(lib_scratch.arena, proj, "src", lib, 0, 0, ""), stderr)) { cb_return_defer(0); }
+    if (!cb_mkdir_if_not_exists(bench_path(lib_scratch.arena, proj, "obj", lib, 0, 0, ""), stderr)) { cb_return_defer(0); }
 
-  cb_append(b, S("./examples/sokol-examples/"), program, S(".glsl"));
-  CB_Str shader = cb_str_from_mark(&mark);
+    for (CB_size h = 0; h < o->headers_per_lib; h++) {
+      b->len = 0;
+      cb_append(b, S("#pragma once\nstatic inline int lib"));
+      cb_append_long(b, (long)lib);
+      cb_append(b, S("_h"));
+      cb_append_long(b, (long)h);
+      cb_append(b, S("(int x) { return x * "));
+      cb_append_long(b, (long)(lib + 2));
+      cb_append(b, S(" + "));
+      cb_append_long(b, (long)h);
+      cb_append(b, S("; }\n"));
+      CB_Str path = bench_path(lib_scratch.arena, proj, "src", lib, "h", h, ".h");
+      if (cb_write_file_if_changed(path, (CB_Str){ .buf = b->buf, .len = b->len, }, stderr) < 0) { cb_return_defer(0); }
+    }
 
-  cb_append(b, S("build/"), program);
-  CB_Str exe = cb_str_from_mark(&mark);
+    CB_size tus = CB_min(o->tus_per_lib, proj->tus - lib * o->tus_per_lib);
+    for (CB_size tu = 0; tu < tus; tu++) {
+      b->len = 0;
+      for (CB_size n = 0; n < o->fan_in; n++) {
+        CB_size from = (n % 2 && lib > 0) ? bench_dep(o, lib) : lib;
+        cb_append(b, S("#include \"../lib"));
+        cb_append_long(b, (long)from);
+        cb_append(b, S("/h"));
+        cb_append_long(b, (long)((tu + n) % o->headers_per_lib));
+        cb_append(b, S(".h\"\n"));
+      }
+      cb_append(b, S("int lib"));
+      cb_append_long(b, (long)lib);
+      cb_append(b, S("_tu"));
+      cb_append_long(b, (long)tu);
+      cb_append(b, S("(int x) { return x"));
+      for (CB_size n = 0; n < o->fan_in; n++) {
+        CB_size from = (n % 2 && lib > 0) ? bench_dep(o, lib) : lib;
+        cb_append(b, S(" + lib"));
+        cb_append_long(b, (long)from);
+        cb_append(b, S("_h"));
+        cb_append_long(b, (long)((tu + n) % o->headers_per_lib));
+        cb_append(b, S("(x)"));
+      }
+      cb_append(b, S("; }\n"));
+      CB_Str path = bench_path(lib_scratch.arena, proj, "src", lib, "tu", tu, ".c");
+      if (cb_write_file_if_changed(path, (CB_Str){ .buf = b->buf, .len = b->len, }, stderr) < 0) { cb_return_defer(0); }
+    }
+    cb_arena_pop_mark(lib_scratch);
+  }
+
+  // main calls the first function of every lib
+  b->len = 0;
+  for (CB_size lib = 0; lib < proj->libs; lib++) {
+    cb_append(b, S("int lib"));
+    cb_append_long(b, (long)lib);
+    cb_append(b, S("_tu0(int x);\n"));
+  }
+  cb_append(b, S("int main(void)\n{\n  int x = 0;\n"));
+  for (CB_size lib = 0; lib < proj->libs; lib++) {
+    cb_append(b, S("  x += lib"));
+    cb_append_long(b, (long)lib);
+    cb_append(b, S("_tu0(x);\n"));
+  }
+  cb_append(b, S("  return x & 1;\n}\n"));
+  CB_Write_Buffer *main_path = cb_mem_buffer(scratch.arena, proj->dir.len + 16);
+  cb_append(main_path, proj->dir, S("/src/main.c"));
+  if (cb_write_file_if_changed((CB_Str){ .buf = main_path->buf, .len = main_path->len, },
+                               (CB_Str){ .buf = b->buf, .len = b->len, }, stderr) < 0) {
+    cb_return_defer(0);
+  }
+  cb_return_defer(1);
 
-  if (!shdc_compile_shader(shader, stderr)) { cb_return_defer(0); }
+ defer:
+  cb_arena_pop_mark(scratch);
+  return result;
+}
+
+// One build of proj the way a cbuild run does it: scan the includes, push
+// the jobs and run the pool. Every TU of lib i waits for the archive of the
+// lib it depends on, like for a generated header.
+CB_b32 bench_run_build(Bench_Options *o, Bench_Project *proj, CB_Write_Buffer *stderr)
+{
+  CB_Arena *arena = cb_alloc_arena(BENCH_ARENA_CAPACITY);
+  CB_b32 result = 0;
+
+  CB_Write_Buffer *b = cb_mem_buffer(arena, proj->dir.len + 32);
+  cb_append(b, proj->dir, S("/.cbuild_log"));
+  CB_Pool pool = cb_pool_init(arena, (CB_Str){ .buf = b->buf, .len = b->len, }, stderr);
+#if defined(POOL_JOBS)
+  pool.max_jobs = POOL_JOBS;
+#endif
+
+  CB_Command flags = cb_da_init(arena, CB_Command, 4);
+  CB_Include_Scanner scanner = cb_include_scanner_init(arena, flags);
+  CB_Command cmd = cb_da_init(arena, CB_Command, 16);
+  CB_Str_List archives = cb_da_init(arena, CB_Str_List, proj->libs);
+  for (CB_size lib = 0; lib < proj->libs; lib++) {
+    CB_Str archive = bench_path(arena, proj, "lib", lib, 0, 0, ".a");
+    *(cb_da_push(arena, &archives)) = archive;
+    CB_size tus = CB_min(o->tus_per_lib, proj->tus - lib * o->tus_per_lib);
+    CB_Str_List objs = cb_da_init(arena, CB_Str_List, tus);
+    for (CB_size tu = 0; tu < tus; tu++) {
+      CB_Str source = bench_path(arena, proj, "src", lib, "tu", tu, ".c");
+      CB_Str obj = bench_path(arena, proj, "obj", lib, "tu", tu, ".o");
+      *(cb_da_push(arena, &objs)) = obj;
+
+      cmd.len = 0;
+      if (o->stub) { cb_cmd_append(arena, &cmd, S("cp"), source, obj); }
+      else         { cb_cmd_append(arena, &cmd, S(CB_TC_CC), S("-c"), S("-o"), obj, source); }
+
+      CB_Str_List inputs = cb_da_init(arena, CB_Str_List, 16);
+      *(cb_da_push(arena, &inputs)) = source;
+      if (lib > 0) { *(cb_da_push(arena, &inputs)) = archives.items[bench_dep(o, lib)]; }
+      if (!cb_scan_includes(&scanner, source, &inputs, stderr)) { cb_return_defer(0); }
+      cb_pool_push(&pool, cmd, obj, inputs.items, inputs.len);
+    }
+
+    Archive_Job *a = new(arena, Archive_Job, 1);
+    a->path = archive;
+    a->members = objs;
+    CB_Job *job = cb_pool_push_fn(&pool, archive_job, a, archive, objs.items, objs.len);
+    job->restat = 1; // unchanged objects leave the archive untouched
+  }
 
-  CB_Str sapp_sources[] = { source, shader };
-  int status = cb_needs_rebuild(exe, sapp_sources, CB_countof(sapp_sources), stderr);
-  if (status <  0) { cb_return_defer(0); }
-  if (status == 0) { cb_return_defer(1); }
-  if (status >  0) {
-    cb_log_emit(stderr, CB_LOG_INFO, S("Building Sokol example: "), program);
+  if (!o->stub) {
+    CB_Write_Buffer *paths = cb_mem_buffer(arena, 2 * proj->dir.len + 32);
+    CB_Str_Mark mark = cb_write_buffer_mark(paths);
+    cb_append(paths, proj->dir, S("/src/main.c"));
+    CB_Str main_source = cb_str_from_mark(&mark);
+    cb_append(paths, proj->dir, S("/bench"));
+    CB_Str exe = cb_str_from_mark(&mark);
 
-    CB_Command cmd = cb_da_init(scratch.arena, CB_Command, 64);
-    cb_cmd_append_lit(scratch.arena, &cmd, "cc");
-    cb_cmd_append    (scratch.arena, &cmd, S("-o"), exe);
-    cb_cmd_append    (scratch.arena, &cmd, source);
-    cb_cmd_append_lit(scratch.arena, &cmd, "-g");
-    cmd_sokol_flags(scratch.arena, &cmd);
-    if (!cb_cmd_run_sync(cmd, stderr)) { cb_return_defer(0); }
-    cb_return_defer(1);
+    cmd.len = 0;
+    cb_cmd_append(arena, &cmd, S(CB_TC_CC), S("-o"), exe, main_source);
+    cb_cmd_append_strs(arena, &cmd, archives.items, archives.len);
+    *(cb_da_push(arena, &archives)) = main_source;
+    cb_pool_push(&pool, cmd, exe, archives.items, archives.len);
   }
 
-  CB_assert(0 && "unreachable");
+  result = cb_pool_run(&pool, stderr);
+
  defer:
-  cb_arena_pop_mark(scratch);
+  cb_free_arena(arena);
   return result;
 }
 
-CB_b32 build_editor(CB_Write_Buffer *stderr)
+CB_i64 bench_now_ns(void)
 {
-  CB_Arena_Mark scratch = cb_arena_get_scratch(0, 0);
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (CB_i64)ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+// CPU time of cbuild itself, without the commands it ran.
+CB_i64 bench_self_cpu_ns(void)
+{
+  struct rusage usage = {0};
+  getrusage(RUSAGE_SELF, &usage);
+  return ((CB_i64)usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000ll +
+         ((CB_i64)usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000ll;
+}
+
+// "--name=value" of arg, empty if arg is not that option.
+CB_Str bench_option(CB_Str arg, CB_Str name)
+{
+  if (!cb_str_starts_with(arg, name) || arg.len <= name.len || arg.buf[name.len] != '=') { return (CB_Str){0}; }
+  return (CB_Str){ .buf = arg.buf + name.len + 1, .len = arg.len - name.len - 1, };
+}
+
+CB_size bench_option_int(CB_Str value, CB_size fallback, CB_Write_Buffer *stderr)
+{
+  CB_size len = 0;
+  CB_i64 n = cb_str_parse_int(value, &len);
+  if (len != value.len || n <= 0) {
+    cb_log_emit(stderr, CB_LOG_ERROR, S("Expected a positive number instead of \""), value, S("\""));
+    return fallback;
+  }
+  return n;
+}
+
+// Generates synthetic projects of every size in --tus and times a clean
+// build, a build after touching one TU and a null build of each, appended to
+// build/bench-build.csv. Usage:
+//   ./cbuild bench-build [--tus=100,1000,10000,50000] [--tus-per-lib=100]
+//                        [--headers-per-lib=16] [--fan-in=8] [--graph=wide|deep]
+//                        [--stub] [--label=<name>]
+// The label defaults to the git commit, so runs before and after a change to
+// the pool can be told apart.
+CB_b32 bench_build(CB_Arena *perm, CB_Str_List args, CB_Write_Buffer *stderr)
+{
+  CB_Arena_Mark scratch = cb_arena_get_scratch(&perm, 1);
   CB_b32 result = 0;
-  CB_Write_Buffer *b = cb_mem_buffer(scratch.arena, 1024);
 
-  CB_Str program_name = S("editor");
-  CB_Str source = S("./examples/editor/editor.c");
-  CB_Str shader = S("./examples/editor/editor.glsl");
+  Bench_Options o = {
+    .tus = cb_str_dup_list(scratch.arena, "100", "1000", "10000", "50000"),
+    .tus_per_lib = 100,
+    .headers_per_lib = 16,
+    .fan_in = 8,
+  };
+  for (CB_size i = 0; i < args.len; i++) {
+    CB_Str arg = args.items[i], value = {0};
+    if ((value = bench_option(arg, S("--tus"))).len) {
+      o.tus.len = 0;
+      while (value.len) {
+        CB_Str item = value;
+        for (item.len = 0; item.len < value.len && value.buf[item.len] != ','; item.len++) {}
+        *(cb_da_push(scratch.arena, &o.tus)) = item;
+        value.buf += CB_min(item.len + 1, value.len);
+        value.len -= CB_min(item.len + 1, value.len);
+      }
+    }
+    else if ((value = bench_option(arg, S("--tus-per-lib"))).len) {
+      o.tus_per_lib = bench_option_int(value, o.tus_per_lib, stderr);
+    }
+    else if ((value = bench_option(arg, S("--headers-per-lib"))).len) {
+      o.headers_per_lib = bench_option_int(value, o.headers_per_lib, stderr);
+    }
+    else if ((value = bench_option(arg, S("--fan-in"))).len) {
+      o.fan_in = bench_option_int(value, o.fan_in, stderr);
+    }
+    else if ((value = bench_option(arg, S("--graph"))).len) {
+      o.deep = cb_str_equals(value, S("deep"));
+      if (!o.deep && !cb_str_equals(value, S("wide"))) {
+        cb_log_emit(stderr, CB_LOG_ERROR, S("Expected --graph=wide or --graph=deep"));
+        cb_return_defer(0);
+      }
+    }
+    else if ((value = bench_option(arg, S("--label"))).len) { o.label = value; }
+    else if (cb_str_equals(arg, S("--stub"))) { o.stub = 1; }
+    else {
+      cb_log_emit(stderr, CB_LOG_ERROR, S("Unknown bench-build option \""), arg, S("\""));
+      cb_return_defer(0);
+    }
+  }
+  if (!o.label.len && cb_file_exists(S(".git"), stderr) == 1) {
+    CB_Command git = cb_da_init(scratch.arena, CB_Command, 4);
+    cb_cmd_append_lit(scratch.arena, &git, "git", "rev-parse", "--short", "HEAD");
+    CB_Read_Result head = cb_cmd_capture(scratch.arena, git, stderr);
+    if (head.status) { o.label = head.file_contents; }
+    while (o.label.len && (o.label.buf[o.label.len - 1] == '\n')) { o.label.len--; }
+  }
+  if (!o.label.len) { o.label = S("unlabeled"); }
 
-  CB_Str_Mark mark = cb_write_buffer_mark(b);
-  cb_append(b, S("./build/"), program_name);
-  CB_Str exe = cb_str_from_mark(&mark);
+  if (!cb_mkdir_if_not_exists(S(BENCH_DIR), stderr)) { cb_return_defer(0); }
+  char *scenarios[] = { "clean", "touch-one", "null", };
+  CB_Write_Buffer *csv = 0;
+  {
+    CB_b32 exists = cb_file_exists(S(BENCH_CSV), stderr);
+    if (exists < 0) { cb_return_defer(0); }
+    CB_Read_Result old = exists ? cb_read_entire_file(scratch.arena, S(BENCH_CSV), stderr) : (CB_Read_Result){0};
+    // The rows before and one per size and scenario, the label and compiler are the long fields
+    CB_size rows = CB_countof(scenarios) * o.tus.len;
+    CB_size row_max = o.label.len + CB_sizeof(CB_TC_CC) + BENCH_LINE_MAX;
+    csv = cb_mem_buffer(scratch.arena, old.file_contents.len + BENCH_LINE_MAX + rows * row_max);
+    if (old.status) { cb_append(csv, old.file_contents); }
+    else { cb_append(csv, S("label,graph,compiler,tus,libs,fan_in,scenario,wall_ms,cbuild_cpu_ms\n")); }
+  }
 
-  if (!shdc_compile_shader(shader, stderr)) { cb_return_defer(0); }
+  for (CB_size i = 0; i < o.tus.len; i++) {
+    Bench_Project proj = { .tus = bench_option_int(o.tus.items[i], 0, stderr), };
+    if (proj.tus == 0) { cb_return_defer(0); }
+    proj.libs = (proj.tus + o.tus_per_lib - 1) / o.tus_per_lib;
+    CB_Write_Buffer *dir = cb_mem_buffer(scratch.arena, 64);
+    cb_append(dir, S(BENCH_DIR "/"), o.deep ? S("deep-") : S("wide-"), o.tus.items[i]);
+    proj.dir = (CB_Str){ .buf = dir->buf, .len = dir->len, };
 
-  CB_Str sapp_sources[] = { source, shader };
-  int status = cb_needs_rebuild(exe, sapp_sources, CB_countof(sapp_sources), stderr);
-  if (status <  0) { cb_return_defer(0); }
-  if (status == 0) { cb_return_defer(1); }
-  if (status >  0) {
-    cb_log_emit(stderr, CB_LOG_INFO, S("Building Editor.c: "));
+    cb_log_emit(stderr, CB_LOG_INFO, S("Benchmark: generating "), proj.dir);
+    // Only the benchmark's own lines, the directories and commands are many
+    CB_Log_Level level = cb_log_level;
+    cb_log_level = CB_LOG_WARNING;
+    CB_b32 generated = bench_generate(&o, &proj, stderr);
+    cb_log_level = level;
+    if (!generated) { cb_return_defer(0); }
 
-    CB_Command cmd = cb_da_init(scratch.arena, CB_Command, 64);
-    cb_cmd_append_lit(scratch.arena, &cmd, "cc");
-    cb_cmd_append    (scratch.arena, &cmd, S("-o"), exe, source);
-    cb_cmd_append_lit(scratch.arena, &cmd, "-I./vendor/");
-    cb_cmd_append_lit(scratch.arena, &cmd, "-lm");
-    cb_cmd_append_lit(scratch.arena, &cmd, "-fsanitize=undefined");
-    cb_cmd_append_lit(scratch.arena, &cmd, "-Wall", "-Wextra");
-    cb_cmd_append_lit(scratch.arena, &cmd, "-g");
-    /* cb_cmd_append_lit(scratch.arena, &cmd, "-O2", "-march=native"); */
-    cmd_sokol_flags(scratch.arena, &cmd);
-    cmd_freetype_flags(scratch.arena, &cmd);
+    for (CB_size scenario = 0; scenario < CB_countof(scenarios); scenario++) {
+      cb_log_level = CB_LOG_WARNING;
+      if (scenario == 0) { // clean: no objects, archives, program or log
+        CB_Command rm = cb_da_init(scratch.arena, CB_Command, 8);
+        cb_cmd_append_lit(scratch.arena, &rm, "find");
+        cb_cmd_append(scratch.arena, &rm, proj.dir);
+        cb_cmd_append_lit(scratch.arena, &rm, "(", "-name", "*.o", "-o", "-name", "*.a", "-o", "-name", "bench",
+                          "-o", "-name", ".cbuild_log", ")", "-type", "f", "-delete");
+        if (!cb_cmd_run_sync(rm, stderr)) { cb_return_defer(0); }
+      }
+      if (scenario == 1) { // touch-one: the middle TU of the middle lib
+        CB_size lib = proj.libs / 2;
+        CB_Str source = bench_path(scratch.arena, &proj, "src", lib, "tu", CB_min(o.tus_per_lib, proj.tus - lib * o.tus_per_lib) / 2, ".c");
+        if (utimensat(AT_FDCWD, cb_str_to_cstr(scratch.arena, source), 0, 0) < 0) {
+          cb_log_emit(stderr, CB_LOG_ERROR, S("Could not touch "), source, S(": "), cb_str_from_cstr(strerror(errno)));
+          cb_return_defer(0);
+        }
+      }
 
-    if (!cb_cmd_run_sync(cmd, stderr)) { cb_return_defer(0); }
-    cb_return_defer(1);
+      CB_i64 cpu = bench_self_cpu_ns();
+      CB_i64 start = bench_now_ns();
+      CB_b32 ok = bench_run_build(&o, &proj, stderr);
+      CB_i64 wall_ms = (bench_now_ns() - start) / 1000000;
+      CB_i64 cpu_ms = (bench_self_cpu_ns() - cpu) / 1000000;
+      cb_log_level = level;
+      if (!ok) { cb_return_defer(0); }
+
+      CB_Str_Mark mark = cb_write_buffer_mark(csv);
+      cb_append(csv, o.label, S(","), o.deep ? S("deep") : S("wide"), S(","), o.stub ? S("stub") : S(CB_TC_CC), S(","));
+      cb_append_long(csv, (long)proj.tus);
+      cb_append(csv, S(","));
+      cb_append_long(csv, (long)proj.libs);
+      cb_append(csv, S(","));
+      cb_append_long(csv, (long)o.fan_in);
+      cb_append(csv, S(","), cb_str_from_cstr(scenarios[scenario]), S(","));
+      cb_append_long(csv, (long)wall_ms);
+      cb_append(csv, S(","));
+      cb_append_long(csv, (long)cpu_ms);
+      cb_append(csv, S("\n"));
+      CB_Str row = cb_str_from_mark(&mark);
+      row.len--;
+      cb_log_emit(stderr, CB_LOG_INFO, S("Benchmark: "), row);
+    }
   }
 
-  CB_assert(0 && "unreachable");
+  if (!cb_write_entire_file(S(BENCH_CSV), (CB_Str){ .buf = csv->buf, .len = csv->len, }, stderr)) { cb_return_defer(0); }
+  cb_log_emit(stderr, CB_LOG_INFO, S("Wrote " BENCH_CSV));
+  cb_return_defer(1);
+
  defer:
   cb_arena_pop_mark(scratch);
   return result;
 }
-#endif // CBUILD_CONFIGURED
+
+// Paths as a segmented array, for bench_da.
+typedef struct Bench_Seg_Strs {
+  CB_Str *blocks[CB_SEG_BLOCKS];
+  CB_size len;
+} Bench_Seg_Strs;
+
+typedef enum Bench_Da_Case {
+  BENCH_DA_PUSH,             // the array grows alone in its arena
+  BENCH_DA_PUSH_INTERLEAVED, // another allocation after every push, cb_da_grow has to copy
+  BENCH_DA_APPEND,           // 64 items at a time
+  BENCH_DA_ITERATE,          // sum of the lengths
+  BENCH_DA_ITERATE_BLOCKS,   // the same, cb_seg_block_len instead of cb_seg_at
+  BENCH_DA_CASE_COUNT,
+} Bench_Da_Case;
+
+#define BENCH_DA_ARENA_CAPACITY (1ll << 30)
+#define BENCH_DA_CHUNK 64
+
+// Nanoseconds and arena bytes of a case on items pushed to a dynamic array
+// (seg = 0) or a segmented one. *sink keeps the loops from being optimized out.
+CB_i64 bench_da_case(CB_Arena *arena, Bench_Da_Case c, CB_b32 seg, CB_Str *items, CB_size items_len,
+                     CB_size *bytes, CB_u64 *sink)
+{
+  cb_arena_reset(arena);
+  CB_u8 *begin = arena->at;
+  CB_Str_List da = cb_da_init(arena, CB_Str_List, 16);
+  Bench_Seg_Strs segs = {0};
+  CB_b32 iterate = (c == BENCH_DA_ITERATE || c == BENCH_DA_ITERATE_BLOCKS);
+  if (iterate) { // built before the clock starts
+    for (CB_size i = 0; i < items_len; i++) {
+      if (seg) { *(cb_seg_push(arena, &segs)) = items[i]; }
+      else { *(cb_da_push(arena, &da)) = items[i]; }
+    }
+  }
+
+  CB_i64 start = bench_now_ns();
+  CB_u64 sum = 0;
+  switch (c) {
+    case BENCH_DA_PUSH:
+    case BENCH_DA_PUSH_INTERLEAVED: {
+      for (CB_size i = 0; i < items_len; i++) {
+        if (seg) { *(cb_seg_push(arena, &segs)) = items[i]; }
+        else { *(cb_da_push(arena, &da)) = items[i]; }
+        if (c == BENCH_DA_PUSH_INTERLEAVED) { sum += (CB_u64)(CB_uptr)new(arena, CB_u64, 1); }
+      }
+    } break;
+    case BENCH_DA_APPEND: {
+      for (CB_size i = 0; i < items_len; i += BENCH_DA_CHUNK) {
+        CB_size n = CB_min(BENCH_DA_CHUNK, items_len - i);
+        if (seg) { cb_seg_append(arena, &segs, items + i, n); }
+        else { for (CB_size k = 0; k < n; k++) { *(cb_da_push(arena, &da)) = items[i + k]; } }
+      }
+    } break;
+    case BENCH_DA_ITERATE: {
+      if (seg) { for (CB_size i = 0; i < segs.len; i++) { sum += (CB_u64)cb_seg_at(&segs, i)->len; } }
+      else { for (CB_size i = 0; i < da.len; i++) { sum += (CB_u64)da.items[i].len; } }
+    } break;
+    case BENCH_DA_ITERATE_BLOCKS: {
+      if (seg) {
+        for (CB_i32 k = 0; cb_seg_block_start(k) < segs.len; k++) {
+          CB_Str *block = segs.blocks[k];
+          for (CB_size i = 0; i < cb_seg_block_len(&segs, k); i++) { sum += (CB_u64)block[i].len; }
+        }
+      }
+      else { for (CB_size i = 0; i < da.len; i++) { sum += (CB_u64)da.items[i].len; } }
+    } break;
+    case BENCH_DA_CASE_COUNT: break;
+  }
+  CB_i64 ns = bench_now_ns() - start;
+
+  *sink += sum + (CB_u64)(seg ? segs.len : da.len);
+  *bytes = arena->at - begin;
+  return ns;
+}
+
+// Times cb_da_push against cb_seg_push on paths, best of --runs, and reports
+// nanoseconds per item and the arena bytes each leaves behind. Usage:
+//   ./cbuild bench-da [--items=1000000] [--runs=5]
+CB_b32 bench_da(CB_Str_List args, CB_Write_Buffer *stderr)
+{
+  CB_size items_len = 1000000, runs = 5;
+  for (CB_size i = 0; i < args.len; i++) {
+    CB_Str value = {0};
+    if ((value = bench_option(args.items[i], S("--items"))).len) { items_len = bench_option_int(value, items_len, stderr); }
+    else if ((value = bench_option(args.items[i], S("--runs"))).len) { runs = bench_option_int(value, runs, stderr); }
+    else {
+      cb_log_emit(stderr, CB_LOG_ERROR, S("Unknown bench-da option \""), args.items[i], S("\""));
+      return 0;
+    }
+  }
+
+  CB_Arena *items_arena = cb_alloc_arena(items_len * CB_sizeof(CB_Str) + 64 * 1024);
+  CB_Arena *arena = cb_alloc_arena(BENCH_DA_ARENA_CAPACITY);
+  CB_Str *items = new(items_arena, CB_Str, items_len);
+  for (CB_size i = 0; i < items_len; i++) {
+    items[i] = (CB_Str){ .buf = (CB_u8 *)"src/bench/path.c", .len = 1 + (CB_size)(i % 16), };
+  }
+
+  CB_Write_Buffer *head = cb_mem_buffer(items_arena, 256);
+  cb_append(head, S("Benchmark: da against seg on "));
+  cb_append_long(head, (long)items_len);
+  cb_append(head, S(" items, best of "));
+  cb_append_long(head, (long)runs);
+  cb_log_emit(stderr, CB_LOG_INFO, (CB_Str){ .buf = head->buf, .len = head->len, });
+  char *cases[] = { "push", "push-interleaved", "append", "iterate", "iterate-blocks", };
+  CB_u64 sink = 0;
+  for (CB_size c = 0; c < BENCH_DA_CASE_COUNT; c++) {
+    CB_i64 best[2] = { INT64_MAX, INT64_MAX, };
+    CB_size bytes[2] = {0};
+    for (CB_size r = 0; r < runs; r++) {
+      for (CB_b32 seg = 0; seg < 2; seg++) {
+        CB_i64 ns = bench_da_case(arena, (Bench_Da_Case)c, seg, items, items_len, bytes + seg, &sink);
+        best[seg] = CB_min(best[seg], ns);
+      }
+    }
+
+    CB_Write_Buffer *row = cb_mem_buffer(items_arena, 256);
+    cb_append(row, cb_str_from_cstr(cases[c]), S(":"));
+    for (CB_b32 seg = 0; seg < 2; seg++) {
+      CB_i64 centi = best[seg] * 100 / CB_max(items_len, 1); // hundredths of a ns per item
+      cb_append(row, seg ? S(", seg ") : S(" da "));
+      cb_append_long(row, (long)(centi / 100));
+      cb_append(row, S("."), (centi % 100 < 10) ? S("0") : S(""));
+      cb_append_long(row, (long)(centi % 100));
+      cb_append(row, S(" ns/item "));
+      cb_append_long(row, (long)(bytes[seg] / 1024));
+      cb_append(row, S(" KiB"));
+    }
+    cb_log_emit(stderr, CB_LOG_INFO, S("Benchmark: "), (CB_Str){ .buf = row->buf, .len = row->len, });
+  }
+  if (sink == 0) { cb_log_emit(stderr, CB_LOG_WARNING, S("Benchmark: nothing was measured")); }
+
+  cb_free_arena(arena);
+  cb_free_arena(items_arena);
+  return 1;
+}
+
+typedef enum Bench_Arena_Case {
+  BENCH_ARENA_MUTEX,   // cb_arena_alloc under a pthread mutex
+  BENCH_ARENA_ATOMIC,  // cb_arena_alloc_atomic
+  BENCH_ARENA_RESERVE, // cb_arena_alloc from blocks of cb_arena_reserve
+  BENCH_ARENA_CASE_COUNT,
+} Bench_Arena_Case;
+
+#define BENCH_ARENA_BLOCK (64 * 1024)
+
+typedef struct Bench_Arena_Node {
+  struct Bench_Arena_Node *next;
+  CB_size value;
+} Bench_Arena_Node;
+
+typedef struct Bench_Arena_Worker {
+  pthread_t thread;
+  Bench_Arena_Case c;
+  CB_Arena *shared;
+  pthread_mutex_t *lock;
+  CB_size items;
+  Bench_Arena_Node *list; // the results, built in the shared arena
+} Bench_Arena_Worker;
+
+void *bench_arena_worker(void *arg)
+{
+  Bench_Arena_Worker *w = arg;
+  CB_Arena block = {0};
+  for (CB_size i = 0; i < w->items; i++) {
+    Bench_Arena_Node *node = 0;
+    switch (w->c) {
+      case BENCH_ARENA_MUTEX: {
+        pthread_mutex_lock(w->lock);
+        node = new(w->shared, Bench_Arena_Node, 1);
+        pthread_mutex_unlock(w->lock);
+      } break;
+      case BENCH_ARENA_ATOMIC: {
+        node = new_atomic(w->shared, Bench_Arena_Node, 1);
+      } break;
+      case BENCH_ARENA_RESERVE: {
+        if ((block.backing + block.capacity) - block.at < CB_sizeof(Bench_Arena_Node) + CB_alignof(Bench_Arena_Node)) {
+          block = cb_arena_reserve(w->shared, BENCH_ARENA_BLOCK);
+        }
+        node = new(&block, Bench_Arena_Node, 1);
+      } break;
+      case BENCH_ARENA_CASE_COUNT: break;
+    }
+    node->value = i;
+    node->next = w->list;
+    w->list = node;
+  }
+  return 0;
+}
+
+// Times --threads workers that each allocate --items list nodes in one
+// shared arena, with a mutex, with cb_arena_alloc_atomic and from blocks of
+// cb_arena_reserve, best of --runs. The lists are checked after the join and
+// the arena is reset once per run. Usage:
+//   ./cbuild bench-arena [--threads=4] [--items=1000000] [--runs=5]
+CB_b32 bench_arena(CB_Str_List args, CB_Write_Buffer *stderr)
+{
+  CB_size threads = 4, items = 1000000, runs = 5;
+  for (CB_size i = 0; i < args.len; i++) {
+    CB_Str value = {0};
+    if ((value = bench_option(args.items[i], S("--threads"))).len) { threads = bench_option_int(value, threads, stderr); }
+    else if ((value = bench_option(args.items[i], S("--items"))).len) { items = bench_option_int(value, items, stderr); }
+    else if ((value = bench_option(args.items[i], S("--runs"))).len) { runs = bench_option_int(value, runs, stderr); }
+    else {
+      cb_log_emit(stderr, CB_LOG_ERROR, S("Unknown bench-arena option \""), args.items[i], S("\""));
+      return 0;
+    }
+  }
+
+  CB_b32 result = 1;
+  // Room for every node with its padding and for one partly used block per worker
+  CB_size capacity = threads * (items * 2 * CB_sizeof(Bench_Arena_Node) + 2 * BENCH_ARENA_BLOCK) + 64 * 1024;
+  CB_Arena *shared = cb_alloc_arena(capacity);
+  Bench_Arena_Worker *workers = new(shared, Bench_Arena_Worker, threads);
+  CB_Arena_Mark start_of_run = cb_arena_push_mark(shared);
+  pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+  char *cases[] = { "mutex", "atomic", "reserve", };
+  for (CB_size c = 0; c < BENCH_ARENA_CASE_COUNT && result; c++) {
+    CB_i64 best = INT64_MAX;
+    CB_size used = 0;
+    for (CB_size r = 0; r < runs && result; r++) {
+      cb_arena_pop_mark(start_of_run);
+      CB_i64 start = bench_now_ns();
+      for (CB_size i = 0; i < threads; i++) {
+        workers[i] = (Bench_Arena_Worker){ .c = (Bench_Arena_Case)c, .shared = shared, .lock = &lock, .items = items, };
+        int err = pthread_create(&workers[i].thread, 0, bench_arena_worker, workers + i);
+        if (err) {
+          cb_log_emit(stderr, CB_LOG_ERROR, S("Could not start a thread: "), cb_str_from_cstr(strerror(err)));
+          threads = i;
+          result = 0;
+        }
+      }
+      for (CB_size i = 0; i < threads; i++) { pthread_join(workers[i].thread, 0); }
+      best = CB_min(best, bench_now_ns() - start);
+      used = shared->at - start_of_run.marker;
+
+      for (CB_size i = 0; i < threads && result; i++) {
+        CB_size expected = items;
+        for (Bench_Arena_Node *node = workers[i].list; node; node = node->next) {
+          if (node->value != --expected) { break; }
+        }
+        if (expected != 0) {
+          cb_log_emit(stderr, CB_LOG_ERROR, S("Benchmark: "), cb_str_from_cstr(cases[c]), S(" corrupted a list"));
+          result = 0;
+        }
+      }
+    }
+    if (!result) { break; }
+
+    CB_Write_Buffer *row = cb_mem_buffer(shared, 256);
+    cb_append(row, S("Benchmark: "), cb_str_from_cstr(cases[c]), S(": "));
+    cb_append_long(row, (long)threads);
+    cb_append(row, S(" threads, "));
+    cb_append_long(row, (long)(best * 100 / (threads * items)) / 100);
+    cb_append(row, S("."));
+    CB_i64 centi = (best * 100 / (threads * items)) % 100;
+    if (centi < 10) { cb_append(row, S("0")); }
+    cb_append_long(row, (long)centi);
+    cb_append(row, S(" ns/alloc, "));
+    cb_append_long(row, (long)(used / 1024));
+    cb_append(row, S(" KiB"));
+    cb_log_emit(stderr, CB_LOG_INFO, (CB_Str){ .buf = row->buf, .len = row->len, });
+  }
+
+  pthread_mutex_destroy(&lock);
+  cb_free_arena(shared);
+  return result;
+}
+#endif // CBUILD_RECIPES
+
+#if !defined(CBUILD_RECIPES)
+// The recipes, compiled into a module the driver reloads when they change
+#define RECIPES_PATH "build/recipes.so"
+// cbuild.c without the recipes, the driver is only rebuilt when this changes
+#define DRIVER_STAMP "build/driver.stamp"
 
 void default_config(CB_Write_Buffer *stderr)
 {
@@ -355,16 +2319,47 @@ void default_config(CB_Write_Buffer *stderr)
   cb_append(conf, S("\n"));
   cb_append(conf, S("// Build my sokol editor example.\n"));
   cb_append(conf, S("#define BUILD_EDITOR\n"));
+  cb_append(conf, S("// Optimize the editor, with -march=native if build/toolchain.h says it is supported.\n"));
+  cb_append(conf, S("// #define EDITOR_OPTIMIZE\n"));
+  cb_append(conf, S("// Report the peak usage and biggest allocation sites of every editor arena at exit.\n"));
+  cb_append(conf, S("// Build cbuild itself with -DCB_ARENA_TELEMETRY for the same report of its arenas.\n"));
+  cb_append(conf, S("// #define EDITOR_ARENA_TELEMETRY\n"));
+  cb_append(conf, S("// Command prefix for the headless PGO workload of `./cbuild release`.\n"));
+  cb_append(conf, S("#define RELEASE_WORKLOAD_RUNNER \"xvfb-run\", \"-a\"\n"));
   cb_append(conf, S("\n"));
   cb_append(conf, S("// Location of Sokol library.\n"));
   cb_append(conf, S("#define SOKOL_LOC \"vendor/sokol/\"\n"));
   cb_append(conf, S("// To build shaders we use sokol-shdc.\n"));
   cb_append(conf, S("#define SOKOL_SHDC_PATH \"vendor/sokol-tools-bin/bin/linux/sokol-shdc\"\n"));
+  cb_append(conf, S("// Shader languages to compile, in parallel. The generated header picks one by the SOKOL_<backend> define.\n"));
+  cb_append(conf, S("#define SHDC_LANGS \"glsl330\", \"glsl300es\", \"hlsl5\", \"metal_macos\"\n"));
   cb_append(conf, S("// Enable to build sokol with debug information and disable optimizations.\n"));
   cb_append(conf, S("// #define SOKOL_DEBUG\n"));
   cb_append(conf, S("\n"));
   cb_append(conf, S("// Location of Freetype library.\n"));
   cb_append(conf, S("#define FREETYPE_LOC \"vendor/freetype/\"\n"));
+  cb_append(conf, S("// Freetype modules to build, with the ones they require. All of them if not defined, one of\n"));
+  cb_append(conf, S("// [ autofit, truetype, type1, cff, cid, pfr, type42, winfonts, pcf, bdf, psaux, psnames, pshinter,\n"));
+  cb_append(conf, S("//   sfnt, smooth, raster, sdf, svg, gzip, lzw, bzip2, cache, gxvalid, otvalid ].\n"));
+  cb_append(conf, S("#define FREETYPE_MODULES \"truetype\", \"sfnt\", \"smooth\", \"sdf\"\n"));
+  cb_append(conf, S("// Reference the Freetype objects from libfreetype.a instead of copying them (GNU thin archive).\n"));
+  cb_append(conf, S("// #define FREETYPE_THIN_ARCHIVE\n"));
+  cb_append(conf, S("\n"));
+  cb_append(conf, S("// Compile Freetype on `./cbuild --worker <address>` processes, round robin.\n"));
+  cb_append(conf, S("// #define DIST_WORKERS \"unix:build/worker0.sock\", \"unix:build/worker1.sock\"\n"));
+  cb_append(conf, S("\n"));
+  cb_append(conf, S("// Parallel jobs, defaults to the number of cpus + 2. Jobs are also held back while\n"));
+  cb_append(conf, S("// their peak RSS from earlier builds (build/.cbuild_log) would not fit in memory.\n"));
+  cb_append(conf, S("// #define POOL_JOBS 8\n"));
+  cb_append(conf, S("// Run every job in its own cgroup v2, memory.max at this multiple of its recorded peak RSS.\n"));
+  cb_append(conf, S("// #define POOL_CGROUP_LIMIT 2\n"));
+  cb_append(conf, S("\n"));
+  cb_append(conf, S("// Drop log lines above this level, one of [ CB_LOG_ERROR, CB_LOG_WARNING, CB_LOG_INFO ].\n"));
+  cb_append(conf, S("// #define LOG_LEVEL CB_LOG_INFO\n"));
+  cb_append(conf, S("// Log as JSON lines, one object per line.\n"));
+  cb_append(conf, S("// #define LOG_JSON\n"));
+  cb_append(conf, S("// Hand log lines to a writer thread instead of a write() per line.\n"));
+  cb_append(conf, S("// #define LOG_ASYNC\n"));
 
   CB_Str content = (CB_Str){.buf = conf->buf, .len = conf->len, };
   if (!cb_write_entire_file(S("build/config.h"), content, stderr)) cb_exit(1);
@@ -372,6 +2367,84 @@ void default_config(CB_Write_Buffer *stderr)
   cb_arena_pop_mark(scratch);
 }
 
+void write_driver_stamp(CB_Write_Buffer *stderr)
+{
+  CB_Arena_Mark scratch = cb_arena_get_scratch(0, 0);
+  CB_Read_Result source = cb_read_entire_file(scratch.arena, S("cbuild.c"), stderr);
+  if (!source.status) { cb_exit(1); }
+
+  CB_Str text = source.file_contents;
+  CB_Str begin = S("#if defined(CBUILD_RECIPES)\n");
+  CB_Str end = S("#endif // CBUILD_RECIPES\n");
+  CB_size from = cb_str_find(text, begin);
+  CB_size to = cb_str_find(text, end);
+  CB_Write_Buffer *driver = cb_mem_buffer(scratch.arena, text.len);
+  if (from < 0 || to < from) {
+    cb_append(driver, text);
+  } else {
+    cb_append(driver, (CB_Str){ .buf = text.buf, .len = from, });
+    cb_append(driver, (CB_Str){ .buf = text.buf + to + end.len, .len = text.len - to - end.len, });
+  }
+  CB_Str content = { .buf = driver->buf, .len = driver->len, };
+  if (cb_write_file_if_changed(S(DRIVER_STAMP), content, stderr) < 0) { cb_exit(1); }
+  cb_arena_pop_mark(scratch);
+}
+
+// 0 if the build called cb_exit
+CB_b32 run_recipes(CB_Recipes *recipes, CB_Arena *perm, CB_Str command, CB_Str_List args, CB_Write_Buffer *stderr)
+{
+  jmp_buf exit_jump;
+  if (setjmp(exit_jump)) {
+    cb_exit_jump = 0;
+    cb_free_scratch_pool(); // the build did not get to pop its marks
+    return 0;
+  }
+  cb_exit_jump = &exit_jump;
+  recipes->run(perm, command, args, stderr);
+  cb_exit_jump = 0;
+  return 1;
+}
+
+// Runs the command after every change to its sources or the recipes. The
+// driver stays resident and only reloads the recipe module, a failed build
+// returns here through cb_exit_jump.
+void watch(CB_Arena *perm, int argc, char **argv, CB_Str_List driver_sources,
+           CB_Str_List recipes_sources, CB_Str_List args, CB_Write_Buffer *stderr)
+{
+  CB_Str command = args.len ? args.items[0] : (CB_Str){0};
+  args.items += args.len ? 1 : 0;
+  args.len -= args.len ? 1 : 0;
+
+  CB_Watch *w = &(CB_Watch){ .arena = cb_alloc_arena(16 * 1024 * 1024), };
+  CB_Recipes recipes = {0};
+  for (;;) {
+    cb_arena_reset(w->arena);
+    w->paths = cb_da_init(w->arena, CB_Str_List, 1024);
+    for (CB_size i = 0; i < recipes_sources.len; i++) {
+      *(cb_da_push(w->arena, &w->paths)) = recipes_sources.items[i];
+    }
+
+    // Runs the new driver in place of this one if it changed
+    write_driver_stamp(stderr);
+    cb_rebuild_yourself(argc, argv, driver_sources, 0, stderr);
+
+    if (cb_recipes_load(&recipes, S(RECIPES_PATH), recipes_sources, stderr)) {
+      CB_Arena_Mark run_mark = cb_arena_push_mark(perm);
+      cb_watch = w;
+      run_recipes(&recipes, perm, command, args, stderr);
+      cb_watch = 0;
+      if (cb_explain_out) { cb_close(cb_explain_out->fd, stderr); }
+      cb_explain_out = 0; // in perm
+      cb_explain = 0;
+      cb_arena_pop_mark(run_mark);
+    }
+
+    cb_log_emit(stderr, CB_LOG_INFO, S("Watching for changes ..."));
+    cb_flush(stderr);
+    if (!cb_watch_wait(w, stderr)) { cb_exit(1); }
+  }
+}
+
 int main(int argc, char **argv)
 {
   CB_Arena *perm = cb_alloc_arena(8 * 1024 * 1024);
@@ -380,22 +2453,41 @@ int main(int argc, char **argv)
 
   // REVIEW: Abort if cbuild is not run from project root.
 
+  // Probe the toolchain i.e. write build/toolchain.h if the compiler or linkers changed.
+  if (!cb_mkdir_if_not_exists(S("build"), stderr)) cb_exit(1);
+  if (!cb_toolchain_probe(S(CB_TC_CC), S("build/toolchain.h"), stderr)) cb_exit(1);
+
   // Configure program i.e. write default build/config.h if it does not exist.
-  CB_b32 user_requested_to_reconfigure = (argc > 1);
+  CB_Str command = (argc > 1) ? cb_str_from_cstr(argv[1]) : S("");
+  CB_b32 user_requested_to_reconfigure = cb_str_equals(command, S("config"));
   CB_b32 config_h_exists = cb_file_exists(S("build/config.h"), stderr);
   if (config_h_exists < 0) { cb_exit(1); }
   if (config_h_exists == 0 || user_requested_to_reconfigure) {
     cb_log_emit(stderr, CB_LOG_INFO, S("Reconfiguring cbuild ..."));
-    if (!cb_mkdir_if_not_exists(S("build"), stderr)) cb_exit(1);
     default_config(stderr);
+    if (user_requested_to_reconfigure) { // do not reconfigure again after the re-run
+      argv[1] = argv[0];
+      argv++;
+      argc--;
+    }
     cb_rebuild_yourself(argc, argv, cbuild_sources, 1, stderr);
   }
 
-  CB_Str_List cbuild_configured_sources = cb_str_dup_list(perm, "cbuild.c", "cbuild.h", "build/config.h");
-  cb_rebuild_yourself(argc, argv, cbuild_configured_sources, 0, stderr);
+  // Editing a recipe only rebuilds the recipe module, not the driver
+  write_driver_stamp(stderr);
+  CB_Str_List driver_sources = cb_str_dup_list(perm, "cbuild.h", "build/toolchain.h", DRIVER_STAMP);
+  cb_rebuild_yourself(argc, argv, driver_sources, 0, stderr);
 
 #if defined(CBUILD_CONFIGURED)
-  run(perm, stderr);
+  CB_Str_List args = cb_da_init(perm, CB_Str_List, 16);
+  for (int i = 2; i < argc; i++) { *(cb_da_push(perm, &args)) = cb_str_from_cstr(argv[i]); }
+  CB_Str_List recipes_sources = cb_str_dup_list(perm, "cbuild.c", "cbuild.h", "build/config.h", "build/toolchain.h");
+  if (cb_str_equals(command, S("watch"))) {
+    watch(perm, argc, argv, driver_sources, recipes_sources, args, stderr);
+  }
+  CB_Recipes recipes = {0};
+  if (!cb_recipes_load(&recipes, S(RECIPES_PATH), recipes_sources, stderr)) { cb_exit(1); }
+  recipes.run(perm, command, args, stderr);
 #endif
 
   cb_flush(stderr);
@@ -403,3 +2495,4 @@ int main(int argc, char **argv)
   cb_free_scratch_pool();
   return 0;
 }
+#endif // !CBUILD_RECIPES
@@ -66,10 +66,15 @@ typedef CB_i32   CB_b32;
 //
 #define new(a, t, n) (t *) cb_arena_alloc(a, CB_sizeof(t), CB_alignof(t), (n))
 
+typedef struct CB_Arena_Stats CB_Arena_Stats;
+
 typedef struct {
   CB_u8 *backing;
   CB_u8 *at;
   CB_size capacity;
+#if defined(CB_ARENA_TELEMETRY)
+  CB_Arena_Stats *stats;
+#endif
 } CB_Arena;
 
 CB_Arena *cb_alloc_arena(CB_size capacity);
@@ -80,6 +85,52 @@ __attribute__((malloc, alloc_size(2,4), alloc_align(3)))
 CB_u8 *cb_arena_alloc(CB_Arena *a, CB_size objsize, CB_size align, CB_size count);
 void cb_arena_reset(CB_Arena *a);
 
+//-- Arena Telemetry
+//
+// Compile with -DCB_ARENA_TELEMETRY to record, per arena, the peak usage and
+// the allocations and bytes of every call site of new, cb_da_init, cb_da_push
+// and cb_arena_alloc. Arenas are named by the site that created them. The
+// report goes to stderr at exit, including the exit on "Out of Memory" which
+// also names the failing call site, so capacities can be sized from data.
+// The counts of all arenas are guarded by one spinlock, so threads allocating
+// from their own arenas, e.g. the log writer and a test's workers, can not
+// race each other or the report.
+//
+#if defined(CB_ARENA_TELEMETRY)
+#define CB_ARENA_SITES 256 // per arena, the rest are counted as "other sites"
+
+typedef struct CB_Arena_Site {
+  const char *file;
+  CB_i32 line;
+  CB_i64 count;
+  CB_i64 bytes;
+} CB_Arena_Site;
+
+struct CB_Arena_Stats {
+  CB_Arena_Stats *next;
+  const char *file;      // where the arena was created
+  CB_i32 line;
+  CB_size capacity;
+  CB_size peak;          // bytes in use at the high-water mark
+  CB_i64 count;
+  CB_i64 bytes;          // requested, without padding
+  CB_b32 freed;
+  CB_Arena_Site sites[CB_ARENA_SITES];
+  CB_Arena_Site other;
+};
+
+CB_Arena *cb_alloc_arena_at(CB_size capacity, const char *file, CB_i32 line);
+CB_Arena cb_arena_init_at(CB_u8 *backing, CB_size capacity, const char *file, CB_i32 line);
+__attribute__((malloc, alloc_size(2,4), alloc_align(3)))
+CB_u8 *cb_arena_alloc_at(CB_Arena *a, CB_size objsize, CB_size align, CB_size count, const char *file, CB_i32 line);
+// Peak, allocations and the biggest call sites of every arena created so far.
+void cb_arena_report(CB_i32 fd);
+
+#define cb_alloc_arena(capacity) cb_alloc_arena_at((capacity), __FILE__, __LINE__)
+#define cb_arena_init(backing, capacity) cb_arena_init_at((backing), (capacity), __FILE__, __LINE__)
+#define cb_arena_alloc(a, objsize, align, count) cb_arena_alloc_at((a), (objsize), (align), (count), __FILE__, __LINE__)
+#endif // CB_ARENA_TELEMETRY
+
 //-- Arena Marker / Temporary Arena
 typedef struct {
   CB_Arena *arena;
@@ -89,11 +140,28 @@ typedef struct {
 CB_Arena_Mark cb_arena_push_mark(CB_Arena *a);
 void cb_arena_pop_mark(CB_Arena_Mark a);
 
+//-- Concurrent Arena
+//
+// Worker threads share an arena through cb_arena_alloc_atomic, which moves
+// `at` with a compare-and-swap instead of a plain store. A thread that makes
+// many small allocations takes a block with cb_arena_reserve and allocates
+// from it with the plain functions, no atomics. Everything is released with
+// the shared arena. Marks, pops and cb_arena_reset stay single-owner: use them
+// before the workers start or after they are joined. Concurrent allocations
+// are not counted by CB_ARENA_TELEMETRY.
+//
+#define new_atomic(a, t, n) (t *) cb_arena_alloc_atomic(a, CB_sizeof(t), CB_alignof(t), (n))
+
+__attribute__((malloc, alloc_size(2,4), alloc_align(3)))
+CB_u8 *cb_arena_alloc_atomic(CB_Arena *a, CB_size objsize, CB_size align, CB_size count);
+// capacity bytes of a, as an arena for one thread
+CB_Arena cb_arena_reserve(CB_Arena *a, CB_size capacity);
+
 //-- Scratch Arena
 #define SCRATCH_ARENA_COUNT 2
 #define SCRATCH_ARENA_CAPACITY (8 * 1024 * 1024)
 
-CB_Arena_Mark cb_arena_scratch(CB_Arena **conflicts, CB_size conflicts_len);
+CB_Arena_Mark cb_arena_get_scratch(CB_Arena **conflicts, CB_size conflicts_len);
 void cb_free_scratch_pool(void);
 
 
@@ -116,6 +184,13 @@ char  *cb_str_to_cstr(CB_Arena *a, CB_Str s);
 
 CB_b32 cb_str_equals(CB_Str a, CB_Str b);
 CB_Str cb_str_chop_right(CB_Str str, unsigned char delim);
+CB_size cb_str_find(CB_Str haystack, CB_Str needle); // -1 if not found
+CB_b32 cb_str_starts_with(CB_Str str, CB_Str prefix);
+CB_i64 cb_str_parse_int(CB_Str str, CB_size *len); // leading decimal integer, *len chars consumed
+
+//-- Hashing (FNV-1a)
+#define CB_HASH_INIT 0xcbf29ce484222325ull
+CB_u64 cb_hash_str(CB_u64 h, CB_Str s);
 
 //-- String Array
 typedef struct {
@@ -130,6 +205,48 @@ CB_Str_List cb_str_dup_list_(CB_Arena *arena, const char *cstrs[], CB_size len);
   cb_str_dup_list_(arena, ((const char*[]){__VA_ARGS__}),       \
    (CB_sizeof(((const char*[]){__VA_ARGS__}))/(CB_sizeof(const char*))))
 
+//-- Path
+//
+// dirname, basename, extension and stem slice the path as written, normalize
+// first for "a/b/" or "a/./b". Normalizing is lexical: "." and duplicate
+// slashes go, ".." removes the component before it, so "./build//x/../editor"
+// is "build/editor". A ".." above a relative path stays, "/.." is "/" and the
+// empty path is ".". Symlinks are not looked at.
+//
+CB_Str cb_path_dirname(CB_Str path);   // "a/b.c" -> "a", "b.c" -> ".", "/b.c" -> "/"
+CB_Str cb_path_basename(CB_Str path);  // "a/b.c" -> "b.c"
+CB_Str cb_path_extension(CB_Str path); // "a/b.tar.gz" -> ".gz", "" for "a/b" and "a/.b"
+CB_Str cb_path_stem(CB_Str path);      // "a/b.c" -> "b"
+CB_Str cb_path_normalize(CB_Arena *arena, CB_Str path);
+// dir/name normalized, name alone if dir is empty or name is absolute.
+CB_Str cb_path_join(CB_Arena *arena, CB_Str dir, CB_Str name);
+
+//-- Path Interning
+//
+// Numbers normalized paths from 1 in the order they are first seen, so graphs
+// and caches keyed by path index arrays and compare integers instead of
+// strings. 0 is no path. An id only means something in its own table.
+//
+typedef CB_u32 CB_Path_Id;
+
+typedef struct CB_Str_Slot {
+  CB_Str key;
+  CB_size value;         // index + 1, 0 if the slot is free
+} CB_Str_Slot;
+
+typedef struct CB_Path_Table {
+  CB_Arena *arena;
+  CB_Str_List paths;     // by id - 1
+  CB_Str_Slot *slots;    // hash table of ids by path
+  CB_size slots_len;     // power of 2
+} CB_Path_Table;
+
+CB_Path_Table cb_path_table_init(CB_Arena *arena);
+// Id of path once normalized, copied into the table's arena if it is new.
+CB_Path_Id cb_path_intern(CB_Path_Table *table, CB_Str path);
+// The normalized path of id.
+CB_Str cb_path_of(CB_Path_Table *table, CB_Path_Id id);
+
 
 ////////////////////////////////////////////////////////////////////////////////
 //- Write Buffer / Buffered IO
@@ -143,6 +260,7 @@ typedef struct {
   CB_size len;
   CB_i32 fd;
   CB_b32 error;
+  CB_i64 flushed; // bytes flushed so far
 } CB_Write_Buffer;
 
 CB_Write_Buffer *cb_mem_buffer(CB_Arena *a, CB_size capacity);
@@ -153,6 +271,7 @@ void  cb_append_bytes(CB_Write_Buffer *b, unsigned char *src, CB_size len);
 void  cb_append_strs(CB_Write_Buffer *b, CB_Str *strs, CB_size strs_len);
 void  cb_append_byte(CB_Write_Buffer *b, unsigned char c);
 void  cb_append_long(CB_Write_Buffer *b, long x);
+void  cb_append_hex(CB_Write_Buffer *b, CB_u64 x);
 
 #define cb_append(b, ...) cb_append_strs((b), ((CB_Str[]){__VA_ARGS__}), CB_countof(((CB_Str[]){__VA_ARGS__})))
 
@@ -203,6 +322,69 @@ CB_Str cb_str_from_mark(CB_Str_Mark *mark);
 void cb_da_grow(CB_Arena *arena, void **items,
                 CB_size *__restrict capacity, CB_size *__restrict len,
                 CB_size item_size, CB_size align);
+#if defined(CB_ARENA_TELEMETRY)
+void cb_da_grow_at(CB_Arena *arena, void **items,
+                   CB_size *__restrict capacity, CB_size *__restrict len,
+                   CB_size item_size, CB_size align, const char *file, CB_i32 line);
+#define cb_da_grow(arena, items, capacity, len, item_size, align) \
+  cb_da_grow_at((arena), (items), (capacity), (len), (item_size), (align), __FILE__, __LINE__)
+#endif
+
+//-- Segmented Array
+//
+// Grows by adding blocks instead of copying: block k holds CB_SEG_FIRST << k
+// items. Items never move, so pointers to them stay valid, and no dead copies
+// are left in the arena. The block of an index follows from its highest set
+// bit. Blocks are allocated on the first push into them and kept when len is
+// reset. A segmented array is a struct with the fields
+//   T *blocks[CB_SEG_BLOCKS];
+//   CB_size len;
+//
+#define CB_SEG_SHIFT 4 // the first block holds CB_SEG_FIRST items
+#define CB_SEG_FIRST ((CB_size)1 << CB_SEG_SHIFT)
+#define CB_SEG_BLOCKS 40
+
+#define cb_seg_block_of_(i)  (63 - __builtin_clzll(((CB_u64)(i) >> CB_SEG_SHIFT) + 1))
+#define cb_seg_block_start(k) ((((CB_size)1 << (k)) - 1) << CB_SEG_SHIFT)
+#define cb_seg_block_cap(k)   (CB_SEG_FIRST << (k))
+// Items in use in block k, to iterate without indexing:
+//   for (CB_i32 k = 0; cb_seg_block_start(k) < s.len; k++) {
+//     for (CB_size i = 0; i < cb_seg_block_len(&s, k); i++) { s.blocks[k][i] ... }
+//   }
+#define cb_seg_block_len(s, k) \
+  (CB_min((s)->len - cb_seg_block_start(k), cb_seg_block_cap(k)))
+
+#define cb_seg_at(s, index) ({                                          \
+      typeof(s) _seg = s;                                               \
+      CB_size _seg_i = (index);                                         \
+      CB_assert(_seg_i >= 0 && _seg_i < _seg->len);                     \
+      CB_i32 _seg_k = cb_seg_block_of_(_seg_i);                         \
+      _seg->blocks[_seg_k] + (_seg_i - cb_seg_block_start(_seg_k));     \
+    })
+
+// The new item is zeroed, also when its block is reused
+#define cb_seg_push(a, s) ({                                            \
+      typeof(s) _seg = s;                                               \
+      CB_i32 _seg_k = cb_seg_block_of_(_seg->len);                      \
+      CB_assert(_seg_k < CB_SEG_BLOCKS);                                \
+      if (!_seg->blocks[_seg_k]) {                                      \
+        _seg->blocks[_seg_k] = new((a), typeof(*_seg->blocks[0]), cb_seg_block_cap(_seg_k)); \
+      }                                                                 \
+      typeof(_seg->blocks[0]) _seg_item = _seg->blocks[_seg_k] + (_seg->len++ - cb_seg_block_start(_seg_k)); \
+      CB_memset(_seg_item, 0, sizeof(*_seg_item));                      \
+      _seg_item;                                                        \
+    })
+
+// Copies items_len items to the end, a memcpy per block
+#define cb_seg_append(a, s, items, items_len) ({                        \
+      typeof(s) _seg = s;                                               \
+      typeof(_seg->blocks[0]) _seg_items = (items);                     \
+      cb_seg_append_((a), (void **)_seg->blocks, &_seg->len, _seg_items, (items_len), \
+                     CB_sizeof(_seg_items[0]), CB_alignof(typeof(_seg_items[0]))); \
+    })
+
+void cb_seg_append_(CB_Arena *arena, void **blocks, CB_size *len,
+                    void *items, CB_size items_len, CB_size item_size, CB_size align);
 
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -216,13 +398,50 @@ typedef enum CB_Log_Level {
   CB_LOG_COUNT,
 } CB_Log_Level;
 
+typedef enum CB_Log_Format {
+  CB_LOG_FORMAT_TEXT, // [INFO]: message
+  CB_LOG_FORMAT_JSON, // {"time_ns":..,"level":"info","tid":..,"msg":"message"}
+} CB_Log_Format;
+
+// Lines above cb_log_level are dropped by cb_log_emit before its arguments are
+// evaluated, lines above CB_LOG_MAX_LEVEL are not even compiled in.
+#ifndef CB_LOG_MAX_LEVEL
+#  define CB_LOG_MAX_LEVEL CB_LOG_INFO
+#endif
+extern CB_Log_Level cb_log_level;
+extern CB_Log_Format cb_log_format;
+
+#define cb_log_enabled(level) ((level) <= CB_LOG_MAX_LEVEL && (level) <= cb_log_level)
+
 void cb_log_begin(CB_Write_Buffer *b, CB_Log_Level level);
 void cb_log_end(CB_Write_Buffer *b);
 void cb_log_emit_strs(CB_Write_Buffer *b, CB_Log_Level level, CB_Str *strs, CB_size strs_len);
 
-#define cb_log_emit(b, level, ...) cb_log_emit_strs(b, level, \
-  ((CB_Str[]){__VA_ARGS__}),                                  \
-  (CB_countof(((CB_Str[]){__VA_ARGS__}))))
+#define cb_log_emit(b, level, ...) do {                          \
+    if (cb_log_enabled(level)) {                                 \
+      cb_log_emit_strs(b, level, ((CB_Str[]){__VA_ARGS__}),      \
+                       (CB_countof(((CB_Str[]){__VA_ARGS__})))); \
+    }                                                            \
+  } while (0)
+
+//-- Asynchronous Log
+//
+// Once started, every flush of a buffer writing to fd (log lines and anything
+// else) is copied into a lock-free multi-producer ring of CB_LOG_RING_SIZE
+// bytes instead of calling write(). A writer thread drains the ring, so many
+// lines cost one syscall. A flush stays in one piece up to half the ring.
+// Forked children go back to writing directly. The ring is drained on
+// cb_log_stop_async() and at exit.
+//
+// CB_Write_Buffers are not thread-safe: other threads log through their own
+// cb_log_buffer().
+#ifndef CB_LOG_RING_SIZE
+#  define CB_LOG_RING_SIZE (1 << 20) // power of two
+#endif
+
+CB_b32 cb_log_start_async(CB_i32 fd, CB_Write_Buffer *stderr);
+void cb_log_stop_async(void);
+CB_Write_Buffer *cb_log_buffer(void); // per thread, writes to the async fd (or 2)
 
 ////////////////////////////////////////////////////////////////////////////////
 //- Command
@@ -256,24 +475,117 @@ CB_u8 *cb_malloc(CB_size amount);
 void cb_mfree(CB_u8 *memory_to_free);
 __attribute__((noreturn))
 void cb_exit (CB_i32 status);
+// cb_exit does longjmp(*cb_exit_jump, 1) instead of exiting if set, so a
+// resident `./cbuild watch` outlives a failed build.
+#include <setjmp.h>
+extern jmp_buf *cb_exit_jump;
+// Called by cb_exit first, cb_pool_run sets it to kill and reap its jobs.
+extern void (*cb_exit_hook)(void);
 CB_b32 cb_write(CB_i32 fd, CB_u8 *buf, CB_size len);
 CB_i32 cb_open(CB_Str filepath, CB_Write_Buffer *stderr);
 CB_b32 cb_close(CB_i32 fd, CB_Write_Buffer *stderr);
 
+typedef struct {
+  CB_i32 status;
+  CB_Str file_contents;
+} CB_Read_Result;
+
 CB_b32 cb_file_exists(CB_Str filepath, CB_Write_Buffer *stderr);
+CB_Read_Result cb_read_entire_file(CB_Arena *arena, CB_Str filepath, CB_Write_Buffer *stderr);
+// Writes <filepath>.tmp and renames it over filepath, so readers and an
+// interrupted write never leave a partial file at filepath.
 CB_b32 cb_write_entire_file(CB_Str filepath, CB_Str content, CB_Write_Buffer *stderr);
 CB_b32 cb_mkdir_if_not_exists(CB_Str directory, CB_Write_Buffer *stderr);
 CB_b32 cb_rename(CB_Str old_path, CB_Str new_path, CB_Write_Buffer *stderr);
 CB_b32 cb_needs_rebuild(CB_Str output_path,
                         CB_Str *input_paths, CB_size input_paths_len, CB_Write_Buffer *stderr);
+
+//-- Explain
+// While cb_explain is set, cb_needs_rebuild and cb_pool_run log why they
+// rebuild each target, and write it to cb_explain_out if set, a JSON object
+// per line:
+//   {"output":"build/editor.o","reason":"newer-input","input":"editor.c",
+//    "output_mtime_ns":1700000000000000000,"input_mtime_ns":1700000012000000000}
+// Reasons are "missing", "newer-input", "command-changed" (with "old_hash"
+// and "new_hash" of the command line), "dep-ran" (input is the output of a
+// job that ran), "interrupted" (an earlier run started the job but stopped
+// before it finished) and "always".
+typedef enum {
+  CB_EXPLAIN_MISSING,
+  CB_EXPLAIN_NEWER_INPUT,
+  CB_EXPLAIN_COMMAND_CHANGED,
+  CB_EXPLAIN_DEP_RAN,
+  CB_EXPLAIN_INTERRUPTED,
+  CB_EXPLAIN_ALWAYS,
+  CB_EXPLAIN_COUNT,
+} CB_Explain_Reason;
+
+typedef struct CB_Explanation {
+  CB_Explain_Reason reason;
+  CB_Str output;
+  CB_Str input;          // the newer input or the output of the dep that ran
+  CB_i64 output_mtime_ns;
+  CB_i64 input_mtime_ns;
+  CB_u64 old_hash;       // of the command line
+  CB_u64 new_hash;
+} CB_Explanation;
+
+extern CB_b32 cb_explain;
+extern CB_Write_Buffer *cb_explain_out;
+void cb_explain_emit(CB_Explanation e, CB_Write_Buffer *stderr);
 void cb_rebuild_yourself(int argc, char **argv, CB_Str_List sources, CB_b32 force_rebuild, CB_Write_Buffer *stderr);
 
+//-- Recipe Module
+//
+// The recipes, everything under CBUILD_RECIPES in cbuild.c, are compiled into
+// a shared object that the cbuild executable (the driver) loads with dlopen.
+// The driver is linked with -rdynamic and the module resolves the cb_*
+// functions against it, so an edit to a recipe only rebuilds and reloads the
+// module, and the state of the driver (log, scratch arenas, cb_watch) stays.
+// Both are rebuilt when cbuild.h changes, which keeps their structs in sync.
+//
+typedef void CB_Recipes_Run(CB_Arena *perm, CB_Str command, CB_Str_List args, CB_Write_Buffer *stderr);
+
+typedef struct CB_Recipes {
+  void *handle;          // of dlopen, 0 if not loaded
+  CB_Recipes_Run *run;   // the module's run()
+  CB_i64 mtime_ns;       // of the loaded module
+} CB_Recipes;
+
+// Rebuilds module from cbuild.c if it is older than one of sources and loads
+// it, unless the loaded module is still current. 1 if recipes->run is set.
+CB_b32 cb_recipes_load(CB_Recipes *recipes, CB_Str module, CB_Str_List sources, CB_Write_Buffer *stderr);
+void cb_recipes_unload(CB_Recipes *recipes);
+
+CB_Str cb_find_program(CB_Arena *arena, CB_Str name); // searches PATH, empty if not found
+// Hashes the identity of program name as found in PATH (path, size, mtime, inode)
+// to detect upgrades of tools that have no cheap version query.
+CB_u64 cb_hash_program(CB_u64 h, CB_Str name);
+// Writes content to filepath unless it already holds exactly that, keeping the
+// mtime of unchanged files. 1 if written, 0 if unchanged, -1 on error.
+CB_b32 cb_write_file_if_changed(CB_Str filepath, CB_Str content, CB_Write_Buffer *stderr);
+
 #define CB_INVALID_PROC (-1)
 typedef int CB_Proc;
 CB_Proc cb_cmd_run_async(CB_Command command, CB_Write_Buffer *stderr);
 CB_b32 cb_cmd_run_sync(CB_Command command, CB_Write_Buffer* stderr);
 CB_b32 cb_proc_wait(CB_Proc proc, CB_Write_Buffer *stderr);
 
+//-- Process options
+typedef struct {
+  CB_i32 fdin;   // redirect child stdin, 0 to inherit
+  CB_i32 fdout;  // redirect child stdout, 0 to inherit
+  CB_i32 fderr;  // redirect child stderr, 0 to inherit
+  CB_b32 quiet;  // do not echo the command
+  CB_Str cgroup; // cgroup v2 directory the child joins before exec, empty to inherit
+} CB_Cmd_Opt;
+
+CB_Proc cb_cmd_run_opt(CB_Command command, CB_Cmd_Opt opt, CB_Write_Buffer *stderr);
+// Exit status of proc without reporting failures, -1 if it did not exit normally.
+CB_i32  cb_proc_wait_status(CB_Proc proc);
+// Runs command to completion and returns its stdout.
+CB_Read_Result cb_cmd_capture(CB_Arena *arena, CB_Command command, CB_Write_Buffer *stderr);
+
 typedef struct CB_Procs CB_Procs;
 struct CB_Procs {
   CB_Proc *items;
@@ -281,6 +593,405 @@ struct CB_Procs {
   CB_size len;
 };
 
+//-- Static Archive
+//
+// In-process replacement for `ar -r` that writes GNU archives (with a symbol
+// index) directly. Members are streamed into the archive with copy_file_range
+// and the archive is left untouched when no member changed. A member changed
+// if its size or mtime differ from its header or it is newer than the archive.
+// Unchanged members are copied out of the previous archive instead of the
+// object file.
+// A thin archive only references the objects by path and stores no data.
+//
+CB_b32 cb_ar_write(CB_Str archive_path, CB_Str *members, CB_size members_len,
+                   CB_b32 thin, CB_Write_Buffer *stderr);
+
+//-- Toolchain Probe
+//
+// Probes the C compiler `cc` for supported flags, linkers, LTO/PGO support and
+// the host CPU features and writes the results as CB_TC_* #defines to
+// header_path, for recipes to include. The probe only runs again when the
+// toolchain fingerprint changes. The fingerprint is made from the compiler and
+// linker binaries found in PATH (path, size, mtime), so checking a cached probe
+// does not spawn anything.
+//
+CB_b32 cb_toolchain_probe(CB_Str cc, CB_Str header_path, CB_Write_Buffer *stderr);
+
+//-- Distributed Compilation
+//
+// Compile commands of the form `cc <flags> -c <source> -o <object>` can be
+// handed to worker processes, distcc style. The coordinator preprocesses the
+// source locally (so headers never have to exist on the worker), sends the
+// translation unit together with the code generation flags and writes the
+// object file it gets back. Workers run `cbuild --worker <address>`, several
+// workers on one host stand in for remote nodes.
+//
+// Addresses are "unix:<path>" or "tcp:<host>:<port>". Workers only ever run
+// their own compiler and refuse flags that load code or write files, but
+// anyone who can connect can still make them compile. Only listen on trusted
+// networks.
+//
+// cb_dist_run_async forks a child that drives the remote compile so the
+// returned proc is waited on like any other. Compiler diagnostics from the
+// worker are written to the coordinator's stderr.
+//
+CB_Proc cb_dist_run_async(CB_Command command, CB_Str worker, CB_Write_Buffer *stderr);
+// Serves compile requests on address until killed, using compiler cc.
+CB_b32 cb_dist_worker(CB_Str address, CB_Str cc, CB_Write_Buffer *stderr);
+
+//-- Batched File IO
+//
+// Stats or reads many files at once. On Linux the statx, openat, read and
+// close requests of up to CB_IO_URING_ENTRIES files go to the kernel with one
+// io_uring_enter and run at device queue depth, which pays off on network file
+// systems and cold caches. Falls back to stat/open/read for small batches,
+// when the kernel refuses io_uring (too old, seccomp) or when compiled with
+// CB_NO_IO_URING.
+//
+typedef struct CB_File_Info {
+  CB_Str path;
+  CB_i32 error;          // errno of the failed request, 0 on success
+  CB_i64 mtime_ns;       // -1 on error
+  CB_i64 size;
+  CB_Str contents;       // cb_read_files, regular files only, null-terminated
+} CB_File_Info;
+
+// Fills in error, mtime_ns and size of every file.
+void cb_stat_files(CB_File_Info *files, CB_size files_len);
+// Like cb_stat_files and reads the regular files into arena.
+void cb_read_files(CB_Arena *arena, CB_File_Info *files, CB_size files_len);
+
+//-- Include Scanner
+//
+// Finds the headers a source includes, directly or indirectly, without running
+// the compiler. Only `#include`, `#include_next` and `#define NAME <header>`
+// are looked at: conditionals are ignored, so the result is a superset of what
+// the compiler reads. `#include MACRO` resolves to every header the macro is
+// defined as (by -D or any scanned file). Headers are searched like the
+// compiler does, quoted ones next to the including file, then in -iquote and
+// -I directories. Headers not found there (system headers) are left out, like
+// `cc -MM`. Every file is read and tokenized once per scanner, its includes
+// are reused by every source scanned after it.
+//
+typedef struct CB_Include_File {
+  CB_Str path;
+  CB_b32 exists;         // -1 until checked
+  CB_b32 scanned;
+  CB_Str_List includes;  // operands: "<a.h>", "\"a.h\"" or a macro name
+  CB_u32 visit;          // scan that last reached it
+} CB_Include_File;
+
+typedef struct CB_Include_Files {
+  CB_Include_File *items;
+  CB_size capacity;
+  CB_size len;
+} CB_Include_Files;
+
+typedef struct CB_Include_Macro {
+  CB_Str name;
+  CB_Str value;          // operand or the name of another macro
+  CB_size next;          // index + 1 of the next definition of name, 0 if none
+} CB_Include_Macro;
+
+typedef struct CB_Include_Macros {
+  CB_Include_Macro *items;
+  CB_size capacity;
+  CB_size len;
+} CB_Include_Macros;
+
+typedef struct CB_Include_Scanner {
+  CB_Arena *arena;
+  CB_Str_List quote_dirs;   // -iquote
+  CB_Str_List include_dirs; // -I
+  CB_Include_Files files;   // every path looked at
+  CB_Include_Macros macros;
+  CB_Str_Slot *file_slots;  // hash tables of files by path and macros by name
+  CB_Str_Slot *macro_slots;
+  CB_size file_slots_len, macro_slots_len; // power of 2
+  CB_u32 visit;
+} CB_Include_Scanner;
+
+// Scanner for the -I, -iquote and -D flags of command, allocates from arena.
+CB_Include_Scanner cb_include_scanner_init(CB_Arena *arena, CB_Command command);
+// Appends the headers source includes to deps, 0 if source can not be read.
+CB_b32 cb_scan_includes(CB_Include_Scanner *scanner, CB_Str source, CB_Str_List *deps, CB_Write_Buffer *stderr);
+// Prerequisites in the make rules of a depfile, as written by `cc -MD`.
+CB_Str_List cb_parse_depfile(CB_Arena *arena, CB_Str depfile);
+
+//-- Job Pool
+//
+// Runs a graph of jobs in parallel without overcommitting memory. A job
+// depends on the earlier jobs whose output is one of its inputs and runs once
+// they are done, if one of them ran, if an input is newer than its output, or
+// if it is marked `always`.
+//
+// Duration and peak RSS of every job are recorded in a log keyed by the job's
+// output, like .ninja_log. Ready jobs start longest critical path first, i.e.
+// by their predicted duration plus the longest chain of jobs waiting on them,
+// so long jobs do not end up alone at the tail of the build. A job only starts
+// while the predicted peak RSS of all running jobs fits in memory_budget, and
+// always starts when nothing else is running. Jobs without history are
+// predicted as the mean of the log.
+//
+// With cgroup_limit set, every job runs in its own cgroup v2 whose memory.max
+// is cgroup_limit times its recorded peak, so a runaway job is OOM-killed on
+// its own instead of the container. cbuild moves itself into a leaf cgroup to
+// enable the memory controller for its children, which needs a delegated
+// cgroup (e.g. `systemd-run --user --scope -p Delegate=yes ./cbuild`).
+//
+typedef CB_b32 CB_Job_Fn(void *data, CB_Write_Buffer *stderr);
+
+// A task job's function and the state it resumes from, see Tasks.
+typedef enum CB_Task_Status {
+  CB_TASK_FAILED,
+  CB_TASK_DONE,
+  CB_TASK_AWAIT,
+} CB_Task_Status;
+
+typedef struct CB_Task {
+  CB_i32 line;           // where to resume, 0 to start
+  CB_i32 status;         // result of the last await
+  CB_Command await_cmd;  // what the task returned CB_TASK_AWAIT for
+  CB_Str await_output;
+} CB_Task;
+
+typedef CB_Task_Status CB_Task_Fn(CB_Task *task, void *data, CB_Write_Buffer *stderr);
+
+typedef struct CB_Job_Ids {
+  CB_size *items;
+  CB_size capacity;
+  CB_size len;
+} CB_Job_Ids;
+
+typedef struct CB_Job {
+  CB_Command cmd;
+  CB_Job_Fn *fn;         // runs in-process instead of cmd if set
+  CB_Task_Fn *task_fn;   // or runs as a task
+  void *data;            // for fn and task_fn, must live until cb_pool_run returns
+  CB_Str output;         // identifies the job in the log
+  CB_Str_List inputs;
+  CB_b32 always;         // run even if output is up to date
+  CB_b32 restat;         // jobs waiting on this one only count it as rebuilt if it touched output
+  CB_Str worker;         // compile on this cbuild worker if set, see cb_dist_run_async
+  CB_Str stderr_path;    // the command's stderr goes to this file if set
+  CB_b32 capture_stdout; // and its stdout too
+  CB_i64 timeout_ms;     // the command is killed after running this long, 0 for no limit
+  CB_b32 atomic;         // writes <output>.tmp in place of its output argument, renamed over output
+                         // once it succeeded. Not for compilers naming their .dwo or .i after -o.
+
+  CB_size id;            // index in pool->jobs, set by the push
+
+  // Set by cb_pool_run
+  CB_Proc proc;
+  CB_i32 status;         // exit status, -1 if it did not run or was killed
+  CB_b32 ran;
+  CB_b32 timed_out;      // killed after timeout_ms
+  CB_b32 skipped;        // not run because a job it waits on failed, see keep_going
+  CB_i64 predicted_rss;  // bytes
+  CB_i64 peak_rss;       // bytes, measured, 0 if unknown
+  CB_i64 duration_ms;    // measured
+  CB_i64 critical_path;  // predicted ms of this job and the longest chain of jobs waiting on it
+  CB_i64 start_ns;
+  CB_Str tmp_output;     // where the command writes output, renamed over it if it succeeds
+  CB_i64 output_mtime_ns; // before the run, for restat
+  CB_File_Info *files;   // output and inputs, stat'ed in one batch before the run
+  CB_Path_Id output_id;  // interned in pool->paths by the push
+  CB_Path_Id *input_ids; // by cb_pool_run
+  CB_Str cgroup;
+  CB_Job_Ids deps;       // earlier jobs making our inputs
+  CB_Job_Ids dependents;
+  CB_size pending;       // deps not done yet
+  CB_u32 state;
+  CB_Task task;
+  CB_size awaiting;      // job the task awaits the output of
+  CB_Job_Ids awaiters;   // tasks awaiting this job
+} CB_Job;
+
+typedef struct CB_Jobs { // segmented, a job does not move while more are pushed
+  CB_Job *blocks[CB_SEG_BLOCKS];
+  CB_size len;
+} CB_Jobs;
+
+typedef struct CB_Job_Record {
+  CB_Str output;
+  CB_i64 duration_ms;
+  CB_i64 peak_rss;       // bytes
+  CB_u64 cmd_hash;       // of the last successful command, 0 if unknown
+  CB_b32 unfinished;     // started but not finished successfully, see the journal
+} CB_Job_Record;
+
+typedef struct CB_Job_Log {
+  CB_Job_Record *items;
+  CB_size capacity;
+  CB_size len;
+} CB_Job_Log;
+
+typedef struct CB_Dir_Listing {
+  CB_Str path;
+  CB_i64 mtime_ns;
+  CB_Str_List entries;   // sorted names, directories end in '/'
+} CB_Dir_Listing;
+
+typedef struct CB_Dir_Cache {
+  CB_Dir_Listing *items;
+  CB_size capacity;
+  CB_size len;
+} CB_Dir_Cache;
+
+typedef struct CB_Pool {
+  CB_Arena *arena;
+  CB_Str log_path;
+  CB_Str journal_path;   // log_path + ".journal"
+  CB_i32 journal;        // its fd while running, -1 otherwise
+  CB_i32 lock;           // fd of log_path + ".lock" while this process holds it, -1 otherwise
+  CB_Job_Log log;
+  CB_Path_Table paths;   // outputs and inputs of the jobs, and the outputs in the log
+  CB_Job_Ids record_of;  // index + 1 in log by path id, 0 if none
+  CB_Job_Ids job_of;     // index + 1 in jobs by output id, stale after a run
+  CB_Str_List conflicts; // outputs pushed with different jobs since the last run
+  CB_Dir_Cache dirs;     // for cb_glob, kept in the log
+  CB_Job_Ids dir_of;     // index + 1 in dirs by path id, 0 if none
+  CB_Str_List glob_ignore; // directory names "**" does not descend into
+  CB_Jobs jobs;
+  CB_Job_Ids ready;      // heap of the READY jobs, longest critical path on top
+  CB_Job_Ids unfit;      // heap of the READY jobs that did not fit in memory, smallest first
+  CB_Job_Ids resume;     // RESUME tasks in the order their await finished, from resume_next
+  CB_size resume_next;
+  CB_Job_Ids running;    // the RUNNING jobs, for wait4 and the timeouts
+  CB_size max_jobs;      // defaults to the number of cpus + 2
+  CB_i64 memory_budget;  // bytes, defaults to cb_available_memory()
+  CB_i64 cgroup_limit;   // 0 to run jobs in cbuild's cgroup
+  CB_b32 keep_going;     // start new jobs after a failure, except those waiting on it
+} CB_Pool;
+
+// Loads the log at log_path, the pool allocates from arena. Runs of other
+// processes on the same log wait for this pool: it holds a lock from here until
+// cb_pool_run has written the log.
+CB_Pool cb_pool_init(CB_Arena *arena, CB_Str log_path, CB_Write_Buffer *stderr);
+// Copies cmd, output and inputs. The job pointer is valid until cb_pool_run
+// returns, what the run set stays readable until the next push. Pushing the
+// same output with the same command line, fn or task_fn and the same inputs
+// again returns the job pushed first, so recipes shared by several builds in
+// one run (e.g. a shader header of every variant) make it once. The data of
+// fn and task_fn must follow from them, output and inputs, the second data is
+// not used. Pushing a different job for an output is an error cb_pool_run
+// reports, it then runs nothing.
+CB_Job *cb_pool_push(CB_Pool *pool, CB_Command cmd, CB_Str output, CB_Str *inputs, CB_size inputs_len);
+CB_Job *cb_pool_push_fn(CB_Pool *pool, CB_Job_Fn *fn, void *data, CB_Str output, CB_Str *inputs, CB_size inputs_len);
+// Runs the pushed jobs and writes the log, 1 if all succeeded. No new jobs are
+// started after a failure unless keep_going is set. Clears the jobs. A job
+// runs if it is always run, a job making one of its inputs ran, its output is
+// missing or older than an input, its command line differs from the last
+// successful one, or a run that was interrupted or failed started it. An
+// atomic command passing its output as an argument writes <output>.tmp
+// instead, which is renamed over output once the command succeeded.
+CB_b32 cb_pool_run(CB_Pool *pool, CB_Write_Buffer *stderr);
+// Paths matching pattern, e.g. "src/**/*.c", in directory order. "*" and "?"
+// match within a path component, "**" matches any number of directories and
+// does not descend into pool->glob_ignore. Wildcards do not match names
+// starting with '.' and symlinks are not followed. Directories are read with
+// getdents64 and their listings cached in the pool's log, so later runs only
+// stat a directory unless its mtime changed. Allocates from pool->arena.
+CB_Str_List cb_glob(CB_Pool *pool, CB_Str pattern, CB_Write_Buffer *stderr);
+// Bytes of memory cbuild may still use: MemAvailable or the room left below
+// the cgroup's memory limit, whichever is lower. -1 if unknown.
+CB_i64 cb_available_memory(void);
+
+//-- Tasks
+//
+// Stackless coroutines (protothreads) for recipes that wait in the middle,
+// e.g. run a command, look at what it wrote, then run the next one. A task is
+// a pool job whose function the pool calls again whenever what it awaits is
+// done, so tasks overlap with each other and with the other jobs while the
+// recipe still reads top to bottom. Locals do not survive an await, keep them
+// in data, and do not await inside a switch statement.
+//
+//   CB_Task_Status probe_task(CB_Task *t, void *data, CB_Write_Buffer *stderr)
+//   {
+//     Probe *p = data;
+//     CB_TASK_BEGIN(t);
+//     CB_AWAIT_CMD(t, p->cmd);                 // t->status is its exit status
+//     if (t->status != 0) { CB_TASK_FAIL(t); }
+//     CB_AWAIT_OUTPUT(t, S("build/foo.o"));    // t->status is 0 if that job succeeded
+//     CB_TASK_END(t);
+//   }
+//
+#define CB_TASK_BEGIN(t) switch ((t)->line) { case 0:
+#define CB_TASK_END(t)   } (t)->line = -1; return CB_TASK_DONE
+#define CB_TASK_FAIL(t)  do { (t)->line = -1; return CB_TASK_FAILED; } while (0)
+#define CB_AWAIT_CMD(t, cmd) do {                                  \
+    (t)->await_cmd = (cmd);                                        \
+    (t)->await_output = (CB_Str){0};                               \
+    (t)->line = __LINE__; return CB_TASK_AWAIT; case __LINE__:;    \
+  } while (0)
+#define CB_AWAIT_OUTPUT(t, output) do {                            \
+    (t)->await_cmd = (CB_Command){0};                              \
+    (t)->await_output = (output);                                  \
+    (t)->line = __LINE__; return CB_TASK_AWAIT; case __LINE__:;    \
+  } while (0)
+
+// Pushes a job running fn as a task, like cb_pool_push_fn. Its commands take a
+// job slot while they run, awaiting another job does not. A task awaiting a
+// job that waits on the task does not run.
+CB_Job *cb_pool_push_task(CB_Pool *pool, CB_Task_Fn *fn, void *data, CB_Str output, CB_Str *inputs, CB_size inputs_len);
+
+//-- Test Runner
+//
+// Runs test executables as pool jobs, along with the jobs pushed before, e.g.
+// those building the tests. Tests run in parallel under pool->max_jobs, the
+// slowest first by their durations in the pool's log, and every test runs even
+// after one failed. A test's stdout and stderr go to <dir>/<name>.log, which
+// is printed if it fails, and it is killed once it runs past its timeout. With
+// shards set only the tests whose name hashes to shard modulo shards run, so CI
+// nodes split the tests between them and a new test does not move the others.
+//
+typedef struct CB_Test {
+  CB_Str name;
+  CB_Command cmd;        // cmd.items[0] is an input of the test's job
+  CB_i64 timeout_ms;     // 0 for the default of the run
+
+  // Set by cb_run_tests
+  CB_b32 ran;            // 0 if it is in another shard or what it waits on failed
+  CB_i32 status;         // exit status, -1 if killed
+  CB_b32 timed_out;
+  CB_i64 duration_ms;
+} CB_Test;
+
+typedef struct CB_Tests {
+  CB_Test *items;
+  CB_size capacity;
+  CB_size len;
+} CB_Tests;
+
+typedef struct CB_Test_Options {
+  CB_Str dir;            // where the logs go
+  CB_i64 timeout_ms;     // for tests without one, 0 for no limit
+  CB_size shard;         // run shard of shards, shards 0 to run all
+  CB_size shards;
+} CB_Test_Options;
+
+// Reads `--shard=<i>/<n>` and `--timeout=<ms>` into options, 0 on any other argument.
+CB_b32 cb_test_parse_args(CB_Str_List args, CB_Test_Options *options, CB_Write_Buffer *stderr);
+// Runs the tests of this shard, 1 if all of them passed.
+CB_b32 cb_run_tests(CB_Pool *pool, CB_Tests *tests, CB_Test_Options options, CB_Write_Buffer *stderr);
+
+//-- Watch
+//
+// `./cbuild watch` stays resident and reruns the build when one of its sources
+// changes. While cb_watch is set, cb_pool_run adds the inputs of its jobs that
+// no job makes, i.e. the sources, to cb_watch->paths.
+//
+typedef struct CB_Watch {
+  CB_Arena *arena;       // for paths
+  CB_Str_List paths;
+} CB_Watch;
+
+extern CB_Watch *cb_watch;
+// Blocks until one of watch->paths is written, replaced, deleted or touched and
+// then until the writes settle. Watches their directories with inotify, so
+// editors that save by renaming a temporary file are seen. 0 on error.
+CB_b32 cb_watch_wait(CB_Watch *watch, CB_Write_Buffer *stderr);
+
 
 #ifdef CBUILD_IMPLEMENTATION
 
@@ -344,6 +1055,45 @@ CB_Str cb_str_chop_right(CB_Str str, unsigned char delim)
   return result;
 }
 
+CB_size cb_str_find(CB_Str haystack, CB_Str needle)
+{
+  for (CB_size i = 0; i + needle.len <= haystack.len; i++) {
+    if (cb_str_equals((CB_Str){ .buf = haystack.buf + i, .len = needle.len, }, needle)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+CB_b32 cb_str_starts_with(CB_Str str, CB_Str prefix)
+{
+  if (str.len < prefix.len) { return 0; }
+  return cb_str_equals((CB_Str){ .buf = str.buf, .len = prefix.len, }, prefix);
+}
+
+CB_i64 cb_str_parse_int(CB_Str str, CB_size *len)
+{
+  CB_i64 result = 0;
+  CB_size i = 0;
+  CB_b32 negative = (str.len > 0 && str.buf[0] == '-');
+  if (negative) { i++; }
+  CB_size digits = i;
+  for (; i < str.len && str.buf[i] >= '0' && str.buf[i] <= '9'; i++) {
+    result = result * 10 + (str.buf[i] - '0');
+  }
+  if (len) { *len = (i == digits) ? 0 : i; }
+  return negative ? -result : result;
+}
+
+CB_u64 cb_hash_str(CB_u64 h, CB_Str s)
+{
+  for (CB_size i = 0; i < s.len; i++) {
+    h ^= s.buf[i];
+    h *= 0x100000001b3ull;
+  }
+  return h;
+}
+
 CB_Str_List cb_str_dup_list_(CB_Arena *arena, const char *cstrs[], CB_size len)
 {
   CB_Str_List result = cb_da_init(arena, CB_Str_List, 32);
@@ -353,6 +1103,134 @@ CB_Str_List cb_str_dup_list_(CB_Arena *arena, const char *cstrs[], CB_size len)
   return result;
 }
 
+//-- Path Implementation
+
+CB_Str cb_path_dirname(CB_Str path)
+{
+  CB_size i = path.len;
+  while (i > 0 && path.buf[i - 1] != '/') { i--; }
+  if (i == 0) { return S("."); }
+  return (CB_Str){ .buf = path.buf, .len = CB_max(i - 1, 1), }; // "/b.c" keeps its "/"
+}
+
+CB_Str cb_path_basename(CB_Str path)
+{
+  CB_size i = path.len;
+  while (i > 0 && path.buf[i - 1] != '/') { i--; }
+  return (CB_Str){ .buf = path.buf + i, .len = path.len - i, };
+}
+
+CB_Str cb_path_extension(CB_Str path)
+{
+  CB_Str name = cb_path_basename(path);
+  for (CB_size i = name.len - 1; i > 0; i--) {
+    if (name.buf[i] == '.') { return (CB_Str){ .buf = name.buf + i, .len = name.len - i, }; }
+  }
+  return (CB_Str){ .buf = name.buf + name.len, .len = 0, };
+}
+
+CB_Str cb_path_stem(CB_Str path)
+{
+  CB_Str name = cb_path_basename(path);
+  name.len -= cb_path_extension(name).len;
+  return name;
+}
+
+CB_Str cb_path_normalize(CB_Arena *arena, CB_Str path)
+{
+  CB_u8 *out = new(arena, CB_u8, path.len + 2);
+  CB_size len = 0;
+  CB_size fixed = 0; // leading "/" and "../" that can not be removed
+  if (path.len > 0 && path.buf[0] == '/') { out[len++] = '/'; fixed = 1; }
+  while (path.len > 0) {
+    CB_Str part = path;
+    for (part.len = 0; part.len < path.len && path.buf[part.len] != '/'; part.len++) {}
+    path.buf += CB_min(part.len + 1, path.len);
+    path.len -= CB_min(part.len + 1, path.len);
+
+    if (part.len == 0 || cb_str_equals(part, S("."))) { continue; }
+    if (cb_str_equals(part, S("..")) && len > fixed) {
+      while (len > fixed && out[len - 1] != '/') { len--; }
+      if (len > fixed) { len--; }
+      else if (fixed == 0) { len = 0; }
+      continue;
+    }
+    if (cb_str_equals(part, S("..")) && fixed == 1 && out[0] == '/') { continue; } // "/.." is "/"
+    if (len > 0 && out[len - 1] != '/') { out[len++] = '/'; }
+    CB_memcpy(out + len, part.buf, (CB_usize)part.len);
+    len += part.len;
+    if (cb_str_equals(part, S(".."))) { fixed = len; }
+  }
+  if (len == 0) { out[len++] = '.'; }
+  out[len] = 0;
+  return (CB_Str){ .buf = out, .len = len, };
+}
+
+CB_Str cb_path_join(CB_Arena *arena, CB_Str dir, CB_Str name)
+{
+  if (dir.len == 0 || (name.len > 0 && name.buf[0] == '/')) { return cb_path_normalize(arena, name); }
+  CB_Arena_Mark scratch = cb_arena_get_scratch(&arena, 1);
+  CB_Write_Buffer *b = cb_mem_buffer(scratch.arena, dir.len + name.len + 1);
+  cb_append(b, dir, S("/"), name);
+  CB_Str result = cb_path_normalize(arena, (CB_Str){ .buf = b->buf, .len = b->len, });
+  cb_arena_pop_mark(scratch);
+  return result;
+}
+
+// Slot of key in an open addressing table growing at half load. A free slot
+// (value 0) is for the caller to fill in with a key that outlives the table.
+static CB_Str_Slot *cb_str_slot_(CB_Arena *arena, CB_Str_Slot **slots, CB_size *slots_len, CB_size used, CB_Str key)
+{
+  if (2 * (used + 1) > *slots_len) {
+    CB_size len = CB_max(*slots_len * 2, 256);
+    CB_Str_Slot *grown = new(arena, CB_Str_Slot, len);
+    for (CB_size i = 0; i < *slots_len; i++) {
+      CB_Str_Slot *old = (*slots) + i;
+      if (old->value == 0) { continue; }
+      CB_u64 j = cb_hash_str(CB_HASH_INIT, old->key);
+      while (grown[j & (CB_u64)(len - 1)].value != 0) { j++; }
+      grown[j & (CB_u64)(len - 1)] = *old;
+    }
+    *slots = grown;
+    *slots_len = len;
+  }
+  CB_u64 mask = (CB_u64)(*slots_len - 1);
+  for (CB_u64 j = cb_hash_str(CB_HASH_INIT, key);; j++) {
+    CB_Str_Slot *slot = (*slots) + (j & mask);
+    if (slot->value == 0 || cb_str_equals(slot->key, key)) { return slot; }
+  }
+}
+
+CB_Path_Table cb_path_table_init(CB_Arena *arena)
+{
+  CB_Path_Table result = {0};
+  result.arena = arena;
+  result.paths = cb_da_init(arena, CB_Str_List, 256);
+  return result;
+}
+
+CB_Path_Id cb_path_intern(CB_Path_Table *table, CB_Str path)
+{
+  CB_Arena_Mark scratch = cb_arena_get_scratch(&table->arena, 1);
+  CB_Str key = cb_path_normalize(scratch.arena, path);
+  CB_Str_Slot *slot = cb_str_slot_(table->arena, &table->slots, &table->slots_len, table->paths.len, key);
+  if (slot->value == 0) {
+    CB_assert(table->paths.len < UINT32_MAX);
+    CB_u8 *copy = new(table->arena, CB_u8, key.len + 1);
+    CB_memcpy(copy, key.buf, (CB_usize)key.len);
+    slot->key = (CB_Str){ .buf = copy, .len = key.len, };
+    *(cb_da_push(table->arena, &table->paths)) = slot->key;
+    slot->value = table->paths.len;
+  }
+  cb_arena_pop_mark(scratch);
+  return (CB_Path_Id)slot->value;
+}
+
+CB_Str cb_path_of(CB_Path_Table *table, CB_Path_Id id)
+{
+  CB_assert(id > 0 && id <= table->paths.len);
+  return table->paths.items[id - 1];
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 //- Arena Allocator Implementation
@@ -366,25 +1244,187 @@ CB_Str_List cb_str_dup_list_(CB_Arena *arena, const char *cstrs[], CB_size len)
 #  define ASAN_UNPOISON_MEMORY_REGION(addr, size) ((void)(addr), (void)(size))
 #endif
 
-CB_Arena cb_arena_init(CB_u8 *backing, CB_size capacity)
+#if defined(CB_ARENA_TELEMETRY)
+#include <pthread.h> // pthread_atfork
+#include <stdio.h> // snprintf
+#include <unistd.h> // getpid
+
+// Call site of the allocation in progress, set by the *_at functions
+static __thread const char *cb_arena_site_file_;
+static __thread CB_i32 cb_arena_site_line_;
+static CB_Arena_Stats *cb_arena_stats_list_;
+static CB_i32 cb_arena_stats_pid_;
+static char cb_arena_stats_locked_; // guards the stats and the list
+
+static void cb_arena_stats_lock_(void)
+{
+  while (__atomic_test_and_set(&cb_arena_stats_locked_, __ATOMIC_ACQUIRE)) {}
+}
+
+static void cb_arena_stats_unlock_(void)
+{
+  __atomic_clear(&cb_arena_stats_locked_, __ATOMIC_RELEASE);
+}
+
+static void cb_arena_report_at_exit_(void)
+{
+  // Forked children that exit without exec inherit the handler, report once
+  if (getpid() == cb_arena_stats_pid_) { cb_arena_report(2); }
+}
+
+static CB_Arena_Stats *cb_arena_stats_new_(CB_size capacity)
+{
+  CB_Arena_Stats *stats = calloc(1, sizeof(CB_Arena_Stats));
+  CB_assert(stats);
+  stats->file = cb_arena_site_file_ ? cb_arena_site_file_ : "?";
+  stats->line = cb_arena_site_line_;
+  stats->capacity = capacity;
+  cb_arena_stats_lock_();
+  stats->next = cb_arena_stats_list_;
+  cb_arena_stats_list_ = stats;
+  if (!stats->next) {
+    cb_arena_stats_pid_ = getpid();
+    atexit(cb_arena_report_at_exit_);
+    // Not held by a thread the child does not have
+    pthread_atfork(cb_arena_stats_lock_, cb_arena_stats_unlock_, cb_arena_stats_unlock_);
+  }
+  cb_arena_stats_unlock_();
+  return stats;
+}
+
+static void cb_arena_stats_record_(CB_Arena *a, CB_size bytes)
+{
+  CB_Arena_Stats *stats = a->stats;
+  if (!stats) { return; }
+  cb_arena_stats_lock_();
+  stats->peak = CB_max(stats->peak, a->at - a->backing);
+  stats->count++;
+  stats->bytes += bytes;
+
+  CB_Arena_Site *site = &stats->other;
+  CB_u64 h = (CB_u64)(CB_uptr)cb_arena_site_file_ * 31 + (CB_u64)cb_arena_site_line_;
+  for (CB_size i = 0; i < CB_ARENA_SITES; i++, h++) {
+    CB_Arena_Site *it = stats->sites + (h % CB_ARENA_SITES);
+    if (it->count == 0) {
+      it->file = cb_arena_site_file_ ? cb_arena_site_file_ : "?";
+      it->line = cb_arena_site_line_;
+    }
+    if (it->line == cb_arena_site_line_ && (it->file == cb_arena_site_file_ || !cb_arena_site_file_)) {
+      site = it;
+      break;
+    }
+  }
+  site->count++;
+  site->bytes += bytes;
+  cb_arena_stats_unlock_();
+  cb_arena_site_file_ = 0;
+  cb_arena_site_line_ = 0;
+}
+
+static void cb_arena_report_one_(CB_i32 fd, CB_Arena_Stats *stats)
+{
+  char line[512];
+  int len = snprintf(line, sizeof(line),
+                     "[ARENA]: %s:%d: peak %lld of %lld KiB (%.1f%%), %lld allocations, %lld KiB requested%s\n",
+                     stats->file, stats->line,
+                     (long long)stats->peak / 1024, (long long)stats->capacity / 1024,
+                     100.0 * (double)stats->peak / (double)CB_max(stats->capacity, 1),
+                     (long long)stats->count, (long long)stats->bytes / 1024,
+                     stats->freed ? ", freed" : "");
+  cb_write(fd, (CB_u8 *)line, CB_min(len, CB_sizeof(line) - 1));
+
+  // Biggest sites first, selected in place from the table
+  CB_b32 shown[CB_ARENA_SITES + 1] = {0};
+  for (CB_size n = 0; n < 8; n++) {
+    CB_Arena_Site *best = 0;
+    CB_size best_index = 0;
+    for (CB_size i = 0; i <= CB_ARENA_SITES; i++) {
+      CB_Arena_Site *it = (i < CB_ARENA_SITES) ? stats->sites + i : &stats->other;
+      if (shown[i] || it->count == 0) { continue; }
+      if (!best || it->bytes > best->bytes) { best = it; best_index = i; }
+    }
+    if (!best) { break; }
+    shown[best_index] = 1;
+    len = snprintf(line, sizeof(line), "[ARENA]:   %10lld KiB %8lld x  %s:%d\n",
+                   (long long)best->bytes / 1024, (long long)best->count,
+                   best == &stats->other ? "other sites" : best->file, best->line);
+    cb_write(fd, (CB_u8 *)line, CB_min(len, CB_sizeof(line) - 1));
+  }
+}
+
+void cb_arena_report(CB_i32 fd)
+{
+  cb_arena_stats_lock_();
+  for (CB_Arena_Stats *stats = cb_arena_stats_list_; stats; stats = stats->next) {
+    if (stats->count > 0) { cb_arena_report_one_(fd, stats); }
+  }
+  cb_arena_stats_unlock_();
+}
+
+CB_Arena *cb_alloc_arena_at(CB_size capacity, const char *file, CB_i32 line)
+{
+  cb_arena_site_file_ = file;
+  cb_arena_site_line_ = line;
+  return (cb_alloc_arena)(capacity);
+}
+
+CB_Arena cb_arena_init_at(CB_u8 *backing, CB_size capacity, const char *file, CB_i32 line)
+{
+  cb_arena_site_file_ = file;
+  cb_arena_site_line_ = line;
+  return (cb_arena_init)(backing, capacity);
+}
+
+CB_u8 *cb_arena_alloc_at(CB_Arena *a, CB_size objsize, CB_size align, CB_size count, const char *file, CB_i32 line)
+{
+  cb_arena_site_file_ = file;
+  cb_arena_site_line_ = line;
+  return (cb_arena_alloc)(a, objsize, align, count);
+}
+
+void cb_da_grow_at(CB_Arena *arena, void **items,
+                   CB_size *__restrict capacity, CB_size *__restrict len,
+                   CB_size item_size, CB_size align, const char *file, CB_i32 line)
+{
+  cb_arena_site_file_ = file;
+  cb_arena_site_line_ = line;
+  (cb_da_grow)(arena, items, capacity, len, item_size, align);
+}
+#endif // CB_ARENA_TELEMETRY
+
+// Names in parentheses are not expanded by the CB_ARENA_TELEMETRY macros
+CB_Arena (cb_arena_init)(CB_u8 *backing, CB_size capacity)
 {
   CB_assert(backing);
   CB_assert(capacity > 0);
   CB_Arena result = {0};
   result.at = result.backing = backing;
   result.capacity = capacity;
+#if defined(CB_ARENA_TELEMETRY)
+  result.stats = cb_arena_stats_new_(capacity);
+#endif
   ASAN_POISON_MEMORY_REGION(backing, (CB_usize)capacity);
   return result;
 }
 
 __attribute__((malloc, alloc_size(2,4), alloc_align(3)))
-CB_u8 *cb_arena_alloc(CB_Arena *a, CB_size objsize, CB_size align, CB_size count)
+CB_u8 *(cb_arena_alloc)(CB_Arena *a, CB_size objsize, CB_size align, CB_size count)
 {
   CB_assert(a->at >= a->backing);
   CB_size avail = (a->backing + a->capacity) - a->at;
   CB_size padding = -(CB_size)((CB_uptr)a->at) & (align - 1);
   CB_size total   = padding + objsize * count;
   if (avail < total) {
+#if defined(CB_ARENA_TELEMETRY)
+    char line[512];
+    int len = snprintf(line, sizeof(line), "[ARENA]: %s:%d: Out of memory allocating %lld bytes in the arena from %s:%d, %lld available\n",
+                       cb_arena_site_file_ ? cb_arena_site_file_ : "?", cb_arena_site_line_, (long long)total,
+                       a->stats ? a->stats->file : "?", a->stats ? a->stats->line : 0, (long long)avail);
+    cb_write(2, (CB_u8 *)line, CB_min(len, CB_sizeof(line) - 1));
+    // The report runs at exit. Exit before CB_assert, which tells the compiler
+    // this branch is unreachable.
+    cb_exit(1);
+#endif
     CB_assert(0 && "Out of memory");
     cb_write(2, (CB_u8 *)"Out of Memory", 13);
     cb_exit(1);
@@ -392,6 +1432,9 @@ CB_u8 *cb_arena_alloc(CB_Arena *a, CB_size objsize, CB_size align, CB_size count
 
   CB_u8 *p = a->at + padding;
   a->at += total;
+#if defined(CB_ARENA_TELEMETRY)
+  cb_arena_stats_record_(a, objsize * count);
+#endif
   ASAN_UNPOISON_MEMORY_REGION(p, (CB_usize)(objsize * count));
 
   CB_memset(p, 0, (CB_usize)(objsize * count));
@@ -406,11 +1449,11 @@ void cb_arena_reset(CB_Arena *a)
   a->at = a->backing + sizeof(*a);
 }
 
-CB_Arena *cb_alloc_arena(CB_size capacity)
+CB_Arena *(cb_alloc_arena)(CB_size capacity)
 {
   CB_Arena *result = 0;
   CB_u8 *mem = cb_malloc(capacity);
-  CB_Arena temp = cb_arena_init(mem, capacity);
+  CB_Arena temp = (cb_arena_init)(mem, capacity);
   result = new(&temp, CB_Arena, 1);
   *result = temp;
   return result;
@@ -419,6 +1462,13 @@ CB_Arena *cb_alloc_arena(CB_size capacity)
 void cb_free_arena(CB_Arena *arena)
 {
   CB_u8 *to_free = arena->backing;
+#if defined(CB_ARENA_TELEMETRY)
+  if (arena->stats) {
+    cb_arena_stats_lock_();
+    arena->stats->freed = 1;
+    cb_arena_stats_unlock_();
+  }
+#endif
   CB_memset(arena, 0, sizeof(*arena));
   cb_mfree(to_free);
 }
@@ -440,6 +1490,39 @@ void cb_arena_pop_mark(CB_Arena_Mark a)
   a.arena->at = a.marker;
 }
 
+__attribute__((malloc, alloc_size(2,4), alloc_align(3)))
+CB_u8 *cb_arena_alloc_atomic(CB_Arena *a, CB_size objsize, CB_size align, CB_size count)
+{
+  // Multiples of 8 bytes, so two threads never (un)poison the same ASan shadow byte
+  align = CB_max(align, 8);
+  CB_size size = (objsize * count + 7) & ~(CB_size)7;
+  CB_u8 *p = 0;
+  CB_u8 *at = __atomic_load_n(&a->at, __ATOMIC_RELAXED);
+  do {
+    CB_size padding = -(CB_size)((CB_uptr)at) & (align - 1);
+    if ((a->backing + a->capacity) - at < padding + size) {
+      // Not cb_exit, a worker thread cannot longjmp to the main thread's cb_exit_jump
+      cb_write(2, (CB_u8 *)"Out of Memory", 13);
+      exit(1);
+    }
+    p = at + padding;
+  } while (!__atomic_compare_exchange_n(&a->at, &at, p + size, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+  ASAN_UNPOISON_MEMORY_REGION(p, (CB_usize)(objsize * count));
+  CB_memset(p, 0, (CB_usize)(objsize * count));
+  return p;
+}
+
+CB_Arena cb_arena_reserve(CB_Arena *a, CB_size capacity)
+{
+  CB_Arena result = {0};
+  result.at = result.backing = cb_arena_alloc_atomic(a, 1, 8, capacity);
+  result.capacity = capacity;
+  // Handed out poisoned, the owner's cb_arena_alloc unpoisons what it uses
+  ASAN_POISON_MEMORY_REGION(result.backing, (CB_usize)capacity);
+  return result;
+}
+
 static __thread CB_Arena *g_thread_scratch_pool[SCRATCH_ARENA_COUNT] = {0, 0};
 
 static CB_Arena *cb_arena_get_scratch_(CB_Arena **conflicts, CB_size conflicts_len)
@@ -489,6 +1572,7 @@ void cb_free_scratch_pool(void)
     CB_Arena *a = g_thread_scratch_pool[i];
     if (a) {
       cb_mfree(a->backing);
+      g_thread_scratch_pool[i] = 0;
     }
   }
 }
@@ -557,6 +1641,16 @@ void cb_append_long(CB_Write_Buffer *b, long x)
   cb_append_bytes(b, beg, end-beg);
 }
 
+void cb_append_hex(CB_Write_Buffer *b, CB_u64 x)
+{
+  unsigned char tmp[16];
+  for (CB_i32 i = 15; i >= 0; i--) {
+    tmp[i] = (unsigned char)"0123456789abcdef"[x & 0xf];
+    x >>= 4;
+  }
+  cb_append_bytes(b, tmp, CB_sizeof(tmp));
+}
+
 void cb_append_strs(CB_Write_Buffer *b, CB_Str *strs, CB_size strs_len)
 {
   for (CB_size i = 0; i < strs_len; i++) {
@@ -565,11 +1659,21 @@ void cb_append_strs(CB_Write_Buffer *b, CB_Str *strs, CB_size strs_len)
   }
 }
 
+// The fd whose flushes go through the log ring, see cb_log_start_async
+static CB_i32 cb_log_ring_fd_ = -1;
+static void cb_log_ring_push_(CB_u8 *bytes, CB_size len);
+
 void cb_flush(CB_Write_Buffer *b)
 {
   b->error |= b->fd < 0;
   if (!b->error && b->len) {
-    b->error |= !cb_write(b->fd, b->buf, b->len);
+    if (b->fd == __atomic_load_n(&cb_log_ring_fd_, __ATOMIC_RELAXED)) {
+      cb_log_ring_push_(b->buf, b->len);
+    }
+    else {
+      b->error |= !cb_write(b->fd, b->buf, b->len);
+    }
+    b->flushed += b->len;
     b->len = 0;
   }
 }
@@ -602,32 +1706,69 @@ CB_Str cb_str_from_mark(CB_Str_Mark *mark)
 ////////////////////////////////////////////////////////////////////////////////
 //- Dynamic Array Implemntation
 
-void cb_da_grow(CB_Arena *arena, void ** items,
-                CB_size *__restrict capacity, CB_size *__restrict len,
-                CB_size item_size, CB_size align)
+void (cb_da_grow)(CB_Arena *arena, void ** items,
+                  CB_size *__restrict capacity, CB_size *__restrict len,
+                  CB_size item_size, CB_size align)
 {
   CB_assert(*items != 0 && *capacity > 0);
   CB_u8 *items_end = (((CB_u8*)(*items)) + (item_size * (*len)));
   if (arena->at == items_end) {
     // Extend in place, no allocation occured between da_grow calls
-    cb_arena_alloc(arena, item_size, align, (*capacity));
+    (cb_arena_alloc)(arena, item_size, align, (*capacity));
     *capacity *= 2;
   }
   else {
     // Relocate array
-    CB_u8 *p = cb_arena_alloc(arena, item_size, align, (*capacity) * 2);
+    CB_u8 *p = (cb_arena_alloc)(arena, item_size, align, (*capacity) * 2);
     CB_memcpy(p, *items, (CB_usize)((*len) * item_size));
     *items = (void *)p;
     *capacity *= 2;
   }
 }
 
+//-- Segmented Array Implementation
+
+void cb_seg_append_(CB_Arena *arena, void **blocks, CB_size *len,
+                    void *items, CB_size items_len, CB_size item_size, CB_size align)
+{
+  CB_u8 *from = items;
+  while (items_len > 0) {
+    CB_i32 k = cb_seg_block_of_(*len);
+    CB_assert(k < CB_SEG_BLOCKS);
+    if (!blocks[k]) { blocks[k] = cb_arena_alloc(arena, item_size, align, cb_seg_block_cap(k)); }
+    CB_size at = *len - cb_seg_block_start(k);
+    CB_size n = CB_min(items_len, cb_seg_block_cap(k) - at);
+    CB_memcpy((CB_u8 *)blocks[k] + at * item_size, from, (CB_usize)(n * item_size));
+    from += n * item_size;
+    items_len -= n;
+    *len += n;
+  }
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 //- Log Implementation
 
+CB_Log_Level cb_log_level = CB_LOG_INFO;
+CB_Log_Format cb_log_format = CB_LOG_FORMAT_TEXT;
+
+// The line between cb_log_begin and cb_log_end on this thread
+static __thread struct {
+  CB_i64 start; // position in the buffer counting flushed bytes
+  CB_Log_Level level;
+  CB_b32 dropped;
+} cb_log_line_;
+
+static void cb_log_append_json_(CB_Write_Buffer *b, CB_Log_Level level, CB_Str msg);
+static void cb_append_json_str_(CB_Write_Buffer *b, CB_Str str);
+
 void cb_log_begin(CB_Write_Buffer *b, CB_Log_Level level)
 {
+  cb_log_line_.start = b->flushed + b->len;
+  cb_log_line_.level = level;
+  cb_log_line_.dropped = !cb_log_enabled(level);
+  // Dropped lines are cut and JSON lines are reformatted at cb_log_end
+  if (cb_log_line_.dropped || cb_log_format == CB_LOG_FORMAT_JSON) { return; }
+
   CB_assert(CB_LOG_COUNT == 3 && "Unhandled case in switch statement.");
   switch (level) {
   case CB_LOG_ERROR: {
@@ -646,6 +1787,20 @@ void cb_log_begin(CB_Write_Buffer *b, CB_Log_Level level)
 
 void cb_log_end(CB_Write_Buffer *b)
 {
+  // A line longer than the buffer was partly flushed already, end it as is
+  CB_size start = (CB_size)(cb_log_line_.start - b->flushed);
+  if (start >= 0 && cb_log_line_.dropped) {
+    b->len = start;
+    return;
+  }
+  if (start >= 0 && cb_log_format == CB_LOG_FORMAT_JSON) {
+    CB_Arena_Mark scratch = cb_arena_get_scratch(0, 0);
+    CB_Str msg = { .buf = new(scratch.arena, CB_u8, b->len - start), .len = b->len - start, };
+    CB_memcpy(msg.buf, b->buf + start, (CB_usize)msg.len);
+    b->len = start;
+    cb_log_append_json_(b, cb_log_line_.level, msg);
+    cb_arena_pop_mark(scratch);
+  }
   cb_append_byte(b, '\n');
   cb_flush(b);
 }
@@ -709,6 +1864,7 @@ void cb_cmd_render(CB_Command cmd, CB_Write_Buffer *buf)
 #include <sys/types.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <dlfcn.h>
 
 CB_u8 *cb_malloc(CB_size amount)
 {
@@ -790,21 +1946,33 @@ CB_b32 cb_write_entire_file(CB_Str filepath, CB_Str content, CB_Write_Buffer *st
   CB_Arena_Mark scratch = cb_arena_get_scratch(0, 0);
   CB_i32 result = 0;
 
-  char *c_filepath = cb_str_to_cstr(scratch.arena, filepath);
-  CB_i32 fd = open(c_filepath, O_WRONLY | O_CREAT | O_TRUNC, 0755);
+  CB_Write_Buffer *tmp = cb_mem_buffer(scratch.arena, filepath.len + 5);
+  cb_append(tmp, filepath, S(".tmp"));
+  CB_Str tmp_path = { .buf = tmp->buf, .len = tmp->len, };
+  char *c_tmp_path = cb_str_to_cstr(scratch.arena, tmp_path);
+  CB_i32 fd = open(c_tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0755);
   if (fd < 0) {
     cb_log_emit(stderr, CB_LOG_ERROR,
                 S("Could not open file "),
-                filepath,
+                tmp_path,
                 S(": "),
                 cb_str_from_cstr(strerror(errno)));
     cb_return_defer(0);
   }
 
-  cb_write(fd, content.buf, content.len);
+  if (!cb_write(fd, content.buf, content.len)) {
+    cb_log_emit(stderr, CB_LOG_ERROR,
+                S("Could not write file "),
+                tmp_path,
+                S(": "),
+                cb_str_from_cstr(strerror(errno)));
+    close(fd);
+    unlink(c_tmp_path);
+    cb_return_defer(0);
+  }
   if (!cb_close(fd, stderr)) cb_return_defer(0);
 
-  cb_return_defer(1);
+  cb_return_defer(cb_rename(tmp_path, filepath, stderr));
 
   CB_assert(0 && "unreachable");
  defer:
@@ -812,11 +1980,6 @@ CB_b32 cb_write_entire_file(CB_Str filepath, CB_Str content, CB_Write_Buffer *st
   return result;
 }
 
-typedef struct {
-  CB_i32 status;
-  CB_Str file_contents;
-} CB_Read_Result;
-
 CB_Read_Result cb_read_entire_file(CB_Arena *arena, CB_Str filepath, CB_Write_Buffer *stderr)
 {
   CB_Arena_Mark scratch = cb_arena_get_scratch(&arena, 1);
@@ -876,8 +2039,13 @@ CB_b32 cb_write(CB_i32 fd, CB_u8 *buf, CB_size len)
   return 1;
 }
 
+jmp_buf *cb_exit_jump = 0;
+void (*cb_exit_hook)(void) = 0;
+
 void cb_exit(int status)
 {
+  if (cb_exit_hook) { cb_exit_hook(); }
+  if (cb_exit_jump) { longjmp(*cb_exit_jump, 1); }
   exit(status);
 }
 
@@ -928,6 +2096,62 @@ CB_b32 cb_rename(CB_Str old_path, CB_Str new_path, CB_Write_Buffer *stderr)
   return result;
 }
 
+CB_b32 cb_explain = 0;
+CB_Write_Buffer *cb_explain_out = 0;
+
+void cb_explain_emit(CB_Explanation e, CB_Write_Buffer *stderr)
+{
+  static char *reasons[CB_EXPLAIN_COUNT] = { "missing", "newer-input", "command-changed", "dep-ran", "interrupted", "always", };
+
+  if (cb_log_enabled(CB_LOG_INFO)) {
+    cb_log_begin(stderr, CB_LOG_INFO);
+      cb_append(stderr, S("EXPLAIN: "), e.output, S(": "));
+      switch (e.reason) {
+        case CB_EXPLAIN_MISSING: cb_append(stderr, S("output is missing")); break;
+        case CB_EXPLAIN_NEWER_INPUT:
+          cb_append(stderr, S("input "), e.input, S(" is "));
+          cb_append_long(stderr, (long)((e.input_mtime_ns - e.output_mtime_ns) / 1000000));
+          cb_append(stderr, S(" ms newer"));
+          break;
+        case CB_EXPLAIN_COMMAND_CHANGED:
+          cb_append(stderr, S("command line changed, hash "));
+          cb_append_hex(stderr, e.old_hash);
+          cb_append(stderr, S(" -> "));
+          cb_append_hex(stderr, e.new_hash);
+          break;
+        case CB_EXPLAIN_DEP_RAN: cb_append(stderr, S("input "), e.input, S(" was rebuilt")); break;
+        case CB_EXPLAIN_INTERRUPTED: cb_append(stderr, S("an earlier run did not finish it")); break;
+        default: cb_append(stderr, S("always rebuilt")); break;
+      }
+    cb_log_end(stderr);
+  }
+
+  if (!cb_explain_out) { return; }
+  CB_Write_Buffer *b = cb_explain_out;
+  cb_append(b, S("{\"output\":"));
+  cb_append_json_str_(b, e.output);
+  cb_append(b, S(",\"reason\":\""), cb_str_from_cstr(reasons[e.reason]), S("\""));
+  if (e.input.len) {
+    cb_append(b, S(",\"input\":"));
+    cb_append_json_str_(b, e.input);
+  }
+  if (e.reason == CB_EXPLAIN_NEWER_INPUT) {
+    cb_append(b, S(",\"output_mtime_ns\":"));
+    cb_append_long(b, (long)e.output_mtime_ns);
+    cb_append(b, S(",\"input_mtime_ns\":"));
+    cb_append_long(b, (long)e.input_mtime_ns);
+  }
+  if (e.reason == CB_EXPLAIN_COMMAND_CHANGED) {
+    cb_append(b, S(",\"old_hash\":\""));
+    cb_append_hex(b, e.old_hash);
+    cb_append(b, S("\",\"new_hash\":\""));
+    cb_append_hex(b, e.new_hash);
+    cb_append(b, S("\""));
+  }
+  cb_append(b, S("}\n"));
+  cb_flush(b);
+}
+
 CB_b32 cb_needs_rebuild(CB_Str output_path, CB_Str *input_paths, CB_size input_paths_len, CB_Write_Buffer *stderr)
 {
   CB_Arena_Mark scratch = cb_arena_get_scratch(0, 0);
@@ -938,7 +2162,10 @@ CB_b32 cb_needs_rebuild(CB_Str output_path, CB_Str *input_paths, CB_size input_p
   struct stat statbuf = {0};
   if (stat(c_output_path, &statbuf) < 0) {
     // NOTE: if output does not exist it 100% must be rebuilt
-    if (errno == ENOENT) { cb_return_defer(1); }
+    if (errno == ENOENT) {
+      if (cb_explain) { cb_explain_emit((CB_Explanation){ .reason = CB_EXPLAIN_MISSING, .output = output_path, }, stderr); }
+      cb_return_defer(1);
+    }
     cb_log_emit(stderr, CB_LOG_ERROR,
                 S("Could not stat file "),
                 output_path,
@@ -947,6 +2174,7 @@ CB_b32 cb_needs_rebuild(CB_Str output_path, CB_Str *input_paths, CB_size input_p
     cb_return_defer(-1);
   }
   CB_i64 output_path_time = statbuf.st_mtime;
+  CB_i64 output_mtime_ns = (CB_i64)statbuf.st_mtim.tv_sec * 1000000000ll + statbuf.st_mtim.tv_nsec;
 
   for (CB_size i = 0; i < input_paths_len; ++i) {
     CB_Str input_path = input_paths[i];
@@ -962,7 +2190,16 @@ CB_b32 cb_needs_rebuild(CB_Str output_path, CB_Str *input_paths, CB_size input_p
     }
     CB_i64 input_path_time = statbuf.st_mtime;
     // NOTE: if even a single input_path is fresher than output_path that's 100% rebuild
-    if (input_path_time > output_path_time) cb_return_defer(1);
+    if (input_path_time > output_path_time) {
+      if (cb_explain) {
+        cb_explain_emit((CB_Explanation){
+            .reason = CB_EXPLAIN_NEWER_INPUT, .output = output_path, .input = input_path,
+            .output_mtime_ns = output_mtime_ns,
+            .input_mtime_ns = (CB_i64)statbuf.st_mtim.tv_sec * 1000000000ll + statbuf.st_mtim.tv_nsec,
+          }, stderr);
+      }
+      cb_return_defer(1);
+    }
   }
 
  defer:
@@ -970,9 +2207,32 @@ CB_b32 cb_needs_rebuild(CB_Str output_path, CB_Str *input_paths, CB_size input_p
   return result;
 }
 
+// Flags shared by the driver and the recipe module, which must agree on them
+static void cb_cmd_append_cbuild_flags_(CB_Arena *arena, CB_Command *cmd)
+{
+  cb_cmd_append_lit(arena, cmd, "-DCBUILD_CONFIGURED");
+  // No split DWARF, a compile and link in one names the .dwo after the
+  // temporary output it is renamed from
+  cb_cmd_append_lit(arena, cmd, "-g3");
+#if defined(CB_TC_FUSE_LD)
+  cb_cmd_append_lit(arena, cmd, CB_TC_FUSE_LD);
+#endif
+#if defined(CB_TC_HAVE_GDB_INDEX)
+  cb_cmd_append_lit(arena, cmd, "-Wl,--gdb-index");
+#endif
+  cb_cmd_append_lit(arena, cmd, "-Wall", "-Wextra", "-Wshadow", "-Wconversion");
+  cb_cmd_append_lit(arena, cmd, "-fsanitize=undefined");
+  cb_cmd_append_lit(arena, cmd, "-fsanitize=address");
+  cb_cmd_append_lit(arena, cmd, "-pthread");
+  /* cb_cmd_append_lit(arena, cmd, "-fsanitize=thread"); */
+#if defined(CB_ARENA_TELEMETRY)
+  cb_cmd_append_lit(arena, cmd, "-DCB_ARENA_TELEMETRY");
+#endif
+}
+
 void cb_rebuild_yourself(int argc, char **argv, CB_Str_List sources, CB_b32 force_rebuild, CB_Write_Buffer *stderr)
 {
-  (void)argc;
+  CB_assert(argv[argc] == 0);
   CB_Arena_Mark scratch = cb_arena_get_scratch(0, 0);
   if (!cb_mkdir_if_not_exists(S("build"), stderr)) cb_exit(1);
 
@@ -986,12 +2246,9 @@ void cb_rebuild_yourself(int argc, char **argv, CB_Str_List sources, CB_b32 forc
 
     CB_Command cmd = cb_da_init(scratch.arena, CB_Command, 128);
     cb_cmd_append_lit(scratch.arena, &cmd, "cc", "-o", "build/cbuild.new", "cbuild.c");
-    cb_cmd_append_lit(scratch.arena, &cmd, "-DCBUILD_CONFIGURED");
-    cb_cmd_append_lit(scratch.arena, &cmd, "-g3");
-    cb_cmd_append_lit(scratch.arena, &cmd, "-Wall", "-Wextra", "-Wshadow", "-Wconversion");
-    cb_cmd_append_lit(scratch.arena, &cmd, "-fsanitize=undefined");
-    cb_cmd_append_lit(scratch.arena, &cmd, "-fsanitize=address");
-    /* cb_cmd_append_lit(scratch.arena, &cmd, "-fsanitize=thread"); */
+    cb_cmd_append_cbuild_flags_(scratch.arena, &cmd);
+    // The recipe module links against the driver's cb_* functions
+    cb_cmd_append_lit(scratch.arena, &cmd, "-rdynamic", "-ldl");
 
     if (!cb_cmd_run_sync(cmd, stderr)) { cb_exit(1); }
 
@@ -1001,8 +2258,8 @@ void cb_rebuild_yourself(int argc, char **argv, CB_Str_List sources, CB_b32 forc
 
     // Re-run yourself
     cb_log_emit(stderr, CB_LOG_INFO, S("CMD: "), cb_str_from_cstr(argv[0]));
-    char *argv_empty[] = { argv[0], 0 };
-    execv(argv_empty[0], argv_empty);
+    cb_log_stop_async();
+    execv(argv[0], argv);
 
     CB_assert(0 && "unreachable");
   }
@@ -1010,14 +2267,79 @@ void cb_rebuild_yourself(int argc, char **argv, CB_Str_List sources, CB_b32 forc
   cb_arena_pop_mark(scratch);
 }
 
+void cb_recipes_unload(CB_Recipes *recipes)
+{
+  if (recipes->handle) { dlclose(recipes->handle); }
+  *recipes = (CB_Recipes){0};
+}
+
+CB_b32 cb_recipes_load(CB_Recipes *recipes, CB_Str module, CB_Str_List sources, CB_Write_Buffer *stderr)
+{
+  CB_Arena_Mark scratch = cb_arena_get_scratch(0, 0);
+  CB_b32 result = 1;
+
+  int status = cb_needs_rebuild(module, sources.items, sources.len, stderr);
+  if (status < 0) { cb_return_defer(0); }
+  if (status > 0) {
+    cb_log_emit(stderr, CB_LOG_INFO, S("Rebuilding recipes ..."));
+    CB_Write_Buffer *tmp = cb_mem_buffer(scratch.arena, module.len + 8);
+    cb_append(tmp, module, S(".new"));
+    CB_Str module_new = { .buf = tmp->buf, .len = tmp->len, };
+    CB_Command cmd = cb_da_init(scratch.arena, CB_Command, 128);
+    cb_cmd_append_lit(scratch.arena, &cmd, "cc", "-shared", "-fPIC", "-DCBUILD_RECIPES");
+    cb_cmd_append(scratch.arena, &cmd, S("-o"), module_new, S("cbuild.c"));
+    cb_cmd_append_cbuild_flags_(scratch.arena, &cmd);
+    if (!cb_cmd_run_sync(cmd, stderr)) { cb_return_defer(0); }
+    // A new inode, the loaded module stays intact until dlclose
+    if (!cb_rename(module_new, module, stderr)) { cb_return_defer(0); }
+  }
+
+  CB_File_Info info = { .path = module, };
+  cb_stat_files(&info, 1);
+  if (info.error) {
+    cb_log_emit(stderr, CB_LOG_ERROR, S("Could not stat "), module, S(": "), cb_str_from_cstr(strerror(info.error)));
+    cb_return_defer(0);
+  }
+  if (recipes->handle && recipes->mtime_ns == info.mtime_ns) { cb_return_defer(1); }
+
+  cb_recipes_unload(recipes);
+  // dlopen searches the library path for names without a slash
+  CB_Write_Buffer *path = cb_mem_buffer(scratch.arena, module.len + 8);
+  if (cb_str_find(module, S("/")) < 0) { cb_append(path, S("./")); }
+  cb_append(path, module, S("\0"));
+  void *handle = dlopen((char *)path->buf, RTLD_NOW | RTLD_LOCAL);
+  if (!handle) {
+    cb_log_emit(stderr, CB_LOG_ERROR, S("Could not load "), module, S(": "), cb_str_from_cstr(dlerror()));
+    cb_return_defer(0);
+  }
+  CB_Recipes_Run *run = (CB_Recipes_Run *)dlsym(handle, "run");
+  if (!run) {
+    cb_log_emit(stderr, CB_LOG_ERROR, S("Could not find run() in "), module, S(": "), cb_str_from_cstr(dlerror()));
+    dlclose(handle);
+    cb_return_defer(0);
+  }
+  *recipes = (CB_Recipes){ .handle = handle, .run = run, .mtime_ns = info.mtime_ns, };
+
+ defer:
+  cb_arena_pop_mark(scratch);
+  return result;
+}
+
 CB_Proc cb_cmd_run_async(CB_Command command, CB_Write_Buffer *stderr)
+{
+  return cb_cmd_run_opt(command, (CB_Cmd_Opt){0}, stderr);
+}
+
+CB_Proc cb_cmd_run_opt(CB_Command command, CB_Cmd_Opt opt, CB_Write_Buffer *stderr)
 {
   CB_assert(command.len >= 1);
 
-  cb_log_begin(stderr, CB_LOG_INFO);
-    cb_append(stderr, S("CMD: "));
-    cb_cmd_render(command, stderr);
-  cb_log_end(stderr);
+  if (!opt.quiet && cb_log_enabled(CB_LOG_INFO)) {
+    cb_log_begin(stderr, CB_LOG_INFO);
+      cb_append(stderr, S("CMD: "));
+      cb_cmd_render(command, stderr);
+    cb_log_end(stderr);
+  }
 
   pid_t cpid = fork();
   if (cpid < 0) {
@@ -1028,7 +2350,27 @@ CB_Proc cb_cmd_run_async(CB_Command command, CB_Write_Buffer *stderr)
   }
 
   if (cpid == 0) {
+    // The parent's, cb_exit in here just exits
+    cb_exit_hook = 0;
+    cb_exit_jump = 0;
+    if (opt.fdin)  { dup2(opt.fdin, 0); }
+    if (opt.fdout) { dup2(opt.fdout, 1); }
+    if (opt.fderr) { dup2(opt.fderr, 2); }
+
     CB_Arena_Mark scratch = cb_arena_get_scratch(0, 0); // REVIEW: not sure what happens here, we never pop the mark
+    if (opt.cgroup.len) {
+      CB_Write_Buffer *b = cb_mem_buffer(scratch.arena, opt.cgroup.len + 16);
+      cb_append(b, opt.cgroup, S("/cgroup.procs"));
+      cb_append_byte(b, 0);
+      CB_i32 fd = open((char *)b->buf, O_WRONLY);
+      if (fd < 0 || !cb_write(fd, (CB_u8 *)"0", 1)) {
+        cb_log_emit(stderr, CB_LOG_ERROR,
+                    S("Could not join cgroup "), opt.cgroup, S(": "),
+                    cb_str_from_cstr(strerror(errno)));
+        cb_exit(1);
+      }
+      close(fd);
+    }
     char *cmd_null[512];
     { // Fill cmd
       CB_size i = 0;
@@ -1099,6 +2441,3837 @@ CB_b32 cb_proc_wait(CB_Proc proc, CB_Write_Buffer *stderr)
   return 1;
 }
 
+CB_i32 cb_proc_wait_status(CB_Proc proc)
+{
+  if (proc == CB_INVALID_PROC) return -1;
+
+  for (;;) {
+    int wstatus = 0;
+    if (waitpid(proc, &wstatus, 0) < 0) {
+      if (errno == EINTR) { continue; }
+      return -1;
+    }
+    if (WIFEXITED(wstatus))   { return WEXITSTATUS(wstatus); }
+    if (WIFSIGNALED(wstatus)) { return -1; }
+  }
+}
+
+CB_Read_Result cb_cmd_capture(CB_Arena *arena, CB_Command command, CB_Write_Buffer *stderr)
+{
+  CB_Read_Result result = {0};
+
+  int fds[2];
+  if (pipe(fds) < 0) {
+    cb_log_emit(stderr, CB_LOG_ERROR,
+                S("Could not create pipe: "),
+                cb_str_from_cstr(strerror(errno)));
+    return result;
+  }
+  fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+  fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+  CB_Proc proc = cb_cmd_run_opt(command, (CB_Cmd_Opt){ .fdout = fds[1], .quiet = 1, }, stderr);
+  close(fds[1]);
+
+  struct { CB_u8 *items; CB_size capacity; CB_size len; } out = {0};
+  out = cb_da_init(arena, typeof(out), 4 * 1024);
+  for (;;) {
+    if (out.capacity - out.len < 1024) {
+      cb_da_grow(arena, (void **)&out.items, &out.capacity, &out.len, 1, 1);
+    }
+    CB_size n = read(fds[0], out.items + out.len, (CB_usize)(out.capacity - out.len - 1));
+    if (n < 0 && errno == EINTR) { continue; }
+    if (n <= 0) { break; }
+    out.len += n;
+  }
+  close(fds[0]);
+  out.items[out.len] = 0;
+
+  result.status = (cb_proc_wait_status(proc) == 0);
+  result.file_contents = (CB_Str){ .buf = out.items, .len = out.len, };
+  return result;
+}
+
+CB_Str cb_find_program(CB_Arena *arena, CB_Str name)
+{
+  CB_Str result = {0};
+  for (CB_size i = 0; i < name.len; i++) {
+    if (name.buf[i] == '/') {
+      return access(cb_str_to_cstr(arena, name), X_OK) == 0 ? name : result;
+    }
+  }
+
+  char *path = getenv("PATH");
+  if (!path) { return result; }
+
+  CB_Str rest = cb_str_from_cstr(path);
+  while (rest.len > 0) {
+    CB_Str dir = rest;
+    for (dir.len = 0; dir.len < rest.len && rest.buf[dir.len] != ':'; dir.len++) {}
+    rest.buf += CB_min(dir.len + 1, rest.len);
+    rest.len -= CB_min(dir.len + 1, rest.len);
+    if (dir.len == 0) { continue; }
+
+    CB_Write_Buffer *b = cb_mem_buffer(arena, dir.len + name.len + 2);
+    cb_append(b, dir, S("/"), name);
+    cb_append_byte(b, 0);
+    if (access((char *)b->buf, X_OK) == 0) {
+      result = (CB_Str){ .buf = b->buf, .len = b->len - 1, };
+      break;
+    }
+  }
+  return result;
+}
+
+CB_u64 cb_hash_program(CB_u64 h, CB_Str name)
+{
+  CB_Arena_Mark scratch = cb_arena_get_scratch(0, 0);
+  CB_Str path = cb_find_program(scratch.arena, name);
+  h = cb_hash_str(h, name);
+  h = cb_hash_str(h, path);
+
+  struct stat statbuf = {0};
+  if (path.len && stat(cb_str_to_cstr(scratch.arena, path), &statbuf) == 0) {
+    CB_i64 fields[] = { statbuf.st_size, statbuf.st_mtime, (CB_i64)statbuf.st_ino, };
+    h = cb_hash_str(h, (CB_Str){ .buf = (CB_u8 *)fields, .len = CB_sizeof(fields), });
+  }
+
+  cb_arena_pop_mark(scratch);
+  return h;
+}
+
+CB_b32 cb_write_file_if_changed(CB_Str filepath, CB_Str content, CB_Write_Buffer *stderr)
+{
+  CB_Arena_Mark scratch = cb_arena_get_scratch(0, 0);
+  CB_b32 result = 0;
+
+  CB_b32 exists = cb_file_exists(filepath, stderr);
+  if (exists < 0) { cb_return_defer(-1); }
+  if (exists) {
+    CB_Read_Result old = cb_read_entire_file(scratch.arena, filepath, stderr);
+    if (old.status && cb_str_equals(old.file_contents, content)) { cb_return_defer(0); }
+  }
+  cb_return_defer(cb_write_entire_file(filepath, content, stderr) ? 1 : -1);
+
+ defer:
+  cb_arena_pop_mark(scratch);
+  return result;
+}
+
+//-- Static Archive Implementation
+//
+// Layout of a GNU archive:
+//   "!<arch>\n" or "!<thin>\n"
+//   "/"  member: big-endian u32 symbol count, u32 header offset per symbol, NUL-terminated names
+//   "//" member: names that do not fit the 16 byte header field, "name/\n" each
+//   member headers (60 bytes) each followed by the member data, 2-byte aligned
+// Thin archives put every name in "//" and do not store member data.
+//
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <elf.h>
+
+#define CB_AR_HEADER_SIZE 60
+#define CB_AR_PAD(n) (((n) + 1) & ~(CB_i64)1)
+
+typedef struct {
+  CB_Str path;        // object file on disk
+  CB_Str name;        // name stored in the archive
+  CB_i64 mtime;       // seconds, as in the header
+  CB_i64 mtime_ns;
+  CB_i64 mode;
+  CB_i64 size;
+  CB_i32 src_fd;      // member data is copied from here, -1 if thin
+  CB_i64 src_off;
+  CB_i32 obj_fd;      // set when the object itself was opened and mapped
+  CB_u8 *data;        // mapped member data, scanned for symbols
+  CB_i64 header_off;  // offset of the member header in the new archive
+  CB_i64 name_off;    // offset into the long name table, -1 if unused
+} CB_Ar_Member;
+
+typedef struct {
+  CB_Str name;
+  CB_i64 mtime;
+  CB_i64 size;
+  CB_i64 data_off;
+} CB_Ar_Entry;
+
+typedef struct {
+  CB_Ar_Entry *items;
+  CB_size capacity;
+  CB_size len;
+} CB_Ar_Entries;
+
+typedef struct {
+  CB_Str name;
+  CB_size member;
+} CB_Ar_Symbol;
+
+typedef struct {
+  CB_Ar_Symbol *items;
+  CB_size capacity;
+  CB_size len;
+} CB_Ar_Symbols;
+
+static CB_i64 cb_ar_parse_field_(CB_u8 *field, CB_size len)
+{
+  CB_i64 result = 0;
+  for (CB_size i = 0; i < len && field[i] >= '0' && field[i] <= '9'; i++) {
+    result = result * 10 + (field[i] - '0');
+  }
+  return result;
+}
+
+static void cb_ar_append_field_(CB_Write_Buffer *b, CB_Str s, CB_size width)
+{
+  CB_assert(s.len <= width);
+  cb_append(b, s);
+  for (CB_size i = s.len; i < width; i++) {
+    cb_append_byte(b, ' ');
+  }
+}
+
+static void cb_ar_append_num_(CB_Write_Buffer *b, CB_i64 x, CB_i64 base, CB_size width)
+{
+  CB_u8 tmp[32];
+  CB_u8 *end = tmp + CB_sizeof(tmp);
+  CB_u8 *beg = end;
+  do {
+    *--beg = (CB_u8)('0' + x % base);
+  } while (x /= base);
+  cb_ar_append_field_(b, (CB_Str){ .buf = beg, .len = end - beg, }, width);
+}
+
+static void cb_ar_append_header_(CB_Write_Buffer *b, CB_Str name, CB_i64 mtime, CB_i64 mode, CB_i64 size)
+{
+  cb_ar_append_field_(b, name, 16);
+  cb_ar_append_num_(b, mtime, 10, 12);
+  cb_ar_append_num_(b, 0, 10, 6); // uid
+  cb_ar_append_num_(b, 0, 10, 6); // gid
+  cb_ar_append_num_(b, mode, 8, 8);
+  cb_ar_append_num_(b, size, 10, 10);
+  cb_append(b, S("`\n"));
+}
+
+static void cb_ar_append_be32_(CB_Write_Buffer *b, CB_u32 x)
+{
+  CB_u8 bytes[4] = { (CB_u8)(x >> 24), (CB_u8)(x >> 16), (CB_u8)(x >> 8), (CB_u8)x, };
+  cb_append_bytes(b, bytes, 4);
+}
+
+// Parses the member headers of a previously written archive.
+// Returns 0 if the file is not an archive we understand.
+static CB_b32 cb_ar_read_entries_(CB_Arena *arena, CB_u8 *map, CB_i64 map_len,
+                                  CB_b32 *thin, CB_Ar_Entries *entries)
+{
+  if (map_len < 8) { return 0; }
+  CB_Str magic = { .buf = map, .len = 8, };
+  if      (cb_str_equals(magic, S("!<arch>\n"))) { *thin = 0; }
+  else if (cb_str_equals(magic, S("!<thin>\n"))) { *thin = 1; }
+  else { return 0; }
+
+  CB_Str long_names = {0};
+  CB_i64 off = 8;
+  while (off + CB_AR_HEADER_SIZE <= map_len) {
+    CB_u8 *hdr = map + off;
+    CB_i64 size = cb_ar_parse_field_(hdr + 48, 10);
+    CB_i64 data_off = off + CB_AR_HEADER_SIZE;
+    CB_b32 special = (hdr[0] == '/' && (hdr[1] == ' ' || hdr[1] == '/' || hdr[1] == 'S'));
+
+    if (hdr[0] == '/' && hdr[1] == '/') {
+      long_names = (CB_Str){ .buf = map + data_off, .len = CB_min(size, map_len - data_off), };
+    }
+    else if (!special) {
+      CB_Ar_Entry e = {0};
+      e.mtime = cb_ar_parse_field_(hdr + 16, 12);
+      e.size = size;
+      e.data_off = data_off;
+      if (hdr[0] == '/') {
+        CB_i64 name_off = cb_ar_parse_field_(hdr + 1, 15);
+        if (name_off >= long_names.len) { return 0; }
+        e.name.buf = long_names.buf + name_off;
+        while (name_off + e.name.len + 1 < long_names.len &&
+               !(e.name.buf[e.name.len] == '/' && e.name.buf[e.name.len + 1] == '\n')) {
+          e.name.len++;
+        }
+      }
+      else {
+        e.name.buf = hdr;
+        while (e.name.len < 16 && hdr[e.name.len] != '/') { e.name.len++; }
+      }
+      *(cb_da_push(arena, entries)) = e;
+    }
+
+    off = data_off + ((*thin && !special) ? 0 : CB_AR_PAD(size));
+  }
+  return 1;
+}
+
+// Collects the defined global symbols of an ELF64 relocatable object.
+// Anything else (e.g. LLVM bitcode from -flto) contributes no symbols.
+static void cb_ar_collect_symbols_(CB_Arena *arena, CB_u8 *data, CB_i64 size,
+                                   CB_size member, CB_Ar_Symbols *syms)
+{
+  Elf64_Ehdr eh = {0};
+  if (size < CB_sizeof(eh)) { return; }
+  CB_memcpy(&eh, data, sizeof(eh));
+  if (eh.e_ident[EI_MAG0] != ELFMAG0 || eh.e_ident[EI_MAG1] != ELFMAG1 ||
+      eh.e_ident[EI_MAG2] != ELFMAG2 || eh.e_ident[EI_MAG3] != ELFMAG3 ||
+      eh.e_ident[EI_CLASS] != ELFCLASS64 || eh.e_ident[EI_DATA] != ELFDATA2LSB) {
+    return;
+  }
+  CB_u64 shdrs_end = eh.e_shoff + (CB_u64)eh.e_shnum * sizeof(Elf64_Shdr);
+  if (shdrs_end > (CB_u64)size) { return; }
+
+  for (CB_u32 i = 0; i < eh.e_shnum; i++) {
+    Elf64_Shdr sh = {0};
+    CB_memcpy(&sh, data + eh.e_shoff + i * sizeof(Elf64_Shdr), sizeof(sh));
+    if (sh.sh_type != SHT_SYMTAB || sh.sh_link >= eh.e_shnum) { continue; }
+
+    Elf64_Shdr strtab = {0};
+    CB_memcpy(&strtab, data + eh.e_shoff + sh.sh_link * sizeof(Elf64_Shdr), sizeof(strtab));
+    if (sh.sh_offset + sh.sh_size > (CB_u64)size ||
+        strtab.sh_offset + strtab.sh_size > (CB_u64)size) {
+      continue;
+    }
+
+    CB_u64 sym_count = sh.sh_size / sizeof(Elf64_Sym);
+    for (CB_u64 j = 1; j < sym_count; j++) {
+      Elf64_Sym sym = {0};
+      CB_memcpy(&sym, data + sh.sh_offset + j * sizeof(Elf64_Sym), sizeof(sym));
+      CB_u32 bind = ELF64_ST_BIND(sym.st_info);
+      CB_u32 type = ELF64_ST_TYPE(sym.st_info);
+      if (sym.st_shndx == SHN_UNDEF) { continue; }
+      if (bind != STB_GLOBAL && bind != STB_WEAK && bind != STB_GNU_UNIQUE) { continue; }
+      if (type == STT_FILE || type == STT_SECTION) { continue; }
+      if (sym.st_name >= strtab.sh_size) { continue; }
+
+      CB_Ar_Symbol s = {0};
+      s.name = cb_str_from_cstr((char *)(data + strtab.sh_offset + sym.st_name));
+      s.member = member;
+      *(cb_da_push(arena, syms)) = s;
+    }
+  }
+}
+
+static CB_Str cb_ar_member_name_(CB_Arena *arena, CB_Str archive_dir, CB_Str path, CB_b32 thin)
+{
+  if (!thin) { return cb_path_basename(path); }
+
+  // Thin archives reference members relative to the archive
+  if (archive_dir.len == 0 || path.buf[0] == '/') { return path; }
+  if (path.len > archive_dir.len && path.buf[archive_dir.len] == '/' &&
+      cb_str_equals((CB_Str){ .buf = path.buf, .len = archive_dir.len, }, archive_dir)) {
+    return (CB_Str){ .buf = path.buf + archive_dir.len + 1, .len = path.len - archive_dir.len - 1, };
+  }
+  CB_Write_Buffer *b = cb_mem_buffer(arena, path.len + 3 * (archive_dir.len + 1));
+  cb_append(b, S("../"));
+  for (CB_size i = 0; i < archive_dir.len; i++) {
+    if (archive_dir.buf[i] == '/') { cb_append(b, S("../")); }
+  }
+  cb_append(b, path);
+  return (CB_Str){ .buf = b->buf, .len = b->len, };
+}
+
+static CB_b32 cb_copy_fd_range_(CB_i32 out_fd, CB_i32 in_fd, CB_i64 in_off, CB_i64 len)
+{
+  loff_t off = in_off;
+  while (len > 0) {
+    long n = syscall(SYS_copy_file_range, in_fd, &off, out_fd, (loff_t *)0, (CB_usize)len, 0u);
+    if (n <= 0) { break; }
+    len -= n;
+  }
+
+  // Fallback when the kernel or filesystem can not copy for us
+  CB_u8 buf[64 * 1024];
+  while (len > 0) {
+    CB_size n = pread(in_fd, buf, (CB_usize)CB_min(len, CB_sizeof(buf)), off);
+    if (n <= 0) { return 0; }
+    if (!cb_write(out_fd, buf, n)) { return 0; }
+    off += n;
+    len -= n;
+  }
+  return 1;
+}
+
+CB_b32 cb_ar_write(CB_Str archive_path, CB_Str *members, CB_size members_len,
+                   CB_b32 thin, CB_Write_Buffer *stderr)
+{
+  CB_Arena_Mark scratch = cb_arena_get_scratch(0, 0);
+  CB_b32 result = 0;
+
+  CB_i32 old_fd = -1;
+  CB_i32 out_fd = -1;
+  CB_u8 *old_map = 0;
+  CB_i64 old_len = 0;
+
+  char *c_archive_path = cb_str_to_cstr(scratch.arena, archive_path);
+  CB_Str archive_dir = cb_str_chop_right(archive_path, '/');
+
+  CB_Ar_Member *m = new(scratch.arena, CB_Ar_Member, CB_max(members_len, 1));
+  for (CB_size i = 0; i < members_len; i++) {
+    m[i].path = members[i];
+    m[i].src_fd = m[i].obj_fd = -1;
+    m[i].name_off = -1;
+
+    struct stat statbuf = {0};
+    if (stat(cb_str_to_cstr(scratch.arena, members[i]), &statbuf) < 0) {
+      cb_log_emit(stderr, CB_LOG_ERROR,
+                  S("Could not stat archive member "),
+                  members[i],
+                  S(": "),
+                  cb_str_from_cstr(strerror(errno)));
+      cb_return_defer(0);
+    }
+    m[i].name = cb_ar_member_name_(scratch.arena, archive_dir, members[i], thin);
+    m[i].mtime = statbuf.st_mtime;
+    m[i].mtime_ns = (CB_i64)statbuf.st_mtim.tv_sec * 1000000000 + statbuf.st_mtim.tv_nsec;
+    m[i].size = statbuf.st_size;
+    m[i].mode = (statbuf.st_mode & 0777) | 0100000;
+  }
+
+  { // Find out which members changed since the archive was last written
+    CB_b32 old_thin = 0;
+    CB_Ar_Entries old = cb_da_init(scratch.arena, CB_Ar_Entries, 64);
+    CB_i64 old_mtime_ns = 0;
+    old_fd = open(c_archive_path, O_RDONLY);
+    if (old_fd >= 0) {
+      struct stat statbuf = {0};
+      if (fstat(old_fd, &statbuf) == 0 && statbuf.st_size > 0) {
+        old_mtime_ns = (CB_i64)statbuf.st_mtim.tv_sec * 1000000000 + statbuf.st_mtim.tv_nsec;
+        old_len = statbuf.st_size;
+        old_map = mmap(0, (CB_usize)old_len, PROT_READ, MAP_PRIVATE, old_fd, 0);
+        if (old_map == MAP_FAILED) { old_map = 0; }
+      }
+      if (!old_map || !cb_ar_read_entries_(scratch.arena, old_map, old_len, &old_thin, &old)) {
+        old.len = 0;
+      }
+    }
+
+    CB_size changed = 0;
+    for (CB_size i = 0; i < members_len; i++) {
+      CB_Ar_Entry *e = 0;
+      for (CB_size j = 0; j < old.len; j++) {
+        if (cb_str_equals(old.items[j].name, m[i].name)) { e = old.items + j; break; }
+      }
+      // The header's whole seconds miss an object rebuilt in the same second
+      // with the same size, that one is newer than the archive
+      if (!e || e->mtime != m[i].mtime || e->size != m[i].size || m[i].mtime_ns > old_mtime_ns) {
+        changed++;
+      }
+      else if (!thin && !old_thin) {
+        m[i].src_fd = old_fd;
+        m[i].src_off = e->data_off;
+        m[i].data = old_map + e->data_off;
+      }
+    }
+
+    CB_b32 same_layout = (old_fd >= 0 && old_thin == thin && old.len == members_len);
+    for (CB_size i = 0; same_layout && i < members_len; i++) {
+      same_layout = cb_str_equals(old.items[i].name, m[i].name);
+    }
+    if (same_layout && changed == 0) { cb_return_defer(1); }
+
+    cb_log_begin(stderr, CB_LOG_INFO);
+      cb_append(stderr, S("AR: "), archive_path, S(" ("));
+      cb_append_long(stderr, (long)changed);
+      cb_append(stderr, S(" of "));
+      cb_append_long(stderr, (long)members_len);
+      cb_append(stderr, thin ? S(" members changed, thin)") : S(" members changed)"));
+    cb_log_end(stderr);
+  }
+
+  CB_Ar_Symbols syms = cb_da_init(scratch.arena, CB_Ar_Symbols, 1024);
+  for (CB_size i = 0; i < members_len; i++) {
+    if (m[i].data == 0 && m[i].size > 0) {
+      m[i].obj_fd = open(cb_str_to_cstr(scratch.arena, m[i].path), O_RDONLY);
+      if (m[i].obj_fd < 0) {
+        cb_log_emit(stderr, CB_LOG_ERROR,
+                    S("Could not open archive member "),
+                    m[i].path,
+                    S(": "),
+                    cb_str_from_cstr(strerror(errno)));
+        cb_return_defer(0);
+      }
+      m[i].data = mmap(0, (CB_usize)m[i].size, PROT_READ, MAP_PRIVATE, m[i].obj_fd, 0);
+      if (m[i].data == MAP_FAILED) {
+        m[i].data = 0;
+        cb_log_emit(stderr, CB_LOG_ERROR,
+                    S("Could not map archive member "),
+                    m[i].path,
+                    S(": "),
+                    cb_str_from_cstr(strerror(errno)));
+        cb_return_defer(0);
+      }
+      if (!thin) {
+        m[i].src_fd = m[i].obj_fd;
+        m[i].src_off = 0;
+      }
+    }
+    cb_ar_collect_symbols_(scratch.arena, m[i].data, m[i].size, i, &syms);
+  }
+
+  // Compute layout, the symbol index refers to absolute member header offsets
+  CB_i64 symtab_size = 0;
+  if (syms.len) {
+    symtab_size = 4 + 4 * syms.len;
+    for (CB_size i = 0; i < syms.len; i++) { symtab_size += syms.items[i].name.len + 1; }
+  }
+
+  CB_size long_names_cap = 1;
+  for (CB_size i = 0; i < members_len; i++) { long_names_cap += m[i].name.len + 2; }
+  CB_Write_Buffer *long_names = cb_mem_buffer(scratch.arena, long_names_cap);
+  for (CB_size i = 0; i < members_len; i++) {
+    if (thin || m[i].name.len + 1 > 16) {
+      m[i].name_off = long_names->len;
+      cb_append(long_names, m[i].name, S("/\n"));
+    }
+  }
+
+  CB_i64 off = 8;
+  if (symtab_size)     { off += CB_AR_HEADER_SIZE + CB_AR_PAD(symtab_size); }
+  if (long_names->len) { off += CB_AR_HEADER_SIZE + CB_AR_PAD(long_names->len); }
+  for (CB_size i = 0; i < members_len; i++) {
+    m[i].header_off = off;
+    off += CB_AR_HEADER_SIZE + (thin ? 0 : CB_AR_PAD(m[i].size));
+  }
+  if (off > (CB_i64)UINT32_MAX) {
+    cb_log_emit(stderr, CB_LOG_ERROR, S("Archive too large for a 32-bit symbol index: "), archive_path);
+    cb_return_defer(0);
+  }
+
+  // Write the new archive next to the old one and swap them when done
+  CB_Write_Buffer *tmp_path = cb_mem_buffer(scratch.arena, archive_path.len + 5);
+  cb_append(tmp_path, archive_path, S(".tmp"));
+  CB_Str tmp = { .buf = tmp_path->buf, .len = tmp_path->len, };
+  out_fd = open(cb_str_to_cstr(scratch.arena, tmp), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (out_fd < 0) {
+    cb_log_emit(stderr, CB_LOG_ERROR,
+                S("Could not open file "),
+                tmp,
+                S(": "),
+                cb_str_from_cstr(strerror(errno)));
+    cb_return_defer(0);
+  }
+
+  CB_Write_Buffer *b = cb_fd_buffer(out_fd, scratch.arena, 64 * 1024);
+  cb_append(b, thin ? S("!<thin>\n") : S("!<arch>\n"));
+
+  if (symtab_size) {
+    cb_ar_append_header_(b, S("/"), 0, 0, symtab_size);
+    cb_ar_append_be32_(b, (CB_u32)syms.len);
+    for (CB_size i = 0; i < syms.len; i++) {
+      cb_ar_append_be32_(b, (CB_u32)m[syms.items[i].member].header_off);
+    }
+    for (CB_size i = 0; i < syms.len; i++) {
+      cb_append(b, syms.items[i].name);
+      cb_append_byte(b, 0);
+    }
+    if (symtab_size & 1) { cb_append_byte(b, 0); }
+  }
+
+  if (long_names->len) {
+    cb_ar_append_header_(b, S("//"), 0, 0, long_names->len);
+    cb_append_bytes(b, long_names->buf, long_names->len);
+    if (long_names->len & 1) { cb_append_byte(b, '\n'); }
+  }
+
+  for (CB_size i = 0; i < members_len; i++) {
+    CB_u8 name_buf[17];
+    CB_Write_Buffer name = { .buf = name_buf, .capacity = CB_sizeof(name_buf), .fd = -1, };
+    if (m[i].name_off >= 0) {
+      cb_append_byte(&name, '/');
+      cb_append_long(&name, (long)m[i].name_off);
+    }
+    else {
+      cb_append(&name, m[i].name, S("/"));
+    }
+    cb_ar_append_header_(b, (CB_Str){ .buf = name.buf, .len = name.len, },
+                         m[i].mtime, m[i].mode, m[i].size);
+    if (thin) { continue; }
+
+    cb_flush(b);
+    if (!cb_copy_fd_range_(out_fd, m[i].src_fd, m[i].src_off, m[i].size)) {
+      cb_log_emit(stderr, CB_LOG_ERROR,
+                  S("Could not copy archive member "),
+                  m[i].path,
+                  S(": "),
+                  cb_str_from_cstr(strerror(errno)));
+      cb_return_defer(0);
+    }
+    if (m[i].size & 1) { cb_append_byte(b, '\n'); }
+  }
+  cb_flush(b);
+  if (b->error) {
+    cb_log_emit(stderr, CB_LOG_ERROR, S("Could not write file "), tmp);
+    cb_return_defer(0);
+  }
+
+  if (!cb_close(out_fd, stderr)) { out_fd = -1; cb_return_defer(0); }
+  out_fd = -1;
+  if (!cb_rename(tmp, archive_path, stderr)) { cb_return_defer(0); }
+  cb_return_defer(1);
+
+ defer:
+  if (out_fd >= 0) { close(out_fd); }
+  for (CB_size i = 0; i < members_len; i++) {
+    if (m[i].obj_fd >= 0) {
+      if (m[i].data) { munmap(m[i].data, (CB_usize)m[i].size); }
+      close(m[i].obj_fd);
+    }
+  }
+  if (old_map) { munmap(old_map, (CB_usize)old_len); }
+  if (old_fd >= 0) { close(old_fd); }
+  cb_arena_pop_mark(scratch);
+  return result;
+}
+
+//-- Toolchain Probe Implementation
+
+#define CB_TC_PROBE_VERSION "2"
+
+static char *cb_tc_tools_[] = { "mold", "ld.lld", "ld.gold", "llvm-profdata", };
+
+static struct {
+  char *name;
+  char *flag;
+  CB_b32 linker; // linkers are ordered fastest first
+} cb_tc_probes_[] = {
+  { "ASAN",         "-fsanitize=address",   0 },
+  { "UBSAN",        "-fsanitize=undefined", 0 },
+  { "TSAN",         "-fsanitize=thread",    0 },
+  { "MARCH_NATIVE", "-march=native",        0 },
+  { "LTO",          "-flto",                0 },
+  { "PGO",          "-fprofile-generate",   0 },
+  { "SPLIT_DWARF",  "-gsplit-dwarf",        0 },
+  { "TIME_TRACE",   "-ftime-trace",         0 },
+  { "TIME_REPORT",  "-ftime-report",        0 },
+  { "LD_MOLD",      "-fuse-ld=mold",        1 },
+  { "LD_LLD",       "-fuse-ld=lld",         1 },
+  { "LD_GOLD",      "-fuse-ld=gold",        1 },
+};
+
+static CB_u64 cb_tc_fingerprint_(CB_Str cc)
+{
+  CB_u64 h = cb_hash_str(CB_HASH_INIT, S("cbuild toolchain v" CB_TC_PROBE_VERSION));
+  h = cb_hash_program(h, cc);
+  for (CB_size i = 0; i < CB_countof(cb_tc_tools_); i++) {
+    h = cb_hash_program(h, cb_str_from_cstr(cb_tc_tools_[i]));
+  }
+  return h;
+}
+
+static void cb_tc_define_(CB_Write_Buffer *b, char *name, CB_Str value)
+{
+  cb_append(b, S("#define CB_TC_"), cb_str_from_cstr(name));
+  if (value.len) {
+    cb_append(b, S(" \""));
+    for (CB_size i = 0; i < value.len; i++) {
+      if (value.buf[i] != '"' && value.buf[i] != '\\') { cb_append_byte(b, value.buf[i]); }
+    }
+    cb_append(b, S("\""));
+  }
+  cb_append_byte(b, '\n');
+}
+
+static CB_Proc cb_tc_try_flags_(CB_Str cc, CB_Str dir, CB_Str name, char **flags, CB_size flags_len,
+                                CB_i32 devnull, CB_Write_Buffer *stderr)
+{
+  CB_Arena_Mark scratch = cb_arena_get_scratch(0, 0);
+  CB_Write_Buffer *b = cb_mem_buffer(scratch.arena, 1024);
+  CB_Str_Mark mark = cb_write_buffer_mark(b);
+  cb_append(b, dir, S("/"), name);
+  CB_Str out = cb_str_from_mark(&mark);
+  cb_append(b, dir, S("/probe.c"));
+  CB_Str src = cb_str_from_mark(&mark);
+
+  CB_Command cmd = cb_da_init(scratch.arena, CB_Command, 16);
+  cb_cmd_append(scratch.arena, &cmd, cc, S("-o"), out, src);
+  cb_cmd_append_lits(scratch.arena, &cmd, flags, flags_len);
+  CB_Proc proc = cb_cmd_run_opt(cmd, (CB_Cmd_Opt){ .fdout = devnull, .fderr = devnull, .quiet = 1, }, stderr);
+
+  cb_arena_pop_mark(scratch);
+  return proc;
+}
+
+CB_b32 cb_toolchain_probe(CB_Str cc, CB_Str header_path, CB_Write_Buffer *stderr)
+{
+  CB_Arena_Mark scratch = cb_arena_get_scratch(0, 0);
+  CB_b32 result = 0;
+  CB_i32 devnull = -1;
+
+  CB_u64 fingerprint = cb_tc_fingerprint_(cc);
+
+  { // Cached?
+    CB_b32 exists = cb_file_exists(header_path, stderr);
+    if (exists < 0) { cb_return_defer(0); }
+    if (exists) {
+      CB_Read_Result header = cb_read_entire_file(scratch.arena, header_path, stderr);
+      CB_Str key = S("CB_TC_FINGERPRINT 0x");
+      CB_size at = header.status ? cb_str_find(header.file_contents, key) : -1;
+      if (at >= 0 && header.file_contents.len >= at + key.len + 16) {
+        CB_u64 cached = 0;
+        for (CB_size i = 0; i < 16; i++) {
+          CB_u8 c = header.file_contents.buf[at + key.len + i];
+          cached = (cached << 4) | (CB_u64)((c <= '9') ? c - '0' : c - 'a' + 10);
+        }
+        if (cached == fingerprint) { cb_return_defer(1); }
+      }
+    }
+  }
+
+  cb_log_emit(stderr, CB_LOG_INFO, S("Probing toolchain "), cc, S(" ..."));
+
+  CB_Str header_dir = cb_str_chop_right(header_path, '/');
+  CB_Write_Buffer *b = cb_mem_buffer(scratch.arena, 16 * 1024);
+  CB_Str_Mark mark = cb_write_buffer_mark(b);
+  if (header_dir.len) { cb_append(b, header_dir, S("/")); }
+  cb_append(b, S("probe"));
+  CB_Str probe_dir = cb_str_from_mark(&mark);
+  cb_append(b, probe_dir, S("/probe.c"));
+  CB_Str probe_src = cb_str_from_mark(&mark);
+
+  if (!cb_mkdir_if_not_exists(probe_dir, stderr)) { cb_return_defer(0); }
+  if (!cb_write_entire_file(probe_src, S("int main(void) { return 0; }\n"), stderr)) { cb_return_defer(0); }
+  devnull = open("/dev/null", O_WRONLY);
+  if (devnull < 0) {
+    cb_log_emit(stderr, CB_LOG_ERROR, S("Could not open /dev/null: "), cb_str_from_cstr(strerror(errno)));
+    cb_return_defer(0);
+  }
+
+  CB_Command version_cmd = cb_da_init(scratch.arena, CB_Command, 4);
+  cb_cmd_append(scratch.arena, &version_cmd, cc, S("--version"));
+  CB_Read_Result version = cb_cmd_capture(scratch.arena, version_cmd, stderr);
+  if (!version.status) {
+    cb_log_emit(stderr, CB_LOG_ERROR, S("Could not run compiler "), cc);
+    cb_return_defer(0);
+  }
+  CB_Str version_line = version.file_contents;
+  for (version_line.len = 0;
+       version_line.len < version.file_contents.len && version_line.buf[version_line.len] != '\n';
+       version_line.len++) {}
+
+  // Flags are probed in parallel, each compiling and linking an empty program
+  CB_Proc procs[CB_countof(cb_tc_probes_)];
+  for (CB_size i = 0; i < CB_countof(cb_tc_probes_); i++) {
+    procs[i] = cb_tc_try_flags_(cc, probe_dir, cb_str_from_cstr(cb_tc_probes_[i].name),
+                                &cb_tc_probes_[i].flag, 1, devnull, stderr);
+  }
+  CB_b32 supported[CB_countof(cb_tc_probes_)];
+  for (CB_size i = 0; i < CB_countof(cb_tc_probes_); i++) {
+    supported[i] = (cb_proc_wait_status(procs[i]) == 0);
+  }
+
+  char *fuse_ld = 0;
+  for (CB_size i = 0; i < CB_countof(cb_tc_probes_); i++) {
+    if (supported[i] && !fuse_ld && cb_tc_probes_[i].linker) {
+      fuse_ld = cb_tc_probes_[i].flag;
+    }
+  }
+  char *gdb_index_flags[] = { fuse_ld ? fuse_ld : "-g", "-Wl,--gdb-index", };
+  CB_b32 gdb_index = cb_proc_wait_status(
+    cb_tc_try_flags_(cc, probe_dir, S("GDB_INDEX"), gdb_index_flags, 2, devnull, stderr)) == 0;
+  // -dumpdir, -dumpbase and -dumpbase-ext name the side files of a compile
+  // after another output than -o, gcc 11 and later
+  char *dumpbase_flags[] = { "-dumpbase-ext", ".c", };
+  CB_b32 dumpbase = cb_proc_wait_status(
+    cb_tc_try_flags_(cc, probe_dir, S("DUMPBASE"), dumpbase_flags, 2, devnull, stderr)) == 0;
+
+  cb_append(b, S("// Generated by cbuild toolchain probe, delete to probe again.\n"));
+  cb_append(b, S("#define CB_TC_FINGERPRINT 0x"));
+  cb_append_hex(b, fingerprint);
+  cb_append(b, S("ull\n"));
+  cb_tc_define_(b, "CC", cc);
+  cb_tc_define_(b, "VERSION", version_line);
+  if (cb_str_find(version_line, S("clang")) >= 0) {
+    cb_tc_define_(b, "CLANG", (CB_Str){0});
+  }
+  else if (cb_str_find(version.file_contents, S("Free Software Foundation")) >= 0) {
+    cb_tc_define_(b, "GCC", (CB_Str){0});
+  }
+
+  cb_append(b, S("\n// Supported flags\n"));
+  for (CB_size i = 0; i < CB_countof(cb_tc_probes_); i++) {
+    if (!supported[i]) { cb_append(b, S("// ")); }
+    cb_append(b, S("#define CB_TC_HAVE_"), cb_str_from_cstr(cb_tc_probes_[i].name), S("\n"));
+  }
+  if (!gdb_index) { cb_append(b, S("// ")); }
+  cb_append(b, S("#define CB_TC_HAVE_GDB_INDEX\n"));
+  if (!dumpbase) { cb_append(b, S("// ")); }
+  cb_append(b, S("#define CB_TC_HAVE_DUMPBASE\n"));
+  if (fuse_ld) {
+    cb_tc_define_(b, "FUSE_LD", cb_str_from_cstr(fuse_ld));
+  }
+  CB_Str profdata = cb_find_program(scratch.arena, S("llvm-profdata"));
+  if (profdata.len) {
+    cb_tc_define_(b, "PROFDATA", profdata);
+  }
+
+  cb_append(b, S("\n// Host CPU features\n"));
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse4.2"))  { cb_tc_define_(b, "CPU_SSE4_2", (CB_Str){0}); }
+  if (__builtin_cpu_supports("avx"))     { cb_tc_define_(b, "CPU_AVX", (CB_Str){0}); }
+  if (__builtin_cpu_supports("avx2"))    { cb_tc_define_(b, "CPU_AVX2", (CB_Str){0}); }
+  if (__builtin_cpu_supports("fma"))     { cb_tc_define_(b, "CPU_FMA", (CB_Str){0}); }
+  if (__builtin_cpu_supports("bmi2"))    { cb_tc_define_(b, "CPU_BMI2", (CB_Str){0}); }
+  if (__builtin_cpu_supports("avx512f")) { cb_tc_define_(b, "CPU_AVX512F", (CB_Str){0}); }
+#endif
+
+  CB_Str header = cb_str_from_mark(&mark);
+  if (!cb_write_entire_file(header_path, header, stderr)) { cb_return_defer(0); }
+  cb_log_emit(stderr, CB_LOG_INFO, S("Wrote "), header_path);
+  cb_return_defer(1);
+
+ defer:
+  if (devnull >= 0) { close(devnull); }
+  cb_arena_pop_mark(scratch);
+  return result;
+}
+
+//-- Distributed Compilation Implementation
+//
+// A connection carries one compile job. Every message is a frame:
+//   u32 magic "CBDW", u32 type, u64 payload length, payload
+// in host byte order (objects are only useful to hosts of the same
+// architecture anyway).
+//   coordinator -> worker: ARG per compiler argument, then SOURCE
+//   worker -> coordinator: OUTPUT (if any), OBJECT (on success), STATUS
+//
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netdb.h>
+#include <signal.h>
+
+#define CB_DIST_MAGIC 0x57444243u // "CBDW"
+#define CB_DIST_MAX_PAYLOAD (1ll << 30)
+#define CB_DIST_ARENA_CAPACITY (256ll << 20) // holds a whole translation unit
+
+enum {
+  CB_DIST_ARG = 1,  // one compiler argument, the first one is the compiler
+  CB_DIST_SOURCE,   // preprocessed translation unit
+  CB_DIST_OUTPUT,   // compiler diagnostics
+  CB_DIST_OBJECT,   // resulting object file
+  CB_DIST_STATUS,   // u32 exit status of the compiler
+};
+
+typedef struct {
+  CB_u32 magic;
+  CB_u32 type;
+  CB_u64 len;
+} CB_Dist_Header;
+
+static CB_b32 cb_read_exact_(CB_i32 fd, CB_u8 *buf, CB_size len)
+{
+  for (CB_size off = 0; off < len;) {
+    CB_size n = read(fd, buf + off, (CB_usize)(len - off));
+    if (n < 0 && errno == EINTR) { continue; }
+    if (n <= 0) { return 0; }
+    off += n;
+  }
+  return 1;
+}
+
+static CB_b32 cb_dist_send_(CB_i32 fd, CB_u32 type, CB_Str payload)
+{
+  CB_Dist_Header h = { .magic = CB_DIST_MAGIC, .type = type, .len = (CB_u64)payload.len, };
+  return cb_write(fd, (CB_u8 *)&h, CB_sizeof(h)) && cb_write(fd, payload.buf, payload.len);
+}
+
+static CB_b32 cb_dist_recv_(CB_i32 fd, CB_Arena *arena, CB_u32 *type, CB_Str *payload)
+{
+  CB_Dist_Header h = {0};
+  if (!cb_read_exact_(fd, (CB_u8 *)&h, CB_sizeof(h))) { return 0; }
+  if (h.magic != CB_DIST_MAGIC || h.len > CB_DIST_MAX_PAYLOAD) { return 0; }
+
+  CB_size len = (CB_size)h.len;
+  CB_u8 *buf = new(arena, CB_u8, len + 1);
+  if (!cb_read_exact_(fd, buf, len)) { return 0; }
+  *type = h.type;
+  *payload = (CB_Str){ .buf = buf, .len = len, };
+  return 1;
+}
+
+// Connects to (or listens on, if listening) "unix:<path>" or "tcp:<host>:<port>".
+static CB_i32 cb_dist_socket_(CB_Str address, CB_b32 listening, CB_Write_Buffer *stderr)
+{
+  CB_Arena_Mark scratch = cb_arena_get_scratch(0, 0);
+  CB_i32 result = -1;
+  CB_i32 fd = -1;
+
+  if (cb_str_starts_with(address, S("unix:"))) {
+    CB_Str path = { .buf = address.buf + 5, .len = address.len - 5, };
+    struct sockaddr_un addr = { .sun_family = AF_UNIX, };
+    if (path.len == 0 || path.len >= CB_sizeof(addr.sun_path)) {
+      cb_log_emit(stderr, CB_LOG_ERROR, S("Invalid unix socket path "), address);
+      cb_return_defer(-1);
+    }
+    CB_memcpy(addr.sun_path, path.buf, (CB_usize)path.len);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) { goto socket_error; }
+    if (listening) {
+      unlink(addr.sun_path); // stale socket of a previous worker
+      if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 64) < 0) { goto socket_error; }
+    } else {
+      if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) { goto socket_error; }
+    }
+    cb_return_defer(fd);
+  }
+
+  if (cb_str_starts_with(address, S("tcp:"))) {
+    CB_Str host_port = { .buf = address.buf + 4, .len = address.len - 4, };
+    CB_Str host = cb_str_chop_right(host_port, ':');
+    if (host.len == 0) {
+      cb_log_emit(stderr, CB_LOG_ERROR, S("Invalid tcp address "), address, S(", expected tcp:<host>:<port>"));
+      cb_return_defer(-1);
+    }
+    CB_Str port = { .buf = host.buf + host.len + 1, .len = host_port.len - host.len - 1, };
+
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM, .ai_flags = listening ? AI_PASSIVE : 0, };
+    struct addrinfo *infos = 0;
+    CB_i32 err = getaddrinfo(cb_str_to_cstr(scratch.arena, host), cb_str_to_cstr(scratch.arena, port), &hints, &infos);
+    if (err != 0) {
+      cb_log_emit(stderr, CB_LOG_ERROR, S("Could not resolve "), address, S(": "), cb_str_from_cstr((char *)gai_strerror(err)));
+      cb_return_defer(-1);
+    }
+    for (struct addrinfo *info = infos; info; info = info->ai_next) {
+      fd = socket(info->ai_family, info->ai_socktype | SOCK_CLOEXEC, info->ai_protocol);
+      if (fd < 0) { continue; }
+      if (listening) {
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(fd, info->ai_addr, info->ai_addrlen) == 0 && listen(fd, 64) == 0) { break; }
+      } else {
+        if (connect(fd, info->ai_addr, info->ai_addrlen) == 0) { break; }
+      }
+      close(fd);
+      fd = -1;
+    }
+    freeaddrinfo(infos);
+    if (fd < 0) { goto socket_error; }
+    cb_return_defer(fd);
+  }
+
+  cb_log_emit(stderr, CB_LOG_ERROR, S("Invalid worker address "), address, S(", expected unix:<path> or tcp:<host>:<port>"));
+  cb_return_defer(-1);
+
+ socket_error:
+  cb_log_emit(stderr, CB_LOG_ERROR,
+              S("Could not "), listening ? S("listen on ") : S("connect to "), address, S(": "),
+              cb_str_from_cstr(strerror(errno)));
+  if (fd >= 0) { close(fd); }
+  cb_return_defer(-1);
+
+ defer:
+  cb_arena_pop_mark(scratch);
+  return result;
+}
+
+// Preprocessor flags stay with the coordinator, *takes_value if the value is the next argument.
+static CB_b32 cb_dist_is_pp_flag_(CB_Str arg, CB_b32 *takes_value)
+{
+  static const char *separate[] = {
+    "-I", "-D", "-U", "-include", "-imacros", "-isystem", "-iquote", "-idirafter", "-MF", "-MT", "-MQ",
+  };
+  static const char *prefixes[] = { "-I", "-D", "-U", "-i", "-M", };
+
+  *takes_value = 0;
+  for (CB_size i = 0; i < CB_countof(separate); i++) {
+    if (cb_str_equals(arg, cb_str_from_cstr((char *)separate[i]))) { *takes_value = 1; return 1; }
+  }
+  for (CB_size i = 0; i < CB_countof(prefixes); i++) {
+    if (cb_str_starts_with(arg, cb_str_from_cstr((char *)prefixes[i]))) { return 1; }
+  }
+  return 0;
+}
+
+// Flags a worker refuses: they load code, write files or read files of the worker.
+static CB_b32 cb_dist_is_unsafe_flag_(CB_Str arg)
+{
+  static const char *prefixes[] = {
+    "-B", "-fplugin", "-specs", "--specs", "-wrapper", "-o", "-save-temps", "-fdump-",
+    "-fprofile-", "-fauto-profile", "-fcreate-profile", "-fstack-usage", "-fcallgraph-info",
+    "-ftime-trace", "-fdebug-prefix-map", "-I", "-i", "-M", "--sysroot", "-L", "-l",
+  };
+  if (arg.len == 0 || arg.buf[0] != '-') { return 1; } // files and @file response files
+  for (CB_size i = 0; i < CB_countof(prefixes); i++) {
+    if (cb_str_starts_with(arg, cb_str_from_cstr((char *)prefixes[i]))) { return 1; }
+  }
+  return 0;
+}
+
+static CB_b32 cb_dist_compile_(CB_Command command, CB_Str worker, CB_Write_Buffer *stderr)
+{
+  CB_Arena *arena = cb_alloc_arena(CB_DIST_ARENA_CAPACITY);
+  CB_b32 result = 0;
+  CB_i32 fd = -1;
+
+  // Split the command into the local preprocessor and the remote compile step
+  CB_Str source = {0};
+  CB_Str output = {0};
+  CB_Command pp     = cb_da_init(arena, CB_Command, command.len + 2);
+  CB_Command remote = cb_da_init(arena, CB_Command, command.len);
+  *(cb_da_push(arena, &pp))     = command.items[0];
+  *(cb_da_push(arena, &remote)) = command.items[0];
+  for (CB_size i = 1; i < command.len; i++) {
+    CB_Str arg = command.items[i];
+    CB_b32 takes_value = 0;
+    if (cb_str_equals(arg, S("-c"))) { continue; }
+    if (cb_str_equals(arg, S("-o")) && i + 1 < command.len) { output = command.items[++i]; continue; }
+    if (cb_dist_is_pp_flag_(arg, &takes_value)) {
+      *(cb_da_push(arena, &pp)) = arg;
+      if (takes_value && i + 1 < command.len) { *(cb_da_push(arena, &pp)) = command.items[++i]; }
+      continue;
+    }
+    if (arg.len > 0 && arg.buf[0] != '-') {
+      if (source.len) { source = (CB_Str){0}; break; }
+      source = arg;
+      continue;
+    }
+    // code generation flags also affect predefined macros (__OPTIMIZE__, __SANITIZE_ADDRESS__, ...)
+    *(cb_da_push(arena, &pp)) = arg;
+    *(cb_da_push(arena, &remote)) = arg;
+  }
+  if (source.len == 0 || output.len == 0) {
+    cb_log_begin(stderr, CB_LOG_ERROR);
+      cb_append(stderr, S("Can only distribute `cc -c <source> -o <object>`, got: "));
+      cb_cmd_render(command, stderr);
+    cb_log_end(stderr);
+    cb_return_defer(0);
+  }
+  cb_cmd_append(arena, &pp, S("-E"), source);
+
+  CB_Read_Result tu = cb_cmd_capture(arena, pp, stderr);
+  if (!tu.status) {
+    cb_log_emit(stderr, CB_LOG_ERROR, S("Could not preprocess "), source);
+    cb_return_defer(0);
+  }
+
+  fd = cb_dist_socket_(worker, 0, stderr);
+  if (fd < 0) { cb_return_defer(0); }
+
+  for (CB_size i = 0; i < remote.len; i++) {
+    if (!cb_dist_send_(fd, CB_DIST_ARG, remote.items[i])) { goto connection_error; }
+  }
+  if (!cb_dist_send_(fd, CB_DIST_SOURCE, tu.file_contents)) { goto connection_error; }
+
+  for (;;) {
+    CB_u32 type = 0;
+    CB_Str payload = {0};
+    if (!cb_dist_recv_(fd, arena, &type, &payload)) { goto connection_error; }
+
+    if (type == CB_DIST_OUTPUT) {
+      cb_write(2, payload.buf, payload.len);
+    } else if (type == CB_DIST_OBJECT) {
+      if (!cb_write_entire_file(output, payload, stderr)) { cb_return_defer(0); }
+    } else if (type == CB_DIST_STATUS && payload.len == CB_sizeof(CB_u32)) {
+      CB_u32 status = 0;
+      CB_memcpy(&status, payload.buf, sizeof(status));
+      cb_return_defer(status == 0);
+    } else {
+      goto connection_error;
+    }
+  }
+
+ connection_error:
+  cb_log_emit(stderr, CB_LOG_ERROR, S("Lost connection to worker "), worker, S(" while compiling "), source);
+  cb_return_defer(0);
+
+ defer:
+  if (fd >= 0) { close(fd); }
+  cb_free_arena(arena);
+  return result;
+}
+
+CB_Proc cb_dist_run_async(CB_Command command, CB_Str worker, CB_Write_Buffer *stderr)
+{
+  CB_assert(command.len >= 1);
+
+  cb_log_begin(stderr, CB_LOG_INFO);
+    cb_append(stderr, S("DIST "), worker, S(": "));
+    cb_cmd_render(command, stderr);
+  cb_log_end(stderr);
+
+  pid_t cpid = fork();
+  if (cpid < 0) {
+    cb_log_emit(stderr, CB_LOG_ERROR,
+                S("Could not fork child process: "),
+                cb_str_from_cstr(strerror(errno)));
+    return CB_INVALID_PROC;
+  }
+
+  if (cpid == 0) {
+    cb_exit_hook = 0;
+    cb_exit_jump = 0;
+    // _exit: the atexit handlers belong to the parent
+    _exit(cb_dist_compile_(command, worker, stderr) ? 0 : 1);
+  }
+
+  return cpid;
+}
+
+static CB_b32 cb_dist_serve_(CB_i32 conn, CB_Str cc, CB_Write_Buffer *stderr)
+{
+  CB_Arena *arena = cb_alloc_arena(CB_DIST_ARENA_CAPACITY);
+  CB_b32 result = 0;
+  CB_i32 out_fd = -1;
+  CB_u32 status = 1;
+  CB_Str source = {0}, object = {0}, output = {0};
+
+  char dir[] = "/tmp/cbuild-worker-XXXXXX";
+  if (!mkdtemp(dir)) {
+    cb_log_emit(stderr, CB_LOG_ERROR, S("Could not create temporary directory: "), cb_str_from_cstr(strerror(errno)));
+    cb_return_defer(0);
+  }
+  CB_Write_Buffer *paths = cb_mem_buffer(arena, 256);
+  CB_Str_Mark mark = cb_write_buffer_mark(paths);
+  cb_append(paths, cb_str_from_cstr(dir), S("/tu.i"));
+  source = cb_str_from_mark(&mark);
+  cb_append(paths, cb_str_from_cstr(dir), S("/tu.o"));
+  object = cb_str_from_mark(&mark);
+  cb_append(paths, cb_str_from_cstr(dir), S("/output"));
+  output = cb_str_from_mark(&mark);
+
+  CB_Command cmd = cb_da_init(arena, CB_Command, 64);
+  *(cb_da_push(arena, &cmd)) = cc;
+  CB_Str rejected = {0};
+  for (CB_size argc = 0;; argc++) {
+    CB_u32 type = 0;
+    CB_Str payload = {0};
+    if (!cb_dist_recv_(conn, arena, &type, &payload)) { cb_return_defer(0); }
+    if (type == CB_DIST_SOURCE) {
+      if (!cb_write_entire_file(source, payload, stderr)) { cb_return_defer(0); }
+      break;
+    }
+    if (type != CB_DIST_ARG) { cb_return_defer(0); }
+    if (argc == 0) { continue; } // the coordinator's compiler, we use our own
+    if (cb_dist_is_unsafe_flag_(payload)) { rejected = payload; }
+    *(cb_da_push(arena, &cmd)) = payload;
+  }
+
+  if (rejected.len) {
+    CB_Write_Buffer *msg = cb_mem_buffer(arena, rejected.len + 64);
+    cb_append(msg, S("cbuild worker: refusing compiler argument "), rejected, S("\n"));
+    cb_dist_send_(conn, CB_DIST_OUTPUT, (CB_Str){ .buf = msg->buf, .len = msg->len, });
+  } else {
+    cb_cmd_append(arena, &cmd, S("-c"), source, S("-o"), object);
+    out_fd = open(cb_str_to_cstr(arena, output), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (out_fd < 0) { cb_return_defer(0); }
+
+    CB_Proc proc = cb_cmd_run_opt(cmd, (CB_Cmd_Opt){ .fdout = out_fd, .fderr = out_fd, }, stderr);
+    CB_i32 exit_status = cb_proc_wait_status(proc);
+    status = exit_status < 0 ? 255 : (CB_u32)exit_status;
+
+    CB_Read_Result diagnostics = cb_read_entire_file(arena, output, stderr);
+    if (diagnostics.file_contents.len > 0) {
+      if (!cb_dist_send_(conn, CB_DIST_OUTPUT, diagnostics.file_contents)) { cb_return_defer(0); }
+    }
+    if (status == 0) {
+      CB_Read_Result obj = cb_read_entire_file(arena, object, stderr);
+      if (!obj.status) { status = 1; }
+      else if (!cb_dist_send_(conn, CB_DIST_OBJECT, obj.file_contents)) { cb_return_defer(0); }
+    }
+  }
+
+  cb_return_defer(cb_dist_send_(conn, CB_DIST_STATUS, (CB_Str){ .buf = (CB_u8 *)&status, .len = CB_sizeof(status), }));
+
+ defer:
+  if (out_fd >= 0) { close(out_fd); }
+  if (source.len) {
+    unlink(cb_str_to_cstr(arena, source));
+    unlink(cb_str_to_cstr(arena, object));
+    unlink(cb_str_to_cstr(arena, output));
+    rmdir(dir);
+  }
+  close(conn);
+  cb_free_arena(arena);
+  return result;
+}
+
+CB_b32 cb_dist_worker(CB_Str address, CB_Str cc, CB_Write_Buffer *stderr)
+{
+  CB_i32 fd = cb_dist_socket_(address, 1, stderr);
+  if (fd < 0) { return 0; }
+  cb_log_emit(stderr, CB_LOG_INFO, S("Worker listening on "), address, S(", compiling with "), cc);
+
+  // One child per connection, reaped by the kernel
+  signal(SIGCHLD, SIG_IGN);
+  for (;;) {
+    CB_i32 conn = accept(fd, 0, 0);
+    if (conn < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) { continue; }
+      cb_log_emit(stderr, CB_LOG_ERROR, S("Could not accept connection: "), cb_str_from_cstr(strerror(errno)));
+      close(fd);
+      return 0;
+    }
+
+    pid_t cpid = fork();
+    if (cpid == 0) {
+      close(fd);
+      signal(SIGCHLD, SIG_DFL); // we wait on the compiler
+      _exit(cb_dist_serve_(conn, cc, stderr) ? 0 : 1);
+    }
+    if (cpid < 0) {
+      cb_log_emit(stderr, CB_LOG_ERROR, S("Could not fork child process: "), cb_str_from_cstr(strerror(errno)));
+    }
+    close(conn);
+  }
+}
+
+//-- Batched File IO Implementation
+//
+// Every file walks through statx -> openat -> read (until size) -> close, one
+// request in flight at a time. Each round queues the next request of up to
+// CB_IO_URING_ENTRIES files, submits them with one io_uring_enter and waits for
+// all of them, so stat'ing n files costs about n / CB_IO_URING_ENTRIES
+// syscalls and reading them four times that.
+//
+
+#if !defined(CB_IO_URING_ENTRIES)
+#  define CB_IO_URING_ENTRIES 256
+#endif
+// Below this the syscalls setting up a ring cost more than they save
+#if !defined(CB_IO_URING_MIN_FILES)
+#  define CB_IO_URING_MIN_FILES 8
+#endif
+
+#if !defined(CB_NO_IO_URING) && defined(__has_include)
+#  if __has_include(<linux/io_uring.h>)
+#    include <linux/io_uring.h>
+#    include <linux/stat.h>
+#    if defined(SYS_io_uring_setup) && defined(IO_URING_OP_SUPPORTED) // 5.6 headers
+#      define CB_IO_URING 1
+#    endif
+#  endif
+#endif
+
+enum {
+  CB_FILE_STATX,
+  CB_FILE_OPEN,
+  CB_FILE_READ,
+  CB_FILE_CLOSE,
+  CB_FILE_DONE,
+};
+
+typedef struct {
+  char *c_path;
+  CB_i32 fd;
+  CB_u32 state;
+#if defined(CB_IO_URING)
+  struct statx stx;
+#endif
+} CB_File_Op_;
+
+static void cb_file_sync_(CB_Arena *arena, CB_File_Info *file, CB_File_Op_ *op)
+{
+  struct stat statbuf = {0};
+  if (stat(op->c_path, &statbuf) < 0) {
+    file->error = errno;
+    return;
+  }
+  file->mtime_ns = (CB_i64)statbuf.st_mtim.tv_sec * 1000000000ll + statbuf.st_mtim.tv_nsec;
+  file->size = statbuf.st_size;
+  if (!arena || !S_ISREG(statbuf.st_mode)) { return; }
+
+  int fd = open(op->c_path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    file->error = errno;
+    return;
+  }
+  CB_u8 *buf = new(arena, CB_u8, file->size + 1);
+  CB_size len = 0;
+  while (len < file->size) {
+    CB_size n = read(fd, buf + len, (CB_usize)(file->size - len));
+    if (n < 0 && errno == EINTR) { continue; }
+    if (n < 0) { file->error = errno; break; }
+    if (n == 0) { break; } // truncated while we read it
+    len += n;
+  }
+  close(fd);
+  buf[len] = 0;
+  file->contents = (CB_Str){ .buf = buf, .len = len, };
+}
+
+#if defined(CB_IO_URING)
+
+typedef struct {
+  int fd;
+  CB_u32 entries;
+  CB_u32 *sq_tail, *sq_mask, *sq_array;
+  CB_u32 *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  void *sq_ring, *cq_ring;
+  CB_usize sq_ring_size, cq_ring_size, sqes_size;
+} CB_Uring_;
+
+static void cb_uring_free_(CB_Uring_ *u)
+{
+  if (u->sqes) { munmap(u->sqes, u->sqes_size); }
+  if (u->cq_ring && u->cq_ring != u->sq_ring) { munmap(u->cq_ring, u->cq_ring_size); }
+  if (u->sq_ring) { munmap(u->sq_ring, u->sq_ring_size); }
+  if (u->fd >= 0) { close(u->fd); }
+  *u = (CB_Uring_){ .fd = -1, };
+}
+
+// 0 if the kernel has no io_uring or lacks one of the opcodes we need.
+static CB_b32 cb_uring_init_(CB_Uring_ *u, CB_u32 entries)
+{
+  *u = (CB_Uring_){ .fd = -1, };
+  struct io_uring_params params = {0};
+  long fd = syscall(SYS_io_uring_setup, entries, &params);
+  if (fd < 0) { return 0; }
+  u->fd = (int)fd;
+  u->entries = params.sq_entries;
+
+  u->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(CB_u32);
+  u->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    u->sq_ring_size = u->cq_ring_size = CB_max(u->sq_ring_size, u->cq_ring_size);
+  }
+  u->sq_ring = mmap(0, u->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, u->fd, IORING_OFF_SQ_RING);
+  if (u->sq_ring == MAP_FAILED) { u->sq_ring = 0; cb_uring_free_(u); return 0; }
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    u->cq_ring = u->sq_ring;
+  } else {
+    u->cq_ring = mmap(0, u->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, u->fd, IORING_OFF_CQ_RING);
+    if (u->cq_ring == MAP_FAILED) { u->cq_ring = 0; cb_uring_free_(u); return 0; }
+  }
+  u->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  u->sqes = mmap(0, u->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED, u->fd, IORING_OFF_SQES);
+  if (u->sqes == MAP_FAILED) { u->sqes = 0; cb_uring_free_(u); return 0; }
+
+  CB_u8 *sq = u->sq_ring, *cq = u->cq_ring;
+  u->sq_tail  = (CB_u32 *)(sq + params.sq_off.tail);
+  u->sq_mask  = (CB_u32 *)(sq + params.sq_off.ring_mask);
+  u->sq_array = (CB_u32 *)(sq + params.sq_off.array);
+  u->cq_head  = (CB_u32 *)(cq + params.cq_off.head);
+  u->cq_tail  = (CB_u32 *)(cq + params.cq_off.tail);
+  u->cq_mask  = (CB_u32 *)(cq + params.cq_off.ring_mask);
+  u->cqes     = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+  // statx, openat, read and close came with 5.6, so did the probe. An older
+  // kernel fails the probe and an unknown opcode would fail every request.
+  union {
+    struct io_uring_probe probe;
+    CB_u8 bytes[sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op)];
+  } probe = {0};
+  if (syscall(SYS_io_uring_register, u->fd, IORING_REGISTER_PROBE, &probe, 256) < 0) {
+    cb_uring_free_(u);
+    return 0;
+  }
+  CB_u8 ops[] = { IORING_OP_STATX, IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE, };
+  for (CB_size i = 0; i < CB_countof(ops); i++) {
+    if (ops[i] > probe.probe.last_op || !(probe.probe.ops[ops[i]].flags & IO_URING_OP_SUPPORTED)) {
+      cb_uring_free_(u);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static void cb_file_op_prep_(struct io_uring_sqe *sqe, CB_File_Info *file, CB_File_Op_ *op)
+{
+  CB_memset(sqe, 0, sizeof(*sqe));
+  switch (op->state) {
+  case CB_FILE_STATX: {
+    sqe->opcode = IORING_OP_STATX;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (CB_u64)(CB_uptr)op->c_path;
+    sqe->len = STATX_TYPE | STATX_SIZE | STATX_MTIME;
+    sqe->off = (CB_u64)(CB_uptr)&op->stx;
+  } break;
+  case CB_FILE_OPEN: {
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (CB_u64)(CB_uptr)op->c_path;
+    sqe->open_flags = O_RDONLY | O_CLOEXEC;
+  } break;
+  case CB_FILE_READ: {
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = op->fd;
+    sqe->addr = (CB_u64)(CB_uptr)(file->contents.buf + file->contents.len);
+    sqe->len = (CB_u32)CB_min(file->size - file->contents.len, 1ll << 30);
+    sqe->off = (CB_u64)file->contents.len;
+  } break;
+  case CB_FILE_CLOSE: {
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = op->fd;
+  } break;
+  default: CB_assert(0 && "unreachable");
+  }
+}
+
+static void cb_file_op_complete_(CB_Arena *arena, CB_File_Info *file, CB_File_Op_ *op, CB_i32 res)
+{
+  switch (op->state) {
+  case CB_FILE_STATX: {
+    if (res < 0) { file->error = -res; op->state = CB_FILE_DONE; break; }
+    file->mtime_ns = (CB_i64)op->stx.stx_mtime.tv_sec * 1000000000ll + op->stx.stx_mtime.tv_nsec;
+    file->size = (CB_i64)op->stx.stx_size;
+    op->state = (arena && S_ISREG(op->stx.stx_mode)) ? CB_FILE_OPEN : CB_FILE_DONE;
+  } break;
+  case CB_FILE_OPEN: {
+    if (res < 0) { file->error = -res; op->state = CB_FILE_DONE; break; }
+    op->fd = res;
+    file->contents.buf = new(arena, CB_u8, file->size + 1);
+    op->state = (file->size > 0) ? CB_FILE_READ : CB_FILE_CLOSE;
+  } break;
+  case CB_FILE_READ: {
+    if (res == -EINTR || res == -EAGAIN) { break; } // again
+    if (res < 0) { file->error = -res; op->state = CB_FILE_CLOSE; break; }
+    file->contents.len += res;
+    // res == 0: truncated while we read it
+    if (res == 0 || file->contents.len == file->size) { op->state = CB_FILE_CLOSE; }
+  } break;
+  case CB_FILE_CLOSE: {
+    file->contents.buf[file->contents.len] = 0;
+    op->fd = -1;
+    op->state = CB_FILE_DONE;
+  } break;
+  default: CB_assert(0 && "unreachable");
+  }
+}
+
+// 0 if the ring failed, the files are left half done.
+static CB_b32 cb_uring_run_(CB_Uring_ *u, CB_Arena *arena, CB_File_Info *files, CB_File_Op_ *ops, CB_size len)
+{
+  CB_size first = 0; // files before this one are done
+  for (;;) {
+    while (first < len && ops[first].state == CB_FILE_DONE) { first++; }
+
+    CB_u32 tail = *u->sq_tail; // we are the only producer
+    CB_u32 queued = 0;
+    for (CB_size i = first; i < len && queued < u->entries; i++) {
+      if (ops[i].state == CB_FILE_DONE) { continue; }
+      CB_u32 index = tail & *u->sq_mask;
+      cb_file_op_prep_(u->sqes + index, files + i, ops + i);
+      u->sqes[index].user_data = (CB_u64)i;
+      u->sq_array[index] = index;
+      tail++;
+      queued++;
+    }
+    if (queued == 0) { return 1; }
+    __atomic_store_n(u->sq_tail, tail, __ATOMIC_RELEASE);
+
+    CB_u32 to_submit = queued;
+    CB_u32 completed = 0;
+    while (completed < queued) {
+      long n = syscall(SYS_io_uring_enter, u->fd, to_submit, queued - completed, IORING_ENTER_GETEVENTS, 0, 0);
+      if (n < 0 && errno == EINTR) { continue; }
+      if (n < 0) { return 0; }
+      to_submit -= (CB_u32)n;
+
+      CB_u32 head = *u->cq_head;
+      CB_u32 cq_tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+      for (; head != cq_tail; head++, completed++) {
+        struct io_uring_cqe *cqe = u->cqes + (head & *u->cq_mask);
+        CB_size i = (CB_size)cqe->user_data;
+        cb_file_op_complete_(arena, files + i, ops + i, cqe->res);
+      }
+      __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+    }
+  }
+}
+
+#endif // CB_IO_URING
+
+static void cb_files_batch_(CB_Arena *arena, CB_File_Info *files, CB_size files_len)
+{
+  CB_Arena_Mark scratch = cb_arena_get_scratch(&arena, 1);
+  CB_File_Op_ *ops = new(scratch.arena, CB_File_Op_, files_len);
+  for (CB_size i = 0; i < files_len; i++) {
+    files[i] = (CB_File_Info){ .path = files[i].path, .mtime_ns = -1, };
+    ops[i] = (CB_File_Op_){ .c_path = cb_str_to_cstr(scratch.arena, files[i].path), .fd = -1, };
+  }
+
+  CB_b32 done = 0;
+#if defined(CB_IO_URING)
+  CB_Uring_ u = {0};
+  if (files_len >= CB_IO_URING_MIN_FILES && cb_uring_init_(&u, CB_IO_URING_ENTRIES)) {
+    done = cb_uring_run_(&u, arena, files, ops, files_len);
+    cb_uring_free_(&u);
+    for (CB_size i = 0; i < files_len && !done; i++) {
+      if (ops[i].fd >= 0) { close(ops[i].fd); }
+      files[i] = (CB_File_Info){ .path = files[i].path, .mtime_ns = -1, };
+    }
+  }
+#endif
+  for (CB_size i = 0; i < files_len && !done; i++) {
+    cb_file_sync_(arena, files + i, ops + i);
+  }
+  cb_arena_pop_mark(scratch);
+}
+
+// In batches, so the ops and C paths of a big build fit in scratch memory.
+#define CB_FILES_BATCH 8192
+
+static void cb_files_(CB_Arena *arena, CB_File_Info *files, CB_size files_len)
+{
+  for (CB_size at = 0; at < files_len; at += CB_FILES_BATCH) {
+    cb_files_batch_(arena, files + at, CB_min(files_len - at, CB_FILES_BATCH));
+  }
+}
+
+void cb_stat_files(CB_File_Info *files, CB_size files_len)
+{
+  cb_files_(0, files, files_len);
+}
+
+void cb_read_files(CB_Arena *arena, CB_File_Info *files, CB_size files_len)
+{
+  CB_assert(arena);
+  cb_files_(arena, files, files_len);
+}
+
+//-- Job Pool Implementation
+//
+// Log format, one job per line:
+// "<duration in ms>\t<peak rss in KiB>\t<command hash, 16 hex digits>\t<output>"
+// and one line per directory read by cb_glob:
+// "dir\t<mtime in ns>\t<path>\t<entry>\t<entry>...", directories ending in '/'.
+//
+// The log is rewritten when a run finishes. While it runs, the pool appends to
+// the journal next to it a "start\t<output>" line before each job and the
+// job's log line once it succeeded, so a run that is killed half way leaves
+// the jobs it did finish and the ones it has to redo. The journal is replayed
+// over the log when the pool is loaded and emptied by the next log write, but
+// for the outputs still unfinished.
+//
+// A write lock on "<log>.lock" keeps two processes from loading and rewriting
+// the same log and journal at once. It is an fcntl lock, which belongs to the
+// process: pools of one process made one after the other, as watch and the
+// release steps do, do not wait for each other.
+//
+
+#include <sys/resource.h>
+#include <sys/time.h> // setitimer
+#include <time.h>
+
+#define CB_POOL_LOG_HEADER  "# cbuild log v3\n"
+#define CB_POOL_DEFAULT_RSS (256ll << 20)
+#define CB_POOL_DEFAULT_DURATION 1000 // ms
+
+enum {
+  CB_JOB_WAITING,  // on deps
+  CB_JOB_READY,
+  CB_JOB_RUNNING,
+  CB_JOB_AWAITING, // task on another job
+  CB_JOB_RESUME,   // task whose await is done
+  CB_JOB_DONE,
+};
+
+// See Tasks Implementation
+static void cb_pool_resume_later_(CB_Pool *pool, CB_Job *task);
+static void cb_pool_resume_(CB_Pool *pool, CB_Job *job, CB_Write_Buffer *stderr);
+
+static CB_i64 cb_now_ns_(void)
+{
+  struct timespec ts = {0};
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (CB_i64)ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+// Null-terminated a + b.
+static CB_Str cb_str_cat_(CB_Arena *arena, CB_Str a, CB_Str b)
+{
+  CB_Write_Buffer *buf = cb_mem_buffer(arena, a.len + b.len + 1);
+  cb_append(buf, a, b);
+  cb_append_byte(buf, 0);
+  return (CB_Str){ .buf = buf->buf, .len = a.len + b.len, };
+}
+
+static CB_Str cb_str_copy_(CB_Arena *arena, CB_Str s)
+{
+  return cb_str_cat_(arena, s, (CB_Str){0});
+}
+
+// Reads /proc and /sys files, which report a size of 0 to cb_read_entire_file.
+static CB_Str cb_read_small_file_(CB_Arena *arena, CB_Str path)
+{
+  CB_Str result = {0};
+  CB_i32 fd = open(cb_str_to_cstr(arena, path), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) { return result; }
+
+  CB_size capacity = 16 * 1024;
+  result.buf = new(arena, CB_u8, capacity);
+  while (result.len < capacity) {
+    CB_size n = read(fd, result.buf + result.len, (CB_usize)(capacity - result.len));
+    if (n < 0 && errno == EINTR) { continue; }
+    if (n <= 0) { break; }
+    result.len += n;
+  }
+  close(fd);
+  return result;
+}
+
+static CB_b32 cb_write_small_file_(CB_Arena *arena, CB_Str path, CB_Str content)
+{
+  CB_i32 fd = open(cb_str_to_cstr(arena, path), O_WRONLY | O_CLOEXEC);
+  if (fd < 0) { return 0; }
+  CB_b32 ok = cb_write(fd, content.buf, content.len);
+  return (close(fd) == 0) && ok;
+}
+
+// Rest of the first line of text that starts with key.
+static CB_Str cb_find_line_(CB_Str text, CB_Str key)
+{
+  while (text.len > 0) {
+    CB_Str line = text;
+    for (line.len = 0; line.len < text.len && text.buf[line.len] != '\n'; line.len++) {}
+    text.buf += CB_min(line.len + 1, text.len);
+    text.len -= CB_min(line.len + 1, text.len);
+    if (cb_str_starts_with(line, key)) {
+      line.buf += key.len;
+      line.len -= key.len;
+      while (line.len > 0 && line.buf[0] == ' ') { line.buf++; line.len--; }
+      return line;
+    }
+  }
+  return (CB_Str){0};
+}
+
+static CB_i64 cb_parse_file_int_(CB_Arena *arena, CB_Str path)
+{
+  CB_size len = 0;
+  CB_i64 value = cb_str_parse_int(cb_read_small_file_(arena, path), &len);
+  return len ? value : -1; // "max" or missing
+}
+
+// cbuild's cgroup directory in the v2 hierarchy (controller ""), or in the v1
+// hierarchy of controller. Empty if cbuild is not in one.
+static CB_Str cb_cgroup_dir_(CB_Arena *arena, CB_Str controller)
+{
+  CB_Str text = cb_read_small_file_(arena, S("/proc/self/cgroup"));
+  while (text.len > 0) {
+    // "<id>:<controller,...>:<path>"
+    CB_Str line = text;
+    for (line.len = 0; line.len < text.len && text.buf[line.len] != '\n'; line.len++) {}
+    text.buf += CB_min(line.len + 1, text.len);
+    text.len -= CB_min(line.len + 1, text.len);
+
+    CB_size colon = cb_str_find(line, S(":"));
+    if (colon < 0) { continue; }
+    CB_Str controllers = { .buf = line.buf + colon + 1, .len = line.len - colon - 1, };
+    CB_size path_start = cb_str_find(controllers, S(":"));
+    if (path_start < 0) { continue; }
+    CB_Str path = { .buf = controllers.buf + path_start + 1, .len = controllers.len - path_start - 1, };
+    controllers.len = path_start;
+
+    if (controller.len == 0 && controllers.len == 0) {
+      // unified hierarchy, mounted on its own or next to the v1 controllers (hybrid)
+      CB_Str mount = (access("/sys/fs/cgroup/cgroup.controllers", F_OK) == 0)
+        ? S("/sys/fs/cgroup") : S("/sys/fs/cgroup/unified");
+      return cb_str_cat_(arena, mount, path);
+    }
+    if (controller.len > 0) {
+      while (controllers.len > 0) {
+        CB_Str name = controllers;
+        for (name.len = 0; name.len < controllers.len && controllers.buf[name.len] != ','; name.len++) {}
+        controllers.buf += CB_min(name.len + 1, controllers.len);
+        controllers.len -= CB_min(name.len + 1, controllers.len);
+        if (cb_str_equals(name, controller)) {
+          return cb_str_cat_(arena, cb_str_cat_(arena, S("/sys/fs/cgroup/"), controller), path);
+        }
+      }
+    }
+  }
+  return (CB_Str){0};
+}
+
+CB_i64 cb_available_memory(void)
+{
+  CB_Arena_Mark scratch = cb_arena_get_scratch(0, 0);
+  CB_i64 result = -1;
+
+  CB_Str meminfo = cb_read_small_file_(scratch.arena, S("/proc/meminfo"));
+  CB_size len = 0;
+  CB_i64 available_kb = cb_str_parse_int(cb_find_line_(meminfo, S("MemAvailable:")), &len);
+  if (len) { result = available_kb * 1024; }
+
+  struct { CB_Str controller; CB_Str limit; CB_Str usage; } cgroups[] = {
+    { S(""),       S("/memory.max"),            S("/memory.current"), },
+    { S("memory"), S("/memory.limit_in_bytes"), S("/memory.usage_in_bytes"), },
+  };
+  for (CB_size i = 0; i < CB_countof(cgroups); i++) {
+    CB_Str dir = cb_cgroup_dir_(scratch.arena, cgroups[i].controller);
+    if (dir.len == 0) { continue; }
+    CB_i64 limit = cb_parse_file_int_(scratch.arena, cb_str_cat_(scratch.arena, dir, cgroups[i].limit));
+    CB_i64 usage = cb_parse_file_int_(scratch.arena, cb_str_cat_(scratch.arena, dir, cgroups[i].usage));
+    if (limit < 0 || usage < 0) { continue; }
+    CB_i64 room = CB_max(limit - usage, 0);
+    result = (result < 0) ? room : CB_min(result, room);
+  }
+
+  cb_arena_pop_mark(scratch);
+  return result;
+}
+
+// Directory to create the job cgroups in, empty if cgroups can not be used. The
+// memory controller can only be enabled for the children of a cgroup without
+// processes, so cbuild moves itself into the leaf "<cgroup>/cbuild" first.
+static CB_Str cb_pool_cgroup_root_(CB_Write_Buffer *stderr)
+{
+  static CB_u8 root[4096];
+  static CB_size root_len = -1; // not set up yet
+  if (root_len >= 0) { return (CB_Str){ .buf = root, .len = root_len, }; }
+  root_len = 0;
+
+  CB_Arena_Mark scratch = cb_arena_get_scratch(0, 0);
+  CB_Str dir = cb_cgroup_dir_(scratch.arena, S(""));
+  CB_Str control = cb_str_cat_(scratch.arena, dir, S("/cgroup.subtree_control"));
+  if (dir.len == 0 || dir.len >= CB_sizeof(root)) {
+    errno = ENOENT;
+    goto cgroup_error;
+  }
+  if (cb_str_find(cb_read_small_file_(scratch.arena, control), S("memory")) < 0) {
+    CB_Str leaf = cb_str_cat_(scratch.arena, dir, S("/cbuild"));
+    if (mkdir((char *)leaf.buf, 0755) < 0 && errno != EEXIST) { goto cgroup_error; }
+    if (!cb_write_small_file_(scratch.arena, cb_str_cat_(scratch.arena, leaf, S("/cgroup.procs")), S("0"))) { goto cgroup_error; }
+    if (!cb_write_small_file_(scratch.arena, control, S("+memory"))) { goto cgroup_error; }
+  }
+  CB_memcpy(root, dir.buf, (CB_usize)dir.len);
+  root_len = dir.len;
+  cb_arena_pop_mark(scratch);
+  return (CB_Str){ .buf = root, .len = root_len, };
+
+ cgroup_error:
+  cb_log_emit(stderr, CB_LOG_WARNING,
+              S("Could not enable the memory controller for the cgroup \""), dir, S("\": "),
+              cb_str_from_cstr(strerror(errno)), S(", running jobs without cgroups"));
+  cb_arena_pop_mark(scratch);
+  return (CB_Str){0};
+}
+
+// mtime of path in ns, -1 if it does not exist.
+static CB_i64 cb_mtime_ns_(CB_Str path)
+{
+  CB_Arena_Mark scratch = cb_arena_get_scratch(0, 0);
+  CB_i64 result = -1;
+  struct stat statbuf = {0};
+  if (stat(cb_str_to_cstr(scratch.arena, path), &statbuf) == 0) {
+    result = (CB_i64)statbuf.st_mtim.tv_sec * 1000000000ll + statbuf.st_mtim.tv_nsec;
+  }
+  cb_arena_pop_mark(scratch);
+  return result;
+}
+
+static CB_Job_Record *cb_pool_record_(CB_Pool *pool, CB_Path_Id output)
+{
+  if (output >= pool->record_of.len || pool->record_of.items[output] == 0) { return 0; }
+  return pool->log.items + pool->record_of.items[output] - 1;
+}
+
+// Listing of dir in the cache, 0 if none.
+static CB_Dir_Listing *cb_pool_dir_(CB_Pool *pool, CB_Str dir)
+{
+  CB_Path_Id id = cb_path_intern(&pool->paths, dir);
+  if (id >= pool->dir_of.len || pool->dir_of.items[id] == 0) { return 0; }
+  return pool->dirs.items + pool->dir_of.items[id] - 1;
+}
+
+// Appends an empty listing of dir to the cache, dir is not copied.
+static CB_Dir_Listing *cb_pool_add_dir_(CB_Pool *pool, CB_Str dir)
+{
+  CB_Path_Id id = cb_path_intern(&pool->paths, dir);
+  CB_Dir_Listing *result = cb_da_push(pool->arena, &pool->dirs);
+  *result = (CB_Dir_Listing){ .path = dir, .mtime_ns = -1, };
+  result->entries = cb_da_init(pool->arena, CB_Str_List, 16);
+  while (pool->dir_of.len <= id) { *(cb_da_push(pool->arena, &pool->dir_of)) = 0; }
+  pool->dir_of.items[id] = pool->dirs.len;
+  return result;
+}
+
+// Appends a record for output to the log.
+static CB_Job_Record *cb_pool_add_record_(CB_Pool *pool, CB_Path_Id output)
+{
+  CB_Job_Record *r = cb_da_push(pool->arena, &pool->log);
+  *r = (CB_Job_Record){0};
+  while (pool->record_of.len <= output) { *(cb_da_push(pool->arena, &pool->record_of)) = 0; }
+  pool->record_of.items[output] = pool->log.len;
+  return r;
+}
+
+// Its line in the log.
+static void cb_pool_append_record_(CB_Write_Buffer *b, CB_Job_Record *r)
+{
+  cb_append_long(b, (long)r->duration_ms);
+  cb_append(b, S("\t"));
+  cb_append_long(b, (long)(r->peak_rss / 1024));
+  cb_append(b, S("\t"));
+  cb_append_hex(b, r->cmd_hash);
+  cb_append(b, S("\t"), r->output, S("\n"));
+}
+
+// Reads the records of a log, or of a journal, where a later line replaces the
+// record of the same output and a "start" line marks it unfinished.
+static void cb_pool_load_(CB_Pool *pool, CB_Str text, CB_b32 journal)
+{
+  while (text.len > 0) {
+    CB_Str line = text;
+    for (line.len = 0; line.len < text.len && text.buf[line.len] != '\n'; line.len++) {}
+    text.buf += CB_min(line.len + 1, text.len);
+    text.len -= CB_min(line.len + 1, text.len);
+
+    if (journal && cb_str_starts_with(line, S("start\t"))) {
+      line.buf += 6;
+      line.len -= 6;
+      CB_Path_Id id = cb_path_intern(&pool->paths, line);
+      CB_Job_Record *r = cb_pool_record_(pool, id);
+      if (!r) {
+        r = cb_pool_add_record_(pool, id);
+        r->output = line;
+        r->duration_ms = CB_POOL_DEFAULT_DURATION;
+      }
+      r->unfinished = 1;
+      // The interrupted command's partial output, if it was atomic. Without the
+      // lock that run may still be writing it.
+      if (pool->lock >= 0) {
+        CB_Arena_Mark scratch = cb_arena_get_scratch(&pool->arena, 1);
+        unlink((char *)cb_str_cat_(scratch.arena, line, S(".tmp")).buf);
+        cb_arena_pop_mark(scratch);
+      }
+      continue;
+    }
+
+    if (cb_str_starts_with(line, S("dir\t"))) {
+      line.buf += 4;
+      line.len -= 4;
+      CB_size len = 0;
+      CB_i64 mtime_ns = cb_str_parse_int(line, &len);
+      if (len == 0 || len >= line.len || line.buf[len] != '\t') { continue; }
+      line.buf += len + 1;
+      line.len -= len + 1;
+
+      CB_Dir_Listing *listing = 0;
+      for (CB_size i = 0; line.len > 0 || i == 0; i++) {
+        CB_Str field = line;
+        for (field.len = 0; field.len < line.len && line.buf[field.len] != '\t'; field.len++) {}
+        line.buf += CB_min(field.len + 1, line.len);
+        line.len -= CB_min(field.len + 1, line.len);
+        if (i > 0) { *(cb_da_push(pool->arena, &listing->entries)) = field; continue; }
+        listing = cb_pool_dir_(pool, field);
+        if (!listing) { listing = cb_pool_add_dir_(pool, field); }
+        listing->entries = cb_da_init(pool->arena, CB_Str_List, 16); // the last line wins
+      }
+      listing->mtime_ns = mtime_ns;
+      continue;
+    }
+
+    CB_i64 fields[2] = {0};
+    CB_b32 ok = 1;
+    for (CB_size i = 0; i < CB_countof(fields) && ok; i++) {
+      CB_size len = 0;
+      fields[i] = cb_str_parse_int(line, &len);
+      ok = (len > 0 && len < line.len && line.buf[len] == '\t');
+      line.buf += len + 1;
+      line.len -= len + 1;
+    }
+    // Command hash, 16 hex digits
+    CB_u64 cmd_hash = 0;
+    ok = ok && line.len > 17 && line.buf[16] == '\t';
+    for (CB_size i = 0; i < 16 && ok; i++) {
+      CB_u8 c = line.buf[i];
+      ok = (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f');
+      cmd_hash = (cmd_hash << 4) | (CB_u64)((c <= '9') ? c - '0' : c - 'a' + 10);
+    }
+    if (!ok) { continue; }
+    line.buf += 17;
+    line.len -= 17;
+    CB_Path_Id id = cb_path_intern(&pool->paths, line);
+    CB_Job_Record *r = cb_pool_record_(pool, id);
+    if (r && !journal) { continue; } // another spelling of the same path
+    if (!r) {
+      r = cb_pool_add_record_(pool, id);
+      r->output = line;
+    }
+    r->duration_ms = fields[0];
+    r->peak_rss = fields[1] * 1024;
+    r->cmd_hash = cmd_hash;
+    r->unfinished = 0;
+  }
+}
+
+// Takes the lock on the log, waiting for the run of another process that holds
+// it. Without its directory there is no log to share, the pool runs unlocked.
+// 1 if it holds the lock.
+static CB_b32 cb_pool_lock_(CB_Pool *pool, CB_Write_Buffer *stderr)
+{
+  if (pool->lock >= 0) { return 1; }
+  CB_Arena_Mark scratch = cb_arena_get_scratch(&pool->arena, 1);
+  CB_b32 result = 0;
+  CB_Str path = cb_str_cat_(scratch.arena, pool->log_path, S(".lock"));
+  int fd = open((char *)path.buf, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    if (errno != ENOENT) {
+      cb_log_emit(stderr, CB_LOG_WARNING,
+                  S("Could not open file "), path, S(": "), cb_str_from_cstr(strerror(errno)),
+                  S(", runs of other processes may rewrite the log at the same time"));
+    }
+    cb_return_defer(0);
+  }
+  struct flock lock = { .l_type = F_WRLCK, .l_whence = SEEK_SET, };
+  int status = fcntl(fd, F_SETLK, &lock);
+  if (status < 0 && (errno == EACCES || errno == EAGAIN)) {
+    cb_log_emit(stderr, CB_LOG_INFO, S("Waiting for another run using "), pool->log_path, S(" ..."));
+    cb_flush(stderr);
+    while ((status = fcntl(fd, F_SETLKW, &lock)) < 0 && errno == EINTR) {}
+  }
+  if (status < 0) {
+    cb_log_emit(stderr, CB_LOG_WARNING,
+                S("Could not lock file "), path, S(": "), cb_str_from_cstr(strerror(errno)),
+                S(", runs of other processes may rewrite the log at the same time"));
+    close(fd);
+    cb_return_defer(0);
+  }
+  pool->lock = fd;
+  result = 1;
+
+ defer:
+  cb_arena_pop_mark(scratch);
+  return result;
+}
+
+// Lets the runs of other processes load the log.
+static void cb_pool_unlock_(CB_Pool *pool)
+{
+  if (pool->lock >= 0) { close(pool->lock); }
+  pool->lock = -1;
+}
+
+CB_Pool cb_pool_init(CB_Arena *arena, CB_Str log_path, CB_Write_Buffer *stderr)
+{
+  CB_Pool result = {0};
+  result.arena = arena;
+  result.log_path = log_path;
+  result.log = cb_da_init(arena, CB_Job_Log, 128);
+  result.paths = cb_path_table_init(arena);
+  result.record_of = cb_da_init(arena, CB_Job_Ids, 256);
+  result.job_of = cb_da_init(arena, CB_Job_Ids, 256);
+  result.conflicts = cb_da_init(arena, CB_Str_List, 4);
+  result.dirs = cb_da_init(arena, CB_Dir_Cache, 64);
+  result.dir_of = cb_da_init(arena, CB_Job_Ids, 64);
+  result.glob_ignore = cb_da_init(arena, CB_Str_List, 4);
+  result.max_jobs = (CB_size)sysconf(_SC_NPROCESSORS_ONLN) + 2;
+  result.memory_budget = cb_available_memory();
+
+  result.journal_path = cb_str_cat_(arena, log_path, S(".journal"));
+  result.journal = -1;
+  result.lock = -1;
+  cb_pool_lock_(&result, stderr);
+  if (cb_file_exists(log_path, stderr) == 1) {
+    CB_Read_Result log = cb_read_entire_file(arena, log_path, stderr);
+    if (log.status && cb_str_starts_with(log.file_contents, S(CB_POOL_LOG_HEADER))) {
+      cb_pool_load_(&result, log.file_contents, 0);
+    }
+  }
+  // The runs since the log was written, the last of them did not finish
+  if (cb_file_exists(result.journal_path, stderr) == 1) {
+    CB_Read_Result journal = cb_read_entire_file(arena, result.journal_path, stderr);
+    if (journal.status) { cb_pool_load_(&result, journal.file_contents, 1); }
+  }
+  return result;
+}
+
+//-- Glob Implementation
+
+// struct linux_dirent64 of getdents64
+typedef struct {
+  CB_u64 d_ino;
+  CB_i64 d_off;
+  unsigned short d_reclen;
+  CB_u8 d_type;
+  char d_name[];
+} CB_Dirent_;
+
+#define CB_DT_UNKNOWN 0
+#define CB_DT_DIR     4
+
+static int cb_glob_compare_(const void *a, const void *b)
+{
+  const CB_Str *x = a, *y = b;
+  int c = __builtin_memcmp(x->buf, y->buf, (CB_usize)CB_min(x->len, y->len));
+  return c ? c : (x->len > y->len) - (x->len < y->len);
+}
+
+// dir/name, or name in the working directory.
+static CB_Str cb_glob_join_(CB_Arena *arena, CB_Str dir, CB_Str name)
+{
+  if (dir.len == 0) { return cb_str_copy_(arena, name); }
+  CB_b32 slash = (dir.buf[dir.len - 1] != '/');
+  CB_Write_Buffer *b = cb_mem_buffer(arena, dir.len + name.len + 1);
+  cb_append(b, dir, slash ? S("/") : S(""), name);
+  return (CB_Str){ .buf = b->buf, .len = b->len, };
+}
+
+// Does one path component match a pattern of "*" and "?"
+static CB_b32 cb_glob_match_(CB_Str pattern, CB_Str name)
+{
+  if (name.len > 0 && name.buf[0] == '.' && (pattern.len == 0 || pattern.buf[0] != '.')) { return 0; }
+  CB_size p = 0, n = 0, star = -1, star_n = 0;
+  while (n < name.len) {
+    if (p < pattern.len && (pattern.buf[p] == '?' || pattern.buf[p] == name.buf[n])) {
+      p++;
+      n++;
+    }
+    else if (p < pattern.len && pattern.buf[p] == '*') {
+      star = p++;
+      star_n = n;
+    }
+    else if (star >= 0) {
+      p = star + 1;
+      n = ++star_n;
+    }
+    else {
+      return 0;
+    }
+  }
+  while (p < pattern.len && pattern.buf[p] == '*') { p++; }
+  return p == pattern.len;
+}
+
+// Listing of dir from the cache if its mtime did not change, 0 if it is not a
+// directory.
+static CB_Dir_Listing *cb_glob_list_(CB_Pool *pool, CB_Str dir, CB_Write_Buffer *stderr)
+{
+  CB_Arena_Mark scratch = cb_arena_get_scratch(&pool->arena, 1);
+  CB_Dir_Listing *result = 0;
+  int fd = -1;
+
+  CB_Dir_Listing *cached = cb_pool_dir_(pool, dir);
+
+  char *c_dir = dir.len ? cb_str_to_cstr(scratch.arena, dir) : ".";
+  struct stat statbuf = {0};
+  int status = stat(c_dir, &statbuf);
+  if (status < 0 && errno != ENOENT && errno != ENOTDIR) {
+    cb_log_emit(stderr, CB_LOG_ERROR, S("Could not stat directory "), dir, S(": "), cb_str_from_cstr(strerror(errno)));
+  }
+  if (status < 0 || !S_ISDIR(statbuf.st_mode)) {
+    if (cached) { cached->mtime_ns = -1; } // gone, not written to the log
+    cb_return_defer(0);
+  }
+  // Taken before reading, a change while we read shows up next time
+  CB_i64 mtime_ns = (CB_i64)statbuf.st_mtim.tv_sec * 1000000000ll + statbuf.st_mtim.tv_nsec;
+  if (cached && cached->mtime_ns == mtime_ns) { cb_return_defer(cached); }
+
+  result = cached;
+  if (!result) { result = cb_pool_add_dir_(pool, cb_str_copy_(pool->arena, dir)); }
+  result->mtime_ns = -1; // until read
+  result->entries = cb_da_init(pool->arena, CB_Str_List, 16);
+
+  fd = open(c_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) {
+    cb_log_emit(stderr, CB_LOG_ERROR, S("Could not open directory "), dir, S(": "), cb_str_from_cstr(strerror(errno)));
+    cb_return_defer(0);
+  }
+  CB_size buf_len = 32 * 1024;
+  CB_u8 *buf = (CB_u8 *)new(scratch.arena, CB_u64, buf_len / 8); // dirents are 8 byte aligned
+  for (;;) {
+    long n = syscall(SYS_getdents64, fd, buf, (CB_usize)buf_len);
+    if (n < 0 && errno == EINTR) { continue; }
+    if (n < 0) {
+      cb_log_emit(stderr, CB_LOG_ERROR, S("Could not read directory "), dir, S(": "), cb_str_from_cstr(strerror(errno)));
+      cb_return_defer(0);
+    }
+    if (n == 0) { break; }
+    for (long off = 0; off < n;) {
+      CB_Dirent_ *d = (CB_Dirent_ *)(buf + off);
+      off += d->d_reclen;
+      CB_Str name = cb_str_from_cstr(d->d_name);
+      if (cb_str_equals(name, S(".")) || cb_str_equals(name, S(".."))) { continue; }
+
+      CB_b32 is_dir = (d->d_type == CB_DT_DIR);
+      if (d->d_type == CB_DT_UNKNOWN) { // some file systems do not fill in d_type
+        struct stat entry = {0};
+        is_dir = (fstatat(fd, d->d_name, &entry, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(entry.st_mode));
+      }
+      CB_Write_Buffer *b = cb_mem_buffer(pool->arena, name.len + 1);
+      cb_append(b, name, is_dir ? S("/") : S(""));
+      *(cb_da_push(pool->arena, &result->entries)) = (CB_Str){ .buf = b->buf, .len = b->len, };
+    }
+  }
+  qsort(result->entries.items, (CB_usize)result->entries.len, sizeof(CB_Str), cb_glob_compare_);
+  result->mtime_ns = mtime_ns;
+
+ defer:
+  if (fd >= 0) { close(fd); }
+  cb_arena_pop_mark(scratch);
+  return result;
+}
+
+// Is listing of a directory that is no longer in its parent's listing
+static CB_b32 cb_glob_orphan_(CB_Pool *pool, CB_Dir_Listing *listing)
+{
+  CB_Str parent = listing->path;
+  while (parent.len > 0 && parent.buf[parent.len - 1] != '/') { parent.len--; }
+  CB_Str name = { .buf = listing->path.buf + parent.len, .len = listing->path.len - parent.len, };
+  if (parent.len > 1) { parent.len--; } // keep "/"
+  if (name.len == 0) { return 0; }
+
+  CB_Dir_Listing *it = cb_pool_dir_(pool, parent);
+  if (!it || it == listing) { return 0; }
+  for (CB_size k = 0; k < it->entries.len; k++) {
+    CB_Str entry = it->entries.items[k];
+    if (entry.len == name.len + 1 && cb_str_starts_with(entry, name) && entry.buf[name.len] == '/') { return 0; }
+  }
+  return 1;
+}
+
+static void cb_glob_walk_(CB_Pool *pool, CB_Str dir, CB_Str *parts, CB_size parts_len, CB_Str_List *out, CB_Write_Buffer *stderr)
+{
+  CB_Str part = parts[0];
+  CB_b32 last = (parts_len == 1);
+
+  if (cb_str_equals(part, S("**"))) {
+    cb_glob_walk_(pool, dir, parts + 1, parts_len - 1, out, stderr);
+    // Copied, the recursion may grow pool->dirs
+    CB_Dir_Listing *listing = cb_glob_list_(pool, dir, stderr);
+    CB_Str_List entries = listing ? listing->entries : (CB_Str_List){0};
+    for (CB_size i = 0; i < entries.len; i++) {
+      CB_Str name = entries.items[i];
+      if (name.buf[name.len - 1] != '/' || name.buf[0] == '.') { continue; }
+      name.len--;
+      CB_b32 ignored = 0;
+      for (CB_size k = 0; k < pool->glob_ignore.len && !ignored; k++) {
+        ignored = cb_str_equals(name, pool->glob_ignore.items[k]);
+      }
+      if (ignored) { continue; }
+      cb_glob_walk_(pool, cb_glob_join_(pool->arena, dir, name), parts, parts_len, out, stderr);
+    }
+    return;
+  }
+
+  CB_b32 wild = 0;
+  for (CB_size i = 0; i < part.len; i++) { wild |= (part.buf[i] == '*' || part.buf[i] == '?'); }
+  if (!wild && !last) {
+    cb_glob_walk_(pool, cb_glob_join_(pool->arena, dir, part), parts + 1, parts_len - 1, out, stderr);
+    return;
+  }
+
+  CB_Dir_Listing *listing = cb_glob_list_(pool, dir, stderr);
+  CB_Str_List entries = listing ? listing->entries : (CB_Str_List){0};
+  for (CB_size i = 0; i < entries.len; i++) {
+    CB_Str name = entries.items[i];
+    CB_b32 is_dir = (name.buf[name.len - 1] == '/');
+    if (is_dir) { name.len--; }
+    if (wild ? !cb_glob_match_(part, name) : !cb_str_equals(part, name)) { continue; }
+    if (last) {
+      *(cb_da_push(pool->arena, out)) = cb_glob_join_(pool->arena, dir, name);
+    }
+    else if (is_dir) {
+      cb_glob_walk_(pool, cb_glob_join_(pool->arena, dir, name), parts + 1, parts_len - 1, out, stderr);
+    }
+  }
+}
+
+CB_Str_List cb_glob(CB_Pool *pool, CB_Str pattern, CB_Write_Buffer *stderr)
+{
+  CB_Str_List result = cb_da_init(pool->arena, CB_Str_List, 16);
+
+  CB_Str dir = {0};
+  if (pattern.len > 0 && pattern.buf[0] == '/') {
+    dir = S("/");
+    pattern.buf++;
+    pattern.len--;
+  }
+  CB_Str_List parts = cb_da_init(pool->arena, CB_Str_List, 8);
+  CB_size globstars = 0;
+  while (pattern.len > 0) {
+    CB_Str part = pattern;
+    for (part.len = 0; part.len < pattern.len && pattern.buf[part.len] != '/'; part.len++) {}
+    pattern.buf += CB_min(part.len + 1, pattern.len);
+    pattern.len -= CB_min(part.len + 1, pattern.len);
+    if (part.len == 0 || cb_str_equals(part, S("."))) { continue; }
+    globstars += cb_str_equals(part, S("**"));
+    *(cb_da_push(pool->arena, &parts)) = part;
+  }
+  if (parts.len == 0) { return result; }
+  // "dir/**" is everything below dir
+  if (cb_str_equals(parts.items[parts.len - 1], S("**"))) { *(cb_da_push(pool->arena, &parts)) = S("*"); }
+
+  cb_glob_walk_(pool, dir, parts.items, parts.len, &result, stderr);
+
+  // "a/**/b/**/*.c" reaches a/b/b/x.c twice
+  if (globstars > 1) {
+    CB_size len = 0;
+    for (CB_size i = 0; i < result.len; i++) {
+      CB_b32 seen = 0;
+      for (CB_size j = 0; j < len && !seen; j++) { seen = cb_str_equals(result.items[i], result.items[j]); }
+      if (!seen) { result.items[len++] = result.items[i]; }
+    }
+    result.len = len;
+  }
+  return result;
+}
+
+static CB_Job *cb_pool_push_(CB_Pool *pool, CB_Path_Id output_id, CB_Str output, CB_Str *inputs, CB_size inputs_len)
+{
+  CB_size id = pool->jobs.len;
+  CB_Job *job = cb_seg_push(pool->arena, &pool->jobs);
+  job->id = id;
+  job->output = cb_str_copy_(pool->arena, output);
+  job->output_id = output_id;
+  job->inputs = cb_da_init(pool->arena, CB_Str_List, CB_max(inputs_len, 1));
+  for (CB_size i = 0; i < inputs_len; i++) {
+    *(cb_da_push(pool->arena, &job->inputs)) = cb_str_copy_(pool->arena, inputs[i]);
+  }
+  job->proc = CB_INVALID_PROC;
+  job->status = -1;
+
+  while (pool->job_of.len <= output_id) { *(cb_da_push(pool->arena, &pool->job_of)) = 0; }
+  if (!pool->job_of.items[output_id] || pool->job_of.items[output_id] > id ||
+      cb_seg_at(&pool->jobs, pool->job_of.items[output_id] - 1)->output_id != output_id) {
+    pool->job_of.items[output_id] = id + 1;
+  }
+  return job;
+}
+
+// The job pushed since the last run that makes output, 0 if none.
+static CB_Job *cb_pool_job_of_(CB_Pool *pool, CB_Path_Id output_id)
+{
+  if (output_id >= pool->job_of.len || pool->job_of.items[output_id] == 0) { return 0; }
+  CB_size index = pool->job_of.items[output_id] - 1;
+  if (index >= pool->jobs.len) { return 0; }
+  CB_Job *job = cb_seg_at(&pool->jobs, index);
+  return (job->output_id == output_id) ? job : 0;
+}
+
+// Whether first, pushed earlier for the same output, has these inputs. A job
+// for the output that is not the same recipe is kept in conflicts.
+static CB_b32 cb_pool_same_job_(CB_Pool *pool, CB_Job *first, CB_b32 same, CB_Str *inputs, CB_size inputs_len)
+{
+  same = same && first->inputs.len == inputs_len;
+  for (CB_size i = 0; same && i < inputs_len; i++) { same = cb_str_equals(first->inputs.items[i], inputs[i]); }
+  if (!same) { *(cb_da_push(pool->arena, &pool->conflicts)) = first->output; }
+  return same;
+}
+
+CB_Job *cb_pool_push(CB_Pool *pool, CB_Command cmd, CB_Str output, CB_Str *inputs, CB_size inputs_len)
+{
+  CB_Path_Id output_id = cb_path_intern(&pool->paths, output);
+  CB_Job *first = cb_pool_job_of_(pool, output_id);
+  if (first) {
+    CB_b32 same = !first->fn && !first->task_fn && first->cmd.len == cmd.len;
+    for (CB_size i = 0; same && i < cmd.len; i++) { same = cb_str_equals(first->cmd.items[i], cmd.items[i]); }
+    if (cb_pool_same_job_(pool, first, same, inputs, inputs_len)) { return first; }
+  }
+
+  CB_Job *job = cb_pool_push_(pool, output_id, output, inputs, inputs_len);
+  job->cmd = cb_da_init(pool->arena, CB_Command, cmd.len);
+  for (CB_size i = 0; i < cmd.len; i++) {
+    *(cb_da_push(pool->arena, &job->cmd)) = cb_str_copy_(pool->arena, cmd.items[i]);
+  }
+  return job;
+}
+
+CB_Job *cb_pool_push_fn(CB_Pool *pool, CB_Job_Fn *fn, void *data, CB_Str output, CB_Str *inputs, CB_size inputs_len)
+{
+  CB_Path_Id output_id = cb_path_intern(&pool->paths, output);
+  CB_Job *first = cb_pool_job_of_(pool, output_id);
+  if (first && cb_pool_same_job_(pool, first, first->fn == fn, inputs, inputs_len)) { return first; }
+
+  CB_Job *job = cb_pool_push_(pool, output_id, output, inputs, inputs_len);
+  job->fn = fn;
+  job->data = data;
+  return job;
+}
+
+static void cb_pool_on_alarm_(int sig) { (void)sig; }
+
+// SIGALRM after ns, to interrupt wait4 at a job's timeout. 0 disarms it.
+static void cb_pool_alarm_(CB_i64 ns)
+{
+  static CB_b32 installed = 0;
+  if (ns > 0 && !installed) {
+    // Without SA_RESTART, so wait4 fails with EINTR
+    struct sigaction action = { .sa_handler = cb_pool_on_alarm_, };
+    sigaction(SIGALRM, &action, 0);
+    installed = 1;
+  }
+  if (ns <= 0 && !installed) { return; }
+  struct itimerval timer = {0};
+  timer.it_value.tv_sec = ns / 1000000000;
+  timer.it_value.tv_usec = (ns % 1000000000) / 1000 + (ns > 0); // never 0, which would disarm it
+  // Again every 100 ms, in case it went off before wait4 started
+  if (ns > 0) { timer.it_interval.tv_usec = 100 * 1000; }
+  setitimer(ITIMER_REAL, &timer, 0);
+}
+
+static void cb_pool_start_(CB_Pool *pool, CB_Job *job, CB_size index, CB_b32 recorded, CB_Write_Buffer *stderr)
+{
+  if (pool->cgroup_limit > 0 && job->worker.len == 0) {
+    CB_Str root = cb_pool_cgroup_root_(stderr);
+    if (root.len == 0) { pool->cgroup_limit = 0; }
+    else {
+      CB_Write_Buffer *b = cb_mem_buffer(pool->arena, root.len + 128);
+      cb_append(b, root, S("/cbuild-job-"));
+      cb_append_long(b, (long)getpid());
+      cb_append(b, S("-"));
+      cb_append_long(b, (long)index);
+      CB_Str cgroup = cb_str_copy_(pool->arena, (CB_Str){ .buf = b->buf, .len = b->len, });
+
+      b->len = 0;
+      if (recorded) { cb_append_long(b, (long)(job->predicted_rss * pool->cgroup_limit)); }
+      else          { cb_append(b, S("max")); }
+      CB_Str memory_max = { .buf = b->buf, .len = b->len, };
+
+      if ((mkdir((char *)cgroup.buf, 0755) < 0 && errno != EEXIST) ||
+          !cb_write_small_file_(pool->arena, cb_str_cat_(pool->arena, cgroup, S("/memory.max")), memory_max)) {
+        cb_log_emit(stderr, CB_LOG_WARNING,
+                    S("Could not create cgroup "), cgroup, S(": "),
+                    cb_str_from_cstr(strerror(errno)), S(", running jobs without cgroups"));
+        rmdir((char *)cgroup.buf);
+        pool->cgroup_limit = 0;
+      }
+      else {
+        job->cgroup = cgroup;
+      }
+    }
+  }
+
+  CB_i32 fderr = 0;
+  if (job->stderr_path.len) {
+    fderr = open(cb_str_to_cstr(pool->arena, job->stderr_path), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fderr < 0) {
+      cb_log_emit(stderr, CB_LOG_ERROR,
+                  S("Could not open file "), job->stderr_path, S(": "),
+                  cb_str_from_cstr(strerror(errno)));
+      job->proc = CB_INVALID_PROC;
+      return;
+    }
+  }
+
+  job->start_ns = cb_now_ns_();
+  // The worker's object is renamed into place by cb_dist_run already
+  if (job->worker.len) { job->proc = cb_dist_run_async(job->cmd, job->worker, stderr); }
+  else {
+    CB_Command cmd = job->cmd;
+    // A restat command has to see its old output to leave it untouched
+    for (CB_size i = 1; job->atomic && !job->restat && i < job->cmd.len && job->tmp_output.len == 0; i++) {
+      if (!cb_str_equals(job->cmd.items[i], job->output)) { continue; }
+      job->tmp_output = cb_str_cat_(pool->arena, job->output, S(".tmp"));
+      cmd = cb_da_init(pool->arena, CB_Command, job->cmd.len);
+      cb_cmd_append_strs(pool->arena, &cmd, job->cmd.items, job->cmd.len);
+      cmd.items[i] = job->tmp_output;
+    }
+    CB_Cmd_Opt opt = { .cgroup = job->cgroup, .fderr = fderr, .fdout = job->capture_stdout ? fderr : 0, };
+    job->proc = cb_cmd_run_opt(cmd, opt, stderr);
+  }
+  if (fderr > 0) { close(fderr); }
+}
+
+// 0 for jobs without a command line.
+static CB_u64 cb_pool_cmd_hash_(CB_Job *job)
+{
+  if (job->cmd.len == 0) { return 0; }
+  CB_u64 h = CB_HASH_INIT;
+  for (CB_size i = 0; i < job->cmd.len; i++) {
+    h = cb_hash_str(h, job->cmd.items[i]);
+    h = cb_hash_str(h, S("\0"));
+  }
+  return h;
+}
+
+// Appends line to the journal in one write, so a run that is killed leaves
+// whole lines.
+static void cb_pool_journal_(CB_Pool *pool, CB_Str line)
+{
+  if (pool->journal >= 0) { cb_write(pool->journal, line.buf, line.len); }
+}
+
+// Journals that job is about to run.
+static void cb_pool_journal_start_(CB_Pool *pool, CB_Job *job)
+{
+  CB_Arena_Mark scratch = cb_arena_get_scratch(&pool->arena, 1);
+  CB_Write_Buffer *b = cb_mem_buffer(scratch.arena, job->output.len + 8);
+  cb_append(b, S("start\t"), job->output, S("\n"));
+  cb_pool_journal_(pool, (CB_Str){ .buf = b->buf, .len = b->len, });
+  cb_arena_pop_mark(scratch);
+
+  CB_Job_Record *r = cb_pool_record_(pool, job->output_id);
+  if (r) { r->unfinished = 1; }
+}
+
+static void cb_pool_record_job_(CB_Pool *pool, CB_Job *job)
+{
+  CB_Job_Record *r = cb_pool_record_(pool, job->output_id);
+  if (!r) {
+    r = cb_pool_add_record_(pool, job->output_id);
+    r->output = job->output;
+  }
+  r->duration_ms = job->duration_ms;
+  if (job->peak_rss > 0) { r->peak_rss = job->peak_rss; }
+  // A failed command may have left the old output behind
+  if (job->status == 0) { r->cmd_hash = cb_pool_cmd_hash_(job); }
+  r->unfinished = (job->status != 0);
+
+  if (job->status == 0) {
+    CB_Arena_Mark scratch = cb_arena_get_scratch(&pool->arena, 1);
+    CB_Write_Buffer *b = cb_mem_buffer(scratch.arena, job->output.len + 64);
+    cb_pool_append_record_(b, r);
+    cb_pool_journal_(pool, (CB_Str){ .buf = b->buf, .len = b->len, });
+    cb_arena_pop_mark(scratch);
+  }
+}
+
+static void cb_pool_finish_(CB_Pool *pool, CB_Job *job, int wstatus, struct rusage *usage, CB_Write_Buffer *stderr)
+{
+  job->duration_ms = (cb_now_ns_() - job->start_ns) / 1000000;
+  // ru_maxrss covers the children the job waited for, like cc1 of cc. On a
+  // worker it would be the fork talking to it, not the compile: unknown, the
+  // log keeps the last local sample.
+  job->peak_rss = job->worker.len ? 0 : (CB_i64)usage->ru_maxrss * 1024;
+  job->status = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : -1;
+
+  CB_b32 oom_killed = 0;
+  if (job->cgroup.len) {
+    CB_i64 peak = cb_parse_file_int_(pool->arena, cb_str_cat_(pool->arena, job->cgroup, S("/memory.peak")));
+    job->peak_rss = CB_max(job->peak_rss, peak);
+    CB_Str events = cb_read_small_file_(pool->arena, cb_str_cat_(pool->arena, job->cgroup, S("/memory.events")));
+    oom_killed = cb_str_parse_int(cb_find_line_(events, S("oom_kill ")), 0) > 0;
+    rmdir((char *)job->cgroup.buf);
+  }
+
+  if (job->tmp_output.len) {
+    // Nothing to rename if the command succeeded without writing it
+    CB_b32 written = access((char *)job->tmp_output.buf, F_OK) == 0;
+    if (job->status == 0 && written && !cb_rename(job->tmp_output, job->output, stderr)) { job->status = 1; }
+    if (job->status != 0 && written) { unlink((char *)job->tmp_output.buf); }
+  }
+
+  if (job->status != 0) {
+    cb_log_begin(stderr, CB_LOG_ERROR);
+      cb_append(stderr, job->output, S(": "));
+      if (job->timed_out) {
+        cb_append(stderr, S("Child process timed out after "));
+        cb_append_long(stderr, (long)job->timeout_ms);
+        cb_append(stderr, S(" ms"));
+      }
+      else if (WIFEXITED(wstatus)) {
+        cb_append(stderr, S("Child process exited with exit code "));
+        cb_append_long(stderr, (long)job->status);
+      }
+      else if (WIFSIGNALED(wstatus)) {
+        cb_append(stderr, S("Child process was terminated by "), cb_str_from_cstr(strsignal(WTERMSIG(wstatus))));
+      }
+      if (oom_killed) { cb_append(stderr, S(" (exceeded the memory.max of its cgroup)")); }
+    cb_log_end(stderr);
+  }
+
+  cb_pool_record_job_(pool, job);
+}
+
+// Whether ready job a runs before b: longer critical path first, then in push order.
+static CB_b32 cb_pool_ready_before_(CB_Pool *pool, CB_size a, CB_size b)
+{
+  CB_i64 path_a = cb_seg_at(&pool->jobs, a)->critical_path;
+  CB_i64 path_b = cb_seg_at(&pool->jobs, b)->critical_path;
+  return (path_a != path_b) ? path_a > path_b : a < b;
+}
+
+// Whether unfit job a fits before b: smaller predicted_rss first, then in push order.
+static CB_b32 cb_pool_unfit_before_(CB_Pool *pool, CB_size a, CB_size b)
+{
+  CB_i64 rss_a = cb_seg_at(&pool->jobs, a)->predicted_rss;
+  CB_i64 rss_b = cb_seg_at(&pool->jobs, b)->predicted_rss;
+  return (rss_a != rss_b) ? rss_a < rss_b : a < b;
+}
+
+typedef CB_b32 CB_Pool_Before_(CB_Pool *pool, CB_size a, CB_size b);
+
+static void cb_pool_heap_push_(CB_Pool *pool, CB_Job_Ids *heap, CB_Pool_Before_ *before, CB_size id)
+{
+  *(cb_da_push(pool->arena, heap)) = id;
+  for (CB_size i = heap->len - 1; i > 0;) {
+    CB_size parent = (i - 1) / 2;
+    if (!before(pool, heap->items[i], heap->items[parent])) { break; }
+    CB_size tmp = heap->items[i];
+    heap->items[i] = heap->items[parent];
+    heap->items[parent] = tmp;
+    i = parent;
+  }
+}
+
+static CB_size cb_pool_heap_pop_(CB_Pool *pool, CB_Job_Ids *heap, CB_Pool_Before_ *before)
+{
+  CB_size top = heap->items[0];
+  heap->items[0] = heap->items[--heap->len];
+  for (CB_size i = 0;;) {
+    CB_size first = i;
+    for (CB_size child = 2 * i + 1; child <= 2 * i + 2 && child < heap->len; child++) {
+      if (before(pool, heap->items[child], heap->items[first])) { first = child; }
+    }
+    if (first == i) { break; }
+    CB_size tmp = heap->items[i];
+    heap->items[i] = heap->items[first];
+    heap->items[first] = tmp;
+    i = first;
+  }
+  return top;
+}
+
+static void cb_pool_ready_(CB_Pool *pool, CB_Job *job)
+{
+  job->state = CB_JOB_READY;
+  cb_pool_heap_push_(pool, &pool->ready, cb_pool_ready_before_, job->id);
+}
+
+// Takes the ready job with the longest critical path that fits in the memory
+// left off the heap, 0 if none. The ones that do not fit wait on the unfit
+// heap, the smallest go back once running jobs finished and made room.
+static CB_Job *cb_pool_pop_ready_(CB_Pool *pool, CB_size running, CB_i64 free_rss)
+{
+  while (pool->unfit.len) {
+    CB_Job *job = cb_seg_at(&pool->jobs, pool->unfit.items[0]);
+    if (running > 0 && job->predicted_rss > free_rss) { break; }
+    cb_pool_heap_pop_(pool, &pool->unfit, cb_pool_unfit_before_);
+    cb_pool_heap_push_(pool, &pool->ready, cb_pool_ready_before_, job->id);
+  }
+  while (pool->ready.len) {
+    CB_Job *job = cb_seg_at(&pool->jobs, cb_pool_heap_pop_(pool, &pool->ready, cb_pool_ready_before_));
+    if (running == 0 || job->predicted_rss <= free_rss) { return job; }
+    cb_pool_heap_push_(pool, &pool->unfit, cb_pool_unfit_before_, job->id);
+  }
+  return 0;
+}
+
+// Marks job done and readies the jobs waiting on it.
+static void cb_pool_done_(CB_Pool *pool, CB_Job *job)
+{
+  job->state = CB_JOB_DONE;
+  if (job->ran && job->restat && job->status == 0) {
+    job->ran = (cb_mtime_ns_(job->output) != job->output_mtime_ns);
+  }
+  for (CB_size i = 0; i < job->dependents.len; i++) {
+    CB_Job *dependent = cb_seg_at(&pool->jobs, job->dependents.items[i]);
+    if (--dependent->pending == 0) { cb_pool_ready_(pool, dependent); }
+  }
+  for (CB_size i = 0; i < job->awaiters.len; i++) {
+    CB_Job *it = cb_seg_at(&pool->jobs, job->awaiters.items[i]);
+    it->task.status = job->ran ? job->status : 0;
+    cb_pool_resume_later_(pool, it);
+  }
+}
+
+// Rewrites the journal with the outputs the log does not cover, unfinished
+// ones, after the log was written.
+static CB_b32 cb_pool_write_journal_(CB_Pool *pool, CB_Write_Buffer *stderr)
+{
+  CB_Arena_Mark scratch = cb_arena_get_scratch(&pool->arena, 1);
+  CB_b32 result = 0;
+
+  CB_Write_Buffer *b = cb_mem_buffer(scratch.arena, 1024);
+  for (CB_size i = 0; i < pool->log.len; i++) {
+    if (!pool->log.items[i].unfinished) { continue; }
+    cb_append(b, S("start\t"), pool->log.items[i].output, S("\n"));
+  }
+  if (b->len) { cb_return_defer(cb_write_entire_file(pool->journal_path, (CB_Str){ .buf = b->buf, .len = b->len, }, stderr)); }
+  if (unlink(cb_str_to_cstr(scratch.arena, pool->journal_path)) < 0 && errno != ENOENT) {
+    cb_log_emit(stderr, CB_LOG_ERROR,
+                S("Could not remove file "), pool->journal_path, S(": "),
+                cb_str_from_cstr(strerror(errno)));
+    cb_return_defer(0);
+  }
+  cb_return_defer(1);
+
+ defer:
+  cb_arena_pop_mark(scratch);
+  return result;
+}
+
+static CB_b32 cb_pool_write_log_(CB_Pool *pool, CB_Write_Buffer *stderr)
+{
+  CB_Arena_Mark scratch = cb_arena_get_scratch(&pool->arena, 1);
+  CB_b32 result = 0;
+
+  CB_Str tmp_path = cb_str_cat_(scratch.arena, pool->log_path, S(".tmp"));
+  CB_i32 fd = cb_open(tmp_path, stderr);
+  if (fd < 0) { cb_return_defer(0); }
+
+  CB_Write_Buffer *b = cb_fd_buffer(fd, scratch.arena, 16 * 1024);
+  cb_append(b, S(CB_POOL_LOG_HEADER));
+  for (CB_size i = 0; i < pool->log.len; i++) {
+    cb_pool_append_record_(b, pool->log.items + i);
+  }
+  for (CB_size i = 0; i < pool->dirs.len; i++) {
+    CB_Dir_Listing *listing = pool->dirs.items + i;
+    // Names with tabs or newlines do not fit the format, they are read again
+    CB_b32 ok = (listing->mtime_ns >= 0 && !cb_glob_orphan_(pool, listing) &&
+                 cb_str_find(listing->path, S("\t")) < 0 && cb_str_find(listing->path, S("\n")) < 0);
+    for (CB_size k = 0; k < listing->entries.len && ok; k++) {
+      ok = (cb_str_find(listing->entries.items[k], S("\t")) < 0 && cb_str_find(listing->entries.items[k], S("\n")) < 0);
+    }
+    if (!ok) { continue; }
+    cb_append(b, S("dir\t"));
+    cb_append_long(b, (long)listing->mtime_ns);
+    cb_append(b, S("\t"), listing->path);
+    for (CB_size k = 0; k < listing->entries.len; k++) {
+      cb_append(b, S("\t"), listing->entries.items[k]);
+    }
+    cb_append(b, S("\n"));
+  }
+  cb_flush(b);
+  if (!cb_close(fd, stderr) || b->error) { cb_return_defer(0); }
+  cb_return_defer(cb_rename(tmp_path, pool->log_path, stderr));
+
+ defer:
+  cb_arena_pop_mark(scratch);
+  return result;
+}
+
+// Stats the outputs and inputs of all jobs, links every job to the earlier
+// jobs making its inputs, predicts its memory use and critical path and
+// readies the jobs that wait on none.
+static void cb_pool_plan_(CB_Pool *pool)
+{
+  CB_Jobs *jobs = &pool->jobs;
+  CB_Arena_Mark scratch = cb_arena_get_scratch(&pool->arena, 1);
+
+  // Every path once by its id: a header many objects include is stat'ed once
+  // and a job finds the job making an input by index, not by comparing strings.
+  for (CB_size i = 0; i < jobs->len; i++) {
+    CB_Job *job = cb_seg_at(jobs, i);
+    job->input_ids = new(pool->arena, CB_Path_Id, job->inputs.len);
+    for (CB_size k = 0; k < job->inputs.len; k++) {
+      job->input_ids[k] = cb_path_intern(&pool->paths, job->inputs.items[k]);
+    }
+  }
+  CB_size paths_len = pool->paths.paths.len + 1;
+  {
+    CB_size *file_of = new(scratch.arena, CB_size, paths_len); // index + 1 in unique
+    CB_File_Info *unique = new(scratch.arena, CB_File_Info, paths_len);
+    CB_size unique_len = 0;
+    CB_size files_len = 0;
+    for (CB_size i = 0; i < jobs->len; i++) {
+      CB_Job *job = cb_seg_at(jobs, i);
+      files_len += 1 + job->inputs.len;
+      for (CB_size k = -1; k < job->inputs.len; k++) {
+        CB_Path_Id id = (k < 0) ? job->output_id : job->input_ids[k];
+        if (file_of[id]) { continue; }
+        unique[unique_len++] = (CB_File_Info){ .path = (k < 0) ? job->output : job->inputs.items[k], };
+        file_of[id] = unique_len;
+      }
+    }
+    cb_stat_files(unique, unique_len);
+
+    CB_File_Info *files = new(pool->arena, CB_File_Info, files_len);
+    for (CB_size i = 0; i < jobs->len; i++) {
+      CB_Job *job = cb_seg_at(jobs, i);
+      job->files = files;
+      *(files++) = unique[file_of[job->output_id] - 1];
+      for (CB_size k = 0; k < job->inputs.len; k++) {
+        *(files++) = unique[file_of[job->input_ids[k]] - 1];
+      }
+    }
+  }
+
+  CB_i64 mean_rss = CB_POOL_DEFAULT_RSS;
+  CB_i64 mean_duration = CB_POOL_DEFAULT_DURATION;
+  {
+    CB_i64 rss_sum = 0, rss_count = 0, duration_sum = 0;
+    for (CB_size i = 0; i < pool->log.len; i++) {
+      duration_sum += pool->log.items[i].duration_ms;
+      if (pool->log.items[i].peak_rss > 0) {
+        rss_sum += pool->log.items[i].peak_rss;
+        rss_count++;
+      }
+    }
+    if (rss_count > 0)     { mean_rss = rss_sum / rss_count; }
+    if (pool->log.len > 0) { mean_duration = duration_sum / pool->log.len; }
+  }
+
+  CB_size *maker = new(scratch.arena, CB_size, paths_len); // index + 1 of the first job making the path
+  for (CB_size i = 0; i < jobs->len; i++) {
+    CB_Job *job = cb_seg_at(jobs, i);
+    job->deps = cb_da_init(pool->arena, CB_Job_Ids, 4);
+    job->dependents = cb_da_init(pool->arena, CB_Job_Ids, 4);
+    for (CB_size k = 0; k < job->inputs.len; k++) {
+      CB_size j = maker[job->input_ids[k]] - 1;
+      if (j < 0) { continue; }
+      *(cb_da_push(pool->arena, &job->deps)) = j;
+      *(cb_da_push(pool->arena, &cb_seg_at(jobs, j)->dependents)) = i;
+    }
+    if (maker[job->output_id] == 0) { maker[job->output_id] = i + 1; }
+    job->pending = job->deps.len;
+    job->state = CB_JOB_WAITING;
+
+    CB_Job_Record *r = cb_pool_record_(pool, job->output_id);
+    job->predicted_rss = (r && r->peak_rss > 0) ? r->peak_rss : mean_rss;
+    job->critical_path = r ? r->duration_ms : mean_duration;
+  }
+
+  // Deps come before their dependents, so walking backwards sees every
+  // dependent's critical path before the jobs it waits on.
+  for (CB_size i = jobs->len - 1; i >= 0; i--) {
+    CB_Job *job = cb_seg_at(jobs, i);
+    for (CB_size k = 0; k < job->deps.len; k++) {
+      CB_Job *dep = cb_seg_at(jobs, job->deps.items[k]);
+      CB_Job_Record *r = cb_pool_record_(pool, dep->output_id);
+      CB_i64 duration = r ? r->duration_ms : mean_duration;
+      dep->critical_path = CB_max(dep->critical_path, duration + job->critical_path);
+    }
+  }
+
+  pool->ready = cb_da_init(pool->arena, CB_Job_Ids, jobs->len + 1);
+  pool->unfit = cb_da_init(pool->arena, CB_Job_Ids, jobs->len + 1);
+  pool->resume = cb_da_init(pool->arena, CB_Job_Ids, 16);
+  pool->resume_next = 0;
+  pool->running = cb_da_init(pool->arena, CB_Job_Ids, 16);
+  for (CB_size i = 0; i < jobs->len; i++) {
+    if (cb_seg_at(jobs, i)->pending == 0) { cb_pool_ready_(pool, cb_seg_at(jobs, i)); }
+  }
+
+  cb_arena_pop_mark(scratch);
+}
+
+// Like cb_needs_rebuild on the stats taken by cb_pool_plan_, and the command
+// line against the log. Only valid while none of the job's deps ran, they may
+// have touched its inputs since. Fills in why if outdated.
+static CB_b32 cb_pool_outdated_(CB_Pool *pool, CB_Job *job, CB_Explanation *why, CB_Write_Buffer *stderr)
+{
+  CB_File_Info *output = job->files;
+  if (output->error == ENOENT) {
+    why->reason = CB_EXPLAIN_MISSING;
+    return 1;
+  }
+  CB_Job_Record *r = cb_pool_record_(pool, job->output_id);
+  if (r && r->unfinished) {
+    why->reason = CB_EXPLAIN_INTERRUPTED;
+    return 1;
+  }
+  for (CB_size i = 0; i <= job->inputs.len; i++) {
+    CB_File_Info *file = job->files + i;
+    if (file->error) {
+      cb_log_emit(stderr, CB_LOG_ERROR,
+                  S("Could not stat file "),
+                  file->path,
+                  S(": "),
+                  cb_str_from_cstr(strerror(file->error)));
+      return -1;
+    }
+    if (i > 0 && file->mtime_ns > output->mtime_ns) {
+      why->reason = CB_EXPLAIN_NEWER_INPUT;
+      why->input = file->path;
+      why->output_mtime_ns = output->mtime_ns;
+      why->input_mtime_ns = file->mtime_ns;
+      return 1;
+    }
+  }
+  CB_u64 hash = cb_pool_cmd_hash_(job);
+  if (r && r->cmd_hash && hash && r->cmd_hash != hash) {
+    why->reason = CB_EXPLAIN_COMMAND_CHANGED;
+    why->old_hash = r->cmd_hash;
+    why->new_hash = hash;
+    return 1;
+  }
+  return 0;
+}
+
+static CB_Pool *cb_pool_running_ = 0;
+
+// cb_exit_hook while a pool runs: a task or a failed allocation that calls
+// cb_exit kills and reaps the running jobs and closes the journal, which keeps
+// their start lines for the next run, before watch carries on.
+static void cb_pool_on_exit_(void)
+{
+  CB_Pool *pool = cb_pool_running_;
+  cb_exit_hook = 0;
+  cb_pool_running_ = 0;
+  if (!pool) { return; }
+  cb_pool_alarm_(0);
+  for (CB_size i = 0; i < pool->running.len; i++) {
+    CB_Job *job = cb_seg_at(&pool->jobs, pool->running.items[i]);
+    if (job->proc == CB_INVALID_PROC) { continue; }
+    kill(job->proc, SIGKILL);
+    while (waitpid(job->proc, 0, 0) < 0 && errno == EINTR) {}
+    job->proc = CB_INVALID_PROC;
+  }
+  pool->running.len = 0;
+  if (pool->journal >= 0) { close(pool->journal); }
+  pool->journal = -1;
+  cb_pool_unlock_(pool);
+  pool->jobs.len = 0;
+}
+
+CB_b32 cb_pool_run(CB_Pool *pool, CB_Write_Buffer *stderr)
+{
+  CB_b32 result = 1;
+  CB_Jobs *jobs = &pool->jobs;
+  CB_size explained[CB_EXPLAIN_COUNT] = {0};
+
+  if (pool->conflicts.len) {
+    for (CB_size i = 0; i < pool->conflicts.len; i++) {
+      cb_log_emit(stderr, CB_LOG_ERROR,
+                  S("Different jobs make "), pool->conflicts.items[i],
+                  S(", each output needs one command line, fn or task_fn with the same inputs"));
+    }
+    pool->conflicts.len = 0;
+    cb_pool_unlock_(pool);
+    jobs->len = 0;
+    return 0;
+  }
+
+  cb_pool_plan_(pool);
+
+  CB_Pool *outer_pool = cb_pool_running_;
+  void (*outer_hook)(void) = cb_exit_hook;
+  cb_pool_running_ = pool;
+  cb_exit_hook = cb_pool_on_exit_;
+
+  cb_pool_lock_(pool, stderr); // again if the pool ran before
+  pool->journal = open(cb_str_to_cstr(pool->arena, pool->journal_path), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (pool->journal < 0) {
+    cb_log_emit(stderr, CB_LOG_WARNING,
+                S("Could not open file "), pool->journal_path, S(": "),
+                cb_str_from_cstr(strerror(errno)), S(", an interrupted run will rebuild by timestamps only"));
+  }
+
+  for (CB_size i = 0; cb_watch && i < jobs->len; i++) {
+    CB_Job *job = cb_seg_at(jobs, i);
+    for (CB_size k = 0; k < job->inputs.len; k++) {
+      CB_b32 made = 0;
+      for (CB_size d = 0; d < job->deps.len && !made; d++) {
+        made = (job->input_ids[k] == cb_seg_at(jobs, job->deps.items[d])->output_id);
+      }
+      if (made) { continue; }
+      *(cb_da_push(cb_watch->arena, &cb_watch->paths)) = cb_str_copy_(cb_watch->arena, job->inputs.items[k]);
+    }
+  }
+
+  CB_i64 budget = (pool->memory_budget > 0) ? pool->memory_budget : INT64_MAX;
+  CB_size max_jobs = CB_max(pool->max_jobs, 1);
+  CB_Job_Ids *running = &pool->running;
+  CB_i64 running_rss = 0;
+  for (;;) {
+    while ((result || pool->keep_going) && running->len < max_jobs) {
+      // Tasks whose await is done go first, they started already
+      CB_Job *job = 0;
+      if (pool->resume_next < pool->resume.len) {
+        job = cb_seg_at(jobs, pool->resume.items[pool->resume_next++]);
+      }
+      if (job) {
+        cb_pool_resume_(pool, job, stderr);
+        if (job->state == CB_JOB_RUNNING) {
+          *(cb_da_push(pool->arena, running)) = job->id;
+          running_rss += job->predicted_rss;
+        }
+        if (job->state == CB_JOB_DONE && job->status != 0) { result = 0; }
+        continue;
+      }
+
+      // Longest critical path first, among the ready jobs that fit in memory
+      job = cb_pool_pop_ready_(pool, running->len, budget - running_rss);
+      if (!job) { break; }
+
+      CB_b32 dep_failed = 0;
+      for (CB_size k = 0; k < job->deps.len && !dep_failed; k++) {
+        CB_Job *dep = cb_seg_at(jobs, job->deps.items[k]);
+        dep_failed = dep->skipped || (dep->ran && dep->status != 0);
+      }
+      if (dep_failed) { // only with keep_going, nothing starts after a failure otherwise
+        job->skipped = 1;
+        cb_pool_done_(pool, job);
+        continue;
+      }
+
+      CB_Explanation why = { .reason = CB_EXPLAIN_ALWAYS, .output = job->output, };
+      CB_b32 stale = job->always;
+      for (CB_size k = 0; k < job->deps.len && !stale; k++) {
+        CB_Job *dep = cb_seg_at(jobs, job->deps.items[k]);
+        stale = dep->ran;
+        if (stale) {
+          why.reason = CB_EXPLAIN_DEP_RAN;
+          why.input = dep->output;
+        }
+      }
+      if (!stale) {
+        CB_b32 status = cb_pool_outdated_(pool, job, &why, stderr);
+        if (status < 0) { job->state = CB_JOB_DONE; result = 0; break; }
+        stale = status;
+      }
+      if (!stale) {
+        cb_pool_done_(pool, job);
+        continue;
+      }
+      if (cb_explain) {
+        cb_explain_emit(why, stderr);
+        explained[why.reason]++;
+      }
+
+      job->ran = 1;
+      job->output_mtime_ns = job->files[0].mtime_ns;
+      CB_Job_Record *r = cb_pool_record_(pool, job->output_id);
+      CB_b32 recorded = r && r->peak_rss > 0;
+      cb_pool_journal_start_(pool, job);
+      if (job->task_fn) {
+        job->start_ns = cb_now_ns_();
+        cb_pool_resume_later_(pool, job);
+        continue;
+      }
+      if (job->fn) {
+        job->start_ns = cb_now_ns_();
+        job->status = job->fn(job->data, stderr) ? 0 : 1;
+        job->duration_ms = (cb_now_ns_() - job->start_ns) / 1000000;
+        cb_pool_record_job_(pool, job);
+        cb_pool_done_(pool, job);
+        if (job->status != 0) { result = 0; }
+        continue;
+      }
+
+      cb_pool_start_(pool, job, job->id, recorded, stderr);
+      if (job->proc == CB_INVALID_PROC) { job->state = CB_JOB_DONE; result = 0; break; }
+      job->state = CB_JOB_RUNNING;
+      *(cb_da_push(pool->arena, running)) = job->id;
+      running_rss += job->predicted_rss;
+    }
+    if (running->len == 0) { break; }
+
+    // Kills the commands past their timeout, SIGALRM interrupts the wait at the next one
+    CB_i64 now = cb_now_ns_();
+    CB_i64 next_timeout = INT64_MAX;
+    for (CB_size i = 0; i < running->len; i++) {
+      CB_Job *job = cb_seg_at(jobs, running->items[i]);
+      if (job->timeout_ms <= 0 || job->timed_out) { continue; }
+      CB_i64 at = job->start_ns + job->timeout_ms * 1000000;
+      if (now < at) { next_timeout = CB_min(next_timeout, at); }
+      else {
+        kill(job->proc, SIGKILL);
+        job->timed_out = 1;
+      }
+    }
+    cb_pool_alarm_((next_timeout == INT64_MAX) ? 0 : next_timeout - now);
+
+    int wstatus = 0;
+    struct rusage usage = {0};
+    pid_t pid = wait4(-1, &wstatus, 0, &usage);
+    cb_pool_alarm_(0);
+    if (pid < 0) {
+      if (errno == EINTR) { continue; }
+      cb_log_emit(stderr, CB_LOG_ERROR,
+                  S("Could not wait on child processes: "),
+                  cb_str_from_cstr(strerror(errno)));
+      result = 0;
+      break;
+    }
+    if (!WIFEXITED(wstatus) && !WIFSIGNALED(wstatus)) { continue; }
+
+    for (CB_size i = 0; i < running->len; i++) {
+      CB_Job *job = cb_seg_at(jobs, running->items[i]);
+      if (job->proc != pid) { continue; }
+      job->proc = CB_INVALID_PROC;
+      running->items[i] = running->items[--running->len];
+      running_rss -= job->predicted_rss;
+      if (job->task_fn) { // the task looks at the exit status itself
+        job->task.status = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : -1;
+        job->peak_rss = CB_max(job->peak_rss, (CB_i64)usage.ru_maxrss * 1024);
+        cb_pool_resume_later_(pool, job);
+        break;
+      }
+      cb_pool_finish_(pool, job, wstatus, &usage, stderr);
+      cb_pool_done_(pool, job);
+      if (job->status != 0) { result = 0; }
+      break;
+    }
+  }
+
+  for (CB_size i = 0; i < jobs->len && result; i++) {
+    if (cb_seg_at(jobs, i)->state != CB_JOB_DONE || cb_seg_at(jobs, i)->skipped) {
+      cb_log_emit(stderr, CB_LOG_ERROR, S("Job did not run: "), cb_seg_at(jobs, i)->output);
+      result = 0;
+    }
+  }
+
+  if (cb_explain) {
+    static char *reasons[CB_EXPLAIN_COUNT] = { "missing", "newer input", "command changed", "dep ran", "interrupted", "always", };
+    CB_size ran = 0;
+    for (CB_size i = 0; i < CB_EXPLAIN_COUNT; i++) { ran += explained[i]; }
+    cb_log_begin(stderr, CB_LOG_INFO);
+      cb_append(stderr, S("EXPLAIN: "));
+      cb_append_long(stderr, (long)ran);
+      cb_append(stderr, S(" of "));
+      cb_append_long(stderr, (long)jobs->len);
+      cb_append(stderr, S(" jobs ran"));
+      for (CB_size i = 0; i < CB_EXPLAIN_COUNT; i++) {
+        if (!explained[i]) { continue; }
+        cb_append(stderr, S(", "));
+        cb_append_long(stderr, (long)explained[i]);
+        cb_append(stderr, S(" "), cb_str_from_cstr(reasons[i]));
+      }
+    cb_log_end(stderr);
+  }
+
+  cb_pool_running_ = outer_pool;
+  cb_exit_hook = outer_hook;
+  if (pool->journal >= 0) { close(pool->journal); }
+  pool->journal = -1;
+  if (!cb_pool_write_log_(pool, stderr) || !cb_pool_write_journal_(pool, stderr)) { result = 0; }
+  cb_pool_unlock_(pool);
+  jobs->len = 0;
+  return result;
+}
+
+//-- Tasks Implementation
+
+CB_Job *cb_pool_push_task(CB_Pool *pool, CB_Task_Fn *fn, void *data, CB_Str output, CB_Str *inputs, CB_size inputs_len)
+{
+  CB_Path_Id output_id = cb_path_intern(&pool->paths, output);
+  CB_Job *first = cb_pool_job_of_(pool, output_id);
+  if (first && cb_pool_same_job_(pool, first, first->task_fn == fn, inputs, inputs_len)) { return first; }
+
+  CB_Job *job = cb_pool_push_(pool, output_id, output, inputs, inputs_len);
+  job->task_fn = fn;
+  job->data = data;
+  return job;
+}
+
+// Queues task to run again, its await is done.
+static void cb_pool_resume_later_(CB_Pool *pool, CB_Job *task)
+{
+  task->state = CB_JOB_RESUME;
+  *(cb_da_push(pool->arena, &pool->resume)) = task->id;
+}
+
+// Runs the task of job until it awaits a command (started, job RUNNING), a
+// job that is not done yet (AWAITING) or returns (DONE).
+static void cb_pool_resume_(CB_Pool *pool, CB_Job *job, CB_Write_Buffer *stderr)
+{
+  CB_Task *task = &job->task;
+  for (;;) {
+    CB_Task_Status status = job->task_fn(task, job->data, stderr);
+    if (status == CB_TASK_AWAIT && task->await_cmd.len > 0) {
+      job->proc = cb_cmd_run_opt(task->await_cmd, (CB_Cmd_Opt){0}, stderr);
+      if (job->proc != CB_INVALID_PROC) {
+        job->state = CB_JOB_RUNNING;
+        return;
+      }
+      task->status = -1;
+      continue;
+    }
+    if (status == CB_TASK_AWAIT) {
+      CB_Job *awaited = cb_pool_job_of_(pool, cb_path_intern(&pool->paths, task->await_output));
+      if (awaited == job) { awaited = 0; }
+      if (awaited && awaited->state != CB_JOB_DONE) {
+        job->awaiting = awaited->id;
+        job->state = CB_JOB_AWAITING;
+        if (!awaited->awaiters.items) { awaited->awaiters = cb_da_init(pool->arena, CB_Job_Ids, 4); }
+        *(cb_da_push(pool->arena, &awaited->awaiters)) = job->id;
+        return;
+      }
+      // Not a job, e.g. a source file, or done already
+      task->status = (awaited && awaited->ran) ? awaited->status : 0;
+      continue;
+    }
+
+    job->status = (status == CB_TASK_DONE) ? 0 : 1;
+    job->duration_ms = (cb_now_ns_() - job->start_ns) / 1000000;
+    cb_pool_record_job_(pool, job);
+    cb_pool_done_(pool, job);
+    return;
+  }
+}
+
+//-- Test Runner Implementation
+
+CB_b32 cb_test_parse_args(CB_Str_List args, CB_Test_Options *options, CB_Write_Buffer *stderr)
+{
+  for (CB_size i = 0; i < args.len; i++) {
+    CB_Str arg = args.items[i];
+    CB_size len = 0, n_len = 0;
+    if (cb_str_starts_with(arg, S("--shard="))) {
+      CB_Str value = { .buf = arg.buf + 8, .len = arg.len - 8, };
+      CB_i64 shard = cb_str_parse_int(value, &len);
+      CB_i64 shards = 0;
+      if (len > 0 && len < value.len && value.buf[len] == '/') {
+        shards = cb_str_parse_int((CB_Str){ .buf = value.buf + len + 1, .len = value.len - len - 1, }, &n_len);
+      }
+      if (n_len == 0 || len + 1 + n_len != value.len || shard < 0 || shard >= shards) {
+        cb_log_emit(stderr, CB_LOG_ERROR, S("Expected --shard=<i>/<n> with 0 <= i < n instead of \""), arg, S("\""));
+        return 0;
+      }
+      options->shard = shard;
+      options->shards = shards;
+    }
+    else if (cb_str_starts_with(arg, S("--timeout="))) {
+      CB_Str value = { .buf = arg.buf + 10, .len = arg.len - 10, };
+      CB_i64 timeout_ms = cb_str_parse_int(value, &len);
+      if (len == 0 || len != value.len || timeout_ms < 0) {
+        cb_log_emit(stderr, CB_LOG_ERROR, S("Expected --timeout=<ms> instead of \""), arg, S("\""));
+        return 0;
+      }
+      options->timeout_ms = timeout_ms;
+    }
+    else {
+      cb_log_emit(stderr, CB_LOG_ERROR, S("Unknown test option \""), arg, S("\", expected --shard=<i>/<n> or --timeout=<ms>"));
+      return 0;
+    }
+  }
+  return 1;
+}
+
+CB_b32 cb_run_tests(CB_Pool *pool, CB_Tests *tests, CB_Test_Options options, CB_Write_Buffer *stderr)
+{
+  CB_Arena_Mark scratch = cb_arena_get_scratch(&pool->arena, 1);
+  CB_b32 result = 1;
+
+  if (!cb_mkdir_if_not_exists(options.dir, stderr)) { cb_return_defer(0); }
+  CB_Job **jobs = new(scratch.arena, CB_Job *, CB_max(tests->len, 1));
+  CB_Str *logs = new(scratch.arena, CB_Str, CB_max(tests->len, 1));
+  CB_size in_shard = 0;
+  for (CB_size i = 0; i < tests->len; i++) {
+    CB_Test *test = tests->items + i;
+    test->ran = test->timed_out = 0;
+    test->status = -1;
+    test->duration_ms = 0;
+    if (options.shards > 0 && cb_hash_str(CB_HASH_INIT, test->name) % (CB_u64)options.shards != (CB_u64)options.shard) { continue; }
+    CB_assert(test->cmd.len > 0);
+
+    CB_Write_Buffer *b = cb_mem_buffer(scratch.arena, test->name.len + 8);
+    cb_append(b, test->name, S(".log"));
+    logs[i] = cb_path_join(scratch.arena, options.dir, (CB_Str){ .buf = b->buf, .len = b->len, });
+    CB_Job *job = cb_pool_push(pool, test->cmd, logs[i], test->cmd.items, 1);
+    job->always = 1;
+    job->stderr_path = job->output;
+    job->capture_stdout = 1;
+    job->timeout_ms = test->timeout_ms ? test->timeout_ms : options.timeout_ms;
+    jobs[i] = job;
+    in_shard++;
+  }
+
+  CB_b32 keep_going = pool->keep_going;
+  pool->keep_going = 1;
+  result = cb_pool_run(pool, stderr);
+  pool->keep_going = keep_going;
+
+  CB_size passed = 0;
+  for (CB_size i = 0; i < tests->len; i++) {
+    CB_Test *test = tests->items + i;
+    CB_Job *job = jobs[i];
+    if (!job) { continue; }
+    test->ran = job->ran && !job->skipped;
+    test->status = job->status;
+    test->timed_out = job->timed_out;
+    test->duration_ms = job->duration_ms;
+    if (!test->ran) {
+      cb_log_emit(stderr, CB_LOG_ERROR, S("SKIP "), test->name, S(": a job it waits on failed"));
+      continue;
+    }
+
+    cb_log_begin(stderr, (test->status == 0) ? CB_LOG_INFO : CB_LOG_ERROR);
+      cb_append(stderr, (test->status == 0) ? S("PASS ") : test->timed_out ? S("TIMEOUT ") : S("FAIL "), test->name, S(" ("));
+      cb_append_long(stderr, (long)test->duration_ms);
+      cb_append(stderr, S(" ms)"));
+    cb_log_end(stderr);
+    if (test->status == 0) { passed++; continue; }
+    CB_Read_Result log = cb_read_entire_file(scratch.arena, logs[i], stderr);
+    if (log.status) { cb_append(stderr, log.file_contents); }
+  }
+
+  cb_log_begin(stderr, (passed == in_shard) ? CB_LOG_INFO : CB_LOG_ERROR);
+    cb_append(stderr, S("Tests: "));
+    cb_append_long(stderr, (long)passed);
+    cb_append(stderr, S(" of "));
+    cb_append_long(stderr, (long)in_shard);
+    cb_append(stderr, S(" passed"));
+    if (options.shards > 0) {
+      cb_append(stderr, S(" in shard "));
+      cb_append_long(stderr, (long)options.shard);
+      cb_append(stderr, S("/"));
+      cb_append_long(stderr, (long)options.shards);
+      cb_append(stderr, S(", "));
+      cb_append_long(stderr, (long)(tests->len - in_shard));
+      cb_append(stderr, S(" in other shards"));
+    }
+    // The slowest three, the ones to split up first
+    CB_b32 *shown = new(scratch.arena, CB_b32, CB_max(tests->len, 1));
+    for (CB_size n = 0; n < 3; n++) {
+      CB_Test *slowest = 0;
+      CB_size slowest_index = 0;
+      for (CB_size i = 0; i < tests->len; i++) {
+        CB_Test *it = tests->items + i;
+        if (!it->ran || shown[i]) { continue; }
+        if (!slowest || it->duration_ms > slowest->duration_ms) { slowest = it; slowest_index = i; }
+      }
+      if (!slowest) { break; }
+      shown[slowest_index] = 1;
+      cb_append(stderr, (n == 0) ? S(", slowest ") : S(", "), slowest->name, S(" "));
+      cb_append_long(stderr, (long)slowest->duration_ms);
+      cb_append(stderr, S(" ms"));
+    }
+  cb_log_end(stderr);
+  if (passed != in_shard) { result = 0; }
+
+ defer:
+  cb_arena_pop_mark(scratch);
+  return result;
+}
+
+//-- Include Scanner Implementation
+
+// Index of the file at path, copies path if it is new.
+static CB_size cb_include_file_(CB_Include_Scanner *scanner, CB_Str path)
+{
+  CB_Str_Slot *slot = cb_str_slot_(scanner->arena, &scanner->file_slots, &scanner->file_slots_len, scanner->files.len, path);
+  if (slot->value == 0) {
+    CB_Include_File *f = cb_da_push(scanner->arena, &scanner->files);
+    f->path = cb_str_copy_(scanner->arena, path);
+    f->exists = -1;
+    slot->key = f->path;
+    slot->value = scanner->files.len;
+  }
+  return slot->value - 1;
+}
+
+static void cb_include_define_(CB_Include_Scanner *scanner, CB_Str name, CB_Str value)
+{
+  CB_Str_Slot *slot = cb_str_slot_(scanner->arena, &scanner->macro_slots, &scanner->macro_slots_len, scanner->macros.len, name);
+  for (CB_size i = slot->value; i != 0; i = scanner->macros.items[i - 1].next) {
+    if (cb_str_equals(scanner->macros.items[i - 1].value, value)) { return; }
+  }
+  CB_Include_Macro *m = cb_da_push(scanner->arena, &scanner->macros);
+  m->name = cb_str_copy_(scanner->arena, name);
+  m->value = cb_str_copy_(scanner->arena, value);
+  m->next = slot->value;
+  slot->key = m->name;
+  slot->value = scanner->macros.len;
+}
+
+static CB_b32 cb_include_ident_char_(CB_u8 c)
+{
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+// Skips spaces, comments and line continuations but not newlines.
+static CB_size cb_include_skip_space_(CB_Str text, CB_size i)
+{
+  while (i < text.len) {
+    CB_u8 c = text.buf[i];
+    if (c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v') { i++; }
+    else if (c == '\\' && i + 1 < text.len && text.buf[i + 1] == '\n') { i += 2; }
+    else if (c == '/' && i + 1 < text.len && text.buf[i + 1] == '*') {
+      // Looks for the '/' of "*/", comments are full of '*'
+      for (i += 3; i < text.len; i++) {
+        CB_u8 *slash = memchr(text.buf + i, '/', (CB_usize)(text.len - i));
+        if (!slash) { return text.len; }
+        i = slash - text.buf;
+        if (text.buf[i - 1] == '*') { break; }
+      }
+      i += 1;
+    }
+    else { break; }
+  }
+  return CB_min(i, text.len);
+}
+
+// Header operand "<...>" or "\"...\"" or identifier at i, empty if none.
+static CB_Str cb_include_operand_(CB_Str text, CB_size i)
+{
+  CB_Str result = { .buf = text.buf + i, .len = 0, };
+  if (i >= text.len) { return result; }
+  CB_u8 c = text.buf[i];
+  if (c == '<' || c == '"') {
+    CB_u8 close = (c == '<') ? '>' : '"';
+    CB_size end = i + 1;
+    while (end < text.len && text.buf[end] != close && text.buf[end] != '\n') { end++; }
+    if (end < text.len && text.buf[end] == close) { result.len = end + 1 - i; }
+    return result;
+  }
+  while (i + result.len < text.len && cb_include_ident_char_(text.buf[i + result.len])) { result.len++; }
+  if (result.len > 0 && c >= '0' && c <= '9') { result.len = 0; }
+  return result;
+}
+
+// Collects the include operands and header defines of text, which has to be
+// null-terminated.
+static void cb_include_tokenize_(CB_Include_Scanner *scanner, CB_Include_File *f, CB_Str text)
+{
+  f->includes = cb_da_init(scanner->arena, CB_Str_List, 8);
+  CB_b32 line_start = 1;
+  CB_size i = 0;
+  while (i < text.len) {
+    CB_u8 c = text.buf[i];
+    CB_u8 next = (i + 1 < text.len) ? text.buf[i + 1] : 0;
+    if (c == '\n') { line_start = 1; i++; }
+    else if (c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v') { i++; }
+    else if (c == '\\' && next == '\n') { i += 2; }
+    else if (c == '/' && next == '*') { i = cb_include_skip_space_(text, i); }
+    else if (c == '/' && next == '/') {
+      while (i < text.len && !(text.buf[i] == '\n' && text.buf[i - 1] != '\\')) { i++; }
+    }
+    else if (c == '"' || c == '\'') {
+      for (i++; i < text.len && text.buf[i] != c && text.buf[i] != '\n'; i++) {
+        if (text.buf[i] == '\\') { i++; }
+      }
+      i++;
+      line_start = 0;
+    }
+    else if (c == '#' && line_start) {
+      i = cb_include_skip_space_(text, i + 1);
+      CB_Str directive = cb_include_operand_(text, i);
+      i = cb_include_skip_space_(text, i + directive.len);
+      if (cb_str_equals(directive, S("include")) || cb_str_equals(directive, S("include_next"))) {
+        CB_Str operand = cb_include_operand_(text, i);
+        if (operand.len > 0) { *(cb_da_push(scanner->arena, &f->includes)) = cb_str_copy_(scanner->arena, operand); }
+      }
+      else if (cb_str_equals(directive, S("define"))) {
+        CB_Str name = cb_include_operand_(text, i);
+        i += name.len;
+        // Object-like macros only, "#define F(x)" has no space before '('
+        if (name.len > 0 && name.buf[0] != '<' && name.buf[0] != '"' && (i >= text.len || text.buf[i] != '(')) {
+          i = cb_include_skip_space_(text, i);
+          CB_Str value = cb_include_operand_(text, i);
+          CB_size end = cb_include_skip_space_(text, i + value.len);
+          if (value.len > 0 && (end >= text.len || text.buf[end] == '\n')) {
+            cb_include_define_(scanner, name, value);
+          }
+        }
+      }
+      line_start = 0; // rest of the directive is skipped like code
+    }
+    else {
+      // Code, skipped up to the next character that can start something else.
+      // strcspn is vectorized, a NUL in the file only stops it early.
+      line_start = 0;
+      i += 1 + (CB_size)strcspn((char *)text.buf + i + 1, "\n/\"'\\");
+    }
+  }
+}
+
+// Index of the file operand refers to from dir, -1 if it is not in the search
+// path.
+static CB_size cb_include_find_(CB_Include_Scanner *scanner, CB_Str dir, CB_Str operand)
+{
+  CB_Str name = { .buf = operand.buf + 1, .len = operand.len - 2, };
+  CB_b32 quoted = (operand.buf[0] == '"');
+  CB_size dirs_len = (quoted ? 1 + scanner->quote_dirs.len : 0) + scanner->include_dirs.len;
+  for (CB_size i = 0; i < dirs_len; i++) {
+    CB_size k = i;
+    CB_Str search = {0};
+    if (quoted && k == 0)                 { search = dir; }
+    else if (quoted && k <= scanner->quote_dirs.len) { search = scanner->quote_dirs.items[k - 1]; }
+    else { search = scanner->include_dirs.items[k - (quoted ? 1 + scanner->quote_dirs.len : 0)]; }
+
+    CB_Arena_Mark scratch = cb_arena_get_scratch(&scanner->arena, 1);
+    CB_size index = cb_include_file_(scanner, cb_path_join(scratch.arena, search, name));
+    cb_arena_pop_mark(scratch);
+
+    CB_Include_File *f = scanner->files.items + index;
+    if (f->exists < 0) { // paths are null-terminated
+      struct stat statbuf = {0};
+      f->exists = (stat((char *)f->path.buf, &statbuf) == 0 && S_ISREG(statbuf.st_mode));
+    }
+    if (f->exists) { return index; }
+    if (name.len > 0 && name.buf[0] == '/') { break; }
+  }
+  return -1;
+}
+
+typedef struct {
+  CB_size *items;   // indices in scanner->files
+  CB_size capacity;
+  CB_size len;
+} CB_Include_Indices_;
+
+typedef struct {
+  CB_Arena *arena;
+  CB_Str_List *deps;
+  CB_Include_Indices_ next; // files to read and scan next
+} CB_Include_Scan_;
+
+// Queues the files operand refers to, 0 if it is a macro not defined yet.
+static CB_b32 cb_include_visit_(CB_Include_Scanner *scanner, CB_Include_Scan_ *scan, CB_Str dir, CB_Str operand, CB_size depth)
+{
+  if (operand.buf[0] == '<' || operand.buf[0] == '"') {
+    CB_size index = cb_include_find_(scanner, dir, operand);
+    if (index >= 0 && scanner->files.items[index].visit != scanner->visit) {
+      scanner->files.items[index].visit = scanner->visit;
+      *(cb_da_push(scan->arena, &scan->next)) = index;
+      *(cb_da_push(scanner->arena, scan->deps)) = scanner->files.items[index].path;
+    }
+    return 1;
+  }
+  if (depth > 16) { return 1; } // recursive macro
+
+  CB_Str_Slot *slot = cb_str_slot_(scanner->arena, &scanner->macro_slots, &scanner->macro_slots_len, scanner->macros.len, operand);
+  if (slot->value == 0) { return 0; }
+  CB_b32 result = 1;
+  for (CB_size i = slot->value; i != 0; i = scanner->macros.items[i - 1].next) {
+    result &= cb_include_visit_(scanner, scan, dir, scanner->macros.items[i - 1].value, depth + 1);
+  }
+  return result;
+}
+
+CB_Include_Scanner cb_include_scanner_init(CB_Arena *arena, CB_Command command)
+{
+  CB_Include_Scanner result = {0};
+  result.arena = arena;
+  result.quote_dirs = cb_da_init(arena, CB_Str_List, 4);
+  result.include_dirs = cb_da_init(arena, CB_Str_List, 8);
+  result.files = cb_da_init(arena, CB_Include_Files, 256);
+  result.macros = cb_da_init(arena, CB_Include_Macros, 256);
+
+  for (CB_size i = 0; i < command.len; i++) {
+    CB_Str arg = command.items[i];
+    CB_Str value = {0};
+    CB_Str_List *dirs = 0;
+    CB_b32 define = 0;
+    struct { CB_Str flag; CB_Str_List *dirs; CB_b32 define; } flags[] = {
+      { S("-I"), &result.include_dirs, 0, },
+      { S("-iquote"), &result.quote_dirs, 0, },
+      { S("-D"), 0, 1, },
+    };
+    for (CB_size k = 0; k < CB_countof(flags); k++) {
+      if (!cb_str_starts_with(arg, flags[k].flag)) { continue; }
+      value = (CB_Str){ .buf = arg.buf + flags[k].flag.len, .len = arg.len - flags[k].flag.len, };
+      if (value.len == 0 && i + 1 < command.len) { value = command.items[++i]; }
+      dirs = flags[k].dirs;
+      define = flags[k].define;
+      break;
+    }
+    if (dirs) {
+      *(cb_da_push(arena, dirs)) = cb_path_normalize(arena, value);
+    }
+    if (define) { // -DNAME=<header>
+      CB_size eq = cb_str_find(value, S("="));
+      if (eq < 0) { continue; }
+      CB_Str name = { .buf = value.buf, .len = eq, };
+      CB_Str operand = cb_include_operand_(value, eq + 1);
+      if (operand.len > 0) { cb_include_define_(&result, name, operand); }
+    }
+  }
+  return result;
+}
+
+CB_b32 cb_scan_includes(CB_Include_Scanner *scanner, CB_Str source, CB_Str_List *deps, CB_Write_Buffer *stderr)
+{
+  CB_Arena_Mark scratch = cb_arena_get_scratch(&scanner->arena, 1);
+  CB_b32 result = 0;
+  scanner->visit++;
+
+  CB_Include_Scan_ scan = { .arena = scratch.arena, .deps = deps, };
+  scan.next = cb_da_init(scratch.arena, CB_Include_Indices_, 64);
+  CB_Include_Indices_ level = cb_da_init(scratch.arena, CB_Include_Indices_, 64);
+  CB_size first = cb_include_file_(scanner, cb_path_normalize(scratch.arena, source));
+  *(cb_da_push(scratch.arena, &level)) = first;
+  scanner->files.items[first].visit = scanner->visit;
+
+  // #include MACRO seen before the header defining MACRO was read
+  typedef struct { CB_Str dir; CB_Str operand; } Pending;
+  typedef struct { Pending *items; CB_size capacity; CB_size len; } Pendings;
+  Pendings pending = cb_da_init(scratch.arena, Pendings, 16);
+
+  while (level.len > 0) {
+    // Read the files of this level no earlier scan read in one batch
+    CB_File_Info *infos = new(scratch.arena, CB_File_Info, level.len);
+    CB_size infos_len = 0;
+    for (CB_size i = 0; i < level.len; i++) {
+      CB_Include_File *f = scanner->files.items + level.items[i];
+      if (!f->scanned) { infos[infos_len++].path = f->path; }
+    }
+    cb_read_files(scratch.arena, infos, infos_len);
+    for (CB_size i = 0, k = 0; i < level.len; i++) {
+      CB_Include_File *f = scanner->files.items + level.items[i];
+      if (f->scanned) { continue; }
+      CB_File_Info *info = infos + k++;
+      if (info->error) {
+        cb_log_emit(stderr, CB_LOG_ERROR,
+                    S("Could not read file "),
+                    f->path,
+                    S(": "),
+                    cb_str_from_cstr(strerror(info->error)));
+        cb_return_defer(0);
+      }
+      cb_include_tokenize_(scanner, f, info->contents);
+      f->scanned = 1;
+      f->exists = 1;
+    }
+
+    scan.next.len = 0;
+    for (CB_size i = 0; i < level.len; i++) {
+      // Copied, visiting grows scanner->files
+      CB_Str dir = scanner->files.items[level.items[i]].path;
+      CB_Str_List includes = scanner->files.items[level.items[i]].includes;
+      while (dir.len > 0 && dir.buf[dir.len - 1] != '/') { dir.len--; }
+      for (CB_size k = 0; k < includes.len; k++) {
+        if (!cb_include_visit_(scanner, &scan, dir, includes.items[k], 0)) {
+          *(cb_da_push(scratch.arena, &pending)) = (Pending){ .dir = dir, .operand = includes.items[k], };
+        }
+      }
+    }
+    // Retry the macros once nothing else is left, a header read since may
+    // have defined them
+    if (scan.next.len == 0) {
+      CB_size len = 0;
+      for (CB_size i = 0; i < pending.len; i++) {
+        if (!cb_include_visit_(scanner, &scan, pending.items[i].dir, pending.items[i].operand, 0)) {
+          pending.items[len++] = pending.items[i];
+        }
+      }
+      pending.len = len;
+    }
+    CB_Include_Indices_ swap = level;
+    level = scan.next;
+    scan.next = swap;
+  }
+  cb_return_defer(1);
+
+ defer:
+  cb_arena_pop_mark(scratch);
+  return result;
+}
+
+CB_Str_List cb_parse_depfile(CB_Arena *arena, CB_Str depfile)
+{
+  CB_Str_List result = cb_da_init(arena, CB_Str_List, 64);
+  CB_b32 prerequisites = 0;
+  CB_size i = 0;
+  while (i < depfile.len) {
+    CB_u8 c = depfile.buf[i];
+    if (c == '\\' && i + 1 < depfile.len && depfile.buf[i + 1] == '\n') { i += 2; continue; }
+    if (c == '\\' && i + 2 < depfile.len && depfile.buf[i + 1] == '\r' && depfile.buf[i + 2] == '\n') { i += 3; continue; }
+    if (c == '\n') { prerequisites = 0; i++; continue; }
+    if (c == ' ' || c == '\t' || c == '\r') { i++; continue; }
+
+    // A path, "\ " and "$$" are escaped
+    CB_Write_Buffer *b = cb_mem_buffer(arena, depfile.len - i + 1);
+    for (; i < depfile.len; i++) {
+      c = depfile.buf[i];
+      CB_u8 next = (i + 1 < depfile.len) ? depfile.buf[i + 1] : 0;
+      if (c == '\\' && (next == ' ' || next == '#' || next == '\\')) { cb_append_byte(b, next); i++; continue; }
+      if (c == '$' && next == '$') { cb_append_byte(b, '$'); i++; continue; }
+      if (c == ' ' || c == '\t' || c == '\n' || c == '\r' || (c == '\\' && (next == '\n' || next == '\r'))) { break; }
+      cb_append_byte(b, c);
+    }
+    CB_Str path = { .buf = b->buf, .len = b->len, };
+    if (!prerequisites && path.len > 0 && path.buf[path.len - 1] == ':') {
+      prerequisites = 1; // "target:"
+      continue;
+    }
+    if (!prerequisites && i < depfile.len && depfile.buf[i] == ' ') {
+      // "target :" or a target followed by more targets
+      CB_size k = i;
+      while (k < depfile.len && depfile.buf[k] == ' ') { k++; }
+      if (k < depfile.len && depfile.buf[k] == ':') { i = k + 1; prerequisites = 1; }
+      continue;
+    }
+    if (prerequisites) { *(cb_da_push(arena, &result)) = path; }
+  }
+  return result;
+}
+
+//-- Watch Implementation
+
+#include <poll.h>
+#include <sys/inotify.h>
+
+#define CB_WATCH_SETTLE_MS 100
+
+CB_Watch *cb_watch = 0;
+
+static int cb_watch_compare_(const void *a, const void *b)
+{
+  CB_Str x = *(CB_Str *)a, y = *(CB_Str *)b;
+  int order = memcmp(x.buf, y.buf, (size_t)CB_min(x.len, y.len));
+  return order ? order : (x.len > y.len) - (x.len < y.len);
+}
+
+CB_b32 cb_watch_wait(CB_Watch *watch, CB_Write_Buffer *stderr)
+{
+  CB_Arena_Mark scratch = cb_arena_get_scratch(&watch->arena, 1);
+  CB_b32 result = 0;
+
+  // Sorted and unique, every source shows up once per job reading it
+  CB_Str *paths = watch->paths.items;
+  CB_size paths_len = 0;
+  qsort(paths, (size_t)watch->paths.len, sizeof(CB_Str), cb_watch_compare_);
+  for (CB_size i = 0; i < watch->paths.len; i++) {
+    if (paths_len && cb_str_equals(paths[paths_len - 1], paths[i])) { continue; }
+    paths[paths_len++] = paths[i];
+  }
+  watch->paths.len = paths_len;
+
+  int fd = inotify_init1(IN_CLOEXEC);
+  if (fd < 0) {
+    cb_log_emit(stderr, CB_LOG_ERROR, S("Could not start inotify: "), cb_str_from_cstr(strerror(errno)));
+    cb_return_defer(0);
+  }
+
+  // Directory of every path, by watch descriptor, "" for the current directory
+  CB_Str_List dirs = cb_da_init(scratch.arena, CB_Str_List, 64);
+  CB_Str last_dir = { .len = -1, };
+  for (CB_size i = 0; i < paths_len; i++) {
+    CB_Str dir = paths[i];
+    while (dir.len && dir.buf[dir.len - 1] != '/') { dir.len--; }
+    if (cb_str_equals(dir, last_dir)) { continue; }
+    last_dir = dir;
+    char *c_dir = dir.len ? cb_str_to_cstr(scratch.arena, dir) : ".";
+    int wd = inotify_add_watch(fd, c_dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE | IN_ATTRIB);
+    if (wd < 0) {
+      cb_log_emit(stderr, CB_LOG_WARNING, S("Could not watch "), dir.len ? dir : S("."), S(": "), cb_str_from_cstr(strerror(errno)));
+      continue;
+    }
+    while (dirs.len <= (CB_size)wd) { *(cb_da_push(scratch.arena, &dirs)) = (CB_Str){0}; }
+    dirs.items[wd] = dir;
+  }
+
+  CB_b32 changed = 0;
+  CB_u8 events[16 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+  for (;;) {
+    // Wait for the first change, then until nothing changed for a while
+    struct pollfd pfd = { .fd = fd, .events = POLLIN, };
+    int ready = poll(&pfd, 1, changed ? CB_WATCH_SETTLE_MS : -1);
+    if (ready < 0 && errno == EINTR) { continue; }
+    if (ready < 0) {
+      cb_log_emit(stderr, CB_LOG_ERROR, S("Could not poll inotify: "), cb_str_from_cstr(strerror(errno)));
+      cb_return_defer(0);
+    }
+    if (ready == 0) { break; }
+
+    CB_size len = read(fd, events, sizeof(events));
+    if (len < 0 && errno == EINTR) { continue; }
+    if (len < 0) {
+      cb_log_emit(stderr, CB_LOG_ERROR, S("Could not read inotify events: "), cb_str_from_cstr(strerror(errno)));
+      cb_return_defer(0);
+    }
+    for (CB_u8 *at = events; at < events + len;) {
+      struct inotify_event *event = (struct inotify_event *)at;
+      at += sizeof(struct inotify_event) + event->len;
+      if (changed || event->len == 0 || event->wd < 0 || event->wd >= dirs.len) { continue; }
+
+      CB_Arena_Mark name_mark = cb_arena_push_mark(scratch.arena);
+      CB_Str name = cb_str_from_cstr(event->name);
+      CB_Write_Buffer *path = cb_mem_buffer(scratch.arena, dirs.items[event->wd].len + name.len + 1);
+      cb_append(path, dirs.items[event->wd], name);
+      CB_Str key = { .buf = path->buf, .len = path->len, };
+      if (bsearch(&key, paths, (size_t)paths_len, sizeof(CB_Str), cb_watch_compare_)) {
+        cb_log_emit(stderr, CB_LOG_INFO, S("Changed "), key);
+        changed = 1;
+      }
+      cb_arena_pop_mark(name_mark);
+    }
+  }
+  result = 1;
+
+ defer:
+  if (fd >= 0) { close(fd); }
+  cb_arena_pop_mark(scratch);
+  return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//- Asynchronous Log Implementation
+//
+// The ring holds records of an 8 byte header (length + 1 once committed) and
+// the bytes, padded to 8. Producers reserve space by moving head with a CAS,
+// copy, then publish the header. The writer consumes committed records in
+// order, zeroes them for reuse and moves tail.
+
+#include <pthread.h>
+#include <sched.h>
+#include <linux/futex.h>
+
+static struct {
+  CB_u8 *buf;
+  CB_u64 capacity;
+  CB_u64 head;     // reserved by producers
+  CB_u64 tail;     // consumed by the writer
+  CB_u32 wake;     // futex, bumped by every commit
+  CB_u32 sleeping; // the writer is (about to be) in futex wait
+  CB_u32 stop;
+  CB_i32 fd;
+  pthread_t writer;
+} cb_log_ring_;
+
+static __thread CB_u8 cb_log_thread_bytes_[4 * 1024];
+static __thread CB_Write_Buffer cb_log_thread_buffer_;
+static __thread CB_i64 cb_log_tid_;
+
+static void cb_log_ring_wake_(void)
+{
+  __atomic_fetch_add(&cb_log_ring_.wake, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&cb_log_ring_.sleeping, __ATOMIC_SEQ_CST)) {
+    syscall(SYS_futex, &cb_log_ring_.wake, FUTEX_WAKE_PRIVATE, 1, 0, 0, 0);
+  }
+}
+
+// A flush longer than half the ring goes in pieces, lines of other threads can
+// land between them.
+static void cb_log_ring_push_(CB_u8 *bytes, CB_size len)
+{
+  CB_u64 mask = cb_log_ring_.capacity - 1;
+  CB_u64 n = (CB_u64)CB_min(len, (CB_size)(cb_log_ring_.capacity / 2));
+  CB_u64 size = 8 + ((n + 7) & ~7ull);
+
+  CB_u64 at = __atomic_load_n(&cb_log_ring_.head, __ATOMIC_RELAXED);
+  for (;;) {
+    CB_u64 tail = __atomic_load_n(&cb_log_ring_.tail, __ATOMIC_ACQUIRE);
+    if (at + size - tail > cb_log_ring_.capacity) { // full, let the writer catch up
+      cb_log_ring_wake_();
+      sched_yield();
+      at = __atomic_load_n(&cb_log_ring_.head, __ATOMIC_RELAXED);
+      continue;
+    }
+    if (__atomic_compare_exchange_n(&cb_log_ring_.head, &at, at + size, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+      break;
+    }
+  }
+
+  CB_u64 body = (at + 8) & mask;
+  CB_u64 first = CB_min(n, cb_log_ring_.capacity - body);
+  CB_memcpy(cb_log_ring_.buf + body, bytes, (CB_usize)first);
+  CB_memcpy(cb_log_ring_.buf, bytes + first, (CB_usize)(n - first));
+  __atomic_store_n((CB_u64 *)(void *)(cb_log_ring_.buf + (at & mask)), n + 1, __ATOMIC_SEQ_CST);
+  cb_log_ring_wake_();
+  if ((CB_u64)len > n) { cb_log_ring_push_(bytes + n, len - (CB_size)n); }
+}
+
+static void *cb_log_writer_(void *arg)
+{
+  (void)arg;
+  CB_u64 mask = cb_log_ring_.capacity - 1;
+  CB_u8 *out = cb_malloc(64 * 1024);
+  CB_u64 out_len = 0;
+
+  for (;;) {
+    CB_u32 stop = __atomic_load_n(&cb_log_ring_.stop, __ATOMIC_ACQUIRE);
+    CB_u64 tail = cb_log_ring_.tail;
+    CB_u64 header;
+    while ((header = __atomic_load_n((CB_u64 *)(void *)(cb_log_ring_.buf + (tail & mask)), __ATOMIC_ACQUIRE))) {
+      CB_u64 n = header - 1;
+      CB_u64 size = 8 + ((n + 7) & ~7ull);
+      for (CB_u64 i = 0; i < n; i++) {
+        if (out_len == 64 * 1024) {
+          cb_write(cb_log_ring_.fd, out, (CB_size)out_len);
+          out_len = 0;
+        }
+        out[out_len++] = cb_log_ring_.buf[(tail + 8 + i) & mask];
+      }
+      CB_u64 first = CB_min(size, cb_log_ring_.capacity - (tail & mask));
+      memset(cb_log_ring_.buf + (tail & mask), 0, (CB_usize)first);
+      memset(cb_log_ring_.buf, 0, (CB_usize)(size - first));
+      tail += size;
+      __atomic_store_n(&cb_log_ring_.tail, tail, __ATOMIC_RELEASE);
+    }
+    if (out_len) {
+      cb_write(cb_log_ring_.fd, out, (CB_size)out_len);
+      out_len = 0;
+    }
+    if (stop && tail == __atomic_load_n(&cb_log_ring_.head, __ATOMIC_ACQUIRE)) { break; }
+
+    // Sleep until the next commit. A commit after the check bumps wake, which
+    // makes the wait return at once.
+    CB_u32 wake = __atomic_load_n(&cb_log_ring_.wake, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&cb_log_ring_.sleeping, 1, __ATOMIC_SEQ_CST);
+    header = __atomic_load_n((CB_u64 *)(void *)(cb_log_ring_.buf + (tail & mask)), __ATOMIC_SEQ_CST);
+    if (!header && !__atomic_load_n(&cb_log_ring_.stop, __ATOMIC_SEQ_CST)) {
+      syscall(SYS_futex, &cb_log_ring_.wake, FUTEX_WAIT_PRIVATE, wake, 0, 0, 0);
+    }
+    __atomic_store_n(&cb_log_ring_.sleeping, 0, __ATOMIC_SEQ_CST);
+  }
+
+  cb_mfree(out);
+  return 0;
+}
+
+// The writer thread does not exist in a forked child
+static void cb_log_after_fork_(void)
+{
+  __atomic_store_n(&cb_log_ring_fd_, -1, __ATOMIC_RELAXED);
+}
+
+CB_b32 cb_log_start_async(CB_i32 fd, CB_Write_Buffer *stderr)
+{
+  static CB_b32 registered = 0;
+  CB_assert((CB_LOG_RING_SIZE & (CB_LOG_RING_SIZE - 1)) == 0 && CB_LOG_RING_SIZE >= 64);
+  if (cb_log_ring_fd_ >= 0) { return cb_log_ring_fd_ == fd; }
+
+  cb_flush(stderr);
+  cb_log_ring_.capacity = CB_LOG_RING_SIZE;
+  cb_log_ring_.buf = cb_malloc(CB_LOG_RING_SIZE); // malloc aligns the headers
+  memset(cb_log_ring_.buf, 0, CB_LOG_RING_SIZE);
+  cb_log_ring_.head = cb_log_ring_.tail = 0;
+  cb_log_ring_.stop = 0;
+  cb_log_ring_.fd = fd;
+
+  int err = pthread_create(&cb_log_ring_.writer, 0, cb_log_writer_, 0);
+  if (err) {
+    cb_mfree(cb_log_ring_.buf);
+    cb_log_emit(stderr, CB_LOG_ERROR, S("Could not start the log writer thread: "), cb_str_from_cstr(strerror(err)));
+    return 0;
+  }
+  if (!registered) {
+    registered = 1;
+    pthread_atfork(0, 0, cb_log_after_fork_);
+    atexit(cb_log_stop_async);
+  }
+  __atomic_store_n(&cb_log_ring_fd_, fd, __ATOMIC_RELEASE);
+  return 1;
+}
+
+void cb_log_stop_async(void)
+{
+  if (cb_log_ring_fd_ < 0) { return; }
+  __atomic_store_n(&cb_log_ring_.stop, 1, __ATOMIC_SEQ_CST);
+  cb_log_ring_wake_();
+  pthread_join(cb_log_ring_.writer, 0);
+  __atomic_store_n(&cb_log_ring_fd_, -1, __ATOMIC_RELEASE);
+  cb_mfree(cb_log_ring_.buf);
+  cb_log_ring_.buf = 0;
+}
+
+CB_Write_Buffer *cb_log_buffer(void)
+{
+  CB_Write_Buffer *b = &cb_log_thread_buffer_;
+  if (!b->buf) {
+    b->buf = cb_log_thread_bytes_;
+    b->capacity = CB_sizeof(cb_log_thread_bytes_);
+  }
+  CB_i32 fd = __atomic_load_n(&cb_log_ring_fd_, __ATOMIC_RELAXED);
+  b->fd = (fd >= 0) ? fd : 2;
+  return b;
+}
+
+static void cb_log_append_json_(CB_Write_Buffer *b, CB_Log_Level level, CB_Str msg)
+{
+  static char *names[CB_LOG_COUNT] = { "error", "warning", "info", };
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  if (!cb_log_tid_) { cb_log_tid_ = syscall(SYS_gettid); }
+
+  cb_append(b, S("{\"time_ns\":"));
+  cb_append_long(b, (long)ts.tv_sec * 1000000000l + ts.tv_nsec);
+  cb_append(b, S(",\"level\":\""), cb_str_from_cstr(names[level]), S("\",\"tid\":"));
+  cb_append_long(b, (long)cb_log_tid_);
+  cb_append(b, S(",\"msg\":"));
+  cb_append_json_str_(b, msg);
+  cb_append(b, S("}"));
+}
+
+// str as a quoted JSON string.
+static void cb_append_json_str_(CB_Write_Buffer *b, CB_Str str)
+{
+  cb_append_byte(b, '"');
+  CB_size run = 0;
+  for (CB_size i = 0; i < str.len; i++) {
+    CB_u8 c = str.buf[i];
+    if (c >= 0x20 && c != '"' && c != '\\') { continue; }
+    cb_append_bytes(b, str.buf + run, i - run);
+    run = i + 1;
+    if (c == '"' || c == '\\') { cb_append_byte(b, '\\'); cb_append_byte(b, c); }
+    else if (c == '\n') { cb_append(b, S("\\n")); }
+    else if (c == '\t') { cb_append(b, S("\\t")); }
+    else {
+      cb_append(b, S("\\u00"));
+      cb_append_byte(b, (CB_u8)"0123456789abcdef"[c >> 4]);
+      cb_append_byte(b, (CB_u8)"0123456789abcdef"[c & 0xf]);
+    }
+  }
+  cb_append_bytes(b, str.buf + run, str.len - run);
+  cb_append_byte(b, '"');
+}
+
 #endif // __LINUX__
 
 #endif // CBUILD_IMPLEMENTATION
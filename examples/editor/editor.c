@@ -295,6 +295,21 @@ void push_text_line(Indices *indices, Vertices *verts, Glyph_Atlas *atlas, hmm_v
   }
 }
 
+// Scripted input used as training run for profile-guided release builds
+// (`./editor --workload`, see build_release in cbuild.c).
+#define WORKLOAD_FRAMES 600
+
+static const char workload_script[] =
+  "#include <stdio.h>\n"
+  "\n"
+  "int main(void)\n"
+  "{\n"
+  "  for (int i = 0; i < 10; i++) {\n"
+  "    printf(\"Hello, World! %d\\n\", i);\n"
+  "  }\n"
+  "  return 0;\n"
+  "}\n";
+
 static struct {
   sg_pipeline pip;
   sg_bindings bind;
@@ -313,8 +328,33 @@ static struct {
   Glyph_Atlas glyph_atlas;
   FT_Library library;
   FT_Face face;
+
+  bool workload;
+  int workload_frame;
 } state;
 
+static void workload_step(Editor *ed)
+{
+  if (state.workload_frame >= WORKLOAD_FRAMES) {
+    sapp_request_quit();
+    return;
+  }
+
+  // Type the script, and every few lines delete and retype a word
+  int at = state.workload_frame % (int)(sizeof(workload_script) - 1);
+  if (at == 0 && ed->text_buffer->len + (CB_size)sizeof(workload_script) >= TEXT_CHUNK_SIZE) {
+    ed->text_buffer->len = 0;
+    ed->cursor = 0;
+    ed->flags |= EDITOR_LINES_DIRTY;
+  }
+  if (workload_script[at] == '\n' && state.workload_frame % 3 == 0) {
+    for (int i = 0; i < 4; i++) { editor_bspc(ed); }
+    for (int i = 4; i > 0; i--) { editor_ins(ed, workload_script[at - i]); }
+  }
+  editor_ins(ed, workload_script[at]);
+  state.workload_frame++;
+}
+
 static void init(void)
 {
   state.perm_arena = cb_alloc_arena(8 * 1024 * 1024);
@@ -495,6 +535,10 @@ static void frame(void)
   Indices  indices = cb_da_init(state.frame_arena, Indices, 4096);
 
 
+  if (state.workload) {
+    workload_step(state.editor);
+  }
+
   { // Render Editor
     editor_recalc_lines(state.editor);
 
@@ -598,7 +642,9 @@ static void cleanup(void)
 
 sapp_desc sokol_main(int argc, char* argv[])
 {
-  (void)argc; (void)argv;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--workload") == 0) { state.workload = true; }
+  }
   return (sapp_desc){
     .init_cb = init,
     .frame_cb = frame,
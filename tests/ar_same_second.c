@@ -0,0 +1,76 @@
+// This is free and unencumbered software released into the public domain.
+
+// cb_ar_write has to replace a member rebuilt in the same second with the
+// same size, which the whole seconds of the member header do not tell apart.
+// Built and run by `./cbuild test`.
+
+#define CBUILD_IMPLEMENTATION
+#include "../cbuild.h"
+
+#define AR_TEST_DIR "build/tests/ar_same_second.d"
+#define AR_TEST_SECOND 1700000000
+
+// Sets the mtime of path to AR_TEST_SECOND and ns.
+CB_b32 set_mtime(CB_Str path, long ns, CB_Write_Buffer *stderr)
+{
+  struct timespec times[2] = {
+    { .tv_sec = AR_TEST_SECOND, .tv_nsec = ns, },
+    { .tv_sec = AR_TEST_SECOND, .tv_nsec = ns, },
+  };
+  if (utimensat(AT_FDCWD, (char *)path.buf, times, 0) < 0) {
+    cb_log_emit(stderr, CB_LOG_ERROR, S("Could not set the mtime of "), path, S(": "), cb_str_from_cstr(strerror(errno)));
+    return 0;
+  }
+  return 1;
+}
+
+CB_i64 mtime_ns(CB_Str path)
+{
+  struct stat st = {0};
+  if (stat((char *)path.buf, &st) < 0) { return -1; }
+  return (CB_i64)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+int main(void)
+{
+  CB_Arena *arena = cb_alloc_arena(1024 * 1024);
+  CB_Write_Buffer *stderr = cb_fd_buffer(2, arena, 4 * 1024);
+  CB_b32 result = 0;
+
+  CB_Str object = S(AR_TEST_DIR "/member.o");
+  CB_Str archive = S(AR_TEST_DIR "/lib.a");
+  if (!cb_mkdir_if_not_exists(S(AR_TEST_DIR), stderr)) { cb_return_defer(0); }
+  unlink((char *)archive.buf);
+
+  // The first build, the archive written right after the object
+  if (!cb_write_entire_file(object, S("first build\n"), stderr)) { cb_return_defer(0); }
+  if (!set_mtime(object, 100000000, stderr)) { cb_return_defer(0); }
+  if (!cb_ar_write(archive, &object, 1, 0, stderr)) { cb_return_defer(0); }
+  if (!set_mtime(archive, 200000000, stderr)) { cb_return_defer(0); }
+
+  // Rebuilt later in the same second, same size
+  if (!cb_write_entire_file(object, S("later build\n"), stderr)) { cb_return_defer(0); }
+  if (!set_mtime(object, 500000000, stderr)) { cb_return_defer(0); }
+  if (!cb_ar_write(archive, &object, 1, 0, stderr)) { cb_return_defer(0); }
+
+  CB_Read_Result read = cb_read_entire_file(arena, archive, stderr);
+  if (!read.status) { cb_return_defer(0); }
+  if (cb_str_find(read.file_contents, S("later build\n")) < 0) {
+    cb_log_emit(stderr, CB_LOG_ERROR, S("Archive test: the archive kept the member of the first build"));
+    cb_return_defer(0);
+  }
+
+  // Nothing changed since, the archive stays as it is
+  CB_i64 written = mtime_ns(archive);
+  if (!cb_ar_write(archive, &object, 1, 0, stderr)) { cb_return_defer(0); }
+  if (mtime_ns(archive) != written) {
+    cb_log_emit(stderr, CB_LOG_ERROR, S("Archive test: an unchanged archive was written again"));
+    cb_return_defer(0);
+  }
+  cb_log_emit(stderr, CB_LOG_INFO, S("Archive test: a member rebuilt in the same second was replaced"));
+  result = 1;
+
+ defer:
+  cb_flush(stderr);
+  return result ? 0 : 1;
+}
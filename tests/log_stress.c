@@ -0,0 +1,93 @@
+// This is free and unencumbered software released into the public domain.
+
+// Threads logging through the async log ring at once, built and run by
+// `./cbuild test`, under TSan if the toolchain has it. The ring of 4 KiB wraps
+// all the time and keeps the threads waiting on the writer.
+
+#define CB_LOG_RING_SIZE 4096
+#define CBUILD_IMPLEMENTATION
+#include "../cbuild.h"
+
+#define LOG_STRESS_OUT "build/tests/log_stress.out"
+#define LOG_STRESS_THREADS 4
+#define LOG_STRESS_LINES 20000
+
+void *log_stress_thread(void *arg)
+{
+  long t = (long)(CB_usize)arg;
+  CB_Write_Buffer *b = cb_log_buffer();
+  for (long i = 0; i < LOG_STRESS_LINES; i++) {
+    cb_append_long(b, t);
+    cb_append(b, S(" "));
+    cb_append_long(b, i);
+    cb_append(b, S(" the quick brown fox jumps over the lazy dog\n"));
+    cb_flush(b);
+  }
+  return 0;
+}
+
+// Every line has to arrive whole and in the order its thread wrote it, and a
+// flush longer than the ring whole after them.
+int main(void)
+{
+  CB_Arena *arena = cb_alloc_arena(64 * 1024 * 1024);
+  CB_Write_Buffer *stderr = cb_fd_buffer(2, arena, 4 * 1024);
+  CB_b32 result = 0;
+
+  CB_i32 fd = cb_open(S(LOG_STRESS_OUT), stderr);
+  if (fd < 0 || !cb_log_start_async(fd, stderr)) { cb_return_defer(0); }
+  pthread_t threads[LOG_STRESS_THREADS];
+  for (long t = 0; t < LOG_STRESS_THREADS; t++) {
+    int err = pthread_create(threads + t, 0, log_stress_thread, (void *)(CB_usize)t);
+    if (err) {
+      cb_log_emit(stderr, CB_LOG_ERROR, S("Could not start a thread: "), cb_str_from_cstr(strerror(err)));
+      cb_exit(1);
+    }
+  }
+  for (long t = 0; t < LOG_STRESS_THREADS; t++) { pthread_join(threads[t], 0); }
+  CB_Write_Buffer *long_flush = cb_fd_buffer(fd, arena, 3 * CB_LOG_RING_SIZE);
+  for (CB_size i = 0; i < long_flush->capacity - 1; i++) { cb_append_byte(long_flush, (CB_u8)('a' + i % 26)); }
+  cb_append_byte(long_flush, '\n');
+  CB_Str long_line = { .buf = long_flush->buf, .len = long_flush->len - 1, };
+  cb_flush(long_flush);
+  cb_log_stop_async();
+
+  CB_Read_Result read = cb_read_entire_file(arena, S(LOG_STRESS_OUT), stderr);
+  if (!read.status) { cb_return_defer(0); }
+  CB_Str rest = read.file_contents;
+  long next[LOG_STRESS_THREADS] = {0};
+  CB_Write_Buffer *expected = cb_mem_buffer(arena, 256);
+  for (long n = 0; n <= LOG_STRESS_THREADS * LOG_STRESS_LINES; n++) {
+    CB_Str line = rest;
+    for (line.len = 0; line.len < rest.len && rest.buf[line.len] != '\n'; line.len++) {}
+    rest.buf += CB_min(line.len + 1, rest.len);
+    rest.len -= CB_min(line.len + 1, rest.len);
+
+    if (n == LOG_STRESS_THREADS * LOG_STRESS_LINES) {
+      if (!cb_str_equals(line, long_line) || rest.len) {
+        cb_log_emit(stderr, CB_LOG_ERROR, S("Log ring stress: the long flush did not arrive whole"));
+        cb_return_defer(0);
+      }
+      break;
+    }
+    long t = (long)cb_str_parse_int(line, 0);
+    expected->len = 0;
+    if (t >= 0 && t < LOG_STRESS_THREADS) {
+      cb_append_long(expected, t);
+      cb_append(expected, S(" "));
+      cb_append_long(expected, next[t]++);
+      cb_append(expected, S(" the quick brown fox jumps over the lazy dog"));
+    }
+    if (!cb_str_equals(line, (CB_Str){ .buf = expected->buf, .len = expected->len, })) {
+      cb_log_emit(stderr, CB_LOG_ERROR, S("Log ring stress: torn or out of order line \""), line, S("\""));
+      cb_return_defer(0);
+    }
+  }
+  cb_log_emit(stderr, CB_LOG_INFO, S("Log ring stress: every line arrived whole and in order"));
+  result = 1;
+
+ defer:
+  if (fd >= 0) { close(fd); }
+  cb_flush(stderr);
+  return result ? 0 : 1;
+}